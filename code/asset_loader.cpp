@@ -0,0 +1,331 @@
+// 
+// MIT License
+// 
+// Copyright (c) 2018 Marcus Larsson
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+#include "asset_loader.h"
+#include "profiler.h"
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <process.h>
+
+
+
+//
+// Stages, run on the loader threads. Each returns the stage that comes next.
+//
+static asset_stage ReadMesh(asset *Asset)
+{
+    mesh_optimize_settings const *Optimize = Asset->Optimize ? &Asset->OptimizeSettings : nullptr;
+    Asset->Cacheable = (GetMeshCacheFileName(Asset->FileName, Asset->CacheFileName) &&
+                        HashMeshSource(Asset->FileName, Optimize, &Asset->SourceHash, &Asset->SourceSize));
+    
+    mesh_optimize_report *Report = Asset->Optimize ? &Asset->Report : nullptr;
+    if (Asset->Cacheable && ReadMeshCache(Asset->CacheFileName, Asset->SourceHash, Asset->SourceSize, &Asset->Mesh, Report))
+    {
+        return AssetStage_Loaded;
+    }
+    
+    return AssetStage_Parse;
+}
+
+
+// NOTE(Marcus): The assets already load in parallel, so a single mesh is parsed on one thread
+static asset_stage ParseMesh(asset *Asset)
+{
+    return LoadPlyFile(Asset->FileName, &Asset->Mesh, 1) ? AssetStage_PostProcess : AssetStage_Failed;
+}
+
+
+static asset_stage PostProcessMesh(asset *Asset)
+{
+    mesh_optimize_report *Report = nullptr;
+    if (Asset->Optimize)
+    {
+        Report = &Asset->Report;
+        if (!OptimizeMesh(&Asset->Mesh, &Asset->OptimizeSettings, 1, Report))
+        {
+            *Report = {};
+        }
+    }
+    GeneratePlyNormals(&Asset->Mesh, NormalWeighting_Area, 1);
+    
+    if (Asset->Cacheable)
+    {
+        WriteMeshCache(Asset->CacheFileName, &Asset->Mesh, Asset->SourceHash, Asset->SourceSize, Report);
+    }
+    
+    return AssetStage_Loaded;
+}
+
+
+// The height field is read, parsed and gets its normals in one go
+static asset_stage ParseTerrain(asset *Asset)
+{
+    return LoadTerrain(Asset->FileName, Asset->Width, Asset->Height, &Asset->Terrain) ? AssetStage_Loaded : AssetStage_Failed;
+}
+
+
+static asset_stage RunAssetStage(asset *Asset, asset_stage Stage)
+{
+    if (Asset->Type == AssetType_Mesh)
+    {
+        switch (Stage)
+        {
+            case AssetStage_Read:           return ReadMesh(Asset);
+            case AssetStage_Parse:          return ParseMesh(Asset);
+            case AssetStage_PostProcess:    return PostProcessMesh(Asset);
+            default:                        return AssetStage_Failed;
+        }
+    }
+    else
+    {
+        // Nothing to read up front, the height field is read as it is parsed
+        return Stage == AssetStage_Read ? AssetStage_Parse : ParseTerrain(Asset);
+    }
+}
+
+
+static void LoadAsset(asset *Asset)
+{
+    PROFILE_SCOPE("LoadAsset");
+    
+    asset_stage Stage = AssetStage_Read;
+    while (Stage != AssetStage_Loaded && Stage != AssetStage_Failed)
+    {
+        InterlockedExchange(&Asset->Stage, Stage);
+        Stage = RunAssetStage(Asset, Stage);
+    }
+    
+    // NOTE(Marcus): The results are written before the stage says they are there
+    InterlockedExchange(&Asset->Stage, Stage);
+}
+
+
+unsigned int __stdcall AssetLoaderWork(void *Data)
+{
+    asset_loader *Loader = (asset_loader *)Data;
+    
+    ProfileRegisterThread("Asset loader");
+    
+    for (;;)
+    {
+        DWORD WaitResult = WaitForSingleObject(Loader->Requests, INFINITE);
+        if (WaitResult != WAIT_OBJECT_0 || !Loader->IsRunning)
+        {
+            break;
+        }
+        
+        // There is one count in the semaphore for every request, so there is always one to take
+        u32 Index = (u32)(InterlockedIncrement(&Loader->NextIndex) - 1);
+        LoadAsset(&Loader->Assets[Index]);
+        SetEvent(Loader->Finished);
+    }
+    
+    ProfileUnregisterThread();
+    return 0;
+}
+
+
+
+//
+// Loader API
+//
+b32 StartAssetLoader(asset_loader *Loader, u32 ThreadCount, u32 AssetCapacity)
+{
+    *Loader = {};
+    
+    ThreadCount = ThreadCount > 0 ? ThreadCount : 1;
+    ThreadCount = ThreadCount < kAssetThreadCountMax ? ThreadCount : kAssetThreadCountMax;
+    
+    Loader->Assets = (asset *)malloc(AssetCapacity * sizeof(asset));
+    Loader->AssetCapacity = AssetCapacity;
+    Loader->Requests = CreateSemaphoreA(nullptr, 0, LONG_MAX, nullptr);
+    Loader->Finished = CreateEventA(nullptr, false, false, nullptr);
+    if (!Loader->Assets || !Loader->Requests || !Loader->Finished)
+    {
+        StopAssetLoader(Loader);
+        return false;
+    }
+    
+    Loader->IsRunning = true;
+    for (u32 Index = 0; Index < ThreadCount; ++Index)
+    {
+        Loader->Threads[Index] = (HANDLE)_beginthreadex(0, 0, (_beginthreadex_proc_type)&AssetLoaderWork,
+                                                        (void *)Loader, 0, &Loader->ThreadIDs[Index]);
+        if (!Loader->Threads[Index])
+        {
+            StopAssetLoader(Loader);
+            return false;
+        }
+        ++Loader->ThreadCount;
+    }
+    
+    return true;
+}
+
+
+// The assets that are being loaded are finished, the ones still queued are dropped
+void StopAssetLoader(asset_loader *Loader)
+{
+    Loader->IsRunning = false;
+    if (Loader->ThreadCount > 0)
+    {
+        ReleaseSemaphore(Loader->Requests, Loader->ThreadCount, nullptr);
+    }
+    
+    for (u32 Index = 0; Index < Loader->ThreadCount; ++Index)
+    {
+        WaitForSingleObject(Loader->Threads[Index], INFINITE);
+        CloseHandle(Loader->Threads[Index]);
+    }
+    Loader->ThreadCount = 0;
+    
+    if (Loader->Requests)
+    {
+        CloseHandle(Loader->Requests);
+        Loader->Requests = nullptr;
+    }
+    
+    if (Loader->Finished)
+    {
+        CloseHandle(Loader->Finished);
+        Loader->Finished = nullptr;
+    }
+    
+    for (u32 Index = 0; Index < (u32)Loader->RequestCount; ++Index)
+    {
+        Free(&Loader->Assets[Index].Mesh);
+        FreeTerrain(&Loader->Assets[Index].Terrain);
+    }
+    
+    free(Loader->Assets);
+    Loader->Assets = nullptr;
+    Loader->AssetCapacity = 0;
+    Loader->RequestCount = 0;
+}
+
+
+static asset *AddAsset(asset_loader *Loader, asset_type Type, char const *FileName, 
+                       asset_callback *Callback, void *UserData)
+{
+    size_t Length = strlen(FileName);
+    if (!Loader->IsRunning || (u32)Loader->RequestCount == Loader->AssetCapacity || Length >= kAssetFileNameLengthMax)
+    {
+        return nullptr;
+    }
+    
+    asset *Asset = &Loader->Assets[Loader->RequestCount];
+    *Asset = {};
+    Asset->Type = Type;
+    memcpy(Asset->FileName, FileName, Length + 1);
+    Asset->Callback = Callback;
+    Asset->UserData = UserData;
+    return Asset;
+}
+
+
+// NOTE(Marcus): The asset is filled in before it is counted, and counted before a thread is woken
+static void QueueAsset(asset_loader *Loader)
+{
+    InterlockedIncrement(&Loader->RequestCount);
+    ReleaseSemaphore(Loader->Requests, 1, nullptr);
+}
+
+
+asset *RequestMesh(asset_loader *Loader, char const *FileName, mesh_optimize_settings const *Optimize,
+                   asset_callback *Callback, void *UserData)
+{
+    asset *Asset = AddAsset(Loader, AssetType_Mesh, FileName, Callback, UserData);
+    if (Asset)
+    {
+        if (Optimize)
+        {
+            Asset->Optimize = true;
+            Asset->OptimizeSettings = *Optimize;
+        }
+        QueueAsset(Loader);
+    }
+    
+    return Asset;
+}
+
+
+asset *RequestTerrain(asset_loader *Loader, char const *FileName, u32 Width, u32 Height,
+                      asset_callback *Callback, void *UserData)
+{
+    asset *Asset = AddAsset(Loader, AssetType_Terrain, FileName, Callback, UserData);
+    if (Asset)
+    {
+        Asset->Width = Width;
+        Asset->Height = Height;
+        QueueAsset(Loader);
+    }
+    
+    return Asset;
+}
+
+
+b32 IsAssetDone(asset *Asset)
+{
+    return Asset->Stage == AssetStage_Loaded || Asset->Stage == AssetStage_Failed;
+}
+
+
+b32 WaitForAsset(asset_loader *Loader, asset *Asset)
+{
+    PROFILE_SCOPE("WaitForAsset");
+    
+    // NOTE(Marcus): Finished is set after every asset, the stage is checked again after each one
+    while (!IsAssetDone(Asset))
+    {
+        WaitForSingleObject(Loader->Finished, INFINITE);
+    }
+    
+    return Asset->Stage == AssetStage_Loaded;
+}
+
+
+void PollAssets(asset_loader *Loader)
+{
+    PROFILE_SCOPE("PollAssets");
+    
+    u32 RequestCount = (u32)Loader->RequestCount;
+    for (u32 Index = Loader->FirstUnpolled; Index < RequestCount; ++Index)
+    {
+        asset *Asset = &Loader->Assets[Index];
+        if (!Asset->IsPolled && IsAssetDone(Asset))
+        {
+            Asset->IsPolled = true;
+            if (Asset->Callback)
+            {
+                Asset->Callback(Asset, Asset->UserData);
+            }
+        }
+        
+        if (Index == Loader->FirstUnpolled && Asset->IsPolled)
+        {
+            ++Loader->FirstUnpolled;
+        }
+    }
+}
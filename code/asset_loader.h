@@ -0,0 +1,139 @@
+// 
+// MIT License
+// 
+// Copyright (c) 2018 Marcus Larsson
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+
+
+#ifndef AssetLoader__h
+#define AssetLoader__h
+
+#define UNICODE
+#define STRICT
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+#include "types.h"
+#include "mesh_cache.h"
+#include "terrain.h"
+
+
+
+//
+// Asset loader
+//
+// Request*() queues an asset and returns right away, the asset is loaded on one of the loader
+// threads and independent assets load at the same time. Every asset goes through the stages
+//
+// read         - the file is hashed and looked up in the mesh cache
+// parse        - the file is parsed, on a cache miss
+// post process - the mesh is optimised, gets normals if it has none and the cache is written
+//
+// stopping at the first one that finishes it. An asset is a future: IsAssetDone() polls it and
+// WaitForAsset() blocks until it is done. The callbacks run on the thread that calls PollAssets(),
+// once for every asset that is done, so they can create GPU resources from the main loop.
+//
+// NOTE(Marcus): Only one thread makes requests, waits and polls. The results belong to the asset
+//               and are freed by StopAssetLoader(), move them out of it to keep them.
+//
+u32 constexpr kAssetFileNameLengthMax = 260;
+u32 constexpr kAssetThreadCountMax = 16;
+
+enum asset_type
+{
+    AssetType_Mesh,
+    AssetType_Terrain,
+};
+
+enum asset_stage
+{
+    AssetStage_Queued,
+    AssetStage_Read,
+    AssetStage_Parse,
+    AssetStage_PostProcess,
+    AssetStage_Loaded,
+    AssetStage_Failed,
+};
+
+struct asset;
+typedef void asset_callback(asset *Asset, void *UserData);
+
+struct asset
+{
+    asset_type Type;
+    char FileName[kAssetFileNameLengthMax];
+    LONG volatile Stage = AssetStage_Queued;
+    
+    asset_callback *Callback;
+    void *UserData;
+    b32 IsPolled;
+    
+    // Mesh, Report is filled in when it is optimised
+    ply_state Mesh;
+    b32 Optimize;
+    mesh_optimize_settings OptimizeSettings;
+    mesh_optimize_report Report;
+    
+    b32 Cacheable;
+    char CacheFileName[kMeshCacheFileNameLengthMax];
+    u64 SourceHash;
+    u64 SourceSize;
+    
+    // Terrain
+    u32 Width;
+    u32 Height;
+    terrain Terrain;
+};
+
+struct asset_loader
+{
+    asset *Assets = nullptr;
+    u32 AssetCapacity = 0;
+    LONG volatile RequestCount = 0;
+    LONG volatile NextIndex = 0;        // Next request for a thread to take
+    u32 FirstUnpolled = 0;
+    
+    HANDLE Requests;                    // Semaphore, one count per request not yet taken
+    HANDLE Finished;                    // Set when an asset is done
+    
+    HANDLE Threads[kAssetThreadCountMax];
+    u32 ThreadIDs[kAssetThreadCountMax];
+    u32 ThreadCount = 0;
+    
+    b32 volatile IsRunning = false;
+};
+
+b32 StartAssetLoader(asset_loader *Loader, u32 ThreadCount, u32 AssetCapacity);
+void StopAssetLoader(asset_loader *Loader);
+
+// Null when the loader is full or the file name is too long
+asset *RequestMesh(asset_loader *Loader, char const *FileName, mesh_optimize_settings const *Optimize = nullptr,
+                   asset_callback *Callback = nullptr, void *UserData = nullptr);
+asset *RequestTerrain(asset_loader *Loader, char const *FileName, u32 Width, u32 Height,
+                      asset_callback *Callback = nullptr, void *UserData = nullptr);
+
+b32 IsAssetDone(asset *Asset);
+b32 WaitForAsset(asset_loader *Loader, asset *Asset);  // True when it loaded
+void PollAssets(asset_loader *Loader);
+
+
+#endif
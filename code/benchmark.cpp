@@ -0,0 +1,1360 @@
+// 
+// MIT License
+// 
+// Copyright (c) 2018 Marcus Larsson
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+#include "benchmark.h"
+#include "particle_system.h"
+#include "perf_counters.h"
+#include "terrain.h"
+#include "hash.h"
+#include "tokenizer.h"
+#include "ply_loader.h"
+#include "parallel.h"
+
+#include <psapi.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <process.h>
+
+u32 constexpr kBenchmarkBatchCount = 8;
+u32 constexpr kBenchmarkWarmUpFrameCount = 60;
+f32 constexpr kBandwidthBoundRatio = 0.6f;  // Of the measured peak
+
+
+
+//
+// Peak memory bandwidth, a copy of a buffer much larger than the caches split over the threads
+//
+struct copy_thread_context
+{
+    u8 *Source;
+    u8 *Destination;
+    size_t Size;
+};
+
+unsigned int __stdcall CopySlice(void *Data)
+{
+    copy_thread_context *Context = (copy_thread_context *)Data;
+    memcpy(Context->Destination, Context->Source, Context->Size);
+    return 0;
+}
+
+
+// Bytes read and written per second
+static f64 MeasureMemoryBandwidth(u32 ThreadCount)
+{
+    size_t constexpr Size = 256ull * 1024 * 1024;
+    u8 *Source = (u8 *)malloc(Size);
+    u8 *Destination = (u8 *)malloc(Size);
+    if (!Source || !Destination)
+    {
+        free(Source);
+        free(Destination);
+        return 0.0;
+    }
+    
+    // Touch the pages before they are timed
+    memset(Source, 1, Size);
+    memset(Destination, 0, Size);
+    
+    LARGE_INTEGER Frequency;
+    QueryPerformanceFrequency(&Frequency);
+    
+    copy_thread_context Contexts[kPerfThreadCountMax];
+    HANDLE Threads[kPerfThreadCountMax];
+    ThreadCount = ThreadCount < kPerfThreadCountMax ? ThreadCount : kPerfThreadCountMax;
+    size_t SliceSize = Size / ThreadCount;
+    
+    f64 Result = 0.0;
+    for (u32 Run = 0; Run < 5; ++Run)
+    {
+        LARGE_INTEGER StartingTime, EndingTime;
+        QueryPerformanceCounter(&StartingTime);
+        
+        for (u32 Index = 0; Index < ThreadCount; ++Index)
+        {
+            Contexts[Index] = {Source + Index * SliceSize, Destination + Index * SliceSize, SliceSize};
+            unsigned int ThreadID;
+            Threads[Index] = (HANDLE)_beginthreadex(0, 0, (_beginthreadex_proc_type)&CopySlice, 
+                                                    (void *)&Contexts[Index], 0, &ThreadID);
+        }
+        
+        for (u32 Index = 0; Index < ThreadCount; ++Index)
+        {
+            WaitForSingleObject(Threads[Index], INFINITE);
+            CloseHandle(Threads[Index]);
+        }
+        
+        QueryPerformanceCounter(&EndingTime);
+        f64 Seconds = (f64)(EndingTime.QuadPart - StartingTime.QuadPart) / (f64)Frequency.QuadPart;
+        f64 Bandwidth = 2.0 * (f64)(SliceSize * ThreadCount) / Seconds;
+        Result = Bandwidth > Result ? Bandwidth : Result;
+    }
+    
+    free(Source);
+    free(Destination);
+    
+    return Result;
+}
+
+
+
+//
+// Scene, the same emitter and terrain as the demo
+//
+void InitScene(particle_system *ParticleSystem, terrain *Terrain, u32 ParticleCount, u32 ThreadCount)
+{
+    ParticleSystem->Po = V3(-2.0f, 35.0f, 12.0f);
+    ParticleSystem->Force = 25.0f;
+    ParticleSystem->ObjectToWorldMatrix = m4_identity;
+    
+    b32 Invertible;
+    ParticleSystem->ObjectToTerrainMatrix = ParticleSystem->ObjectToWorldMatrix * M4Translation(V3(30.5f, 140.0f, 43.5f));
+    ParticleSystem->TerrainToObjectMatrix = M4AffineInverse(&ParticleSystem->ObjectToTerrainMatrix, &Invertible);
+    assert(Invertible);
+    
+    Init(ParticleSystem, ParticleCount, ThreadCount, 1.0f / 60.0f, 
+         Terrain->Heights, Terrain->Width, Terrain->Height, Terrain->Normals);
+}
+
+
+
+//
+// Benchmark
+//
+struct benchmark_batch
+{
+    f64 Seconds;
+    u64 StepCount;
+    u64 Counters[PerfCounter_Count];
+};
+
+static int CompareBatches(void const *A, void const *B)
+{
+    f64 a = ((benchmark_batch const *)A)->Seconds;
+    f64 b = ((benchmark_batch const *)B)->Seconds;
+    return (a > b) - (a < b);
+}
+
+
+int RunBenchmark(char const *CommandLine)
+{
+    u32 ParticleCount = 1000000;
+    u32 ThreadCount = 4;
+    u32 FrameCount = 30;    // Per batch
+    
+    char const *Arguments = strstr(CommandLine, "-bench");
+    if (Arguments)
+    {
+        sscanf_s(Arguments + strlen("-bench"), "%u %u %u", &ParticleCount, &ThreadCount, &FrameCount);
+    }
+    ThreadCount = ThreadCount > 0 ? ThreadCount : 1;
+    FrameCount = FrameCount > 0 ? FrameCount : 1;
+    
+    terrain Terrain;
+    if (!LoadTerrain("..\\data\\volcano.txt", 61, 87, &Terrain))
+    {
+        printf("Failed to load the terrain\n");
+        return 1;
+    }
+    
+    
+    //
+    // No level of detail, every awake particle is stepped
+    particle_system ParticleSystem;
+    ParticleSystem.Lod.Enabled = false;
+    InitScene(&ParticleSystem, &Terrain, ParticleCount, ThreadCount);
+    
+    printf("Particles: %u, threads: %u, compact layout: %u, %u batches of %u frames\n", 
+           ParticleCount, ThreadCount, PARTICLE_COMPACT_LAYOUT, kBenchmarkBatchCount, FrameCount);
+    
+    for (u32 Frame = 0; Frame < kBenchmarkWarmUpFrameCount; ++Frame)
+    {
+        Update(&ParticleSystem);
+    }
+    
+    
+    //
+    // Counters for the workers and this thread
+    HANDLE Threads[kPerfThreadCountMax];
+    u32 CountedThreadCount = 0;
+    Threads[CountedThreadCount++] = GetCurrentThread();
+    for (u32 Index = 0; Index < ThreadCount && CountedThreadCount < kPerfThreadCountMax; ++Index)
+    {
+        Threads[CountedThreadCount++] = ParticleSystem.ThreadContext[Index].ThreadHandle;
+    }
+    
+    perf_counters Counters;
+    if (!OpenPerfCounters(&Counters, Threads, CountedThreadCount))
+    {
+        printf("No hardware counters available, only timing is reported\n");
+    }
+    
+    LARGE_INTEGER Frequency;
+    QueryPerformanceFrequency(&Frequency);
+    
+    benchmark_batch Batches[kBenchmarkBatchCount];
+    for (u32 Batch = 0; Batch < kBenchmarkBatchCount; ++Batch)
+    {
+        benchmark_batch *Result = &Batches[Batch];
+        Result->StepCount = 0;
+        
+        LARGE_INTEGER StartingTime, EndingTime;
+        StartPerfCounters(&Counters);
+        QueryPerformanceCounter(&StartingTime);
+        
+        for (u32 Frame = 0; Frame < FrameCount; ++Frame)
+        {
+            Update(&ParticleSystem);
+            Result->StepCount += ParticleSystem.Lod.StepCount;
+        }
+        
+        QueryPerformanceCounter(&EndingTime);
+        StopPerfCounters(&Counters);
+        
+        Result->Seconds = (f64)(EndingTime.QuadPart - StartingTime.QuadPart) / (f64)Frequency.QuadPart;
+        for (u32 Counter = 0; Counter < PerfCounter_Count; ++Counter)
+        {
+            Result->Counters[Counter] = Counters.Values[Counter];
+        }
+    }
+    
+    ClosePerfCounters(&Counters);
+    
+    f64 LayoutBytesPerStep = 0.0;
+    particle_attribute Attributes[kParticleAttributeCountMax];
+    u32 AttributeCount = GetAttributes(&ParticleSystem, Attributes);
+    for (u32 Index = 0; Index < AttributeCount; ++Index)
+    {
+        LayoutBytesPerStep += 2.0 * Attributes[Index].ElementSize;
+    }
+    
+    ShutDown(&ParticleSystem);
+    
+    
+    //
+    // Report the median batch, normalised per simulated particle step
+    qsort(Batches, kBenchmarkBatchCount, sizeof(benchmark_batch), CompareBatches);
+    benchmark_batch *Fastest = &Batches[0];
+    benchmark_batch *Median = &Batches[kBenchmarkBatchCount / 2];
+    f64 Steps = Median->StepCount > 0 ? (f64)Median->StepCount : 1.0;
+    
+    printf("Time per step: %.3f ns (fastest batch %.3f ns), %.1f M steps/s\n", 
+           1e9 * Median->Seconds / Steps, 1e9 * Fastest->Seconds / (Fastest->StepCount ? Fastest->StepCount : 1),
+           1e-6 * Steps / Median->Seconds);
+    
+    printf("Counters (%s), per step:\n", Counters.Backend);
+    for (u32 Counter = 0; Counter < PerfCounter_Count; ++Counter)
+    {
+        if (Counters.Available[Counter])
+        {
+            printf("  %-16s %10.3f\n", GetPerfCounterName((perf_counter)Counter), (f64)Median->Counters[Counter] / Steps);
+        }
+        else
+        {
+            printf("  %-16s %10s\n", GetPerfCounterName((perf_counter)Counter), "n/a");
+        }
+    }
+    
+    if (Counters.Available[PerfCounter_Cycles] && Counters.Available[PerfCounter_Instructions])
+    {
+        printf("  %-16s %10.3f\n", "IPC", 
+               (f64)Median->Counters[PerfCounter_Instructions] / (f64)Median->Counters[PerfCounter_Cycles]);
+    }
+    
+    
+    //
+    // Bandwidth, the bytes moved are measured as a cache line per last level cache miss. That 
+    // covers the reads and the write allocates but not the write backs, so it is a lower bound.
+    // Without the counter the layout gives the bytes each step should move, every attribute array
+    // read and written once, which is printed for reference but not used for the verdict.
+    f64 PeakBandwidth = MeasureMemoryBandwidth(ThreadCount);
+    if (Counters.Available[PerfCounter_CacheMisses])
+    {
+        f64 BytesPerStep = 64.0 * (f64)Median->Counters[PerfCounter_CacheMisses] / Steps;
+        f64 Bandwidth = BytesPerStep * Steps / Median->Seconds;
+        f64 Ratio = PeakBandwidth > 0.0 ? Bandwidth / PeakBandwidth : 0.0;
+        
+        printf("Bandwidth: %.1f bytes/step, %.2f GB/s (LLC misses, layout %.1f bytes/step), peak copy %.2f GB/s, %.0f%% of peak\n",
+               BytesPerStep, 1e-9 * Bandwidth, LayoutBytesPerStep, 1e-9 * PeakBandwidth, 100.0 * Ratio);
+        printf("Verdict: %s\n", Ratio >= kBandwidthBoundRatio ? 
+               "bandwidth bound, a smaller layout helps more than SIMD" : 
+               "compute bound, SIMD and fewer instructions per step help more than the layout");
+    }
+    else
+    {
+        printf("Bandwidth: n/a without the LLC miss counter (layout %.1f bytes/step), peak copy %.2f GB/s\n",
+               LayoutBytesPerStep, 1e-9 * PeakBandwidth);
+        printf("Verdict: n/a, the bytes moved were not measured\n");
+    }
+    
+    FreeTerrain(&Terrain);
+    
+    return 0;
+}
+
+
+
+//
+// Determinism
+//
+// A run with a single thread is the reference, each variant is stepped in lockstep with it and
+// all attribute arrays are hashed after every frame. On a mismatch the arrays are compared to find
+// the first particle that differs.
+//
+// The rest variants turn on friction so particles actually come to rest and the resting sets are
+// rebuilt, and add a prime number of particles so no thread gets a range of the same size as
+// another. Run -verify in both the default and the PARTICLE_COMPACT_LAYOUT build.
+//
+u32 constexpr kVerificationExtraParticleCount = 61;
+f32 constexpr kVerificationFriction = 8.0f;
+u32 constexpr kVerificationRestStepCount = 10;
+
+struct verification_variant
+{
+    u32 ThreadCount;
+    b32 LodEnabled;
+    b32 RestEnabled;
+};
+
+static verification_variant const kVerificationVariants[] = 
+{
+    {2, false, false}, {3, false, false}, {4, false, false}, {7, false, false}, {16, false, false},
+    {2, true, false},  {3, true, false},  {4, true, false},  {7, true, false},  {16, true, false},
+    {2, false, true},  {3, false, true},  {7, true, true},   {16, true, true},
+};
+
+
+static void SetUpVariant(particle_system *ParticleSystem, verification_variant const *Setup)
+{
+    b32 LodEnabled = Setup->LodEnabled;
+    if (Setup->RestEnabled)
+    {
+        ParticleSystem->Friction = kVerificationFriction;
+        ParticleSystem->RestStepCount = kVerificationRestStepCount;
+    }
+    
+    particle_lod *Lod = &ParticleSystem->Lod;
+    Lod->Enabled = LodEnabled;
+    
+    // A fixed camera below the emitter, and a budget that keeps adjusting the lod scale
+    Lod->CameraP = ParticleSystem->Po - V3(0.0f, 20.0f, 0.0f);
+    Lod->NearDistance = 15.0f;
+    Lod->FarDistance = 40.0f;
+    Lod->StepBudget = LodEnabled ? ParticleSystem->ParticleCount / 2 : 0;
+}
+
+
+static u64 HashParticleState(particle_system *ParticleSystem)
+{
+    u64 Hash = kHashSeed;
+    
+    particle_attribute Attributes[kParticleAttributeCountMax];
+    u32 AttributeCount = GetAttributes(ParticleSystem, Attributes);
+    for (u32 Index = 0; Index < AttributeCount; ++Index)
+    {
+        Hash = Hash64(*Attributes[Index].Data, (size_t)ParticleSystem->ParticleCount * Attributes[Index].ElementSize, Hash);
+    }
+    
+    return Hash;
+}
+
+
+static void ReportDivergence(particle_system *Reference, particle_system *ParticleSystem, u32 Frame)
+{
+    particle_attribute ReferenceAttributes[kParticleAttributeCountMax];
+    particle_attribute Attributes[kParticleAttributeCountMax];
+    u32 AttributeCount = GetAttributes(Reference, ReferenceAttributes);
+    GetAttributes(ParticleSystem, Attributes);
+    
+    u32 FirstIndex = u32Max;
+    char const *FirstName = nullptr;
+    for (u32 Attribute = 0; Attribute < AttributeCount; ++Attribute)
+    {
+        u32 ElementSize = Attributes[Attribute].ElementSize;
+        u8 *A = (u8 *)*ReferenceAttributes[Attribute].Data;
+        u8 *B = (u8 *)*Attributes[Attribute].Data;
+        
+        for (u32 Index = 0; Index < FirstIndex && Index < ParticleSystem->ParticleCount; ++Index)
+        {
+            if (memcmp(A + Index * ElementSize, B + Index * ElementSize, ElementSize) != 0)
+            {
+                FirstIndex = Index;
+                FirstName = Attributes[Attribute].Name;
+                break;
+            }
+        }
+    }
+    
+    if (FirstIndex == u32Max)
+    {
+        printf("    frame %u: the hashes differ but the arrays are equal\n", Frame);
+        return;
+    }
+    
+    u32 Thread = 0;
+    thread_context *ThreadContext = ParticleSystem->ThreadContext;
+    while (Thread + 1 < ThreadContext->ThreadCount && FirstIndex >= ThreadContext[Thread].EndIndex)
+    {
+        ++Thread;
+    }
+    
+    v3 ReferenceP = Reference->P[FirstIndex];
+    v3 P = ParticleSystem->P[FirstIndex];
+    printf("    first divergence at frame %u, particle %u (thread %u), attribute %s\n", Frame, FirstIndex, Thread, FirstName);
+    printf("    P reference (%.9g, %.9g, %.9g), got (%.9g, %.9g, %.9g), flags %u / %u\n", 
+           ReferenceP.x, ReferenceP.y, ReferenceP.z, P.x, P.y, P.z, 
+           Reference->Flags[FirstIndex], ParticleSystem->Flags[FirstIndex]);
+}
+
+
+int RunVerification(char const *CommandLine)
+{
+    u32 ParticleCount = 100000;
+    u32 FrameCount = 600;   // Longer than the lifetime, so respawned particles are covered
+    
+    char const *Arguments = strstr(CommandLine, "-verify");
+    if (Arguments)
+    {
+        sscanf_s(Arguments + strlen("-verify"), "%u %u", &ParticleCount, &FrameCount);
+    }
+    
+    terrain Terrain;
+    if (!LoadTerrain("..\\data\\volcano.txt", 61, 87, &Terrain))
+    {
+        printf("Failed to load the terrain\n");
+        return 1;
+    }
+    
+    printf("Particles: %u, frames: %u, compact layout: %u\n", ParticleCount, FrameCount, PARTICLE_COMPACT_LAYOUT);
+    
+    u32 FailedCount = 0;
+    for (u32 Variant = 0; Variant < ArrayCount(kVerificationVariants); ++Variant)
+    {
+        verification_variant const *Setup = &kVerificationVariants[Variant];
+        u32 VariantParticleCount = ParticleCount + (Setup->RestEnabled ? kVerificationExtraParticleCount : 0);
+        
+        particle_system Reference;
+        InitScene(&Reference, &Terrain, VariantParticleCount, 1);
+        SetUpVariant(&Reference, Setup);
+        
+        particle_system ParticleSystem;
+        InitScene(&ParticleSystem, &Terrain, VariantParticleCount, Setup->ThreadCount);
+        SetUpVariant(&ParticleSystem, Setup);
+        
+        u32 DivergentFrame = u32Max;
+        u32 RestingCountMax = 0;
+        u64 Hash = HashParticleState(&Reference);
+        if (Hash != HashParticleState(&ParticleSystem))
+        {
+            DivergentFrame = 0;
+        }
+        
+        for (u32 Frame = 1; Frame <= FrameCount && DivergentFrame == u32Max; ++Frame)
+        {
+            Update(&Reference);
+            Update(&ParticleSystem);
+            RestingCountMax = ParticleSystem.RestingCount > RestingCountMax ? ParticleSystem.RestingCount : RestingCountMax;
+            
+            Hash = HashParticleState(&Reference);
+            if (Hash != HashParticleState(&ParticleSystem))
+            {
+                DivergentFrame = Frame;
+            }
+        }
+        
+        printf("%2u threads, lod %s, rest %s: ", Setup->ThreadCount, Setup->LodEnabled ? "on " : "off",
+               Setup->RestEnabled ? "on " : "off");
+        if (DivergentFrame == u32Max)
+        {
+            printf("ok, hash %016llx, at most %u of %u resting\n", (unsigned long long)Hash, 
+                   RestingCountMax, VariantParticleCount);
+        }
+        else
+        {
+            printf("DIVERGED\n");
+            ReportDivergence(&Reference, &ParticleSystem, DivergentFrame);
+            ++FailedCount;
+        }
+        
+        ShutDown(&Reference);
+        ShutDown(&ParticleSystem);
+    }
+    
+    FreeTerrain(&Terrain);
+    
+    return FailedCount > 0 ? 1 : 0;
+}
+
+
+
+//
+// Number parsing
+//
+// Tokenises a buffer of numbers in the formats of the assets, and of the exporters that write them
+// with exponents, and compares the tokenizer with strtod and strtof on the same text. Every value
+// must have the same bits as the C library returns.
+//
+u32 constexpr kNumberFormatCount = 5;
+u32 constexpr kNumberBatchCount = 5;
+f64 constexpr kRandomUnit = 1.0 / 9007199254740992.0;   // 2^-53
+
+static u64 NextRandom(u64 *State)
+{
+    *State = MixHash(*State + 0x9E3779B97F4A7C15ull);
+    return *State;
+}
+
+
+static char *GenerateNumbers(u32 Count, u64 Seed, size_t *Size)
+{
+    size_t Capacity = (size_t)Count * 32 + 1;
+    char *Text = (char *)malloc(Capacity);
+    size_t Length = 0;
+    
+    u64 State = Seed;
+    for (u32 Index = 0; Index < Count; ++Index)
+    {
+        u64 Random = NextRandom(&State);
+        u32 Format = Index % kNumberFormatCount;
+        char *At = Text + Length;
+        size_t Left = Capacity - Length;
+        int Written = 0;
+        
+        if (Format == 0)
+        {
+            // Ply vertex attributes
+            Written = snprintf(At, Left, "%.6f", (f64)((s64)(Random % 4000000) - 2000000) / 1000000.0);
+        }
+        else if (Format == 1)
+        {
+            // Heightfields and indices
+            Written = snprintf(At, Left, "%u", (u32)(Random % 100000));
+        }
+        else if (Format == 2)
+        {
+            // Round trip f32, the shortest exact text
+            f32 Value = (f32)((f64)(Random >> 11) * kRandomUnit * 2000.0 - 1000.0);
+            Written = snprintf(At, Left, "%.9g", Value);
+        }
+        else if (Format == 3)
+        {
+            // Round trip f64
+            f64 Value = (f64)(Random >> 11) * kRandomUnit * 2.0e6 - 1.0e6;
+            Written = snprintf(At, Left, "%.17g", Value);
+        }
+        else
+        {
+            // Exported with exponents
+            Written = snprintf(At, Left, "%.5e", (f64)(Random >> 11) * kRandomUnit * pow(10.0, (f64)(s32)(Random % 20) - 10.0));
+        }
+        
+        Length += Written;
+        Text[Length++] = (Index % 8) == 7 ? '\n' : ' ';
+    }
+    
+    Text[Length] = 0;
+    *Size = Length;
+    
+    return Text;
+}
+
+
+static f64 GetSeconds(LARGE_INTEGER StartingTime, LARGE_INTEGER Frequency)
+{
+    LARGE_INTEGER EndingTime;
+    QueryPerformanceCounter(&EndingTime);
+    return (f64)(EndingTime.QuadPart - StartingTime.QuadPart) / (f64)Frequency.QuadPart;
+}
+
+
+static int CompareSeconds(void const *A, void const *B)
+{
+    f64 a = *(f64 const *)A;
+    f64 b = *(f64 const *)B;
+    return (a > b) - (a < b);
+}
+
+
+int RunNumberBenchmark(char const *CommandLine)
+{
+    u32 NumberCount = 1000000;
+    
+    char const *Arguments = strstr(CommandLine, "-numbers");
+    if (Arguments)
+    {
+        sscanf_s(Arguments + strlen("-numbers"), "%u", &NumberCount);
+    }
+    NumberCount = NumberCount > 0 ? NumberCount : 1;
+    
+    size_t Size;
+    char *Text = GenerateNumbers(NumberCount, kHashSeed, &Size);
+    
+    string Input;
+    Input.Data = (u8 *)Text;
+    Input.Count = Size;
+    
+    
+    //
+    // Correctness, each token against the C library
+    u32 Mismatches64 = 0;
+    u32 Mismatches32 = 0;
+    tokenizer Tokenizer = Tokenize(Input);
+    char *At = Text;
+    for (u32 Index = 0; Index < NumberCount; ++Index)
+    {
+        while (IsWhiteSpace(*At))
+        {
+            ++At;
+        }
+        
+        token Token = GetToken(&Tokenizer);
+        char *End;
+        f64 Expected64 = strtod(At, &End);
+        f32 Expected32 = strtof(At, nullptr);
+        
+        if (Token.Type != Token_Number || (char *)Token.Text.Data != At || (char *)Token.Text.Data + Token.Text.Count != End)
+        {
+            printf("Token %u is not the number %.*s\n", Index, (int)(End - At), At);
+            free(Text);
+            return 1;
+        }
+        
+        if (memcmp(&Token.f64, &Expected64, sizeof(f64)) != 0)
+        {
+            if (Mismatches64++ < 8)
+            {
+                printf("f64 mismatch: %.*s gave %.17g, strtod %.17g\n", (int)Token.Text.Count, At, Token.f64, Expected64);
+            }
+        }
+        if (memcmp(&Token.f32, &Expected32, sizeof(f32)) != 0)
+        {
+            if (Mismatches32++ < 8)
+            {
+                printf("f32 mismatch: %.*s gave %.9g, strtof %.9g\n", (int)Token.Text.Count, At, Token.f32, Expected32);
+            }
+        }
+        
+        At = End;
+    }
+    
+    
+    //
+    // Throughput, the fastest of a few passes over the whole buffer
+    LARGE_INTEGER Frequency;
+    QueryPerformanceFrequency(&Frequency);
+    
+    f64 TokenizerSeconds[kNumberBatchCount];
+    f64 StrtodSeconds[kNumberBatchCount];
+    f64 StrtofSeconds[kNumberBatchCount];
+    f64 Sum = 0.0;
+    for (u32 Batch = 0; Batch < kNumberBatchCount; ++Batch)
+    {
+        LARGE_INTEGER StartingTime;
+        
+        QueryPerformanceCounter(&StartingTime);
+        Tokenizer = Tokenize(Input);
+        for (token Token = GetToken(&Tokenizer); Token.Type != Token_EndOfStream; Token = GetToken(&Tokenizer))
+        {
+            Sum += Token.f64;
+        }
+        TokenizerSeconds[Batch] = GetSeconds(StartingTime, Frequency);
+        
+        QueryPerformanceCounter(&StartingTime);
+        At = Text;
+        for (u32 Index = 0; Index < NumberCount; ++Index)
+        {
+            Sum += strtod(At, &At);
+        }
+        StrtodSeconds[Batch] = GetSeconds(StartingTime, Frequency);
+        
+        QueryPerformanceCounter(&StartingTime);
+        At = Text;
+        for (u32 Index = 0; Index < NumberCount; ++Index)
+        {
+            Sum += strtof(At, &At);
+        }
+        StrtofSeconds[Batch] = GetSeconds(StartingTime, Frequency);
+    }
+    
+    qsort(TokenizerSeconds, kNumberBatchCount, sizeof(f64), CompareSeconds);
+    qsort(StrtodSeconds, kNumberBatchCount, sizeof(f64), CompareSeconds);
+    qsort(StrtofSeconds, kNumberBatchCount, sizeof(f64), CompareSeconds);
+    
+    printf("Numbers: %u, %.1f MB, checksum %g\n", NumberCount, 1e-6 * (f64)Size, Sum);
+    printf("  %-10s %8.1f MB/s %8.2f ns/number (f32, f64 and integers)\n", "tokenizer", 
+           1e-6 * (f64)Size / TokenizerSeconds[0], 1e9 * TokenizerSeconds[0] / NumberCount);
+    printf("  %-10s %8.1f MB/s %8.2f ns/number\n", "strtod", 
+           1e-6 * (f64)Size / StrtodSeconds[0], 1e9 * StrtodSeconds[0] / NumberCount);
+    printf("  %-10s %8.1f MB/s %8.2f ns/number\n", "strtof", 
+           1e-6 * (f64)Size / StrtofSeconds[0], 1e9 * StrtofSeconds[0] / NumberCount);
+    printf("Mismatches: %u f64, %u f32\n", Mismatches64, Mismatches32);
+    
+    free(Text);
+    
+    return (Mismatches64 > 0 || Mismatches32 > 0) ? 1 : 0;
+}
+
+
+
+//
+// Assets
+//
+// Synthetic assets of production size: a wavy grid mesh with positions, normals and texture
+// coordinates, written as ascii and as binary little endian ply, the same mesh with nothing but
+// positions as binary little endian ply, which LoadPlyFile() uses in place, and a square height
+// field in the format of volcano.txt. They are generated once into the data directory, the sizes are part of
+// the names, and then loaded a few times each with LoadPlyFile() and LoadTerrain().
+//
+u32 constexpr kAssetPassCount = 3;
+u32 constexpr kAssetWriteBufferSize = 8 * 1024 * 1024;
+u32 constexpr kAssetLineSizeMax = 256; // Longest line the generators append at a time
+f32 constexpr kAssetGridStep = 0.01f;
+
+enum generated_asset
+{
+    GeneratedAsset_AsciiMesh,
+    GeneratedAsset_BinaryMesh,
+    GeneratedAsset_PositionMesh,    // Binary, x y z only
+    GeneratedAsset_HeightField,
+};
+
+struct asset_writer
+{
+    FILE *File;
+    char *Buffer;
+    char *At;
+    b32 Error;
+};
+
+
+static b32 OpenAssetWriter(asset_writer *Writer, char const *FileName)
+{
+    *Writer = {};
+    if (fopen_s(&Writer->File, FileName, "wb") != 0)
+    {
+        return false;
+    }
+    
+    Writer->Buffer = (char *)malloc(kAssetWriteBufferSize);
+    Writer->At = Writer->Buffer;
+    if (!Writer->Buffer)
+    {
+        fclose(Writer->File);
+        return false;
+    }
+    
+    return true;
+}
+
+
+static void FlushAssetWriter(asset_writer *Writer)
+{
+    size_t Size = (size_t)(Writer->At - Writer->Buffer);
+    if (Size > 0 && fwrite(Writer->Buffer, 1, Size, Writer->File) != Size)
+    {
+        Writer->Error = true;
+    }
+    Writer->At = Writer->Buffer;
+}
+
+
+// Returns where to append at least kAssetLineSizeMax bytes
+static char *ReserveLine(asset_writer *Writer)
+{
+    if (Writer->Buffer + kAssetWriteBufferSize - Writer->At < kAssetLineSizeMax)
+    {
+        FlushAssetWriter(Writer);
+    }
+    return Writer->At;
+}
+
+
+static b32 CloseAssetWriter(asset_writer *Writer)
+{
+    FlushAssetWriter(Writer);
+    b32 Result = (fclose(Writer->File) == 0) && !Writer->Error;
+    free(Writer->Buffer);
+    return Result;
+}
+
+
+// NOTE(Marcus): snprintf() is far too slow for gigabytes of text, the values are written by hand
+static char *AppendU32(char *At, u32 Value)
+{
+    char Digits[10];
+    u32 Count = 0;
+    do
+    {
+        Digits[Count++] = (char)('0' + Value % 10);
+        Value /= 10;
+    } while (Value);
+    
+    while (Count)
+    {
+        *At++ = Digits[--Count];
+    }
+    return At;
+}
+
+
+// Four decimals, which is what the ascii exporters of the modelling tools tend to write
+static char *AppendFixed(char *At, f32 Value)
+{
+    s64 Scaled = (s64)(Value * 10000.0f + (Value < 0.0f ? -0.5f : 0.5f));
+    if (Scaled < 0)
+    {
+        *At++ = '-';
+        Scaled = -Scaled;
+    }
+    
+    At = AppendU32(At, (u32)(Scaled / 10000));
+    *At++ = '.';
+    u32 Fraction = (u32)(Scaled % 10000);
+    *At++ = (char)('0' + Fraction / 1000);
+    *At++ = (char)('0' + Fraction / 100 % 10);
+    *At++ = (char)('0' + Fraction / 10 % 10);
+    *At++ = (char)('0' + Fraction % 10);
+    return At;
+}
+
+
+// x y z nx ny nz s t of a vertex of the mesh, y = sin(x) cos(z) / 4
+static void GetGridVertex(u32 x, u32 z, u32 Width, u32 Height, f32 *Vertex)
+{
+    f32 X = (f32)x * kAssetGridStep;
+    f32 Z = (f32)z * kAssetGridStep;
+    f32 dYdX = 0.25f * cosf(X) * cosf(Z);
+    f32 dYdZ = -0.25f * sinf(X) * sinf(Z);
+    v3 N = Normalize(V3(-dYdX, 1.0f, -dYdZ));
+    
+    Vertex[0] = X;
+    Vertex[1] = 0.25f * sinf(X) * cosf(Z);
+    Vertex[2] = Z;
+    Vertex[3] = N.x;
+    Vertex[4] = N.y;
+    Vertex[5] = N.z;
+    Vertex[6] = Width > 1 ? (f32)x / (f32)(Width - 1) : 0.0f;
+    Vertex[7] = Height > 1 ? (f32)z / (f32)(Height - 1) : 0.0f;
+}
+
+
+static b32 GenerateMesh(char const *FileName, u32 Width, u32 Height, generated_asset Asset)
+{
+    asset_writer Writer;
+    if (!OpenAssetWriter(&Writer, FileName))
+    {
+        return false;
+    }
+    
+    b32 Binary = Asset != GeneratedAsset_AsciiMesh;
+    u32 ValueCount = Asset == GeneratedAsset_PositionMesh ? 3 : 8;
+    
+    // NOTE(Marcus): The comment is padded so the binary body starts 4 byte aligned, positions are
+    //               only used in place when they are aligned
+    u32 FaceCount = 2 * (Width - 1) * (Height - 1);
+    u32 Padding = 0;
+    for (u32 Pass = 0; Pass < 2; ++Pass)
+    {
+        int Length = snprintf(Writer.At, kAssetWriteBufferSize,
+                              "ply\n"
+                              "format %s 1.0\n"
+                              "comment Generated by particles.exe -assets%*s\n"
+                              "element vertex %u\n"
+                              "property float x\nproperty float y\nproperty float z\n"
+                              "%s"
+                              "element face %u\n"
+                              "property list uchar uint vertex_indices\n"
+                              "end_header\n", 
+                              Binary ? "binary_little_endian" : "ascii", Padding, "", Width * Height, 
+                              ValueCount == 8 ? ("property float nx\nproperty float ny\nproperty float nz\n"
+                                                 "property float s\nproperty float t\n") : "",
+                              FaceCount);
+        Padding = (4 - (u32)Length % 4) % 4;
+        if (Pass == 1)
+        {
+            Writer.At += Length;
+        }
+    }
+    
+    for (u32 z = 0; z < Height; ++z)
+    {
+        for (u32 x = 0; x < Width; ++x)
+        {
+            f32 Vertex[8];
+            GetGridVertex(x, z, Width, Height, Vertex);
+            
+            char *At = ReserveLine(&Writer);
+            if (Binary)
+            {
+                memcpy(At, Vertex, ValueCount * sizeof(f32));
+                At += ValueCount * sizeof(f32);
+            }
+            else
+            {
+                for (u32 Index = 0; Index < ValueCount; ++Index)
+                {
+                    At = AppendFixed(At, Vertex[Index]);
+                    *At++ = Index + 1 < ValueCount ? ' ' : '\n';
+                }
+            }
+            Writer.At = At;
+        }
+    }
+    
+    for (u32 z = 0; z + 1 < Height; ++z)
+    {
+        for (u32 x = 0; x + 1 < Width; ++x)
+        {
+            u32 I = z * Width + x;
+            u32 Triangles[2][3] = {{I, I + Width, I + Width + 1}, {I, I + Width + 1, I + 1}};
+            
+            char *At = ReserveLine(&Writer);
+            for (u32 Triangle = 0; Triangle < 2; ++Triangle)
+            {
+                if (Binary)
+                {
+                    *At++ = 3;
+                    memcpy(At, Triangles[Triangle], 3 * sizeof(u32));
+                    At += 3 * sizeof(u32);
+                }
+                else
+                {
+                    *At++ = '3';
+                    for (u32 Index = 0; Index < 3; ++Index)
+                    {
+                        *At++ = ' ';
+                        At = AppendU32(At, Triangles[Triangle][Index]);
+                    }
+                    *At++ = '\n';
+                }
+            }
+            Writer.At = At;
+        }
+    }
+    
+    return CloseAssetWriter(&Writer);
+}
+
+
+// Smooth hills in the range of volcano.txt
+static u32 GetGridHeight(u32 x, u32 z)
+{
+    f32 Height = 100.0f + 60.0f * sinf((f32)x * 0.013f) * cosf((f32)z * 0.017f) + 30.0f * sinf((f32)(x + z) * 0.003f);
+    return (u32)Height;
+}
+
+
+static b32 GenerateHeightField(char const *FileName, u32 Size)
+{
+    asset_writer Writer;
+    if (!OpenAssetWriter(&Writer, FileName))
+    {
+        return false;
+    }
+    
+    for (u32 z = 0; z < Size; ++z)
+    {
+        for (u32 x = 0; x < Size; ++x)
+        {
+            char *At = ReserveLine(&Writer);
+            At = AppendU32(At, GetGridHeight(x, z));
+            *At++ = x + 1 < Size ? ' ' : '\n';
+            Writer.At = At;
+        }
+    }
+    
+    return CloseAssetWriter(&Writer);
+}
+
+
+// Generates the asset unless it already exists, through a temporary file so an interrupted run
+// does not leave a truncated asset behind
+static b32 PrepareAsset(char const *FileName, generated_asset Asset, u32 Width, u32 Height)
+{
+    FILE *Existing;
+    if (fopen_s(&Existing, FileName, "rb") == 0)
+    {
+        fclose(Existing);
+        return true;
+    }
+    
+    char TempFileName[MAX_PATH];
+    snprintf(TempFileName, sizeof(TempFileName), "%s.tmp", FileName);
+    
+    printf("Generating %s...\n", FileName);
+    b32 Result = (Asset == GeneratedAsset_HeightField ? GenerateHeightField(TempFileName, Width) : 
+                  GenerateMesh(TempFileName, Width, Height, Asset));
+    if (!Result || rename(TempFileName, FileName) != 0)
+    {
+        printf("Failed to generate %s\n", FileName);
+        remove(TempFileName);
+        return false;
+    }
+    
+    return true;
+}
+
+
+static u64 GetAssetFileSize(char const *FileName)
+{
+    LARGE_INTEGER Size = {};
+    HANDLE File = CreateFileA(FileName, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (File != INVALID_HANDLE_VALUE)
+    {
+        GetFileSizeEx(File, &Size);
+        CloseHandle(File);
+    }
+    return (u64)Size.QuadPart;
+}
+
+
+static f64 GetPeakWorkingSet()
+{
+    PROCESS_MEMORY_COUNTERS Counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &Counters, sizeof(Counters)))
+    {
+        return 0.0;
+    }
+    return (f64)Counters.PeakWorkingSetSize;
+}
+
+
+// The fastest pass, the first one reads the file from disk if it is not in the file cache
+static void ReportAssetCase(char const *Name, u64 FileSize, u64 VertexCount, f64 *Seconds, u32 PassCount)
+{
+    qsort(Seconds, PassCount, sizeof(f64), CompareSeconds);
+    printf("  %-8s %9.1f MB %9.1f ms %9.1f MB/s %9.2f M vertices/s (first pass %.1f ms), peak working set %.1f MB\n", 
+           Name, 1e-6 * (f64)FileSize, 1e3 * Seconds[0], 1e-6 * (f64)FileSize / Seconds[0], 
+           1e-6 * (f64)VertexCount / Seconds[0], 1e3 * Seconds[PassCount - 1], 1e-6 * GetPeakWorkingSet());
+}
+
+
+// A mesh with only positions has to be used in place, it is the case that measures the zero copy
+static b32 RunMeshCase(char const *Name, char const *FileName, u32 VertexCount, u32 ThreadCount, 
+                       b32 PositionsOnly = false)
+{
+    LARGE_INTEGER Frequency;
+    QueryPerformanceFrequency(&Frequency);
+    
+    f64 Seconds[kAssetPassCount];
+    for (u32 Pass = 0; Pass < kAssetPassCount; ++Pass)
+    {
+        LARGE_INTEGER StartingTime;
+        QueryPerformanceCounter(&StartingTime);
+        
+        ply_state State;
+        b32 Loaded = LoadPlyFile(FileName, &State, ThreadCount);
+        Seconds[Pass] = GetSeconds(StartingTime, Frequency);
+        
+        b32 Complete = (Loaded && State.VertexCount == VertexCount && 
+                        (PositionsOnly ? State.Positions == (v3 *)State.Vertices : State.Normals && State.TexCoords));
+        if (Loaded)
+        {
+            Free(&State);
+        }
+        if (!Complete)
+        {
+            printf("  %-8s failed to load %s\n", Name, FileName);
+            return false;
+        }
+    }
+    
+    ReportAssetCase(Name, GetAssetFileSize(FileName), VertexCount, Seconds, kAssetPassCount);
+    return true;
+}
+
+
+static b32 RunTerrainCase(char const *FileName, u32 Size, u32 ThreadCount)
+{
+    LARGE_INTEGER Frequency;
+    QueryPerformanceFrequency(&Frequency);
+    
+    f64 Seconds[kAssetPassCount];
+    for (u32 Pass = 0; Pass < kAssetPassCount; ++Pass)
+    {
+        LARGE_INTEGER StartingTime;
+        QueryPerformanceCounter(&StartingTime);
+        
+        terrain Terrain;
+        b32 Loaded = LoadTerrain(FileName, Size, Size, &Terrain, ThreadCount);
+        Seconds[Pass] = GetSeconds(StartingTime, Frequency);
+        
+        if (!Loaded)
+        {
+            printf("  %-8s failed to load %s\n", "terrain", FileName);
+            return false;
+        }
+        FreeTerrain(&Terrain);
+    }
+    
+    ReportAssetCase("terrain", GetAssetFileSize(FileName), (u64)Size * Size, Seconds, kAssetPassCount);
+    return true;
+}
+
+
+int RunAssetBenchmark(char const *CommandLine)
+{
+    u32 VertexCount = 1000000;
+    u32 GridSize = 1024;
+    u32 ThreadCount = GetProcessorCount();
+    char Cases[16] = "all";
+    
+    char const *Arguments = strstr(CommandLine, "-assets");
+    if (Arguments)
+    {
+        sscanf_s(Arguments + strlen("-assets"), "%u %u %u %15s", &VertexCount, &GridSize, &ThreadCount, 
+                 Cases, (unsigned)sizeof(Cases));
+    }
+    VertexCount = VertexCount > 4 ? VertexCount : 4;
+    GridSize = GridSize > 2 ? GridSize : 2;
+    ThreadCount = ThreadCount > 0 ? ThreadCount : 1;
+    b32 All = strcmp(Cases, "all") == 0;
+    
+    // The mesh is as square as the vertex count allows
+    u32 Width = (u32)ceil(sqrt((f64)VertexCount));
+    u32 Height = (VertexCount + Width - 1) / Width;
+    u32 MeshVertexCount = Width * Height;
+    
+    char AsciiFileName[MAX_PATH];
+    char BinaryFileName[MAX_PATH];
+    char PositionFileName[MAX_PATH];
+    char TerrainFileName[MAX_PATH];
+    snprintf(AsciiFileName, sizeof(AsciiFileName), "..\\data\\bench_mesh_%ux%u_ascii.ply", Width, Height);
+    snprintf(BinaryFileName, sizeof(BinaryFileName), "..\\data\\bench_mesh_%ux%u_binary.ply", Width, Height);
+    snprintf(PositionFileName, sizeof(PositionFileName), "..\\data\\bench_mesh_%ux%u_xyz.ply", Width, Height);
+    snprintf(TerrainFileName, sizeof(TerrainFileName), "..\\data\\bench_terrain_%ux%u.txt", GridSize, GridSize);
+    
+    b32 Result = true;
+    printf("Mesh: %u vertices (%u x %u), height field: %u x %u, threads: %u\n", 
+           MeshVertexCount, Width, Height, GridSize, GridSize, ThreadCount);
+    
+    // NOTE(Marcus): The peak working set is that of the process, run a single case to isolate it
+    if (All || strcmp(Cases, "ascii") == 0)
+    {
+        Result = (PrepareAsset(AsciiFileName, GeneratedAsset_AsciiMesh, Width, Height) && 
+                  RunMeshCase("ascii", AsciiFileName, MeshVertexCount, ThreadCount) && Result);
+    }
+    if (All || strcmp(Cases, "binary") == 0)
+    {
+        Result = (PrepareAsset(BinaryFileName, GeneratedAsset_BinaryMesh, Width, Height) && 
+                  RunMeshCase("binary", BinaryFileName, MeshVertexCount, ThreadCount) && Result);
+    }
+    if (All || strcmp(Cases, "xyz") == 0)
+    {
+        Result = (PrepareAsset(PositionFileName, GeneratedAsset_PositionMesh, Width, Height) && 
+                  RunMeshCase("xyz", PositionFileName, MeshVertexCount, ThreadCount, true) && Result);
+    }
+    if (All || strcmp(Cases, "terrain") == 0)
+    {
+        Result = (PrepareAsset(TerrainFileName, GeneratedAsset_HeightField, GridSize, GridSize) && 
+                  RunTerrainCase(TerrainFileName, GridSize, ThreadCount) && Result);
+    }
+    
+    return Result ? 0 : 1;
+}
+
+
+
+//
+// Matrices
+//
+// The affine, rigid and look at inverses against M4Inverse, which must agree within a tolerance
+// relative to the largest element. Each is then timed against the function it replaced.
+//
+f32 constexpr kMatrixTolerance = 1.0e-4f;
+
+// Written by the timed loops so the compiler can not remove the work
+static f32 volatile MatrixSink;
+
+// M4LookAt() as it was, the camera matrix inverted with M4Inverse()
+static m4 LookAtInverse(v3 const CameraP, v3 const LookAtP)
+{
+    v3 Z = Normalize(CameraP - LookAtP);
+    v3 X = Normalize(Cross(V3(0.0f, 1.0f, 0.0f), Z));
+    v3 Y = Cross(Z, X);
+    
+    m4 Rotate = {V4(X, 0.0f), V4(Y, 0.0f), V4(Z, 0.0f), V4(0.0f, 0.0f, 0.0f, 1.0f)};
+    m4 Translate = M4Translate(CameraP);
+    m4 Result = Rotate * Translate;
+    
+    return M4Inverse(&Result);
+}
+
+
+static f32 RandomRange(u64 *State, f32 Min, f32 Max)
+{
+    return Min + (Max - Min) * (f32)((f64)(NextRandom(State) >> 11) * kRandomUnit);
+}
+
+
+static m4 RandomRotation(u64 *State)
+{
+    m4 Result = (M4RotationX(RandomRange(State, -Pi32, Pi32)) * 
+                 M4RotationY(RandomRange(State, -Pi32, Pi32)) * 
+                 M4RotationZ(RandomRange(State, -Pi32, Pi32)));
+    return Result;
+}
+
+
+static v3 RandomPosition(u64 *State)
+{
+    return V3(RandomRange(State, -100.0f, 100.0f), RandomRange(State, -100.0f, 100.0f), RandomRange(State, -100.0f, 100.0f));
+}
+
+
+// The largest difference of the elements relative to the largest element of Expected
+static f32 GetMatrixError(m4 const& A, m4 const& Expected)
+{
+    f32 Largest = 0.0f;
+    f32 Difference = 0.0f;
+    for (u32 Index = 0; Index < 16; ++Index)
+    {
+        f32 a = A.E[Index / 4][Index % 4];
+        f32 e = Expected.E[Index / 4][Index % 4];
+        Largest = fabsf(e) > Largest ? fabsf(e) : Largest;
+        Difference = fabsf(a - e) > Difference ? fabsf(a - e) : Difference;
+    }
+    
+    return Largest > 0.0f ? Difference / Largest : Difference;
+}
+
+
+int RunMatrixBenchmark(char const *CommandLine)
+{
+    u32 MatrixCount = 100000;
+    
+    char const *Arguments = strstr(CommandLine, "-matrices");
+    if (Arguments)
+    {
+        sscanf_s(Arguments + strlen("-matrices"), "%u", &MatrixCount);
+    }
+    MatrixCount = MatrixCount > 1 ? MatrixCount : 2;
+    
+    m4 *Affine = (m4 *)malloc(MatrixCount * sizeof(m4));
+    m4 *Rigid = (m4 *)malloc(MatrixCount * sizeof(m4));
+    v3 *Cameras = (v3 *)malloc(MatrixCount * sizeof(v3));
+    m4 *Results = (m4 *)malloc(MatrixCount * sizeof(m4));
+    if (!Affine || !Rigid || !Cameras || !Results)
+    {
+        printf("Could not allocate %u matrices\n", MatrixCount);
+        free(Affine);
+        free(Rigid);
+        free(Cameras);
+        free(Results);
+        return 1;
+    }
+    
+    u64 Random = kHashSeed;
+    for (u32 Index = 0; Index < MatrixCount; ++Index)
+    {
+        m4 Rotation = RandomRotation(&Random);
+        m4 Translation = M4Translation(RandomPosition(&Random));
+        m4 Scale = M4Scale(RandomRange(&Random, 0.1f, 10.0f), RandomRange(&Random, 0.1f, 10.0f), RandomRange(&Random, 0.1f, 10.0f));
+        Rigid[Index] = Rotation * Translation;
+        Affine[Index] = Scale * RandomRotation(&Random) * Rigid[Index];
+        
+        // Away from straight above or below the origin, where the look at basis is undefined
+        Cameras[Index] = RandomPosition(&Random);
+        Cameras[Index].x += Cameras[Index].x < 0.0f ? -1.0f : 1.0f;
+    }
+    
+    
+    //
+    // Correctness
+    f32 AffineError = 0.0f;
+    f32 RigidError = 0.0f;
+    f32 LookAtError = 0.0f;
+    v3 const LookAtP = V3(0.0f, 0.0f, 0.0f);
+    for (u32 Index = 0; Index < MatrixCount; ++Index)
+    {
+        f32 Error = GetMatrixError(M4AffineInverse(&Affine[Index]), M4Inverse(&Affine[Index]));
+        AffineError = Error > AffineError ? Error : AffineError;
+        
+        Error = GetMatrixError(M4RigidInverse(&Rigid[Index]), M4Inverse(&Rigid[Index]));
+        RigidError = Error > RigidError ? Error : RigidError;
+        
+        Error = GetMatrixError(M4LookAt(Cameras[Index], LookAtP), LookAtInverse(Cameras[Index], LookAtP));
+        LookAtError = Error > LookAtError ? Error : LookAtError;
+    }
+    
+    
+    //
+    // Throughput, the fastest of a few passes over all matrices with the results written out
+    LARGE_INTEGER Frequency;
+    QueryPerformanceFrequency(&Frequency);
+    
+    u32 constexpr CaseCount = 6;
+    char const *CaseNames[CaseCount] = 
+    {
+        "affine inverse", "", "rigid inverse", "", "look at", "",
+    };
+    f64 Seconds[CaseCount][kNumberBatchCount];
+    f32 Sum = 0.0f;
+    for (u32 Batch = 0; Batch < kNumberBatchCount; ++Batch)
+    {
+        LARGE_INTEGER StartingTime;
+        
+        for (u32 Case = 0; Case < CaseCount; ++Case)
+        {
+            QueryPerformanceCounter(&StartingTime);
+            for (u32 Index = 0; Index < MatrixCount; ++Index)
+            {
+                switch (Case)
+                {
+                    case 0: Results[Index] = M4AffineInverse(&Affine[Index]); break;
+                    case 1: Results[Index] = M4Inverse(&Affine[Index]); break;
+                    case 2: Results[Index] = M4RigidInverse(&Rigid[Index]); break;
+                    case 3: Results[Index] = M4Inverse(&Rigid[Index]); break;
+                    case 4: Results[Index] = M4LookAt(Cameras[Index], LookAtP); break;
+                    case 5: Results[Index] = LookAtInverse(Cameras[Index], LookAtP); break;
+                }
+            }
+            Seconds[Case][Batch] = GetSeconds(StartingTime, Frequency);
+            Sum += Results[MatrixCount / 2].E[0][0];
+        }
+    }
+    MatrixSink = Sum;
+    
+    printf("Matrices: %u\n", MatrixCount);
+    for (u32 Case = 0; Case < CaseCount; Case += 2)
+    {
+        qsort(Seconds[Case], kNumberBatchCount, sizeof(f64), CompareSeconds);
+        qsort(Seconds[Case + 1], kNumberBatchCount, sizeof(f64), CompareSeconds);
+        printf("  %-15s %7.2f ns/op, M4Inverse %7.2f ns/op, %5.2fx\n", CaseNames[Case], 
+               1e9 * Seconds[Case][0] / MatrixCount, 
+               1e9 * Seconds[Case + 1][0] / MatrixCount, Seconds[Case + 1][0] / Seconds[Case][0]);
+    }
+    printf("Largest relative error: %.2g affine, %.2g rigid, %.2g look at\n", AffineError, RigidError, LookAtError);
+    
+    free(Affine);
+    free(Rigid);
+    free(Cameras);
+    free(Results);
+    
+    b32 Failed = AffineError > kMatrixTolerance || RigidError > kMatrixTolerance || LookAtError > kMatrixTolerance;
+    
+    return Failed ? 1 : 0;
+}
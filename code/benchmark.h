@@ -0,0 +1,104 @@
+// 
+// MIT License
+// 
+// Copyright (c) 2018 Marcus Larsson
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+
+#ifndef Benchmark__h
+#define Benchmark__h
+
+#include "types.h"
+
+struct particle_system;
+struct terrain;
+
+// Sets up a particle system with the emitter and terrain of the demo
+void InitScene(particle_system *ParticleSystem, terrain *Terrain, u32 ParticleCount, u32 ThreadCount);
+
+//
+// Headless benchmark of the particle update, started with -bench on the command line:
+//
+//   particles.exe -bench [ParticleCount] [ThreadCount] [FrameCount]
+//
+// Returns the exit code of the process.
+//
+int RunBenchmark(char const *CommandLine);
+
+//
+// Determinism check of the particle update, started with -verify on the command line:
+//
+//   particles.exe -verify [ParticleCount] [FrameCount]
+//
+// Steps the simulation with different thread counts, with and without level of detail and rest
+// detection, and compares the state to a single threaded run after every frame. Run it in the
+// PARTICLE_COMPACT_LAYOUT build as well. Returns 1 if any run diverged.
+//
+int RunVerification(char const *CommandLine);
+
+//
+// Regression suite, started with -regress on the command line:
+//
+//   particles.exe -regress [update]
+//
+// Times the particle update, the terrain preprocessing, the tokenizer, the ply loader and the
+// matrix functions, and compares the samples to the baseline stored for this machine. The first run
+// on a machine, or a run with update, stores the baseline as data/baseline_<fingerprint>.json. The
+// baselines belong to the machine and are not committed. Returns 1 if any case got significantly
+// slower.
+//
+int RunRegressionSuite(char const *CommandLine);
+
+//
+// Number parsing benchmark, started with -numbers on the command line:
+//
+//   particles.exe -numbers [NumberCount]
+//
+// Checks that the tokenizer parses the same f64 and f32 values as strtod and strtof, and compares
+// their throughput. Returns 1 if any value differs.
+//
+int RunNumberBenchmark(char const *CommandLine);
+
+//
+// Asset loading benchmark, started with -assets on the command line:
+//
+//   particles.exe -assets [VertexCount] [GridSize] [ThreadCount] [all|ascii|binary|xyz|terrain]
+//
+// Generates an ascii and a binary ply mesh with about VertexCount vertices, a binary one with only
+// positions that is loaded without copying them, and a GridSize x GridSize height field in the
+// data directory, unless they are there from an earlier run, and reports the MB/s and vertices/s
+// of LoadPlyFile() and LoadTerrain() along with the peak working set. Meant for sizes up to 100M
+// vertices and 32K x 32K grids. Returns 1 if an asset failed to generate or load.
+//
+int RunAssetBenchmark(char const *CommandLine);
+
+//
+// Matrix benchmark, started with -matrices on the command line:
+//
+//   particles.exe -matrices [MatrixCount]
+//
+// Checks that M4AffineInverse(), M4RigidInverse() and M4LookAt() agree with M4Inverse(), then
+// times each against the function it replaced. Returns 1 if any result differs.
+//
+int RunMatrixBenchmark(char const *CommandLine);
+
+
+#endif
@@ -413,6 +413,7 @@ b32 CreateRenderable(directx_state *State,
     
     Renderable->Topology = Topology;
     Renderable->Stride = VertexSize;
+    Renderable->IndexFormat = IndexSize == sizeof(u32) ? DXGI_FORMAT_R32_UINT : DXGI_FORMAT_R16_UINT;
     
     return true;
 }
@@ -428,7 +429,7 @@ void RenderRenderable(directx_state *State, directx_renderable_indexed *Renderab
     
     ID3D11DeviceContext *DeviceContext = State->DeviceContext;
     DeviceContext->IASetVertexBuffers(0, 1, &Renderable->VertexBuffer.Ptr, &Renderable->Stride, &Offset);
-    DeviceContext->IASetIndexBuffer(Renderable->IndexBuffer.Ptr, DXGI_FORMAT_R16_UINT, 0);
+    DeviceContext->IASetIndexBuffer(Renderable->IndexBuffer.Ptr, Renderable->IndexFormat, 0);
     DeviceContext->IASetPrimitiveTopology(Renderable->Topology);
     DeviceContext->DrawIndexed(Renderable->IndexBuffer.ElementCount, 0, 0);
 }
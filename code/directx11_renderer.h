@@ -131,6 +131,7 @@ struct directx_renderable_indexed
     directx_buffer VertexBuffer;
     directx_buffer IndexBuffer;
     u32 Stride;
+    DXGI_FORMAT IndexFormat;
     D3D11_PRIMITIVE_TOPOLOGY Topology;
 };
 
@@ -0,0 +1,102 @@
+// 
+// MIT License
+// 
+// Copyright (c) 2018 Marcus Larsson
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+
+#ifndef Hash__h
+#define Hash__h
+
+#include <string.h>
+#include "types.h"
+
+
+
+//
+// 64 bit non-cryptographic hash over 8 byte words, the rounds of xxHash64 on a single lane with a 
+// final avalanche. Every word is mixed on its own before it is combined, so a change to one word 
+// can not be cancelled by a change to the next. Fast enough to hash every attribute array each
+// frame.
+//
+// NOTE(Marcus): The hashes are stored, as the source key of the mesh cache and in the names of the
+//               regression baselines. Changing the function needs a new kMeshCacheVersion, and
+//               the baselines are recorded again.
+//
+u64 constexpr kHashSeed = 0xCBF29CE484222325ull;
+u64 constexpr kHashPrime1 = 0x9E3779B185EBCA87ull;
+u64 constexpr kHashPrime2 = 0xC2B2AE3D27D4EB4Full;
+u64 constexpr kHashPrime3 = 0x165667B19E3779F9ull;
+
+inline u64 RotateLeft64(u64 Value, u32 Shift)
+{
+    return (Value << Shift) | (Value >> (64 - Shift));
+}
+
+
+inline u64 MixHash(u64 Hash)
+{
+    Hash ^= Hash >> 33;
+    Hash *= 0xFF51AFD7ED558CCDull;
+    Hash ^= Hash >> 33;
+    Hash *= 0xC4CEB9FE1A85EC53ull;
+    Hash ^= Hash >> 33;
+    return Hash;
+}
+
+
+inline u64 HashWord(u64 Hash, u64 Word)
+{
+    Word *= kHashPrime2;
+    Word = RotateLeft64(Word, 31);
+    Word *= kHashPrime1;
+    
+    Hash ^= Word;
+    Hash = RotateLeft64(Hash, 27) * kHashPrime1 + kHashPrime3;
+    return Hash;
+}
+
+
+inline u64 Hash64(void const *Data, size_t Size, u64 Seed = kHashSeed)
+{
+    u8 const *At = (u8 const *)Data;
+    u64 Hash = Seed + kHashPrime3 + Size * kHashPrime1;
+    
+    for (; Size >= 8; Size -= 8, At += 8)
+    {
+        u64 Word;
+        memcpy(&Word, At, 8);
+        Hash = HashWord(Hash, Word);
+    }
+    
+    // The size is in the seed, so the zero padding of the last word is not ambiguous
+    if (Size > 0)
+    {
+        u64 Word = 0;
+        memcpy(&Word, At, Size);
+        Hash = HashWord(Hash, Word);
+    }
+    
+    return MixHash(Hash);
+}
+
+
+#endif
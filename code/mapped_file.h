@@ -0,0 +1,322 @@
+// 
+// MIT License
+// 
+// Copyright (c) 2018 Marcus Larsson
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+#ifndef MappedFile__h
+#define MappedFile__h
+
+#if defined(_WIN32)
+#define UNICODE
+#define STRICT
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "types.h"
+
+
+
+//
+// A read only view of a whole file. With CopyOnWrite the pages can be written to, the writes are
+// private to the process and never reaches the file.
+//
+struct mapped_file
+{
+#if defined(_WIN32)
+    HANDLE File = INVALID_HANDLE_VALUE;
+    HANDLE Mapping = nullptr;
+#else
+    int File = -1;
+#endif
+    
+    u8 *Data = nullptr;
+    u64 Size = 0;
+};
+
+
+#if defined(_WIN32)
+
+static void CloseMappedFile(mapped_file *MappedFile)
+{
+    if (MappedFile->Data)
+    {
+        UnmapViewOfFile(MappedFile->Data);
+        MappedFile->Data = nullptr;
+    }
+    
+    if (MappedFile->Mapping)
+    {
+        CloseHandle(MappedFile->Mapping);
+        MappedFile->Mapping = nullptr;
+    }
+    
+    if (MappedFile->File != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(MappedFile->File);
+        MappedFile->File = INVALID_HANDLE_VALUE;
+    }
+    
+    MappedFile->Size = 0;
+}
+
+
+// Opens the file and the mapping object without mapping any of it
+static b32 OpenMappedFileHandles(char const *FileName, mapped_file *MappedFile, b32 CopyOnWrite)
+{
+    *MappedFile = {};
+    
+    MappedFile->File = CreateFileA(FileName, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                                   FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (MappedFile->File == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+    
+    LARGE_INTEGER Size;
+    if (!GetFileSizeEx(MappedFile->File, &Size) || Size.QuadPart == 0)
+    {
+        // NOTE(Marcus): Empty files can not be mapped
+        CloseMappedFile(MappedFile);
+        return false;
+    }
+    MappedFile->Size = (u64)Size.QuadPart;
+    
+    MappedFile->Mapping = CreateFileMappingA(MappedFile->File, nullptr, 
+                                             CopyOnWrite ? PAGE_WRITECOPY : PAGE_READONLY, 
+                                             0, 0, nullptr);
+    if (MappedFile->Mapping == nullptr)
+    {
+        CloseMappedFile(MappedFile);
+        return false;
+    }
+    
+    return true;
+}
+
+
+static u8 *MapFileRange(mapped_file *MappedFile, u64 Offset, u64 Size, b32 CopyOnWrite)
+{
+    return (u8 *)MapViewOfFile(MappedFile->Mapping, CopyOnWrite ? FILE_MAP_COPY : FILE_MAP_READ, 
+                               (DWORD)(Offset >> 32), (DWORD)(Offset & 0xFFFFFFFF), (SIZE_T)Size);
+}
+
+
+static void UnmapFileRange(u8 *Data, u64 Size)
+{
+    UnmapViewOfFile(Data);
+}
+
+
+// Offsets of mapped ranges must be a multiple of this
+static u64 GetMappingGranularity()
+{
+    SYSTEM_INFO SystemInfo;
+    GetSystemInfo(&SystemInfo);
+    return SystemInfo.dwAllocationGranularity;
+}
+
+#else
+
+static void CloseMappedFile(mapped_file *MappedFile)
+{
+    if (MappedFile->Data)
+    {
+        munmap(MappedFile->Data, MappedFile->Size);
+        MappedFile->Data = nullptr;
+    }
+    
+    if (MappedFile->File >= 0)
+    {
+        close(MappedFile->File);
+        MappedFile->File = -1;
+    }
+    
+    MappedFile->Size = 0;
+}
+
+
+static b32 OpenMappedFileHandles(char const *FileName, mapped_file *MappedFile, b32 CopyOnWrite)
+{
+    *MappedFile = {};
+    
+    MappedFile->File = open(FileName, O_RDONLY);
+    if (MappedFile->File < 0)
+    {
+        return false;
+    }
+    
+    struct stat Stat;
+    if (fstat(MappedFile->File, &Stat) != 0 || Stat.st_size == 0)
+    {
+        CloseMappedFile(MappedFile);
+        return false;
+    }
+    MappedFile->Size = (u64)Stat.st_size;
+    
+    return true;
+}
+
+
+static u8 *MapFileRange(mapped_file *MappedFile, u64 Offset, u64 Size, b32 CopyOnWrite)
+{
+    void *Data = mmap(nullptr, Size, CopyOnWrite ? PROT_READ | PROT_WRITE : PROT_READ, MAP_PRIVATE, 
+                      MappedFile->File, (off_t)Offset);
+    return Data == MAP_FAILED ? nullptr : (u8 *)Data;
+}
+
+
+static void UnmapFileRange(u8 *Data, u64 Size)
+{
+    munmap(Data, Size);
+}
+
+
+static u64 GetMappingGranularity()
+{
+    return (u64)sysconf(_SC_PAGESIZE);
+}
+
+#endif
+
+
+static b32 OpenMappedFile(char const *FileName, mapped_file *MappedFile, b32 CopyOnWrite = false)
+{
+    if (!OpenMappedFileHandles(FileName, MappedFile, CopyOnWrite))
+    {
+        return false;
+    }
+    
+    MappedFile->Data = MapFileRange(MappedFile, 0, MappedFile->Size, CopyOnWrite);
+    if (MappedFile->Data == nullptr)
+    {
+        CloseMappedFile(MappedFile);
+        return false;
+    }
+    
+    return true;
+}
+
+
+
+//
+// A read only window into a file, only the window is mapped and it is moved forward as the file is
+// read. The memory used is bounded by the size of the window and not by the size of the file.
+//
+struct mapped_window
+{
+    mapped_file File;       // Its Data and Size are unused, only the window is mapped
+    u64 FileSize;
+    u64 WindowSize;
+    
+    u8 *View;               // The mapped range, starts on the granularity
+    u64 ViewSize;
+    
+    u64 Offset;             // Of Data in the file
+    u8 *Data;
+    u64 Size;
+};
+
+
+static void CloseMappedWindow(mapped_window *Window)
+{
+    if (Window->View)
+    {
+        UnmapFileRange(Window->View, Window->ViewSize);
+        Window->View = nullptr;
+    }
+    
+    CloseMappedFile(&Window->File);
+    Window->Data = nullptr;
+    Window->Size = 0;
+}
+
+
+// Maps WindowSize bytes, or up to the end of the file, from Offset
+static b32 MoveMappedWindow(mapped_window *Window, u64 Offset)
+{
+    u64 Granularity = GetMappingGranularity();
+    u64 ViewOffset = Offset - Offset % Granularity;
+    u64 ViewSize = Window->FileSize - ViewOffset;
+    ViewSize = ViewSize < Window->WindowSize ? ViewSize : Window->WindowSize;
+    
+    if (Window->View)
+    {
+        UnmapFileRange(Window->View, Window->ViewSize);
+    }
+    
+    Window->View = MapFileRange(&Window->File, ViewOffset, ViewSize, false);
+    if (Window->View == nullptr)
+    {
+        Window->Data = nullptr;
+        Window->Size = 0;
+        return false;
+    }
+    
+#if !defined(_WIN32)
+    madvise(Window->View, ViewSize, MADV_SEQUENTIAL);
+#endif
+    
+    Window->ViewSize = ViewSize;
+    Window->Offset = Offset;
+    Window->Data = Window->View + (Offset - ViewOffset);
+    Window->Size = ViewSize - (Offset - ViewOffset);
+    
+    return true;
+}
+
+
+// A window of zero bytes maps the whole file
+static b32 OpenMappedWindow(char const *FileName, mapped_window *Window, u64 WindowSize)
+{
+    *Window = {};
+    
+    if (!OpenMappedFileHandles(FileName, &Window->File, false))
+    {
+        return false;
+    }
+    
+    // The window is at least two granules, so it always reaches past a window that starts a
+    // granule before the read position
+    u64 Granularity = GetMappingGranularity();
+    Window->FileSize = Window->File.Size;
+    Window->WindowSize = WindowSize > 0 ? WindowSize : Window->FileSize;
+    Window->WindowSize = Window->WindowSize > 2 * Granularity ? Window->WindowSize : 2 * Granularity;
+    Window->WindowSize += Granularity - 1;
+    Window->WindowSize -= Window->WindowSize % Granularity;
+    
+    if (!MoveMappedWindow(Window, 0))
+    {
+        CloseMappedWindow(Window);
+        return false;
+    }
+    
+    return true;
+}
+
+
+#endif
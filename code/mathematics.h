@@ -635,21 +635,6 @@ inline m4 M4RotationZ(f32 Angle)
 // 3 m n o p  3.0 3.1 3.2 3.3
 
 
-inline m4 operator * (m4& A, m4& B)
-{
-    m4 Result;
-    
-    for (int R = 0; R < 4; ++R) 
-    {
-        for (int C = 0; C < 4; ++C) 
-        {
-            Result.E[R][C] = Dot(Row(A, R), Col(B, C));
-        }
-    }
-    
-    return Result;
-}
-
 inline m4 operator * (m4 const& A, m4 const& B)
 {
     m4 Result;
@@ -678,17 +663,6 @@ inline m4 operator * (m4 const& A, m4 const& B)
 //   0 1 2 3
 // 0 a b c d  0.0 0.1 0.2 0.3  
 
-inline v4 operator * (v4& V, m4 const& M)
-{
-    v4 Result;
-    for (int Index = 0; Index < 4; ++Index) 
-    {
-        Result.E[Index] = Dot(Col(M, Index), V);
-    }
-    
-    return Result;
-}
-
 inline v4 operator * (v4 const& V, m4 const& M)
 {
     v4 Result;
@@ -841,6 +815,72 @@ inline m4 M4Inverse(m4 *M, b32 *Invertible = nullptr)
 }
 
 
+//
+// Inverse of an affine matrix, one with (0, 0, 0, 1) as the last column. The 3x3 part is
+// inverted with cross products and the translation is moved to the other side, which is far
+// cheaper than the cofactors of M4Inverse.
+//
+inline m4 M4AffineInverse(m4 const *M, b32 *Invertible = nullptr)
+{
+    m4 Result = m4_identity;
+    Invertible ? *Invertible = true : 0;
+    
+    v3 R0 = V3(M->E[0][0], M->E[0][1], M->E[0][2]);
+    v3 R1 = V3(M->E[1][0], M->E[1][1], M->E[1][2]);
+    v3 R2 = V3(M->E[2][0], M->E[2][1], M->E[2][2]);
+    v3 T  = V3(M->E[3][0], M->E[3][1], M->E[3][2]);
+    
+    v3 C0 = Cross(R1, R2);
+    v3 C1 = Cross(R2, R0);
+    v3 C2 = Cross(R0, R1);
+    f32 Determinant = Dot(R0, C0);
+    
+    if (AlmostEqualRelative(Determinant, 0.0f))
+    {
+        Invertible ? *Invertible = false : 0;
+        return Result;
+    }
+    
+    f32 InvertedDeterminant = 1.0f / Determinant;
+    C0 *= InvertedDeterminant;
+    C1 *= InvertedDeterminant;
+    C2 *= InvertedDeterminant;
+    
+    // The cross products are the columns of the inverted 3x3 part
+    Result =
+    {
+        C0.x, C1.x, C2.x, 0.0f,
+        C0.y, C1.y, C2.y, 0.0f,
+        C0.z, C1.z, C2.z, 0.0f,
+        -Dot(T, C0), -Dot(T, C1), -Dot(T, C2), 1.0f,
+    };
+    
+    return Result;
+}
+
+
+//
+// Inverse of a rotation followed by a translation, the transposed rotation followed by the
+// negated translation in the rotated basis.
+//
+inline m4 M4RigidInverse(m4 const *M)
+{
+    v3 X = V3(M->E[0][0], M->E[0][1], M->E[0][2]);
+    v3 Y = V3(M->E[1][0], M->E[1][1], M->E[1][2]);
+    v3 Z = V3(M->E[2][0], M->E[2][1], M->E[2][2]);
+    v3 T = V3(M->E[3][0], M->E[3][1], M->E[3][2]);
+    
+    m4 Result =
+    {
+        X.x, Y.x, Z.x, 0.0f,
+        X.y, Y.y, Z.y, 0.0f,
+        X.z, Y.z, Z.z, 0.0f,
+        -Dot(T, X), -Dot(T, Y), -Dot(T, Z), 1.0f,
+    };
+    
+    return Result;
+}
+
 inline m4 M4Perspective(f32 const Fovx, f32 const AspectRatio, f32 const Near, f32 const Far)
 {
     m4 Result = {};
@@ -869,19 +909,23 @@ inline m4 M4Perspective(f32 const Fovx, f32 const AspectRatio, f32 const Near, f
 #define assert(x)
 #endif
 
-inline m4 M4LookAt(v3 const CameraP, v3 const LookAtP) // TODO(Marcus): Sloooow!
+//
+// The view matrix, the inverse of the rotation to the camera basis followed by the translation
+// to the camera. The basis is orthonormal so the inverse is built directly, like M4RigidInverse.
+//
+inline m4 M4LookAt(v3 const CameraP, v3 const LookAtP)
 {
     v3 Z = Normalize(CameraP - LookAtP);
     v3 X = Normalize(Cross(V3(0.0f, 1.0f, 0.0f), Z));
     v3 Y = Cross(Z, X);
     
-    m4 Rotate = {V4(X, 0.0f), V4(Y, 0.0f), V4(Z, 0.0f), V4(0.0f, 0.0f, 0.0f, 1.0f)};
-    m4 Translate = M4Translate(CameraP);
-    m4 Result = Rotate * Translate; 
-    
-    b32 Invertible = false;
-    Result = M4Inverse(&Result, &Invertible);
-    assert(Invertible);
+    m4 Result =
+    {
+        X.x, Y.x, Z.x, 0.0f,
+        X.y, Y.y, Z.y, 0.0f,
+        X.z, Y.z, Z.z, 0.0f,
+        -Dot(CameraP, X), -Dot(CameraP, Y), -Dot(CameraP, Z), 1.0f,
+    };
     
     return Result;
 }
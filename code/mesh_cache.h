@@ -0,0 +1,361 @@
+// 
+// MIT License
+// 
+// Copyright (c) 2018 Marcus Larsson
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+
+
+#ifndef MeshCache__h
+#define MeshCache__h
+
+#include <stdio.h>
+#include <string.h>
+#include "ply_loader.h"
+#include "mesh_optimizer.h"
+#include "mapped_file.h"
+#include "hash.h"
+#include "profiler.h"
+
+
+
+//
+// Mesh cache
+//
+// header | positions | normals | texture coordinates | indices
+//
+// A mesh read with LoadPlyFile is written next to its file as <file>.cache, every array starts at a
+// 64 byte aligned offset and is laid out the way ply_state holds it, so it can be uploaded as it is.
+// The cache is keyed by a hash of the contents of the ply file seeded with the version, and with the
+// settings when the mesh is optimised before it is cached (see OptimizeMesh). A mesh without normals
+// gets them before it is cached (see GeneratePlyNormals). On a hit the cache is mapped and the
+// ply_state points into the mapping, nothing is parsed or copied.
+//
+// NOTE(Marcus): Bump kMeshCacheVersion when LoadPlyFile changes what it produces for a file, the
+//               old caches then miss and are written again.
+//
+u32 constexpr kMeshCacheMagicNumber = 0x4853454D; // MESH
+u32 constexpr kMeshCacheVersion = 4;
+u32 constexpr kMeshCacheAlignment = 64;
+u32 constexpr kMeshCacheFileNameLengthMax = 512;
+
+struct mesh_cache_header
+{
+    u32 MagicNumber;
+    u32 Version;
+    u64 SourceHash;
+    u64 SourceSize;
+    u32 SourceFormat;
+    
+    u32 VertexCount;
+    u32 FaceCount;
+    u32 IndexCount;
+    u32 IndexSize;
+    u32 NormalElementCount;
+    u32 TexCoordElementCount;
+    
+    // From OptimizeMesh, zero when the mesh is not optimised
+    u32 VertexCountBefore;
+    f32 AcmrBefore;
+    f32 AcmrAfter;
+    
+    // Zero when the array is missing
+    u64 PositionOffset;
+    u64 NormalOffset;
+    u64 TexCoordOffset;
+    u64 IndexOffset;
+    
+    u64 Size;               // Of the whole file
+};
+
+
+static u64 AlignMeshCacheOffset(u64 Offset)
+{
+    return (Offset + kMeshCacheAlignment - 1) & ~(u64)(kMeshCacheAlignment - 1);
+}
+
+
+// Room is left for the name of the temporary file the cache is written to
+static b32 GetMeshCacheFileName(char const *FileName, char *CacheFileName)
+{
+    int Length = snprintf(CacheFileName, kMeshCacheFileNameLengthMax, "%s.cache", FileName);
+    return Length > 0 && Length + 4 < (int)kMeshCacheFileNameLengthMax;
+}
+
+
+static b32 HashMeshSource(char const *FileName, mesh_optimize_settings const *Optimize, u64 *Hash, u64 *Size)
+{
+    PROFILE_SCOPE("HashMeshSource");
+    
+    mapped_file File;
+    if (!OpenMappedFile(FileName, &File))
+    {
+        return false;
+    }
+    
+    u64 Seed = kHashSeed ^ kMeshCacheVersion;
+    if (Optimize)
+    {
+        Seed = Hash64(&Optimize->WeldEpsilon, sizeof(Optimize->WeldEpsilon), Seed);
+    }
+    
+    *Hash = Hash64(File.Data, (size_t)File.Size, Seed);
+    *Size = File.Size;
+    
+    CloseMappedFile(&File);
+    return true;
+}
+
+
+static b32 IsMeshCacheArrayValid(mapped_file *File, u64 Offset, u64 Size)
+{
+    return Offset >= sizeof(mesh_cache_header) && Offset % kMeshCacheAlignment == 0 && Offset + Size <= File->Size;
+}
+
+
+// On a hit the state owns the mapping of the cache until Free
+static b32 ReadMeshCache(char const *CacheFileName, u64 SourceHash, u64 SourceSize, ply_state *State,
+                         mesh_optimize_report *Report)
+{
+    PROFILE_SCOPE("ReadMeshCache");
+    
+    mapped_file File;
+    if (!OpenMappedFile(CacheFileName, &File, true))
+    {
+        return false;
+    }
+    
+    mesh_cache_header *Header = (mesh_cache_header *)File.Data;
+    b32 Valid = (File.Size >= sizeof(mesh_cache_header) &&
+                 Header->MagicNumber == kMeshCacheMagicNumber &&
+                 Header->Version == kMeshCacheVersion &&
+                 Header->SourceHash == SourceHash &&
+                 Header->SourceSize == SourceSize &&
+                 Header->Size == File.Size &&
+                 Header->VertexCount > 0 &&
+                 (Header->NormalElementCount == 0 || Header->NormalElementCount == 3) &&
+                 (Header->TexCoordElementCount == 0 || Header->TexCoordElementCount == 2) &&
+                 (Header->IndexCount == 0 || Header->IndexSize == sizeof(u16) || Header->IndexSize == sizeof(u32)));
+    
+    if (Valid)
+    {
+        u64 VertexCount = Header->VertexCount;
+        Valid = (IsMeshCacheArrayValid(&File, Header->PositionOffset, VertexCount*sizeof(v3)) &&
+                 (!Header->NormalElementCount || IsMeshCacheArrayValid(&File, Header->NormalOffset, VertexCount*sizeof(v3))) &&
+                 (!Header->TexCoordElementCount || IsMeshCacheArrayValid(&File, Header->TexCoordOffset, VertexCount*sizeof(v2))) &&
+                 (!Header->IndexCount || IsMeshCacheArrayValid(&File, Header->IndexOffset, (u64)Header->IndexCount*Header->IndexSize)));
+    }
+    
+    if (!Valid)
+    {
+        CloseMappedFile(&File);
+        return false;
+    }
+    
+    *State = {};
+    State->Positions = (v3 *)(File.Data + Header->PositionOffset);
+    State->PositionElementCount = 3;
+    State->VertexCount = Header->VertexCount;
+    State->VertexSize = sizeof(v3);
+    State->FaceCount = Header->FaceCount;
+    
+    if (Header->NormalElementCount)
+    {
+        State->Normals = (v3 *)(File.Data + Header->NormalOffset);
+        State->NormalElementCount = 3;
+        State->VertexSize += sizeof(v3);
+    }
+    
+    if (Header->TexCoordElementCount)
+    {
+        State->TexCoords = (v2 *)(File.Data + Header->TexCoordOffset);
+        State->TexCoordElementCount = 2;
+        State->VertexSize += sizeof(v2);
+    }
+    
+    if (Header->IndexCount)
+    {
+        State->Indices = File.Data + Header->IndexOffset;
+        State->IndexCount = Header->IndexCount;
+        State->IndexSize = Header->IndexSize;
+    }
+    
+    State->FinishedWithHeader = true;
+    State->Format = (ply_format)Header->SourceFormat;
+    State->File = File;
+    State->Cached = true;
+    
+    if (Report)
+    {
+        Report->VertexCountBefore = Header->VertexCountBefore;
+        Report->VertexCountAfter = Header->VertexCount;
+        Report->TriangleCount = Header->IndexCount / 3;
+        Report->AcmrBefore = Header->AcmrBefore;
+        Report->AcmrAfter = Header->AcmrAfter;
+    }
+    
+    return true;
+}
+
+
+// NOTE(Marcus): The cache is written to a temporary file that is then moved over the old one, so a
+//               crash or another process never sees half a cache
+static b32 WriteMeshCache(char const *CacheFileName, ply_state *State, u64 SourceHash, u64 SourceSize,
+                          mesh_optimize_report *Report)
+{
+    PROFILE_SCOPE("WriteMeshCache");
+    
+    mesh_cache_header Header = {};
+    Header.MagicNumber = kMeshCacheMagicNumber;
+    Header.Version = kMeshCacheVersion;
+    Header.SourceHash = SourceHash;
+    Header.SourceSize = SourceSize;
+    Header.SourceFormat = State->Format;
+    Header.VertexCount = State->VertexCount;
+    Header.FaceCount = State->FaceCount;
+    Header.IndexCount = State->IndexCount;
+    Header.IndexSize = State->IndexSize;
+    Header.NormalElementCount = State->Normals ? 3 : 0;
+    Header.TexCoordElementCount = State->TexCoords ? 2 : 0;
+    
+    if (Report)
+    {
+        Header.VertexCountBefore = Report->VertexCountBefore;
+        Header.AcmrBefore = Report->AcmrBefore;
+        Header.AcmrAfter = Report->AcmrAfter;
+    }
+    
+    struct
+    {
+        void const *Data;
+        u64 Size;
+        u64 *Offset;
+    } Arrays[] =
+    {
+        { State->Positions, (u64)State->VertexCount*sizeof(v3), &Header.PositionOffset },
+        { State->Normals, (u64)State->VertexCount*sizeof(v3), &Header.NormalOffset },
+        { State->TexCoords, (u64)State->VertexCount*sizeof(v2), &Header.TexCoordOffset },
+        { State->Indices, (u64)State->IndexCount*State->IndexSize, &Header.IndexOffset },
+    };
+    u32 const ArrayCount = sizeof(Arrays) / sizeof(Arrays[0]);
+    
+    u64 Offset = AlignMeshCacheOffset(sizeof(mesh_cache_header));
+    for (u32 Index = 0; Index < ArrayCount; ++Index)
+    {
+        if (Arrays[Index].Data && Arrays[Index].Size > 0)
+        {
+            *Arrays[Index].Offset = Offset;
+            Offset = AlignMeshCacheOffset(Offset + Arrays[Index].Size);
+        }
+    }
+    Header.Size = Offset;
+    
+    
+    //
+    // Write
+    char TempFileName[kMeshCacheFileNameLengthMax];
+    snprintf(TempFileName, sizeof(TempFileName), "%s.tmp", CacheFileName);
+    
+    FILE *File;
+    if (fopen_s(&File, TempFileName, "wb") != 0)
+    {
+        return false;
+    }
+    
+    u8 Padding[kMeshCacheAlignment] = {};
+    b32 Result = fwrite(&Header, sizeof(Header), 1, File) == 1;
+    u64 Written = sizeof(Header);
+    
+    for (u32 Index = 0; Result && Index < ArrayCount; ++Index)
+    {
+        if (*Arrays[Index].Offset)
+        {
+            size_t PaddingSize = (size_t)(*Arrays[Index].Offset - Written);
+            Result = fwrite(Padding, 1, PaddingSize, File) == PaddingSize;
+            Result = Result && fwrite(Arrays[Index].Data, 1, (size_t)Arrays[Index].Size, File) == Arrays[Index].Size;
+            Written = *Arrays[Index].Offset + Arrays[Index].Size;
+        }
+    }
+    
+    size_t PaddingSize = (size_t)(Header.Size - Written);
+    Result = Result && fwrite(Padding, 1, PaddingSize, File) == PaddingSize;
+    Result = (fclose(File) == 0) && Result;
+    
+#if defined(_WIN32)
+    Result = Result && MoveFileExA(TempFileName, CacheFileName, MOVEFILE_REPLACE_EXISTING);
+#else
+    Result = Result && rename(TempFileName, CacheFileName) == 0;
+#endif
+    
+    if (!Result)
+    {
+        remove(TempFileName);
+    }
+    
+    return Result;
+}
+
+
+//
+// Main
+//
+// Loads the mesh from the cache of the file when it is up to date, and otherwise with LoadPlyFile,
+// optimises it when there are settings, generates normals when it has none, and writes the cache for
+// the next time. A cache that cannot be read or written is never an error, only the ply file itself
+// can fail to load. The report is only filled in for an optimised mesh, from the cache on a hit.
+static b32 LoadCachedPlyFile(char const *FileName, ply_state *State, u32 ThreadCount = 1,
+                             mesh_optimize_settings const *Optimize = nullptr, mesh_optimize_report *Report = nullptr)
+{
+    PROFILE_SCOPE("LoadCachedPlyFile");
+    
+    char CacheFileName[kMeshCacheFileNameLengthMax];
+    u64 SourceHash;
+    u64 SourceSize;
+    mesh_optimize_report LocalReport = {};
+    Report = Optimize ? (Report ? Report : &LocalReport) : nullptr;
+    
+    b32 Cacheable = GetMeshCacheFileName(FileName, CacheFileName) && HashMeshSource(FileName, Optimize, &SourceHash, &SourceSize);
+    if (Cacheable && ReadMeshCache(CacheFileName, SourceHash, SourceSize, State, Report))
+    {
+        return true;
+    }
+    
+    if (!LoadPlyFile(FileName, State, ThreadCount))
+    {
+        return false;
+    }
+    
+    // NOTE(Marcus): A mesh that cannot be optimised is cached as it is, the report is all zero
+    if (Optimize && !OptimizeMesh(State, Optimize, ThreadCount, Report))
+    {
+        *Report = {};
+    }
+    GeneratePlyNormals(State, NormalWeighting_Area, ThreadCount);
+    
+    if (Cacheable)
+    {
+        WriteMeshCache(CacheFileName, State, SourceHash, SourceSize, Report);
+    }
+    return true;
+}
+
+
+#endif
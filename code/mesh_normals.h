@@ -0,0 +1,476 @@
+// 
+// MIT License
+// 
+// Copyright (c) 2018 Marcus Larsson
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+#ifndef MeshNormals__h
+#define MeshNormals__h
+
+#define UNICODE
+#define STRICT
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <xmmintrin.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "types.h"
+#include "mathematics.h"
+#include "parallel.h"
+#include "profiler.h"
+
+
+
+//
+// Vertex normals
+//
+// The normal of a vertex is the normalised sum of the normals of the triangles around it, weighted
+// by the area of each triangle or by its angle at the vertex. It takes two passes and neither of
+// them writes to memory another work item writes to:
+// - the weighted normal of every triangle, or of every corner with angle weights, in parallel over
+//   the triangles
+// - every vertex sums the weighted normals of its corners, found through the vertex to corner
+//   adjacency in compressed sparse rows, in parallel over the vertices
+//
+// The adjacency only depends on the indices. InitMeshNormals() builds it once and
+// UpdateMeshNormals() runs the two passes, so the normals of a mesh that deforms, like a terrain
+// that is edited, can be updated every frame. The threads are a pool that lives from
+// InitMeshNormals() to FreeMeshNormals(), an update does not create any. ComputeVertexNormals()
+// does all of it once.
+//
+// NOTE(Marcus): The corners of a vertex are always summed in the same order, so the normals are the
+//               same for any thread count. Vertices without triangles, or where the triangles
+//               cancel out, get a zero normal.
+//
+// A height field, Width * Height vertices row by row, has no adjacency to build. InitGridNormals()
+// sets up the grid weighting, where a vertex sums the fan of triangles it forms with its eight
+// neighbours, and UpdateMeshNormals() then runs a single pass over ranges of rows.
+//
+u32 constexpr kNormalRangeSize = 1 << 16; // Triangles or vertices per parallel work item
+u32 constexpr kNormalSortSizeMax = 32;    // Corners sorted with an insertion sort, qsort above it
+u32 constexpr kNormalGridRowsPerWork = 64;
+
+enum normal_weighting
+{
+    NormalWeighting_Area,
+    NormalWeighting_Angle,
+    NormalWeighting_Grid,  // Height field, see InitGridNormals()
+};
+
+struct mesh_normals
+{
+    normal_weighting Weighting;
+    u32 VertexCount;
+    u32 TriangleCount;
+    
+    // The rows and columns of a height field
+    u32 GridWidth;
+    u32 GridHeight;
+    
+    // Not owned, they must stay the same until FreeMeshNormals()
+    void const *Indices;
+    u32 IndexSize;
+    
+    // The corners of vertex V are Corners[Offsets[V], Offsets[V + 1]), corner C is corner C % 3 of
+    // triangle C / 3
+    u32 *Offsets;
+    u32 *Corners;
+    LONG volatile *Counts;  // While the adjacency is built
+    
+    // Weighted normal of every triangle, or of every corner with angle weights
+    __m128 *Weighted;
+    
+    parallel_pool *Pool;    // When there is more than one thread
+    
+    // During an update
+    v3 const *Positions;
+    v3 *Normals;
+};
+
+
+inline u32 GetMeshIndex(void const *Indices, u32 IndexSize, u32 Index)
+{
+    return IndexSize == sizeof(u16) ? ((u16 const *)Indices)[Index] : ((u32 const *)Indices)[Index];
+}
+
+
+
+//
+// Adjacency
+static void CountCorners(void *Data, u32 Range)
+{
+    mesh_normals *MeshNormals = (mesh_normals *)Data;
+    
+    u32 End = GetRangeEnd(Range, kNormalRangeSize, 3*MeshNormals->TriangleCount);
+    for (u32 Corner = Range*kNormalRangeSize; Corner < End; ++Corner)
+    {
+        u32 Vertex = GetMeshIndex(MeshNormals->Indices, MeshNormals->IndexSize, Corner);
+        InterlockedIncrement(&MeshNormals->Counts[Vertex]);
+    }
+}
+
+
+static void FillCorners(void *Data, u32 Range)
+{
+    mesh_normals *MeshNormals = (mesh_normals *)Data;
+    
+    u32 End = GetRangeEnd(Range, kNormalRangeSize, 3*MeshNormals->TriangleCount);
+    for (u32 Corner = Range*kNormalRangeSize; Corner < End; ++Corner)
+    {
+        u32 Vertex = GetMeshIndex(MeshNormals->Indices, MeshNormals->IndexSize, Corner);
+        u32 Slot = MeshNormals->Offsets[Vertex] + (u32)InterlockedIncrement(&MeshNormals->Counts[Vertex]) - 1;
+        MeshNormals->Corners[Slot] = Corner;
+    }
+}
+
+
+static int CompareCorners(void const *A, void const *B)
+{
+    u32 a = *(u32 const *)A;
+    u32 b = *(u32 const *)B;
+    return (a > b) - (a < b);
+}
+
+
+// The fill hands out the slots of a vertex in any order, sorted they are summed the same way every time
+static void SortCorners(void *Data, u32 Range)
+{
+    mesh_normals *MeshNormals = (mesh_normals *)Data;
+    
+    u32 End = GetRangeEnd(Range, kNormalRangeSize, MeshNormals->VertexCount);
+    for (u32 Vertex = Range*kNormalRangeSize; Vertex < End; ++Vertex)
+    {
+        u32 *Corners = &MeshNormals->Corners[MeshNormals->Offsets[Vertex]];
+        u32 Count = MeshNormals->Offsets[Vertex + 1] - MeshNormals->Offsets[Vertex];
+        if (Count > kNormalSortSizeMax)
+        {
+            qsort(Corners, Count, sizeof(u32), CompareCorners);
+            continue;
+        }
+        
+        for (u32 Index = 1; Index < Count; ++Index)
+        {
+            u32 Corner = Corners[Index];
+            u32 Slot = Index;
+            for (; Slot > 0 && Corners[Slot - 1] > Corner; --Slot)
+            {
+                Corners[Slot] = Corners[Slot - 1];
+            }
+            Corners[Slot] = Corner;
+        }
+    }
+}
+
+
+
+//
+// Normals
+static f32 GetCornerAngle(v3 A, v3 B)
+{
+    f32 Lengths = Length(A)*Length(B);
+    if (Lengths <= 0.0f)
+    {
+        return 0.0f;
+    }
+    
+    f32 Cosine = Dot(A, B) / Lengths;
+    return ArcCos(Max(-1.0f, Min(1.0f, Cosine)));
+}
+
+
+static void WeighTriangles(void *Data, u32 Range)
+{
+    mesh_normals *MeshNormals = (mesh_normals *)Data;
+    v3 const *Positions = MeshNormals->Positions;
+    __m128 *Weighted = MeshNormals->Weighted;
+    
+    u32 End = GetRangeEnd(Range, kNormalRangeSize, MeshNormals->TriangleCount);
+    for (u32 Triangle = Range*kNormalRangeSize; Triangle < End; ++Triangle)
+    {
+        v3 A = Positions[GetMeshIndex(MeshNormals->Indices, MeshNormals->IndexSize, 3*Triangle + 0)];
+        v3 B = Positions[GetMeshIndex(MeshNormals->Indices, MeshNormals->IndexSize, 3*Triangle + 1)];
+        v3 C = Positions[GetMeshIndex(MeshNormals->Indices, MeshNormals->IndexSize, 3*Triangle + 2)];
+        
+        // NOTE(Marcus): The length of the cross product is twice the area of the triangle
+        v3 N = Cross(B - A, C - A);
+        if (MeshNormals->Weighting == NormalWeighting_Area)
+        {
+            Weighted[Triangle] = _mm_setr_ps(N.x, N.y, N.z, 0.0f);
+            continue;
+        }
+        
+        f32 Area = Length(N);
+        v3 Unit = Area > 0.0f ? N * (1.0f / Area) : v3_zero;
+        v3 Angles = V3(GetCornerAngle(B - A, C - A), GetCornerAngle(C - B, A - B), GetCornerAngle(A - C, B - C));
+        Weighted[3*Triangle + 0] = _mm_setr_ps(Angles.x*Unit.x, Angles.x*Unit.y, Angles.x*Unit.z, 0.0f);
+        Weighted[3*Triangle + 1] = _mm_setr_ps(Angles.y*Unit.x, Angles.y*Unit.y, Angles.y*Unit.z, 0.0f);
+        Weighted[3*Triangle + 2] = _mm_setr_ps(Angles.z*Unit.x, Angles.z*Unit.y, Angles.z*Unit.z, 0.0f);
+    }
+}
+
+
+static void GatherNormals(void *Data, u32 Range)
+{
+    mesh_normals *MeshNormals = (mesh_normals *)Data;
+    u32 const *Offsets = MeshNormals->Offsets;
+    u32 const *Corners = MeshNormals->Corners;
+    __m128 const *Weighted = MeshNormals->Weighted;
+    b32 PerCorner = MeshNormals->Weighting == NormalWeighting_Angle;
+    
+    u32 End = GetRangeEnd(Range, kNormalRangeSize, MeshNormals->VertexCount);
+    for (u32 Vertex = Range*kNormalRangeSize; Vertex < End; ++Vertex)
+    {
+        __m128 Sum = _mm_setzero_ps();
+        for (u32 Slot = Offsets[Vertex]; Slot < Offsets[Vertex + 1]; ++Slot)
+        {
+            u32 Corner = Corners[Slot];
+            Sum = _mm_add_ps(Sum, Weighted[PerCorner ? Corner : Corner / 3]);
+        }
+        
+        f32 E[4];
+        _mm_storeu_ps(E, Sum);
+        v3 N = V3(E[0], E[1], E[2]);
+        f32 LengthSquared = LengthSq(N);
+        MeshNormals->Normals[Vertex] = LengthSquared > 0.0f ? N * (1.0f / SquareRoot(LengthSquared)) : v3_zero;
+    }
+}
+
+
+
+// NOTE(Marcus): The neighbours are taken in the order left, right, up, down and then the diagonals,
+//               and each is crossed with the one before it. This is the normal the terrain has
+//               always had, kept bit for bit.
+static void GatherGridNormals(void *Data, u32 Range)
+{
+    mesh_normals *MeshNormals = (mesh_normals *)Data;
+    v3 const *Vertices = MeshNormals->Positions;
+    v3 *Normals = MeshNormals->Normals;
+    
+    u32 const w = MeshNormals->GridWidth;
+    u32 const h = MeshNormals->GridHeight;
+    
+    u32 const ZEnd = GetRangeEnd(Range, kNormalGridRowsPerWork, h);
+    for (u32 z = Range * kNormalGridRowsPerWork; z < ZEnd; ++z)
+    {
+        u32 Index = w * z;
+        for (u32 x = 0; x < w; ++x)
+        {
+            v3  V[8] = {};
+            b32 B[8] = {};
+            v3 Vo = Vertices[Index];
+            
+            if (x > 0) // Left
+            {
+                V[0] = Vertices[(w * z) + x - 1];
+                B[0] = true;
+            }
+            if (x < w - 1) // Right
+            {
+                V[1] = Vertices[(w * z) + x + 1];
+                B[1] = true;
+            }
+            if (z > 0) // Up
+            {
+                V[2] = Vertices[(w * (z - 1)) + x];
+                B[2] = true;
+            }
+            if (z < h - 1) // Down
+            {
+                V[3] = Vertices[(w * (z + 1)) + x];
+                B[3] = true;
+            }
+            if (B[2] && B[0]) // Up left
+            {
+                V[4] = Vertices[(w * (z - 1)) + x - 1];
+                B[4] = true;
+            }
+            if (B[2] && B[1]) // Up right
+            {
+                V[5] = Vertices[(w * (z - 1)) + x + 1];
+                B[5] = true;
+            }
+            if (B[3] && B[1]) // Down right
+            {
+                V[6] = Vertices[(w * (z + 1)) + x + 1];
+                B[6] = true;
+            }
+            if (B[3] && B[0]) // Down left
+            {
+                V[7] = Vertices[(w * (z + 1)) + x - 1];
+                B[7] = true;
+            }
+            
+            v3 N = v3_zero;
+            for (u32 i = 0; i < 8; ++i)
+            {
+                if (B[i])
+                {
+                    v3 Va = V[i];
+                    v3 Vb = V[(i - 1) % 8];
+                    N += Cross(Va - Vo, Vb - Vo);
+                }
+            }
+            Normals[Index++] = Normalize(N);
+        }
+    }
+}
+
+
+
+static void RunNormalPass(mesh_normals *MeshNormals, u32 Count, parallel_work *Work)
+{
+    if (MeshNormals->Pool)
+    {
+        RunParallelPool(MeshNormals->Pool, Count, Work, MeshNormals);
+    }
+    else
+    {
+        for (u32 Index = 0; Index < Count; ++Index)
+        {
+            Work(MeshNormals, Index);
+        }
+    }
+}
+
+
+
+//
+// API
+static void FreeMeshNormals(mesh_normals *MeshNormals)
+{
+    free(MeshNormals->Offsets);
+    free(MeshNormals->Corners);
+    free((void *)MeshNormals->Counts);
+    _mm_free(MeshNormals->Weighted);
+    StopParallelPool(MeshNormals->Pool);
+    *MeshNormals = {};
+}
+
+
+// The indices are three per triangle, IndexSize bytes each, and must all be less than VertexCount.
+// ThreadCount is the size of the pool used here and by every UpdateMeshNormals().
+static b32 InitMeshNormals(mesh_normals *MeshNormals, void const *Indices, u32 IndexSize, u32 IndexCount, 
+                           u32 VertexCount, normal_weighting Weighting, u32 ThreadCount = 1)
+{
+    PROFILE_SCOPE("InitMeshNormals");
+    
+    *MeshNormals = {};
+    MeshNormals->Weighting = Weighting;
+    MeshNormals->VertexCount = VertexCount;
+    MeshNormals->TriangleCount = IndexCount / 3;
+    MeshNormals->Indices = Indices;
+    MeshNormals->IndexSize = IndexSize;
+    
+    u32 CornerCount = 3*MeshNormals->TriangleCount;
+    u32 WeightedCount = Weighting == NormalWeighting_Angle ? CornerCount : MeshNormals->TriangleCount;
+    MeshNormals->Offsets = (u32 *)malloc(((size_t)VertexCount + 1)*sizeof(u32));
+    MeshNormals->Corners = (u32 *)malloc(((size_t)CornerCount + 1)*sizeof(u32));
+    MeshNormals->Counts = (LONG volatile *)calloc((size_t)VertexCount + 1, sizeof(LONG));
+    MeshNormals->Weighted = (__m128 *)_mm_malloc(((size_t)WeightedCount + 1)*sizeof(__m128), 16);
+    MeshNormals->Pool = ThreadCount > 1 ? StartParallelPool(ThreadCount) : nullptr;
+    if (!MeshNormals->Offsets || !MeshNormals->Corners || !MeshNormals->Counts || !MeshNormals->Weighted || 
+        (ThreadCount > 1 && !MeshNormals->Pool))
+    {
+        FreeMeshNormals(MeshNormals);
+        return false;
+    }
+    
+    RunNormalPass(MeshNormals, GetRangeCount(CornerCount, kNormalRangeSize), CountCorners);
+    
+    u32 Offset = 0;
+    for (u32 Vertex = 0; Vertex < VertexCount; ++Vertex)
+    {
+        MeshNormals->Offsets[Vertex] = Offset;
+        Offset += (u32)MeshNormals->Counts[Vertex];
+        MeshNormals->Counts[Vertex] = 0;
+    }
+    MeshNormals->Offsets[VertexCount] = Offset;
+    
+    RunNormalPass(MeshNormals, GetRangeCount(CornerCount, kNormalRangeSize), FillCorners);
+    RunNormalPass(MeshNormals, GetRangeCount(VertexCount, kNormalRangeSize), SortCorners);
+    
+    free((void *)MeshNormals->Counts);
+    MeshNormals->Counts = nullptr;
+    
+    return true;
+}
+
+
+// A height field of Width * Height vertices, row by row, with the grid weighting
+static b32 InitGridNormals(mesh_normals *MeshNormals, u32 Width, u32 Height, u32 ThreadCount = 1)
+{
+    *MeshNormals = {};
+    MeshNormals->Weighting = NormalWeighting_Grid;
+    MeshNormals->VertexCount = Width * Height;
+    MeshNormals->GridWidth = Width;
+    MeshNormals->GridHeight = Height;
+    
+    MeshNormals->Pool = ThreadCount > 1 ? StartParallelPool(ThreadCount) : nullptr;
+    if (ThreadCount > 1 && !MeshNormals->Pool)
+    {
+        FreeMeshNormals(MeshNormals);
+        return false;
+    }
+    
+    return true;
+}
+
+
+// Normals may be the same array every update, it is completely overwritten
+static void UpdateMeshNormals(mesh_normals *MeshNormals, v3 const *Positions, v3 *Normals)
+{
+    PROFILE_SCOPE("UpdateMeshNormals");
+    
+    MeshNormals->Positions = Positions;
+    MeshNormals->Normals = Normals;
+    
+    if (MeshNormals->Weighting == NormalWeighting_Grid)
+    {
+        RunNormalPass(MeshNormals, GetRangeCount(MeshNormals->GridHeight, kNormalGridRowsPerWork), GatherGridNormals);
+    }
+    else
+    {
+        RunNormalPass(MeshNormals, GetRangeCount(MeshNormals->TriangleCount, kNormalRangeSize), WeighTriangles);
+        RunNormalPass(MeshNormals, GetRangeCount(MeshNormals->VertexCount, kNormalRangeSize), GatherNormals);
+    }
+    
+    MeshNormals->Positions = nullptr;
+    MeshNormals->Normals = nullptr;
+}
+
+
+static b32 ComputeVertexNormals(v3 const *Positions, u32 VertexCount, void const *Indices, u32 IndexSize, 
+                                u32 IndexCount, v3 *Normals, normal_weighting Weighting, u32 ThreadCount = 1)
+{
+    mesh_normals MeshNormals;
+    if (!InitMeshNormals(&MeshNormals, Indices, IndexSize, IndexCount, VertexCount, Weighting, ThreadCount))
+    {
+        return false;
+    }
+    
+    UpdateMeshNormals(&MeshNormals, Positions, Normals);
+    FreeMeshNormals(&MeshNormals);
+    return true;
+}
+
+
+#endif
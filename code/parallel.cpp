@@ -0,0 +1,220 @@
+// 
+// MIT License
+// 
+// Copyright (c) 2018 Marcus Larsson
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+#include "parallel.h"
+#include "profiler.h"
+
+#define UNICODE
+#define STRICT
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <process.h>
+#include <stdlib.h>
+
+
+
+struct parallel_job
+{
+    parallel_work *Work;
+    void *Data;
+    u32 Count;
+    LONG volatile NextIndex;
+};
+
+
+static void RunParallelJob(parallel_job *Job)
+{
+    for (;;)
+    {
+        u32 Index = (u32)(InterlockedIncrement(&Job->NextIndex) - 1);
+        if (Index >= Job->Count)
+        {
+            return;
+        }
+        Job->Work(Job->Data, Index);
+    }
+}
+
+
+unsigned int __stdcall ParallelWorker(void *Data)
+{
+    RunParallelJob((parallel_job *)Data);
+    
+    // The work may have registered the thread with the profiler
+    ProfileUnregisterThread();
+    return 0;
+}
+
+
+void ParallelFor(u32 Count, u32 ThreadCount, parallel_work *Work, void *Data)
+{
+    parallel_job Job;
+    Job.Work = Work;
+    Job.Data = Data;
+    Job.Count = Count;
+    Job.NextIndex = 0;
+    
+    ThreadCount = ThreadCount < Count ? ThreadCount : Count;
+    ThreadCount = ThreadCount < kParallelThreadCountMax ? ThreadCount : kParallelThreadCountMax;
+    
+    // The calling thread is one of the workers
+    HANDLE Threads[kParallelThreadCountMax];
+    u32 StartedCount = 0;
+    for (u32 Index = 1; Index < ThreadCount; ++Index)
+    {
+        unsigned int ThreadID;
+        HANDLE Thread = (HANDLE)_beginthreadex(0, 0, (_beginthreadex_proc_type)&ParallelWorker, 
+                                               (void *)&Job, 0, &ThreadID);
+        if (Thread)
+        {
+            Threads[StartedCount++] = Thread;
+        }
+    }
+    
+    RunParallelJob(&Job);
+    
+    for (u32 Index = 0; Index < StartedCount; ++Index)
+    {
+        WaitForSingleObject(Threads[Index], INFINITE);
+        CloseHandle(Threads[Index]);
+    }
+}
+
+
+//
+// Pool
+struct parallel_pool
+{
+    u32 WorkerCount; // The calling thread is not one of them
+    HANDLE Threads[kParallelThreadCountMax];
+    
+    HANDLE Start;    // Released once for every thread that takes part in a job
+    HANDLE Finished; // Released by every thread when the job is done
+    b32 volatile Quit;
+    
+    parallel_job Job;
+};
+
+
+unsigned int __stdcall ParallelPoolWorker(void *Data)
+{
+    parallel_pool *Pool = (parallel_pool *)Data;
+    
+    for (;;)
+    {
+        WaitForSingleObject(Pool->Start, INFINITE);
+        if (Pool->Quit)
+        {
+            ProfileUnregisterThread();
+            return 0;
+        }
+        
+        RunParallelJob(&Pool->Job);
+        ReleaseSemaphore(Pool->Finished, 1, nullptr);
+    }
+}
+
+
+parallel_pool *StartParallelPool(u32 ThreadCount)
+{
+    parallel_pool *Pool = (parallel_pool *)calloc(1, sizeof(parallel_pool));
+    if (!Pool)
+    {
+        return nullptr;
+    }
+    
+    ThreadCount = ThreadCount > 0 ? ThreadCount : 1;
+    ThreadCount = ThreadCount < kParallelThreadCountMax ? ThreadCount : kParallelThreadCountMax;
+    
+    Pool->Start = CreateSemaphoreA(nullptr, 0, kParallelThreadCountMax, nullptr);
+    Pool->Finished = CreateSemaphoreA(nullptr, 0, kParallelThreadCountMax, nullptr);
+    for (u32 Index = 1; Index < ThreadCount; ++Index)
+    {
+        unsigned int ThreadID;
+        HANDLE Thread = (HANDLE)_beginthreadex(0, 0, (_beginthreadex_proc_type)&ParallelPoolWorker, 
+                                               (void *)Pool, 0, &ThreadID);
+        if (Thread)
+        {
+            Pool->Threads[Pool->WorkerCount++] = Thread;
+        }
+    }
+    
+    return Pool;
+}
+
+
+void RunParallelPool(parallel_pool *Pool, u32 Count, parallel_work *Work, void *Data)
+{
+    Pool->Job.Work = Work;
+    Pool->Job.Data = Data;
+    Pool->Job.Count = Count;
+    Pool->Job.NextIndex = 0;
+    
+    // NOTE(Marcus): Small jobs run on the calling thread alone, waking the pool costs more
+    u32 WakeCount = Pool->WorkerCount;
+    WakeCount = WakeCount < Count ? WakeCount : (Count > 0 ? Count - 1 : 0);
+    if (WakeCount > 0)
+    {
+        ReleaseSemaphore(Pool->Start, (LONG)WakeCount, nullptr);
+    }
+    
+    RunParallelJob(&Pool->Job);
+    
+    for (u32 Index = 0; Index < WakeCount; ++Index)
+    {
+        WaitForSingleObject(Pool->Finished, INFINITE);
+    }
+}
+
+
+void StopParallelPool(parallel_pool *Pool)
+{
+    if (!Pool)
+    {
+        return;
+    }
+    
+    Pool->Quit = true;
+    if (Pool->WorkerCount > 0)
+    {
+        ReleaseSemaphore(Pool->Start, (LONG)Pool->WorkerCount, nullptr);
+    }
+    for (u32 Index = 0; Index < Pool->WorkerCount; ++Index)
+    {
+        WaitForSingleObject(Pool->Threads[Index], INFINITE);
+        CloseHandle(Pool->Threads[Index]);
+    }
+    
+    CloseHandle(Pool->Start);
+    CloseHandle(Pool->Finished);
+    free(Pool);
+}
+
+
+u32 GetProcessorCount()
+{
+    SYSTEM_INFO SystemInfo;
+    GetSystemInfo(&SystemInfo);
+    return SystemInfo.dwNumberOfProcessors > 0 ? (u32)SystemInfo.dwNumberOfProcessors : 1;
+}
@@ -0,0 +1,72 @@
+// 
+// MIT License
+// 
+// Copyright (c) 2018 Marcus Larsson
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+#ifndef Parallel__h
+#define Parallel__h
+
+#include "types.h"
+
+
+
+//
+// Runs Work(Data, Index) for every Index in [0, Count) on ThreadCount threads, the calling thread
+// included, and returns when all of them are done. The indices are handed out one at a time, so
+// uneven work items balance out. Meant for one-off jobs like loading, the threads are created and
+// joined on every call.
+//
+typedef void parallel_work(void *Data, u32 Index);
+
+u32 constexpr kParallelThreadCountMax = 64;
+
+void ParallelFor(u32 Count, u32 ThreadCount, parallel_work *Work, void *Data);
+
+//
+// Threads that stay alive between jobs, for work that runs every frame where creating threads in
+// every ParallelFor() would cost more than the work. RunParallelPool() has the same contract as
+// ParallelFor() with the threads of the pool and the calling thread. One job at a time, started
+// from one thread.
+//
+struct parallel_pool;
+
+parallel_pool *StartParallelPool(u32 ThreadCount);
+void RunParallelPool(parallel_pool *Pool, u32 Count, parallel_work *Work, void *Data);
+void StopParallelPool(parallel_pool *Pool);
+
+// Logical processors of the machine
+u32 GetProcessorCount();
+
+// Work items of RangeSize elements each, the last one may be shorter
+inline u32 GetRangeCount(u32 Count, u32 RangeSize)
+{
+    return (u32)(((u64)Count + RangeSize - 1) / RangeSize);
+}
+
+inline u32 GetRangeEnd(u32 Index, u32 RangeSize, u32 Count)
+{
+    u64 End = ((u64)Index + 1)*RangeSize;
+    return End < Count ? (u32)End : Count;
+}
+
+
+#endif
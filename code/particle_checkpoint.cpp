@@ -0,0 +1,305 @@
+// 
+// MIT License
+// 
+// Copyright (c) 2018 Marcus Larsson
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+#include "particle_system.h"
+#include "profiler.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if 0
+#include <stdio.h>
+#else
+#define printf(...)
+#endif
+
+
+
+//
+// Checkpoint file
+//
+// The header is followed by the attribute arrays, each starting at a 64 byte aligned offset. When a
+// checkpoint is loaded the file is mapped copy-on-write and the particle system uses the arrays in
+// the mapping directly, so nothing is copied and only the pages that are touched are read.
+//
+// A particle system that uses a mapping gets its arrays copied out and the mapping closed before a
+// save, Windows can not truncate a file that is mapped so saving over the loaded checkpoint would
+// fail otherwise.
+//
+// NOTE(Marcus): There is no random state to save, the emission direction of a particle only depends
+//               on its index and the thread ranges.
+//
+u32 constexpr kCheckpointMagicNumber = 0x4B484350; // PCHK
+u32 constexpr kCheckpointVersion = 3;
+u32 constexpr kCheckpointAlignment = 64;
+
+struct checkpoint_header
+{
+    u32 MagicNumber;
+    u32 Version;
+    u32 CompactLayout;
+    u32 ParticleCount;
+    u32 FrameIndex;
+    
+    u32 AttributeCount;
+    u32 AttributeElementSizes[kParticleAttributeCountMax];
+    u64 AttributeOffsets[kParticleAttributeCountMax];
+    
+    m4 ObjectToWorldMatrix;
+    m4 ObjectToTerrainMatrix;
+    m4 TerrainToObjectMatrix;
+    
+    v3 Po;
+    v3 ddPg;
+    
+    f32 dt;
+    f32 Lifetime;
+    f32 Force;
+    f32 Friction;
+    f32 RestSpeed;
+    u32 RestStepCount;
+    
+    f32 LodParticleSize;
+    f32 LodFullRatePixelSize;
+    f32 LodHalfRatePixelSize;
+    f32 LodScale;
+    u32 LodStepBudget;
+    b32 LodEnabled;
+};
+
+
+static u64 AlignUp(u64 Value, u64 Alignment)
+{
+    return (Value + Alignment - 1) & ~(Alignment - 1);
+}
+
+
+
+// Copies the attribute arrays out of the checkpoint mapping into memory of their own
+static b32 DetachCheckpoint(particle_system *ParticleSystem)
+{
+    particle_attribute Attributes[kParticleAttributeCountMax];
+    u32 AttributeCount = GetAttributes(ParticleSystem, Attributes);
+    
+    void *Copies[kParticleAttributeCountMax] = {};
+    for (u32 Index = 0; Index < AttributeCount; ++Index)
+    {
+        size_t Size = (size_t)Attributes[Index].ElementSize * ParticleSystem->ParticleCount;
+        Copies[Index] = malloc(Size);
+        if (!Copies[Index])
+        {
+            for (u32 Copy = 0; Copy < Index; ++Copy)
+            {
+                free(Copies[Copy]);
+            }
+            return false;
+        }
+        memcpy(Copies[Index], *Attributes[Index].Data, Size);
+    }
+    
+    for (u32 Index = 0; Index < AttributeCount; ++Index)
+    {
+        *Attributes[Index].Data = Copies[Index];
+    }
+    CloseMappedFile(&ParticleSystem->Checkpoint);
+    
+    return true;
+}
+
+
+b32 SaveCheckpoint(particle_system *ParticleSystem, char const *FileName)
+{
+    PROFILE_SCOPE("SaveCheckpoint");
+    
+    checkpoint_header Header = {};
+    Header.MagicNumber = kCheckpointMagicNumber;
+    Header.Version = kCheckpointVersion;
+    Header.CompactLayout = PARTICLE_COMPACT_LAYOUT;
+    Header.ParticleCount = ParticleSystem->ParticleCount;
+    Header.FrameIndex = ParticleSystem->FrameIndex;
+    
+    particle_attribute Attributes[kParticleAttributeCountMax];
+    Header.AttributeCount = GetAttributes(ParticleSystem, Attributes);
+    
+    u64 Offset = AlignUp(sizeof(checkpoint_header), kCheckpointAlignment);
+    for (u32 Index = 0; Index < Header.AttributeCount; ++Index)
+    {
+        Header.AttributeElementSizes[Index] = Attributes[Index].ElementSize;
+        Header.AttributeOffsets[Index] = Offset;
+        
+        u64 Size = (u64)Attributes[Index].ElementSize * ParticleSystem->ParticleCount;
+        Offset = AlignUp(Offset + Size, kCheckpointAlignment);
+    }
+    
+    Header.ObjectToWorldMatrix = ParticleSystem->ObjectToWorldMatrix;
+    Header.ObjectToTerrainMatrix = ParticleSystem->ObjectToTerrainMatrix;
+    Header.TerrainToObjectMatrix = ParticleSystem->TerrainToObjectMatrix;
+    
+    Header.Po = ParticleSystem->Po;
+    Header.ddPg = ParticleSystem->ddPg;
+    
+    Header.dt = ParticleSystem->dt;
+    Header.Lifetime = ParticleSystem->Lifetime;
+    Header.Force = ParticleSystem->Force;
+    Header.Friction = ParticleSystem->Friction;
+    Header.RestSpeed = ParticleSystem->RestSpeed;
+    Header.RestStepCount = ParticleSystem->RestStepCount;
+    
+    particle_lod *Lod = &ParticleSystem->Lod;
+    Header.LodParticleSize = Lod->ParticleSize;
+    Header.LodFullRatePixelSize = Lod->FullRatePixelSize;
+    Header.LodHalfRatePixelSize = Lod->HalfRatePixelSize;
+    Header.LodScale = Lod->Scale;
+    Header.LodStepBudget = Lod->StepBudget;
+    Header.LodEnabled = Lod->Enabled;
+    
+    
+    //
+    // Write
+    if (ParticleSystem->Checkpoint.Data && !DetachCheckpoint(ParticleSystem))
+    {
+        printf("Failed to copy the particles out of the loaded checkpoint\n");
+        return false;
+    }
+    
+    FILE *File;
+    if (fopen_s(&File, FileName, "wb") != 0)
+    {
+        printf("Failed to open checkpoint %s for writing\n", FileName);
+        return false;
+    }
+    
+    u8 Padding[kCheckpointAlignment] = {};
+    b32 Result = fwrite(&Header, sizeof(Header), 1, File) == 1;
+    u64 Written = sizeof(Header);
+    
+    for (u32 Index = 0; Result && Index < Header.AttributeCount; ++Index)
+    {
+        Result = fwrite(Padding, 1, Header.AttributeOffsets[Index] - Written, File) == Header.AttributeOffsets[Index] - Written;
+        Written = Header.AttributeOffsets[Index];
+        
+        size_t Size = (size_t)Attributes[Index].ElementSize * ParticleSystem->ParticleCount;
+        Result = Result && fwrite(*Attributes[Index].Data, 1, Size, File) == Size;
+        Written += Size;
+    }
+    
+    fclose(File);
+    
+    return Result;
+}
+
+
+
+b32 LoadCheckpoint(particle_system *ParticleSystem, char const *FileName)
+{
+    PROFILE_SCOPE("LoadCheckpoint");
+    
+    mapped_file File;
+    if (!OpenMappedFile(FileName, &File, true))
+    {
+        printf("Failed to map checkpoint %s\n", FileName);
+        return false;
+    }
+    
+    
+    //
+    // Validate
+    particle_attribute Attributes[kParticleAttributeCountMax];
+    u32 AttributeCount = GetAttributes(ParticleSystem, Attributes);
+    
+    checkpoint_header *Header = (checkpoint_header *)File.Data;
+    b32 Valid = (File.Size >= sizeof(checkpoint_header) &&
+                 Header->MagicNumber == kCheckpointMagicNumber &&
+                 Header->Version == kCheckpointVersion &&
+                 Header->CompactLayout == PARTICLE_COMPACT_LAYOUT &&
+                 Header->ParticleCount == ParticleSystem->ParticleCount &&
+                 Header->AttributeCount == AttributeCount);
+    
+    for (u32 Index = 0; Valid && Index < AttributeCount; ++Index)
+    {
+        u64 Size = (u64)Attributes[Index].ElementSize * ParticleSystem->ParticleCount;
+        Valid = (Header->AttributeElementSizes[Index] == Attributes[Index].ElementSize &&
+                 Header->AttributeOffsets[Index] % kCheckpointAlignment == 0 &&
+                 Header->AttributeOffsets[Index] + Size <= File.Size);
+    }
+    
+    if (!Valid)
+    {
+        printf("%s is not a valid checkpoint for this particle system\n", FileName);
+        CloseMappedFile(&File);
+        return false;
+    }
+    
+    
+    //
+    // Adopt the arrays in the mapping
+    if (ParticleSystem->Checkpoint.Data)
+    {
+        CloseMappedFile(&ParticleSystem->Checkpoint);
+    }
+    else
+    {
+        for (u32 Index = 0; Index < AttributeCount; ++Index)
+        {
+            free(*Attributes[Index].Data);
+        }
+    }
+    
+    for (u32 Index = 0; Index < AttributeCount; ++Index)
+    {
+        *Attributes[Index].Data = File.Data + Header->AttributeOffsets[Index];
+    }
+    
+    ParticleSystem->Checkpoint = File;
+    ParticleSystem->FrameIndex = Header->FrameIndex;
+    
+    ParticleSystem->ObjectToWorldMatrix = Header->ObjectToWorldMatrix;
+    ParticleSystem->ObjectToTerrainMatrix = Header->ObjectToTerrainMatrix;
+    ParticleSystem->TerrainToObjectMatrix = Header->TerrainToObjectMatrix;
+    
+    ParticleSystem->Po = Header->Po;
+    ParticleSystem->ddPg = Header->ddPg;
+    
+    ParticleSystem->dt = Header->dt;
+    ParticleSystem->Lifetime = Header->Lifetime;
+    ParticleSystem->Force = Header->Force;
+    ParticleSystem->Friction = Header->Friction;
+    ParticleSystem->RestSpeed = Header->RestSpeed;
+    ParticleSystem->RestStepCount = Header->RestStepCount;
+#if PARTICLE_COMPACT_LAYOUT
+    SetAgeScale(ParticleSystem);
+#endif
+    
+    particle_lod *Lod = &ParticleSystem->Lod;
+    Lod->ParticleSize = Header->LodParticleSize;
+    Lod->FullRatePixelSize = Header->LodFullRatePixelSize;
+    Lod->HalfRatePixelSize = Header->LodHalfRatePixelSize;
+    Lod->Scale = Header->LodScale;
+    Lod->StepBudget = Header->LodStepBudget;
+    Lod->Enabled = Header->LodEnabled;
+    
+    RebuildRestingSets(ParticleSystem);
+    
+    return true;
+}
@@ -0,0 +1,129 @@
+// 
+// MIT License
+// 
+// Copyright (c) 2018 Marcus Larsson
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+#ifndef ParticleExport__h
+#define ParticleExport__h
+
+#define UNICODE
+#define STRICT
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <stdio.h>
+
+#include "types.h"
+#include "particle_system.h"
+
+
+
+//
+// Point cloud export
+//
+// ExportParticles() copies the particles into a snapshot and returns, the snapshot is written as
+// binary little endian PLY on the exporter thread while the simulation goes on. Each particle is
+// stored in the snapshot as the row it has in the file
+//
+// x y z [vx vy vz] [age]
+//
+// so a file is written with a few large sequential writes straight from the snapshot. With a
+// TileSize the particles are split over square tiles in x and z, one file per tile that has any
+// particles in it, named <name>_<x>_<z>.ply after the integer coordinates of the tile. Positions
+// and velocities are in the object space of the particle system, the age is the elapsed time.
+// Particles without a finite position are written to the tile nearest to them.
+//
+// PollExport() returns the result of each export once it has been written, so failures can be
+// reported while the exporter runs rather than only by StopExporter().
+//
+// NOTE(Marcus): An export is dropped if the previous one is still being written, like the frames
+//               of the recorder, so exporting on a cadence never stalls the simulation.
+//
+u32 constexpr kExportFileNameLengthMax = 260;
+u32 constexpr kExportTileCountMax = 4096;
+u32 constexpr kExportRangeSize = 1 << 18; // Particles per work item when taking the snapshot
+u32 constexpr kExportWriteSize = 64 * 1024 * 1024;
+u32 constexpr kExportResultCount = 4;     // Exports that can finish between two PollExport() calls
+
+enum export_attribute
+{
+    ExportAttribute_Velocity = 0x1,
+    ExportAttribute_Age = 0x2,
+};
+
+struct particle_export_settings
+{
+    u32 Attributes = ExportAttribute_Velocity | ExportAttribute_Age;
+    f32 TileSize = 0.0f; // 0 writes all particles to a single file
+};
+
+struct export_result
+{
+    u32 FrameIndex;
+    u32 FileCount;
+    u32 FailedCount; // Files that could not be written
+};
+
+struct particle_exporter
+{
+    u8 *Rows = nullptr; // The snapshot, the rows of a tile are contiguous
+    u32 RowSize;
+    u32 ParticleCapacity;
+    u32 ParticleCount;
+    u32 FrameIndex;
+    particle_export_settings Settings;
+    char FileName[kExportFileNameLengthMax];
+    
+    // The tile grid covers the particles of the snapshot, TileOffsets[Tile] is the first row of a tile
+    s32 TileMinX;
+    s32 TileMinZ;
+    u32 TileCountX;
+    u32 TileCountZ;
+    u32 *TileOffsets = nullptr;
+    
+    // Per range of kExportRangeSize particles, used while the snapshot is taken
+    f32 *RangeBounds = nullptr;  // Min x, min z, max x and max z
+    u32 *RangeOffsets = nullptr; // Next row of the range in each tile
+    particle_system *ParticleSystem;
+    u32 ThreadCount;
+    
+    HANDLE ExportReady;
+    HANDLE WriterThread;
+    u32 WriterThreadID;
+    
+    LONG volatile IsWriting = 0;
+    b32 volatile IsRunning = false;
+    LONG volatile ExportCount = 0;
+    u32 DroppedCount = 0;
+    b32 Error = false;
+    
+    export_result Results[kExportResultCount];
+    u32 ReportedCount = 0;
+};
+
+b32 StartExporter(particle_exporter *Exporter, u32 ParticleCapacity, u32 ThreadCount);
+b32 ExportParticles(particle_exporter *Exporter, particle_system *ParticleSystem, char const *FileName,
+                    particle_export_settings const *Settings);
+b32 PollExport(particle_exporter *Exporter, export_result *Result); // True once for every export written
+b32 StopExporter(particle_exporter *Exporter);
+
+
+#endif
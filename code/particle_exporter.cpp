@@ -0,0 +1,515 @@
+// 
+// MIT License
+// 
+// Copyright (c) 2018 Marcus Larsson
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+#include "particle_export.h"
+#include "parallel.h"
+#include "profiler.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <process.h>
+
+#if 0
+#include <stdio.h>
+#else
+#define printf(...)
+#endif
+
+
+
+//
+// Snapshot, taken on the calling thread and the ParallelFor() workers, one range of particles each
+//
+static void GetRange(particle_exporter *Exporter, u32 Range, u32 *StartIndex, u32 *EndIndex)
+{
+    *StartIndex = Range * kExportRangeSize;
+    *EndIndex = Exporter->ParticleCount - *StartIndex > kExportRangeSize ? 
+        *StartIndex + kExportRangeSize : Exporter->ParticleCount;
+}
+
+
+// NOTE(Marcus): The scaled coordinate is clamped so the conversion can not overflow, a NaN fails
+//               the first comparison and ends up at -Limit. Rounded down without floorf() since
+//               this runs up to three times per particle.
+inline s32 GetTile(f32 Value, f32 InvTileSize)
+{
+    f32 Limit = (f32)(1 << 30);
+    f32 Scaled = Value * InvTileSize;
+    Scaled = Scaled > -Limit ? Scaled : -Limit;
+    Scaled = Scaled < Limit ? Scaled : Limit;
+    s32 Truncated = (s32)Scaled;
+    return Truncated - (Scaled < (f32)Truncated ? 1 : 0);
+}
+
+
+// Particles outside the bounds, the ones with a position that is not finite, go to the nearest tile
+inline u32 ClampTile(s32 Tile, s32 TileMin, u32 TileCount)
+{
+    s64 Offset = (s64)Tile - TileMin;
+    return Offset < 0 ? 0 : (Offset >= (s64)TileCount ? TileCount - 1 : (u32)Offset);
+}
+
+
+inline u32 GetTileIndex(particle_exporter *Exporter, v3 P, f32 InvTileSize)
+{
+    if (Exporter->TileCountX * Exporter->TileCountZ == 1)
+    {
+        return 0;
+    }
+    
+    u32 X = ClampTile(GetTile(P.x, InvTileSize), Exporter->TileMinX, Exporter->TileCountX);
+    u32 Z = ClampTile(GetTile(P.z, InvTileSize), Exporter->TileMinZ, Exporter->TileCountZ);
+    return Z * Exporter->TileCountX + X;
+}
+
+
+inline b32 IsFinite(f32 Value)
+{
+    // NOTE(Marcus): False for NaN and the infinities
+    return Value - Value == 0.0f;
+}
+
+
+static void FindBounds(void *Data, u32 Range)
+{
+    particle_exporter *Exporter = (particle_exporter *)Data;
+    v3 *P = Exporter->ParticleSystem->P;
+    
+    u32 StartIndex, EndIndex;
+    GetRange(Exporter, Range, &StartIndex, &EndIndex);
+    
+    // The bounds stay empty, min above max, if no particle in the range has a finite position
+    f32 *Bounds = &Exporter->RangeBounds[4 * Range];
+    Bounds[0] = Bounds[1] = f32Max;
+    Bounds[2] = Bounds[3] = -f32Max;
+    for (u32 Index = StartIndex; Index < EndIndex; ++Index)
+    {
+        if (!IsFinite(P[Index].x) || !IsFinite(P[Index].z))
+        {
+            continue;
+        }
+        
+        Bounds[0] = Min(Bounds[0], P[Index].x);
+        Bounds[1] = Min(Bounds[1], P[Index].z);
+        Bounds[2] = Max(Bounds[2], P[Index].x);
+        Bounds[3] = Max(Bounds[3], P[Index].z);
+    }
+}
+
+
+static void CountTiles(void *Data, u32 Range)
+{
+    particle_exporter *Exporter = (particle_exporter *)Data;
+    v3 *P = Exporter->ParticleSystem->P;
+    f32 InvTileSize = 1.0f / Exporter->Settings.TileSize;
+    
+    u32 StartIndex, EndIndex;
+    GetRange(Exporter, Range, &StartIndex, &EndIndex);
+    
+    u32 TileCount = Exporter->TileCountX * Exporter->TileCountZ;
+    u32 *Counts = &Exporter->RangeOffsets[(size_t)Range * TileCount];
+    memset(Counts, 0, TileCount * sizeof(u32));
+    for (u32 Index = StartIndex; Index < EndIndex; ++Index)
+    {
+        ++Counts[GetTileIndex(Exporter, P[Index], InvTileSize)];
+    }
+}
+
+
+static void CopyRows(void *Data, u32 Range)
+{
+    particle_exporter *Exporter = (particle_exporter *)Data;
+    particle_system *ParticleSystem = Exporter->ParticleSystem;
+    f32 InvTileSize = Exporter->Settings.TileSize > 0.0f ? 1.0f / Exporter->Settings.TileSize : 0.0f;
+    b32 Velocity = Exporter->Settings.Attributes & ExportAttribute_Velocity;
+    b32 Age = Exporter->Settings.Attributes & ExportAttribute_Age;
+    
+    u32 StartIndex, EndIndex;
+    GetRange(Exporter, Range, &StartIndex, &EndIndex);
+    
+    u32 TileCount = Exporter->TileCountX * Exporter->TileCountZ;
+    u32 *Offsets = &Exporter->RangeOffsets[(size_t)Range * TileCount];
+    for (u32 Index = StartIndex; Index < EndIndex; ++Index)
+    {
+        v3 P = ParticleSystem->P[Index];
+        u32 Tile = GetTileIndex(Exporter, P, InvTileSize);
+        f32 *Row = (f32 *)(Exporter->Rows + (size_t)Offsets[Tile]++ * Exporter->RowSize);
+        
+        *Row++ = P.x;
+        *Row++ = P.y;
+        *Row++ = P.z;
+        if (Velocity)
+        {
+            v3 dP = LoadVelocity(ParticleSystem, Index);
+            *Row++ = dP.x;
+            *Row++ = dP.y;
+            *Row++ = dP.z;
+        }
+        if (Age)
+        {
+            *Row++ = GetElapsed(ParticleSystem, Index);
+        }
+    }
+}
+
+
+// Counting sort of the particles by tile, a range writes its particles of a tile after those of the
+// ranges before it so the particles keep their order within a tile
+static b32 TakeSnapshot(particle_exporter *Exporter)
+{
+    u32 RangeCount = (Exporter->ParticleCount + kExportRangeSize - 1) / kExportRangeSize;
+    
+    Exporter->TileMinX = 0;
+    Exporter->TileMinZ = 0;
+    Exporter->TileCountX = 1;
+    Exporter->TileCountZ = 1;
+    if (Exporter->Settings.TileSize > 0.0f && Exporter->ParticleCount > 0)
+    {
+        ParallelFor(RangeCount, Exporter->ThreadCount, FindBounds, Exporter);
+        
+        f32 *Bounds = Exporter->RangeBounds;
+        for (u32 Range = 1; Range < RangeCount; ++Range)
+        {
+            f32 *RangeBounds = &Exporter->RangeBounds[4 * Range];
+            Bounds[0] = Min(Bounds[0], RangeBounds[0]);
+            Bounds[1] = Min(Bounds[1], RangeBounds[1]);
+            Bounds[2] = Max(Bounds[2], RangeBounds[2]);
+            Bounds[3] = Max(Bounds[3], RangeBounds[3]);
+        }
+        if (Bounds[0] > Bounds[2])
+        {
+            Bounds[0] = Bounds[1] = Bounds[2] = Bounds[3] = 0.0f;
+        }
+        
+        f32 InvTileSize = 1.0f / Exporter->Settings.TileSize;
+        s32 MinX = GetTile(Bounds[0], InvTileSize);
+        s32 MinZ = GetTile(Bounds[1], InvTileSize);
+        s32 MaxX = GetTile(Bounds[2], InvTileSize);
+        s32 MaxZ = GetTile(Bounds[3], InvTileSize);
+        
+        u64 TileCountX = (u64)((s64)MaxX - MinX + 1);
+        u64 TileCountZ = (u64)((s64)MaxZ - MinZ + 1);
+        if (TileCountX * TileCountZ > kExportTileCountMax)
+        {
+            printf("Too many tiles to export, %llu x %llu\n", TileCountX, TileCountZ);
+            return false;
+        }
+        
+        Exporter->TileMinX = MinX;
+        Exporter->TileMinZ = MinZ;
+        Exporter->TileCountX = (u32)TileCountX;
+        Exporter->TileCountZ = (u32)TileCountZ;
+    }
+    
+    u32 TileCount = Exporter->TileCountX * Exporter->TileCountZ;
+    if (TileCount == 1)
+    {
+        for (u32 Range = 0; Range < RangeCount; ++Range)
+        {
+            Exporter->RangeOffsets[Range] = Range * kExportRangeSize;
+        }
+        Exporter->TileOffsets[0] = 0;
+    }
+    else
+    {
+        ParallelFor(RangeCount, Exporter->ThreadCount, CountTiles, Exporter);
+        
+        u32 Offset = 0;
+        for (u32 Tile = 0; Tile < TileCount; ++Tile)
+        {
+            Exporter->TileOffsets[Tile] = Offset;
+            for (u32 Range = 0; Range < RangeCount; ++Range)
+            {
+                u32 *Count = &Exporter->RangeOffsets[(size_t)Range * TileCount + Tile];
+                u32 RangeTileCount = *Count;
+                *Count = Offset;
+                Offset += RangeTileCount;
+            }
+        }
+    }
+    Exporter->TileOffsets[TileCount] = Exporter->ParticleCount;
+    
+    ParallelFor(RangeCount, Exporter->ThreadCount, CopyRows, Exporter);
+    
+    return true;
+}
+
+
+
+//
+// Writing, done on the exporter thread
+//
+static b32 WritePlyFile(particle_exporter *Exporter, char const *FileName, u32 StartRow, u32 EndRow)
+{
+    FILE *File;
+    if (fopen_s(&File, FileName, "wb") != 0)
+    {
+        printf("Failed to open %s for the export\n", FileName);
+        return false;
+    }
+    
+    // NOTE(Marcus): Unbuffered, the rows are written straight from the snapshot
+    setvbuf(File, nullptr, _IONBF, 0);
+    
+    b32 Velocity = Exporter->Settings.Attributes & ExportAttribute_Velocity;
+    b32 Age = Exporter->Settings.Attributes & ExportAttribute_Age;
+    
+    char Header[512];
+    int Length = snprintf(Header, sizeof(Header), 
+                          "ply\n"
+                          "format binary_little_endian 1.0\n"
+                          "comment frame %u\n"
+                          "element vertex %u\n"
+                          "property float x\n"
+                          "property float y\n"
+                          "property float z\n"
+                          "%s%s"
+                          "end_header\n", 
+                          Exporter->FrameIndex, EndRow - StartRow,
+                          Velocity ? "property float vx\nproperty float vy\nproperty float vz\n" : "",
+                          Age ? "property float age\n" : "");
+    b32 Result = fwrite(Header, 1, Length, File) == (size_t)Length;
+    
+    u8 *At = Exporter->Rows + (size_t)StartRow * Exporter->RowSize;
+    u8 *End = Exporter->Rows + (size_t)EndRow * Exporter->RowSize;
+    while (Result && At < End)
+    {
+        size_t Size = (size_t)(End - At) < kExportWriteSize ? (size_t)(End - At) : kExportWriteSize;
+        Result = fwrite(At, 1, Size, File) == Size;
+        At += Size;
+    }
+    
+    Result = (fclose(File) == 0) && Result;
+    return Result;
+}
+
+
+static void WriteExport(particle_exporter *Exporter, export_result *Result)
+{
+    PROFILE_SCOPE("WriteExport");
+    
+    Result->FrameIndex = Exporter->FrameIndex;
+    Result->FileCount = 0;
+    Result->FailedCount = 0;
+    
+    u32 TileCount = Exporter->TileCountX * Exporter->TileCountZ;
+    if (TileCount == 1 && Exporter->Settings.TileSize <= 0.0f)
+    {
+        ++Result->FileCount;
+        if (!WritePlyFile(Exporter, Exporter->FileName, 0, Exporter->ParticleCount))
+        {
+            ++Result->FailedCount;
+        }
+        return;
+    }
+    
+    // The tile coordinates go in front of the extension
+    char const *FileName = Exporter->FileName;
+    char const *Extension = strrchr(FileName, '.');
+    char const *Separator = strrchr(FileName, '\\');
+    Separator = Separator ? Separator : strrchr(FileName, '/');
+    if (!Extension || Extension < Separator)
+    {
+        Extension = FileName + strlen(FileName);
+    }
+    
+    for (u32 Tile = 0; Tile < TileCount; ++Tile)
+    {
+        u32 StartRow = Exporter->TileOffsets[Tile];
+        u32 EndRow = Exporter->TileOffsets[Tile + 1];
+        if (StartRow == EndRow)
+        {
+            continue;
+        }
+        
+        s32 X = Exporter->TileMinX + (s32)(Tile % Exporter->TileCountX);
+        s32 Z = Exporter->TileMinZ + (s32)(Tile / Exporter->TileCountX);
+        
+        char TileFileName[kExportFileNameLengthMax + 32];
+        snprintf(TileFileName, sizeof(TileFileName), "%.*s_%d_%d%s", 
+                 (int)(Extension - FileName), FileName, X, Z, Extension);
+        
+        ++Result->FileCount;
+        if (!WritePlyFile(Exporter, TileFileName, StartRow, EndRow))
+        {
+            ++Result->FailedCount;
+        }
+    }
+}
+
+
+unsigned int __stdcall ExporterWrite(void *Data)
+{
+    particle_exporter *Exporter = (particle_exporter *)Data;
+    
+    ProfileRegisterThread("Exporter");
+    
+    for (;;)
+    {
+        WaitForSingleObject(Exporter->ExportReady, INFINITE);
+        
+        if (Exporter->IsWriting)
+        {
+            export_result Result;
+            WriteExport(Exporter, &Result);
+            Exporter->Error |= Result.FailedCount > 0;
+            
+            // The result is published before the snapshot is handed back, see PollExport()
+            Exporter->Results[Exporter->ExportCount % kExportResultCount] = Result;
+            InterlockedIncrement(&Exporter->ExportCount);
+            InterlockedExchange(&Exporter->IsWriting, 0);
+        }
+        
+        if (!Exporter->IsRunning)
+        {
+            break;
+        }
+    }
+    
+    ProfileUnregisterThread();
+    return 0;
+}
+
+
+
+//
+// Exporter API
+//
+b32 StartExporter(particle_exporter *Exporter, u32 ParticleCapacity, u32 ThreadCount)
+{
+    *Exporter = {};
+    
+    u32 RangeCount = (ParticleCapacity + kExportRangeSize - 1) / kExportRangeSize;
+    RangeCount = RangeCount > 0 ? RangeCount : 1;
+    
+    // NOTE(Marcus): Room for the largest row, position, velocity and age
+    Exporter->ParticleCapacity = ParticleCapacity;
+    Exporter->Rows = (u8 *)malloc((size_t)ParticleCapacity * 7 * sizeof(f32));
+    Exporter->TileOffsets = (u32 *)malloc((kExportTileCountMax + 1) * sizeof(u32));
+    Exporter->RangeBounds = (f32 *)malloc(4 * RangeCount * sizeof(f32));
+    Exporter->RangeOffsets = (u32 *)malloc((size_t)RangeCount * kExportTileCountMax * sizeof(u32));
+    if (!Exporter->Rows || !Exporter->TileOffsets || !Exporter->RangeBounds || !Exporter->RangeOffsets)
+    {
+        free(Exporter->Rows);
+        free(Exporter->TileOffsets);
+        free(Exporter->RangeBounds);
+        free(Exporter->RangeOffsets);
+        *Exporter = {};
+        return false;
+    }
+    
+    Exporter->ThreadCount = ThreadCount > 0 ? ThreadCount : 1;
+    Exporter->IsRunning = true;
+    
+    Exporter->ExportReady = CreateEventA(nullptr, false, false, nullptr);
+    assert(Exporter->ExportReady);
+    
+    Exporter->WriterThread = (HANDLE)_beginthreadex(0, 0, (_beginthreadex_proc_type)&ExporterWrite,
+                                                    (void *)Exporter, 0, &Exporter->WriterThreadID);
+    assert(Exporter->WriterThread);
+    
+    return true;
+}
+
+
+b32 ExportParticles(particle_exporter *Exporter, particle_system *ParticleSystem, char const *FileName,
+                    particle_export_settings const *Settings)
+{
+    PROFILE_SCOPE("ExportParticles");
+    
+    if (!Exporter->IsRunning || 
+        ParticleSystem->ParticleCount > Exporter->ParticleCapacity ||
+        strlen(FileName) >= kExportFileNameLengthMax)
+    {
+        return false;
+    }
+    
+    if (Exporter->IsWriting)
+    {
+        ++Exporter->DroppedCount;
+        return false;
+    }
+    
+    Exporter->Settings = *Settings;
+    Exporter->RowSize = sizeof(v3);
+    Exporter->RowSize += (Settings->Attributes & ExportAttribute_Velocity) ? sizeof(v3) : 0;
+    Exporter->RowSize += (Settings->Attributes & ExportAttribute_Age) ? sizeof(f32) : 0;
+    Exporter->ParticleCount = ParticleSystem->ParticleCount;
+    Exporter->FrameIndex = ParticleSystem->FrameIndex;
+    Exporter->ParticleSystem = ParticleSystem;
+    memcpy(Exporter->FileName, FileName, strlen(FileName) + 1);
+    
+    b32 Result = TakeSnapshot(Exporter);
+    Exporter->ParticleSystem = nullptr;
+    if (!Result)
+    {
+        return false;
+    }
+    
+    InterlockedExchange(&Exporter->IsWriting, 1);
+    SetEvent(Exporter->ExportReady);
+    
+    return true;
+}
+
+
+b32 PollExport(particle_exporter *Exporter, export_result *Result)
+{
+    if (Exporter->ReportedCount == (u32)Exporter->ExportCount)
+    {
+        return false;
+    }
+    
+    *Result = Exporter->Results[Exporter->ReportedCount++ % kExportResultCount];
+    return true;
+}
+
+
+b32 StopExporter(particle_exporter *Exporter)
+{
+    if (!Exporter->IsRunning)
+    {
+        return false;
+    }
+    
+    //
+    // Let the writer finish the export in progress
+    Exporter->IsRunning = false;
+    SetEvent(Exporter->ExportReady);
+    WaitForSingleObject(Exporter->WriterThread, INFINITE);
+    CloseHandle(Exporter->WriterThread);
+    CloseHandle(Exporter->ExportReady);
+    
+    free(Exporter->Rows);
+    free(Exporter->TileOffsets);
+    free(Exporter->RangeBounds);
+    free(Exporter->RangeOffsets);
+    
+    b32 Result = !Exporter->Error;
+    Exporter->Rows = nullptr;
+    Exporter->TileOffsets = nullptr;
+    Exporter->RangeBounds = nullptr;
+    Exporter->RangeOffsets = nullptr;
+    return Result;
+}
@@ -0,0 +1,405 @@
+// 
+// MIT License
+// 
+// Copyright (c) 2018 Marcus Larsson
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+#include "particle_recording.h"
+#include "profiler.h"
+#include <stdlib.h>
+#include <process.h>
+
+#if 0
+#include <stdio.h>
+#else
+#define printf(...)
+#endif
+
+
+
+//
+// Workers, each one handles every WorkerCount:th block of the frame
+//
+static b32 DecodeBlock(particle_player *Player, u32 Block)
+{
+    recording_header *Header = Player->Header;
+    u64 FrameOffset = Player->FrameOffsets[Player->JobFrame];
+    u64 FrameEnd = (Player->JobFrame + 1 < Player->FrameCount ? 
+                    Player->FrameOffsets[Player->JobFrame + 1] : Player->IndexOffset);
+    u8 *Frame = Player->File.Data + FrameOffset;
+    
+    // NOTE(Marcus): Each block is bounded by the end of its own frame, a corrupt block size 
+    // must not let the decoder run into the next frame or the frame index
+    recording_frame_header *FrameHeader = (recording_frame_header *)Frame;
+    u32 *BlockSizes = (u32 *)(Frame + sizeof(recording_frame_header));
+    u64 BlockStart = sizeof(recording_frame_header) + Header->BlockCount * sizeof(u32);
+    for (u32 Index = 0; Index < Block; ++Index)
+    {
+        BlockStart += BlockSizes[Index];
+    }
+    u64 BlockEnd = BlockStart + BlockSizes[Block];
+    
+    if (BlockEnd > FrameEnd - FrameOffset || FrameHeader->Prediction > RecordingPrediction_Order2)
+    {
+        return false;
+    }
+    
+    u8 *At = Frame + BlockStart;
+    u8 *End = Frame + BlockEnd;
+    
+    s32 *Q0 = Player->Q[0];
+    s32 *Q1 = Player->Q[1];
+    s32 *Q2 = Player->Q[2];
+    
+    recording_prediction Prediction = (recording_prediction)FrameHeader->Prediction;
+    s32 K1 = Prediction == RecordingPrediction_None ? 0 : (Prediction == RecordingPrediction_Order1 ? 1 : 2);
+    s32 K2 = Prediction == RecordingPrediction_Order2 ? 1 : 0;
+    
+    u32 StartIndex, EndIndex;
+    GetBlockRange(Header->ParticleCount, Header->BlockCount, Block, &StartIndex, &EndIndex);
+    
+    for (u32 Index = 3 * StartIndex; Index < 3 * EndIndex; ++Index)
+    {
+        u64 Value = 0;
+        u32 Shift = 0;
+        for (;;)
+        {
+            if (At == End || Shift > 28)
+            {
+                return false;
+            }
+            
+            u8 Byte = *At++;
+            Value |= (u64)(Byte & 0x7F) << Shift;
+            Shift += 7;
+            
+            if (!(Byte & 0x80))
+            {
+                break;
+            }
+        }
+        
+        if (Value == kRecordingRawEscape)
+        {
+            if (End - At < 4)
+            {
+                return false;
+            }
+            
+            Q0[Index] = (s32)((u32)At[0] | ((u32)At[1] << 8) | ((u32)At[2] << 16) | ((u32)At[3] << 24));
+            At += 4;
+        }
+        else if (Value > 0xFFFFFFFF)
+        {
+            return false;
+        }
+        else
+        {
+            s64 Predicted = (s64)K1 * Q1[Index] - (s64)K2 * Q2[Index];
+            Q0[Index] = (s32)(Predicted + UnZigZag((u32)Value));
+        }
+    }
+    
+    return true;
+}
+
+
+static void DequantiseBlock(particle_player *Player, u32 Block)
+{
+    recording_header *Header = Player->Header;
+    
+    u32 StartIndex, EndIndex;
+    GetBlockRange(Header->ParticleCount, Header->BlockCount, Block, &StartIndex, &EndIndex);
+    
+    s32 *Q = Player->JobSource;
+    f32 *P = (f32 *)Player->JobOutput;
+    f32 Step = Header->Step;
+    for (u32 Index = 3 * StartIndex; Index < 3 * EndIndex; ++Index)
+    {
+        P[Index] = (f32)Q[Index] * Step;
+    }
+}
+
+
+unsigned int __stdcall PlayerWork(void *Data)
+{
+    player_thread_context *Context = (player_thread_context *)Data;
+    particle_player *Player = Context->Player;
+    
+    ProfileRegisterThread("Player worker");
+    
+    for (;;)
+    {
+        DWORD WaitResult = WaitForSingleObject(Context->Work, INFINITE);
+        if (WaitResult != WAIT_OBJECT_0 || !Player->IsPlaying)
+        {
+            break;
+        }
+        
+        {
+            PROFILE_SCOPE(Player->Job == PlayerJob_Decode ? "DecodeBlocks" : "DequantiseBlocks");
+            for (u32 Block = Context->WorkerIndex; Block < Player->Header->BlockCount; Block += Player->WorkerCount)
+            {
+                if (Player->Job == PlayerJob_Decode)
+                {
+                    Context->Error |= !DecodeBlock(Player, Block);
+                }
+                else
+                {
+                    DequantiseBlock(Player, Block);
+                }
+            }
+        }
+        
+        ResetEvent(Context->Work);
+        SetEvent(Context->Finished);
+    }
+    
+    ProfileUnregisterThread();
+    return 0;
+}
+
+
+
+//
+// Jobs
+//
+static void BeginJob(particle_player *Player)
+{
+    Player->IsWorking = true;
+    for (u32 Index = 0; Index < Player->WorkerCount; ++Index)
+    {
+        SetEvent(Player->Workers[Index].Work);
+    }
+}
+
+
+static b32 FinishJob(particle_player *Player)
+{
+    if (!Player->IsWorking)
+    {
+        return !Player->Error;
+    }
+    
+    for (u32 Index = 0; Index < Player->WorkerCount; ++Index)
+    {
+        WaitForSingleObject(Player->Workers[Index].Finished, INFINITE);
+        ResetEvent(Player->Workers[Index].Finished);
+        
+        Player->Error |= Player->Workers[Index].Error;
+        Player->Workers[Index].Error = false;
+    }
+    Player->IsWorking = false;
+    
+    return !Player->Error;
+}
+
+
+// Starts decoding the frame after CurrentFrame into Q[0], the history is rotated first
+static void BeginDecodeNextFrame(particle_player *Player)
+{
+    s32 *Oldest = Player->Q[2];
+    Player->Q[2] = Player->Q[1];
+    Player->Q[1] = Player->Q[0];
+    Player->Q[0] = Oldest;
+    
+    ++Player->CurrentFrame;
+    Player->HistoryCount = Player->HistoryCount < 3 ? Player->HistoryCount + 1 : 3;
+    
+    Player->Job = PlayerJob_Decode;
+    Player->JobFrame = (u32)Player->CurrentFrame;
+    BeginJob(Player);
+}
+
+
+
+//
+// Player API
+//
+b32 OpenPlayer(particle_player *Player, char const *FileName, u32 ThreadCount)
+{
+    *Player = {};
+    
+    if (!OpenMappedFile(FileName, &Player->File))
+    {
+        printf("Failed to map recording %s\n", FileName);
+        return false;
+    }
+    
+    //
+    // Validate the header and the frame index
+    mapped_file *File = &Player->File;
+    recording_header *Header = (recording_header *)File->Data;
+    recording_footer *Footer = (recording_footer *)(File->Data + File->Size - sizeof(recording_footer));
+    
+    b32 Valid = (File->Size >= sizeof(recording_header) + sizeof(recording_footer) &&
+                 Header->MagicNumber == kRecordingMagicNumber &&
+                 Header->Version == kRecordingVersion &&
+                 Header->BlockCount > 0 && Header->KeyframeInterval > 0 &&
+                 Footer->MagicNumber == kRecordingMagicNumber &&
+                 Footer->IndexOffset + Footer->FrameCount * sizeof(u64) + sizeof(recording_footer) == File->Size);
+    
+    // NOTE(Marcus): Frames are written back to back, so a frame ends where the next one starts
+    u64 FrameHeaderSize = sizeof(recording_frame_header) + Header->BlockCount * sizeof(u32);
+    u64 PreviousEnd = sizeof(recording_header);
+    for (u32 Index = 0; Valid && Index < Footer->FrameCount; ++Index)
+    {
+        u64 Offset = ((u64 *)(File->Data + Footer->IndexOffset))[Index];
+        Valid = Offset >= PreviousEnd && Offset + FrameHeaderSize <= Footer->IndexOffset;
+        PreviousEnd = Offset + FrameHeaderSize;
+    }
+    
+    if (!Valid)
+    {
+        printf("%s is not a valid recording\n", FileName);
+        CloseMappedFile(File);
+        return false;
+    }
+    
+    Player->Header = Header;
+    Player->FrameOffsets = (u64 *)(File->Data + Footer->IndexOffset);
+    Player->FrameCount = Footer->FrameCount;
+    Player->IndexOffset = Footer->IndexOffset;
+    
+    for (u32 Index = 0; Index < 3; ++Index)
+    {
+        Player->Q[Index] = (s32 *)calloc(3 * (size_t)Header->ParticleCount, sizeof(s32));
+        assert(Player->Q[Index]);
+    }
+    
+    
+    //
+    // Workers
+    ThreadCount = ThreadCount > 0 ? ThreadCount : 1;
+    ThreadCount = ThreadCount < Header->BlockCount ? ThreadCount : Header->BlockCount;
+    
+    Player->IsPlaying = true;
+    Player->WorkerCount = ThreadCount;
+    Player->Workers = (player_thread_context *)calloc(ThreadCount, sizeof(player_thread_context));
+    assert(Player->Workers);
+    
+    for (u32 Index = 0; Index < ThreadCount; ++Index)
+    {
+        player_thread_context *Context = &Player->Workers[Index];
+        Context->Player = Player;
+        Context->WorkerIndex = Index;
+        
+        Context->Work = CreateEventA(nullptr, true, false, nullptr);
+        Context->Finished = CreateEventA(nullptr, true, false, nullptr);
+        assert(Context->Work && Context->Finished);
+        
+        Context->ThreadHandle = (HANDLE)_beginthreadex(0, 0, (_beginthreadex_proc_type)&PlayerWork, 
+                                                       (void *)Context, 0, &Context->ThreadID);
+        assert(Context->ThreadHandle);
+    }
+    
+    return true;
+}
+
+
+b32 GetFrame(particle_player *Player, u32 FrameIndex, v3 *P)
+{
+    PROFILE_SCOPE("GetFrame");
+    
+    //
+    // Wait for the frame that was decoded in the background
+    if (!FinishJob(Player) || FrameIndex >= Player->FrameCount)
+    {
+        return false;
+    }
+    
+    s32 *Source = nullptr;
+    s32 Frame = (s32)FrameIndex;
+    
+    if (Frame == Player->CurrentFrame)
+    {
+        Source = Player->Q[0];
+    }
+    else if (Frame == Player->CurrentFrame - 1 && Player->HistoryCount >= 2)
+    {
+        Source = Player->Q[1];
+    }
+    else
+    {
+        //
+        // Seek, continue from the current frame if it is after the keyframe, otherwise start at the keyframe
+        s32 Keyframe = Frame - (Frame % (s32)Player->Header->KeyframeInterval);
+        if (Player->CurrentFrame < Keyframe || Player->CurrentFrame > Frame)
+        {
+            Player->CurrentFrame = Keyframe - 1;
+            Player->HistoryCount = 0;
+        }
+        
+        while (Player->CurrentFrame < Frame)
+        {
+            BeginDecodeNextFrame(Player);
+            if (!FinishJob(Player))
+            {
+                Player->CurrentFrame = -1;
+                Player->HistoryCount = 0;
+                return false;
+            }
+        }
+        
+        Source = Player->Q[0];
+    }
+    
+    Player->Job = PlayerJob_Dequantise;
+    Player->JobSource = Source;
+    Player->JobOutput = P;
+    BeginJob(Player);
+    FinishJob(Player);
+    
+    //
+    // Prefetch the next frame
+    if (Player->CurrentFrame == Frame && FrameIndex + 1 < Player->FrameCount)
+    {
+        BeginDecodeNextFrame(Player);
+    }
+    
+    return true;
+}
+
+
+void ClosePlayer(particle_player *Player)
+{
+    FinishJob(Player);
+    
+    Player->IsPlaying = false;
+    for (u32 Index = 0; Index < Player->WorkerCount; ++Index)
+    {
+        player_thread_context *Context = &Player->Workers[Index];
+        SetEvent(Context->Work);
+        WaitForSingleObject(Context->ThreadHandle, INFINITE);
+        
+        CloseHandle(Context->ThreadHandle);
+        CloseHandle(Context->Work);
+        CloseHandle(Context->Finished);
+    }
+    free(Player->Workers);
+    
+    for (u32 Index = 0; Index < 3; ++Index)
+    {
+        free(Player->Q[Index]);
+    }
+    
+    CloseMappedFile(&Player->File);
+}
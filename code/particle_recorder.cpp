@@ -0,0 +1,395 @@
+// 
+// MIT License
+// 
+// Copyright (c) 2018 Marcus Larsson
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+#include "particle_recording.h"
+#include "profiler.h"
+#include <stdlib.h>
+#include <process.h>
+
+#if 0
+#include <stdio.h>
+#else
+#define printf(...)
+#endif
+
+
+
+//
+// Encoding, done in parallel by the encoder threads, one block each
+//
+static u8 *WriteVarint(u8 *Out, u64 Value)
+{
+    while (Value >= 0x80)
+    {
+        *Out++ = (u8)(Value | 0x80);
+        Value >>= 7;
+    }
+    *Out++ = (u8)Value;
+    
+    return Out;
+}
+
+
+static void EncodeBlock(recorder_thread_context *Context)
+{
+    particle_recorder *Recorder = Context->Recorder;
+    
+    f32 *P = (f32 *)Recorder->Frame;
+    s32 *Q0 = Recorder->Q[0];
+    s32 *Q1 = Recorder->Q[1];
+    s32 *Q2 = Recorder->Q[2];
+    
+    // NOTE(Marcus): Predicted = K1 * Q1 - K2 * Q2, this avoids branching on the prediction per value
+    recording_prediction Prediction = Recorder->Prediction;
+    s32 K1 = Prediction == RecordingPrediction_None ? 0 : (Prediction == RecordingPrediction_Order1 ? 1 : 2);
+    s32 K2 = Prediction == RecordingPrediction_Order2 ? 1 : 0;
+    
+    f32 InvStep = 1.0f / Recorder->Header.Step;
+    f32 Limit = (f32)(1 << 29);
+    
+    u8 *Out = Context->Output;
+    for (u32 Index = 3 * Context->StartIndex; Index < 3 * Context->EndIndex; ++Index)
+    {
+        f32 Scaled = Max(-Limit, Min(Limit, P[Index] * InvStep));
+        s32 Quantised = (s32)floorf(Scaled + 0.5f);
+        s64 Predicted = (s64)K1 * Q1[Index] - (s64)K2 * Q2[Index];
+        Q0[Index] = Quantised;
+        
+        // NOTE(Marcus): With values up to 2^29 a linear prediction can be off by up to 2^31
+        s64 Residual = (s64)Quantised - Predicted;
+        if (Residual == (s32)Residual)
+        {
+            Out = WriteVarint(Out, ZigZag((s32)Residual));
+        }
+        else
+        {
+            Out = WriteVarint(Out, kRecordingRawEscape);
+            for (u32 Byte = 0; Byte < 4; ++Byte)
+            {
+                *Out++ = (u8)((u32)Quantised >> (8 * Byte));
+            }
+        }
+    }
+    
+    Context->OutputSize = (u32)(Out - Context->Output);
+}
+
+
+unsigned int __stdcall RecorderEncode(void *Data)
+{
+    recorder_thread_context *Context = (recorder_thread_context *)Data;
+    particle_recorder *Recorder = Context->Recorder;
+    
+    ProfileRegisterThread("Recorder encoder");
+    
+    for (;;)
+    {
+        DWORD WaitResult = WaitForSingleObject(Context->Encode, INFINITE);
+        if (WaitResult != WAIT_OBJECT_0 || !Recorder->IsEncoding)
+        {
+            break;
+        }
+        
+        {
+            PROFILE_SCOPE("EncodeBlock");
+            EncodeBlock(Context);
+        }
+        
+        ResetEvent(Context->Encode);
+        SetEvent(Context->Finished);
+    }
+    
+    ProfileUnregisterThread();
+    return 0;
+}
+
+
+
+//
+// Writing, the writer thread hands each frame to the encoders and writes the result in block order
+//
+static void Write(particle_recorder *Recorder, void const *Data, size_t Size)
+{
+    if (Size > 0 && fwrite(Data, 1, Size, Recorder->File) != Size)
+    {
+        Recorder->Error = true;
+    }
+    Recorder->FileOffset += Size;
+}
+
+
+static void EncodeAndWriteFrame(particle_recorder *Recorder)
+{
+    u32 Phase = Recorder->FrameCount % Recorder->Header.KeyframeInterval;
+    
+    Recorder->Frame = Recorder->Slots[Recorder->Tail];
+    u32 FrameIndex = Recorder->SlotFrameIndex[Recorder->Tail];
+    Recorder->Prediction = (Phase == 0 ? RecordingPrediction_None : 
+                            Phase == 1 ? RecordingPrediction_Order1 : RecordingPrediction_Order2);
+    
+    for (u32 Index = 0; Index < Recorder->EncoderCount; ++Index)
+    {
+        SetEvent(Recorder->Encoders[Index].Encode);
+    }
+    
+    for (u32 Index = 0; Index < Recorder->EncoderCount; ++Index)
+    {
+        WaitForSingleObject(Recorder->Encoders[Index].Finished, INFINITE);
+        ResetEvent(Recorder->Encoders[Index].Finished);
+    }
+    
+    //
+    // The slot can be reused as soon as the encoders are done with it
+    Recorder->Tail = (Recorder->Tail + 1) % kRecorderSlotCount;
+    InterlockedDecrement(&Recorder->FullSlotCount);
+    
+    
+    //
+    // Write the frame and remember where it starts
+    if (Recorder->FrameCount == Recorder->FrameOffsetCapacity)
+    {
+        Recorder->FrameOffsetCapacity = Recorder->FrameOffsetCapacity ? 2 * Recorder->FrameOffsetCapacity : 1024;
+        Recorder->FrameOffsets = (u64 *)realloc(Recorder->FrameOffsets, Recorder->FrameOffsetCapacity * sizeof(u64));
+        assert(Recorder->FrameOffsets);
+    }
+    Recorder->FrameOffsets[Recorder->FrameCount++] = Recorder->FileOffset;
+    
+    recording_frame_header FrameHeader;
+    FrameHeader.FrameIndex = FrameIndex;
+    FrameHeader.Prediction = Recorder->Prediction;
+    Write(Recorder, &FrameHeader, sizeof(FrameHeader));
+    
+    for (u32 Index = 0; Index < Recorder->EncoderCount; ++Index)
+    {
+        Write(Recorder, &Recorder->Encoders[Index].OutputSize, sizeof(u32));
+    }
+    
+    for (u32 Index = 0; Index < Recorder->EncoderCount; ++Index)
+    {
+        Write(Recorder, Recorder->Encoders[Index].Output, Recorder->Encoders[Index].OutputSize);
+    }
+    
+    //
+    // Rotate the history, the oldest frame is overwritten by the next frame
+    s32 *Oldest = Recorder->Q[2];
+    Recorder->Q[2] = Recorder->Q[1];
+    Recorder->Q[1] = Recorder->Q[0];
+    Recorder->Q[0] = Oldest;
+}
+
+
+unsigned int __stdcall RecorderWrite(void *Data)
+{
+    particle_recorder *Recorder = (particle_recorder *)Data;
+    
+    for (;;)
+    {
+        WaitForSingleObject(Recorder->FrameReady, INFINITE);
+        
+        while (Recorder->FullSlotCount > 0)
+        {
+            EncodeAndWriteFrame(Recorder);
+        }
+        
+        if (!Recorder->IsRecording)
+        {
+            break;
+        }
+    }
+    
+    return 0;
+}
+
+
+
+//
+// Recorder API
+//
+b32 StartRecording(particle_recorder *Recorder, char const *FileName, u32 ParticleCount, 
+                   u32 EncoderCount, f32 Step, u32 KeyframeInterval)
+{
+    *Recorder = {};
+    
+    if (fopen_s(&Recorder->File, FileName, "wb") != 0)
+    {
+        printf("Failed to open %s for recording\n", FileName);
+        return false;
+    }
+    setvbuf(Recorder->File, nullptr, _IOFBF, 8 * 1024 * 1024);
+    
+    EncoderCount = EncoderCount > 0 ? EncoderCount : 1;
+    EncoderCount = EncoderCount < ParticleCount ? EncoderCount : 1;
+    
+    recording_header *Header = &Recorder->Header;
+    Header->MagicNumber = kRecordingMagicNumber;
+    Header->Version = kRecordingVersion;
+    Header->ParticleCount = ParticleCount;
+    Header->BlockCount = EncoderCount;
+    Header->KeyframeInterval = KeyframeInterval > 0 ? KeyframeInterval : 1;
+    Header->Step = Step;
+    Write(Recorder, Header, sizeof(recording_header));
+    
+    for (u32 Index = 0; Index < kRecorderSlotCount; ++Index)
+    {
+        Recorder->Slots[Index] = (v3 *)malloc(ParticleCount * sizeof(v3));
+        assert(Recorder->Slots[Index]);
+    }
+    
+    for (u32 Index = 0; Index < 3; ++Index)
+    {
+        Recorder->Q[Index] = (s32 *)calloc(3 * ParticleCount, sizeof(s32));
+        assert(Recorder->Q[Index]);
+    }
+    
+    Recorder->IsRecording = true;
+    Recorder->IsEncoding = true;
+    
+    
+    //
+    // Threads
+    Recorder->FrameReady = CreateEventA(nullptr, false, false, nullptr);
+    assert(Recorder->FrameReady);
+    
+    Recorder->EncoderCount = EncoderCount;
+    Recorder->Encoders = (recorder_thread_context *)calloc(EncoderCount, sizeof(recorder_thread_context));
+    assert(Recorder->Encoders);
+    
+    for (u32 Index = 0; Index < EncoderCount; ++Index)
+    {
+        recorder_thread_context *Context = &Recorder->Encoders[Index];
+        Context->Recorder = Recorder;
+        GetBlockRange(ParticleCount, EncoderCount, Index, &Context->StartIndex, &Context->EndIndex);
+        
+        // NOTE(Marcus): Worst case is kRecordingValueSizeMax bytes for each of the three coordinates
+        Context->Output = (u8 *)malloc(3 * kRecordingValueSizeMax * (size_t)(Context->EndIndex - Context->StartIndex) + 1);
+        assert(Context->Output);
+        
+        Context->Encode = CreateEventA(nullptr, true, false, nullptr);
+        Context->Finished = CreateEventA(nullptr, true, false, nullptr);
+        assert(Context->Encode && Context->Finished);
+        
+        Context->ThreadHandle = (HANDLE)_beginthreadex(0, 0, (_beginthreadex_proc_type)&RecorderEncode, 
+                                                       (void *)Context, 0, &Context->ThreadID);
+        assert(Context->ThreadHandle);
+    }
+    
+    Recorder->WriterThread = (HANDLE)_beginthreadex(0, 0, (_beginthreadex_proc_type)&RecorderWrite,
+                                                    (void *)Recorder, 0, &Recorder->WriterThreadID);
+    assert(Recorder->WriterThread);
+    
+    return !Recorder->Error;
+}
+
+
+void Record(particle_recorder *Recorder, v3 *P)
+{
+    PROFILE_SCOPE("Record");
+    
+    if (!Recorder->IsRecording)
+    {
+        return;
+    }
+    
+    u32 FrameIndex = Recorder->SourceFrameCount++;
+    
+    if (Recorder->FullSlotCount == kRecorderSlotCount)
+    {
+        ++Recorder->DroppedFrameCount;
+        return;
+    }
+    
+    memcpy(Recorder->Slots[Recorder->Head], P, Recorder->Header.ParticleCount * sizeof(v3));
+    Recorder->SlotFrameIndex[Recorder->Head] = FrameIndex;
+    Recorder->Head = (Recorder->Head + 1) % kRecorderSlotCount;
+    
+    InterlockedIncrement(&Recorder->FullSlotCount);
+    SetEvent(Recorder->FrameReady);
+}
+
+
+b32 StopRecording(particle_recorder *Recorder)
+{
+    if (!Recorder->File)
+    {
+        return false;
+    }
+    
+    //
+    // Let the writer finish the frames that are queued, then stop the encoders
+    Recorder->IsRecording = false;
+    SetEvent(Recorder->FrameReady);
+    WaitForSingleObject(Recorder->WriterThread, INFINITE);
+    CloseHandle(Recorder->WriterThread);
+    
+    Recorder->IsEncoding = false;
+    for (u32 Index = 0; Index < Recorder->EncoderCount; ++Index)
+    {
+        recorder_thread_context *Context = &Recorder->Encoders[Index];
+        SetEvent(Context->Encode);
+        WaitForSingleObject(Context->ThreadHandle, INFINITE);
+        
+        CloseHandle(Context->ThreadHandle);
+        CloseHandle(Context->Encode);
+        CloseHandle(Context->Finished);
+        free(Context->Output);
+    }
+    CloseHandle(Recorder->FrameReady);
+    
+    
+    //
+    // Frame index and footer
+    recording_footer Footer;
+    Footer.IndexOffset = Recorder->FileOffset;
+    Footer.FrameCount = Recorder->FrameCount;
+    Footer.MagicNumber = kRecordingMagicNumber;
+    
+    Write(Recorder, Recorder->FrameOffsets, Recorder->FrameCount * sizeof(u64));
+    Write(Recorder, &Footer, sizeof(Footer));
+    
+    if (fclose(Recorder->File) != 0)
+    {
+        Recorder->Error = true;
+    }
+    Recorder->File = nullptr;
+    
+    printf("Recorded %u frames, dropped %u\n", Recorder->FrameCount, Recorder->DroppedFrameCount);
+    
+    
+    //
+    // Free
+    for (u32 Index = 0; Index < kRecorderSlotCount; ++Index)
+    {
+        free(Recorder->Slots[Index]);
+    }
+    
+    for (u32 Index = 0; Index < 3; ++Index)
+    {
+        free(Recorder->Q[Index]);
+    }
+    
+    free(Recorder->Encoders);
+    free(Recorder->FrameOffsets);
+    
+    return !Recorder->Error;
+}
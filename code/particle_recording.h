@@ -0,0 +1,237 @@
+// 
+// MIT License
+// 
+// Copyright (c) 2018 Marcus Larsson
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+
+#ifndef ParticleRecording__h
+#define ParticleRecording__h
+
+#define UNICODE
+#define STRICT
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <stdio.h>
+
+#include "mathematics.h"
+#include "mapped_file.h"
+
+
+
+//
+// Recording file
+//
+// header | frame | frame | ... | frame index | footer
+//
+// Each frame is a recording_frame_header, followed by the byte size of each block and then the blocks
+// themselves. A block holds the particles [StartIndex, EndIndex) of the frame (see GetBlockRange()),
+// blocks are independent of each other so they can be encoded and decoded in parallel.
+//
+// Positions are quantised to multiples of Step. The quantised value is predicted from the previous
+// frames (nothing for keyframes, the previous frame, or a linear extrapolation of the two previous
+// frames) and the residual is stored zigzag encoded as a variable length integer. A residual that
+// does not fit in 32 bits is stored as the escape 2^32, which no 32 bit residual encodes to,
+// followed by the quantised value itself as 4 little endian bytes.
+//
+u32 constexpr kRecordingMagicNumber = 0x43455250; // PREC
+u32 constexpr kRecordingVersion = 1;
+
+u64 constexpr kRecordingRawEscape = 1ull << 32;
+u32 constexpr kRecordingValueSizeMax = 9; // Escape and raw value
+
+struct recording_header
+{
+    u32 MagicNumber;
+    u32 Version;
+    u32 ParticleCount;
+    u32 BlockCount;
+    u32 KeyframeInterval;
+    f32 Step;
+};
+
+enum recording_prediction
+{
+    RecordingPrediction_None,   // Keyframe
+    RecordingPrediction_Order1, // Q = Q1
+    RecordingPrediction_Order2, // Q = 2 * Q1 - Q2
+};
+
+struct recording_frame_header
+{
+    u32 FrameIndex; // Counts the Record() calls, a gap to the previous frame means frames were dropped
+    u32 Prediction;
+};
+
+struct recording_footer
+{
+    u64 IndexOffset;
+    u32 FrameCount;
+    u32 MagicNumber;
+};
+
+
+inline void GetBlockRange(u32 ParticleCount, u32 BlockCount, u32 Block, u32 *StartIndex, u32 *EndIndex)
+{
+    u32 ParticlesPerBlock = ParticleCount / BlockCount;
+    *StartIndex = Block * ParticlesPerBlock;
+    *EndIndex = Block < BlockCount - 1 ? *StartIndex + ParticlesPerBlock : ParticleCount;
+}
+
+inline u32 ZigZag(s32 Value)
+{
+    return ((u32)Value << 1) ^ (u32)(Value >> 31);
+}
+
+inline s32 UnZigZag(u32 Value)
+{
+    return (s32)(Value >> 1) ^ -(s32)(Value & 1);
+}
+
+
+
+//
+// Recorder
+//
+// Record() copies the positions into a free slot and returns, the encoding and writing is done on the
+// recorder threads. If all slots are busy the frame is dropped rather than stalling the caller.
+//
+u32 constexpr kRecorderSlotCount = 3;
+
+struct particle_recorder;
+struct recorder_thread_context
+{
+    particle_recorder *Recorder;
+    
+    HANDLE Encode;
+    HANDLE Finished;
+    HANDLE ThreadHandle;
+    u32 ThreadID;
+    
+    u32 StartIndex;
+    u32 EndIndex;
+    
+    u8 *Output;
+    u32 OutputSize;
+};
+
+struct particle_recorder
+{
+    FILE *File = nullptr;
+    recording_header Header;
+    
+    v3 *Slots[kRecorderSlotCount];
+    u32 SlotFrameIndex[kRecorderSlotCount];
+    u32 Head = 0; // Next slot to be filled by Record()
+    u32 Tail = 0; // Next slot to be encoded
+    LONG volatile FullSlotCount = 0;
+    
+    s32 *Q[3]; // Quantised positions of the current and the two previous frames
+    
+    v3 *Frame;  // The frame being encoded
+    recording_prediction Prediction;
+    
+    u64 *FrameOffsets = nullptr;
+    u32 FrameOffsetCapacity = 0;
+    u32 FrameCount = 0;
+    u32 SourceFrameCount = 0; // Frames passed to Record(), including the dropped ones
+    u32 DroppedFrameCount = 0;
+    
+    recorder_thread_context *Encoders = nullptr;
+    u32 EncoderCount = 0;
+    
+    HANDLE FrameReady;
+    HANDLE WriterThread;
+    u32 WriterThreadID;
+    u64 FileOffset = 0;
+    
+    b32 volatile IsRecording = false;
+    b32 volatile IsEncoding = false;
+    b32 Error = false;
+};
+
+b32 StartRecording(particle_recorder *Recorder, char const *FileName, u32 ParticleCount, 
+                   u32 EncoderCount, f32 Step = 1.0f / 1024.0f, u32 KeyframeInterval = 30);
+void Record(particle_recorder *Recorder, v3 *P);
+b32 StopRecording(particle_recorder *Recorder);
+
+
+
+
+//
+// Player
+//
+// Decodes frames from a memory mapped recording. Seeking decodes forward from the closest keyframe
+// before the frame, stepping forward continues from the last decoded frame. After a frame has been
+// returned the next one is decoded in the background, so playing forward only waits for it when the
+// decoding is slower than the playback.
+//
+enum player_job
+{
+    PlayerJob_Decode,
+    PlayerJob_Dequantise,
+};
+
+struct particle_player;
+struct player_thread_context
+{
+    particle_player *Player;
+    
+    HANDLE Work;
+    HANDLE Finished;
+    HANDLE ThreadHandle;
+    u32 ThreadID;
+    
+    u32 WorkerIndex;
+    b32 Error;
+};
+
+struct particle_player
+{
+    mapped_file File;
+    recording_header *Header = nullptr;
+    u64 *FrameOffsets = nullptr;
+    u32 FrameCount = 0;
+    u64 IndexOffset = 0;    // End of the last frame
+    
+    s32 *Q[3];              // Quantised positions of CurrentFrame and the two frames before it
+    s32 CurrentFrame = -1;
+    u32 HistoryCount = 0;   // Number of valid frames in Q
+    
+    player_job Job;
+    u32 JobFrame;
+    s32 *JobSource;
+    v3 *JobOutput;
+    b32 IsWorking = false;  // A job has been handed to the workers and not yet waited for
+    
+    player_thread_context *Workers = nullptr;
+    u32 WorkerCount = 0;
+    
+    b32 volatile IsPlaying = false;
+    b32 Error = false;
+};
+
+b32 OpenPlayer(particle_player *Player, char const *FileName, u32 ThreadCount);
+b32 GetFrame(particle_player *Player, u32 FrameIndex, v3 *P);
+void ClosePlayer(particle_player *Player);
+
+
+#endif
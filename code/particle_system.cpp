@@ -23,7 +23,9 @@
 //
 
 #include "particle_system.h"
+#include "profiler.h"
 #include <stdlib.h>
+#include <string.h>
 #include <process.h>
 
 #define UNUSED_VAR(x) x
@@ -36,6 +38,30 @@
 
 
 
+// The particles are emitted in a narrow cone, the direction only depends on the index of the particle
+// so the result does not depend on how the particles are split over the threads
+static v3 GetEmitVelocity(particle_system *ParticleSystem, u32 Index)
+{
+    f32 Radius = 0.15f;
+    f32 Theta = Tau32 / (f32)ParticleSystem->ParticleCount;
+    f32 Angle = (f32)(Index + 1) * Theta;
+    
+    v3 F = V3(Radius * Cos(Angle), 1.0f, -Radius * Sin(Angle));
+    F = Normalize(F);
+    
+    v3 Result = ParticleSystem->Force * F;
+    return Result;
+}
+
+
+// Identifies the Simulate and Finished handoffs of a worker in a frame in the trace
+static u64 GetFlowID(u32 FrameIndex, u32 ThreadIndex, b32 IsFinished)
+{
+    u64 Result = ((((u64)FrameIndex << 16) | ThreadIndex) << 1) | (IsFinished ? 1 : 0);
+    return Result;
+}
+
+
 unsigned int __stdcall ParticleUpdate(void* Data)
 {
     thread_context *Context = (thread_context *)Data;
@@ -50,8 +76,8 @@ unsigned int __stdcall ParticleUpdate(void* Data)
     UNUSED_VAR(ThreadID);
     printf("Thread# %u handles %u <= Index < %u\n", ThreadID, Context->StartIndex, Context->EndIndex);
     
-    f32 dt = ParticleSystem->dt;
-    u32 ParticleCount = ParticleSystem->ParticleCount;
+    ProfileRegisterThread("Particle worker");
+    u32 ThreadIndex = (u32)(Context - ParticleSystem->ThreadContext);
     
     while (ParticleSystem->IsSimulating)
     {
@@ -60,42 +86,120 @@ unsigned int __stdcall ParticleUpdate(void* Data)
         {
             case WAIT_OBJECT_0: 
             {
-                f32 Radius = 0.15f;
-                f32 Theta = Tau32 / (f32)ParticleCount;
-                f32 Angle = (f32)Context->StartIndex * Theta;
+                // ShutDown() wakes the thread without work to let it exit
+                if (!ParticleSystem->IsSimulating)
+                {
+                    break;
+                }
+                
+                ProfileBegin("Simulate");
+                u64 BusyBegin = ReadTimestamp();
+                ProfileFlow("Simulate", BusyBegin, GetFlowID(ParticleSystem->FrameIndex, ThreadIndex, false), true);
+                
+                particle_lod *Lod = &ParticleSystem->Lod;
+                // NOTE(Marcus): Read every frame, LoadCheckpoint() can change the time step
+                f32 dt = ParticleSystem->dt;
+                u32 FrameIndex = ParticleSystem->FrameIndex;
+                u32 StepCount = 0;
+                u32 CollisionCount = 0;
+                
+                f32 RestSpeedSq = Square(ParticleSystem->RestSpeed);
+                u32 RestStepCount = ParticleSystem->RestStepCount;
+                b32 ContactResponse = RestStepCount > 0 || ParticleSystem->Friction > 0.0f;
+                
+                //
+                // Resting particles, only their lifetime is updated. Expired particles are woken up
+                // and respawned by the loop below.
+                if (ParticleSystem->WakeRequested)
+                {
+                    for (u32 RestIndex = 0; RestIndex < Context->RestingCount; ++RestIndex)
+                    {
+                        // The age was kept up to date while resting, the next step is one frame
+                        ParticleSystem->Flags[Context->Resting[RestIndex]] = 0;
+                        ParticleSystem->LastStep[Context->Resting[RestIndex]] = (u8)(FrameIndex - 1);
+                    }
+                    Context->RestingCount = 0;
+                }
+                
+                // NOTE(Marcus): An expired particle is respawned here and keeps its resting flag
+                //               until after the loop below, so its age is only advanced once. The
+                //               expired ones are moved to the end of the list, past RestingCount,
+                //               and the particles put to rest by the loop are added after them.
+                u32 RestingCountBefore = Context->RestingCount;
+                for (u32 RestIndex = 0; RestIndex < Context->RestingCount;)
+                {
+                    u32 Index = Context->Resting[RestIndex];
+                    
+                    if (AdvanceAge(ParticleSystem, Index, dt))
+                    {
+                        ResetAge(ParticleSystem, Index);
+                        ParticleSystem->P[Index] = ParticleSystem->Po;
+                        StoreVelocity(ParticleSystem, Index, GetEmitVelocity(ParticleSystem, Index));
+                        ParticleSystem->LastStep[Index] = (u8)FrameIndex;
+                        ++StepCount;
+                        
+                        Context->Resting[RestIndex] = Context->Resting[--Context->RestingCount];
+                        Context->Resting[Context->RestingCount] = Index;
+                    }
+                    else
+                    {
+                        ++RestIndex;
+                    }
+                }
+                u32 WokenBegin = Context->RestingCount;
+                u32 RestingEnd = RestingCountBefore;
                 
                 for (u32 Index = Context->StartIndex; Index < Context->EndIndex; ++Index)
                 {
+                    u8 *Flags = &ParticleSystem->Flags[Index];
+                    if (*Flags & ParticleFlag_Resting)
+                    {
+                        continue;
+                    }
+                    
                     v3 *P = &ParticleSystem->P[Index];
-                    v3 *dP = &ParticleSystem->dP[Index];
-                    f32 *Duration = &ParticleSystem->Duration[Index];
-                    f32 *Elapsed = &ParticleSystem->Elapsed[Index];
                     
-                    *Elapsed += dt;
-                    if (*Elapsed > *Duration)
+                    //
+                    // Level of detail, far away particles are stepped every 2nd or 4th frame. The
+                    // index offset spreads the skipped particles over the frames. The time step
+                    // covers the frames since the last step, which differs from the interval on the
+                    // frames where a particle moves to another band.
+                    if (Lod->Enabled)
                     {
-                        *Elapsed = 0;
-                        *P = ParticleSystem->Po;
+                        f32 DistanceSq = LengthSq(*P - Lod->CameraP);
+                        u32 Interval = DistanceSq < Lod->NearDistanceSq ? 1 : (DistanceSq < Lod->FarDistanceSq ? 2 : 4);
                         
-                        Angle += Theta;
-                        if (Angle > Tau32)
+                        if (((FrameIndex + Index) & (Interval - 1)) != 0)
                         {
-                            Angle -= Tau32;
+                            continue;
                         }
-                        
-                        v3 F = V3(Radius * Cos(Angle), 1.0f, -Radius * Sin(Angle));
-                        F = Normalize(F);
-                        *dP = ParticleSystem->Force * F;
+                    }
+                    
+                    u8 *LastStep = &ParticleSystem->LastStep[Index];
+                    f32 Stepdt = (f32)(u8)(FrameIndex - *LastStep) * dt;
+                    *LastStep = (u8)FrameIndex;
+                    ++StepCount;
+                    
+                    v3 dP;
+                    if (AdvanceAge(ParticleSystem, Index, Stepdt))
+                    {
+                        ResetAge(ParticleSystem, Index);
+                        *P = ParticleSystem->Po;
+                        *Flags = 0;
+                        dP = GetEmitVelocity(ParticleSystem, Index);
                     }
                     else
                     {
-                        v4 Po = V4(*P + *dP * dt, 1.0f);
-                        *dP += ParticleSystem->ddPg * dt;
+                        dP = LoadVelocity(ParticleSystem, Index);
+                        
+                        v4 Po = V4(*P + dP * Stepdt, 1.0f);
+                        dP += ParticleSystem->ddPg * Stepdt;
                         
                         v4 Pt = Po * ParticleSystem->ObjectToTerrainMatrix;
                         s32 x = (u32)Pt.x;
                         s32 z = (u32)Pt.z;
                         
+                        b32 InContact = false;
                         if ((0 <= x && x < (s32)Context->Width) && 
                             (0 <= z && z < (s32)Context->Height))
                         {
@@ -103,15 +207,64 @@ unsigned int __stdcall ParticleUpdate(void* Data)
                             if (Pt.y < h)
                             {
                                 Pt.y = (f32)h + 0.1f;
+                                ++CollisionCount;
                             }
+                            
+                            // NOTE(Marcus): Particles lying on the terrain sit at h + 0.1
+                            InContact = Pt.y <= (f32)h + 0.1f;
                         }
                         
                         
                         Po = Pt * ParticleSystem->TerrainToObjectMatrix;
                         *P = Po.xyz();
+                        
+                        //
+                        // Contact, remove the velocity into the terrain and apply friction to the rest
+                        u32 SlowSteps = 0;
+                        if (InContact && ContactResponse)
+                        {
+                            v4 dPt = V4(dP, 0.0f) * ParticleSystem->ObjectToTerrainMatrix;
+                            f32 Damping = Max(0.0f, 1.0f - ParticleSystem->Friction * Stepdt);
+                            dPt = V4(Damping * dPt.x, Max(0.0f, dPt.y), Damping * dPt.z, 0.0f);
+                            dP = (dPt * ParticleSystem->TerrainToObjectMatrix).xyz();
+                            
+                            if (RestStepCount > 0 && LengthSq(dP) < RestSpeedSq)
+                            {
+                                SlowSteps = (*Flags >> ParticleFlag_SlowStepShift) + 1;
+                            }
+                        }
+                        
+                        if (RestStepCount > 0 && SlowSteps >= RestStepCount)
+                        {
+                            *Flags = ParticleFlag_Resting;
+                            dP = v3_zero;
+                            Context->Resting[RestingEnd++] = Index;
+                        }
+                        else
+                        {
+                            *Flags = (u8)(SlowSteps << ParticleFlag_SlowStepShift);
+                        }
                     }
+                    
+                    StoreVelocity(ParticleSystem, Index, dP);
                 }
                 
+                // The particles respawned from rest are stepped as usual from the next frame, the
+                // newly resting ones take their place in the list
+                for (u32 RestIndex = WokenBegin; RestIndex < RestingCountBefore; ++RestIndex)
+                {
+                    ParticleSystem->Flags[Context->Resting[RestIndex]] = 0;
+                }
+                memmove(Context->Resting + WokenBegin, Context->Resting + RestingCountBefore, 
+                        (RestingEnd - RestingCountBefore) * sizeof(u32));
+                Context->RestingCount = WokenBegin + (RestingEnd - RestingCountBefore);
+                
+                Context->StepCount = StepCount;
+                Context->CollisionCount = CollisionCount;
+                Context->BusyTicks = ReadTimestamp() - BusyBegin;
+                ProfileFlow("Finished", ReadTimestamp(), GetFlowID(ParticleSystem->FrameIndex, ThreadIndex, true), false);
+                ProfileEnd("Simulate", BusyBegin);
+                
                 printf("Thread# %u is done!\n", ThreadID);
                 ResetEvent(Context->Simulate);
                 SetEvent(Context->Finished);
@@ -120,12 +273,14 @@ unsigned int __stdcall ParticleUpdate(void* Data)
             default: 
             {
                 printf("ThreadID %u, wait error (%d)\n", ThreadID, GetLastError()); 
+                ProfileUnregisterThread();
                 return 0; 
             } break;
         }
     }
     printf("ThreadID %u, exiting...\n", ThreadID);
     
+    ProfileUnregisterThread();
     return 0;
 }
 
@@ -137,6 +292,13 @@ void Init(particle_system *ParticleSystem, u32 ParticleCount, u32 ThreadCount, f
     ParticleSystem->P = (v3 *)calloc(ParticleCount, sizeof(v3));
     assert(ParticleSystem->P);
     
+#if PARTICLE_COMPACT_LAYOUT
+    ParticleSystem->dP = (u16 *)calloc(3 * ParticleCount, sizeof(u16));
+    assert(ParticleSystem->dP);
+    
+    ParticleSystem->Age = (u16 *)calloc(ParticleCount, sizeof(u16));
+    assert(ParticleSystem->Age);
+#else
     ParticleSystem->dP = (v3 *)calloc(ParticleCount, sizeof(v3));
     assert(ParticleSystem->dP);
     
@@ -145,30 +307,32 @@ void Init(particle_system *ParticleSystem, u32 ParticleCount, u32 ThreadCount, f
     
     ParticleSystem->Elapsed = (f32 *)calloc(ParticleCount, sizeof(f32));
     assert(ParticleSystem->Elapsed);
+#endif
+    
+    ParticleSystem->Flags = (u8 *)calloc(ParticleCount, sizeof(u8));
+    assert(ParticleSystem->Flags);
+    
+    // As if stepped in the frame before the first one
+    ParticleSystem->LastStep = (u8 *)malloc(ParticleCount * sizeof(u8));
+    assert(ParticleSystem->LastStep);
+    memset(ParticleSystem->LastStep, (u8)(ParticleSystem->FrameIndex - 1), ParticleCount * sizeof(u8));
+    
+    ParticleSystem->dt = dt;
+    ParticleSystem->ParticleCount = ParticleCount;
+#if PARTICLE_COMPACT_LAYOUT
+    SetAgeScale(ParticleSystem);
+#endif
     
-    f32 Radius = 0.15f;
-    f32 Angle = 0.0f;
-    f32 Theta = Tau32 / (f32)ParticleCount;
     for (u32 Index = 0; Index < ParticleCount; ++Index)
     {
         ParticleSystem->P[Index] = ParticleSystem->Po;
-        ParticleSystem->Duration[Index] = 8.0f;
-        ParticleSystem->Elapsed[Index] = 0.0f;
-        
-        Angle += Theta;
-        if (Angle > Tau32)
-        {
-            Angle = Tau32 - Angle;
-        }
-        
-        v3 F = V3(Radius * Cos(Angle), 1.0f, Radius * -Sin(Angle));
-        F = Normalize(F);
-        ParticleSystem->dP[Index]= ParticleSystem->Force * F;
+#if !PARTICLE_COMPACT_LAYOUT
+        ParticleSystem->Duration[Index] = ParticleSystem->Lifetime;
+#endif
+        ResetAge(ParticleSystem, Index);
+        StoreVelocity(ParticleSystem, Index, GetEmitVelocity(ParticleSystem, Index));
     }
     
-    ParticleSystem->dt = dt;
-    ParticleSystem->ParticleCount = ParticleCount;
-    
     
     //
     // Multithreaded stuff
@@ -203,6 +367,11 @@ void Init(particle_system *ParticleSystem, u32 ParticleCount, u32 ThreadCount, f
             ThreadContext[Index].EndIndex = ParticleCount;
         }
         
+        u32 RangeCount = ThreadContext[Index].EndIndex - ThreadContext[Index].StartIndex;
+        ThreadContext[Index].Resting = (u32 *)calloc(RangeCount > 0 ? RangeCount : 1, sizeof(u32));
+        assert(ThreadContext[Index].Resting);
+        ThreadContext[Index].RestingCount = 0;
+        
         ThreadContext[Index].Simulate = CreateEventA(nullptr, true, false, nullptr);
         if(ThreadContext[Index].Simulate == nullptr)
         {
@@ -237,11 +406,71 @@ void Init(particle_system *ParticleSystem, u32 ParticleCount, u32 ThreadCount, f
 
 
 
+//
+// Recreates the per thread lists of resting particles from the particle flags
+void RebuildRestingSets(particle_system *ParticleSystem)
+{
+    thread_context *ThreadContext = ParticleSystem->ThreadContext;
+    for (u32 ThreadIndex = 0; ThreadIndex < ThreadContext->ThreadCount; ++ThreadIndex)
+    {
+        thread_context *Context = &ThreadContext[ThreadIndex];
+        
+        Context->RestingCount = 0;
+        for (u32 Index = Context->StartIndex; Index < Context->EndIndex; ++Index)
+        {
+            if (ParticleSystem->Flags[Index] & ParticleFlag_Resting)
+            {
+                Context->Resting[Context->RestingCount++] = Index;
+            }
+        }
+    }
+}
+
+
+
+//
+// Wakes up all resting particles at the start of the next Update(), call this whenever the terrain
+// or the forces acting on the particles changes.
+void Wake(particle_system *ParticleSystem)
+{
+    ParticleSystem->WakeRequested = true;
+}
+
+
+
+void SetLodCamera(particle_system *ParticleSystem, v3 CameraP, f32 Fov, u32 ViewportWidth)
+{
+    particle_lod *Lod = &ParticleSystem->Lod;
+    
+    b32 Invertible = false;
+    m4 WorldToObjectMatrix = M4AffineInverse(&ParticleSystem->ObjectToWorldMatrix, &Invertible);
+    assert(Invertible);
+    Lod->CameraP = (V4(CameraP, 1.0f) * WorldToObjectMatrix).xyz();
+    
+    //
+    // Projected size in pixels = ParticleSize * ViewportWidth / (2 * Distance * tan(Fov / 2)),
+    // solved for the distance at which a particle has the given size.
+    f32 PixelsAtUnitDistance = Lod->ParticleSize * (f32)ViewportWidth / (2.0f * Tan(0.5f * Fov));
+    Lod->NearDistance = PixelsAtUnitDistance / Lod->FullRatePixelSize;
+    Lod->FarDistance = PixelsAtUnitDistance / Lod->HalfRatePixelSize;
+}
+
+
+
 void Update(particle_system *ParticleSystem)
 {
+    PROFILE_SCOPE("Update");
+    
     thread_context *ThreadContext = ParticleSystem->ThreadContext;
+    particle_lod *Lod = &ParticleSystem->Lod;
+    
+    Lod->NearDistanceSq = Square(Lod->Scale * Lod->NearDistance);
+    Lod->FarDistanceSq = Square(Lod->Scale * Lod->FarDistance);
+    
+    u64 BarrierBegin = ReadTimestamp();
     for (u32 Index = 0; Index < ThreadContext->ThreadCount; ++Index)
     {
+        ProfileFlow("Simulate", ReadTimestamp(), GetFlowID(ParticleSystem->FrameIndex, Index, false), false);
         b32 Result = SetEvent(ThreadContext[Index].Simulate);
         if(!Result)
         {
@@ -255,7 +484,49 @@ void Update(particle_system *ParticleSystem)
     {
         WaitForSingleObject(ThreadContext[Index].Finished, INFINITE);
         ResetEvent(ThreadContext[Index].Finished);
+        ProfileFlow("Finished", ReadTimestamp(), GetFlowID(ParticleSystem->FrameIndex, Index, true), true);
+    }
+    
+    u64 BarrierEnd = ReadTimestamp();
+    u64 BusyTicks[kProfileThreadCountMax];
+    u32 WorkerCount = ThreadContext->ThreadCount < kProfileThreadCountMax ? ThreadContext->ThreadCount : kProfileThreadCountMax;
+    for (u32 Index = 0; Index < WorkerCount; ++Index)
+    {
+        BusyTicks[Index] = ThreadContext[Index].BusyTicks;
+    }
+    ProfileBarrier("Update", BarrierBegin, BarrierEnd, BusyTicks, WorkerCount);
+    
+    ParticleSystem->WakeRequested = false;
+    
+    //
+    // Keep the number of particle steps within the budget by pulling the lod distances closer
+    Lod->StepCount = 0;
+    ParticleSystem->RestingCount = 0;
+    ParticleSystem->CollisionCount = 0;
+    for (u32 Index = 0; Index < ThreadContext->ThreadCount; ++Index)
+    {
+        Lod->StepCount += ThreadContext[Index].StepCount;
+        ParticleSystem->RestingCount += ThreadContext[Index].RestingCount;
+        ParticleSystem->CollisionCount += ThreadContext[Index].CollisionCount;
+    }
+    
+    ProfileCounter("Awake particles", ParticleSystem->ParticleCount - ParticleSystem->RestingCount);
+    ProfileCounter("Collisions", ParticleSystem->CollisionCount);
+    ProfileCounter("Particle steps", Lod->StepCount);
+    
+    if (Lod->StepBudget > 0)
+    {
+        if (Lod->StepCount > Lod->StepBudget)
+        {
+            Lod->Scale = Max(0.05f, 0.9f * Lod->Scale);
+        }
+        else
+        {
+            Lod->Scale = Min(1.0f, 1.02f * Lod->Scale);
+        }
     }
+    
+    ++ParticleSystem->FrameIndex;
 }
 
 
@@ -265,6 +536,11 @@ void ShutDown(particle_system *ParticleSystem)
     thread_context *ThreadContext = ParticleSystem->ThreadContext;
     
     ParticleSystem->IsSimulating = false;
+    for (u32 Index = 0; Index < ThreadContext->ThreadCount; ++Index)
+    {
+        SetEvent(ThreadContext[Index].Simulate);
+    }
+    
     for (u32 Index = 0; Index < ThreadContext->ThreadCount; ++Index)
     {
         WaitForSingleObject(ThreadContext[Index].ThreadHandle, INFINITE);
@@ -281,28 +557,35 @@ void ShutDown(particle_system *ParticleSystem)
         {
             printf("Closed thread %u.\n", ThreadContext[Index].ThreadID);
         }
+        
+        CloseHandle(ThreadContext[Index].Simulate);
+        CloseHandle(ThreadContext[Index].Finished);
     }
     
     
     //
     // Free memory
-    if (ParticleSystem->P)
+    if (ParticleSystem->Checkpoint.Data)
     {
-        free(ParticleSystem->P);
+        CloseMappedFile(&ParticleSystem->Checkpoint);
     }
-    
-    if (ParticleSystem->dP)
-    {
-        free(ParticleSystem->dP);
-    }
-    
-    if (ParticleSystem->Duration)
+    else
     {
-        free(ParticleSystem->Duration);
+        particle_attribute Attributes[kParticleAttributeCountMax];
+        u32 AttributeCount = GetAttributes(ParticleSystem, Attributes);
+        for (u32 Index = 0; Index < AttributeCount; ++Index)
+        {
+            if (*Attributes[Index].Data)
+            {
+                free(*Attributes[Index].Data);
+            }
+        }
     }
     
-    if (ParticleSystem->Elapsed)
+    for (u32 Index = 0; Index < ThreadContext->ThreadCount; ++Index)
     {
-        free(ParticleSystem->Elapsed);
+        free(ThreadContext[Index].Resting);
     }
+    free(ThreadContext);
+    ParticleSystem->ThreadContext = nullptr;
 }
\ No newline at end of file
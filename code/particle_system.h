@@ -28,6 +28,19 @@
 #include <windows.h>
 
 #include "mathematics.h"
+#include "mapped_file.h"
+
+// NOTE(Marcus): Build with /DPARTICLE_COMPACT_LAYOUT=1 to store the velocity as half floats and the
+//               age as a normalised u16. This cuts the bytes read and written per particle step
+//               from 32 to 20, at the cost of 11 bits of precision in the velocity. The half float
+//               conversions requires a cpu with F16C.
+#ifndef PARTICLE_COMPACT_LAYOUT
+#define PARTICLE_COMPACT_LAYOUT 0
+#endif
+
+#if PARTICLE_COMPACT_LAYOUT
+#include <immintrin.h>
+#endif
 
 
 
@@ -53,6 +66,60 @@ struct thread_context
     u32 ThreadID;
     u32 StartIndex;
     u32 EndIndex;
+    
+    u32 StepCount;
+    u32 CollisionCount;
+    u64 BusyTicks;    // Time spent simulating in the last Update(), in ReadTimestamp() ticks
+    
+    u32 *Resting;     // Compacted list of the resting particles in [StartIndex, EndIndex)
+    u32 RestingCount;
+};
+
+
+//
+// Level of detail
+// Particles that are small on screen are integrated less often, but with a larger time step. The
+// thresholds are given in projected size (pixels) and converted to distances by SetLodCamera().
+//
+struct particle_lod
+{
+    v3 CameraP = v3_zero; // In object space
+    
+    f32 ParticleSize = 1.0f;        // World space size of the quad generated for each particle
+    f32 FullRatePixelSize = 8.0f;   // Larger than this on screen: updated every step
+    f32 HalfRatePixelSize = 2.0f;   // Larger than this: every 2nd step, smaller: every 4th step
+    
+    f32 NearDistance = f32Max;
+    f32 FarDistance = f32Max;
+    f32 NearDistanceSq = f32Max;
+    f32 FarDistanceSq = f32Max;
+    
+    // NOTE(Marcus): The distances are multiplied with Scale, which Update() lowers when a frame
+    //               takes more particle steps than StepBudget and slowly raises back towards 1.
+    f32 Scale = 1.0f;
+    u32 StepBudget = 0; // 0 = unbounded
+    u32 StepCount = 0;  // Particle steps taken during the last Update()
+    
+    b32 Enabled = false;
+};
+
+
+//
+// Rest detection
+// A particle that is in contact with the terrain and moves slower than RestSpeed for RestStepCount
+// consecutive steps is put to rest, a RestStepCount of 0 turns it off. Resting particles are only
+// aged until their duration expires.
+//
+// While rest or friction is on, a particle in contact loses its velocity into the terrain and its
+// tangential velocity is damped by Friction. With both off the velocity is left alone on contact,
+// as it always was. Rest needs Friction > 0 in practice, undamped particles keep sliding down
+// the slopes and seldom get slow enough.
+//
+enum particle_flag
+{
+    ParticleFlag_Resting = 0x01,
+    
+    ParticleFlag_SlowStepShift = 1, // The remaining bits counts the consecutive slow steps
 };
 
 
@@ -66,23 +133,172 @@ struct particle_system
     m4 TerrainToObjectMatrix;
     
     v3 *P = nullptr;
+#if PARTICLE_COMPACT_LAYOUT
+    u16 *dP = nullptr;  // Three half floats per particle
+    u16 *Age = nullptr; // Elapsed * AgeScale, the particle expires at AgeLimit
+    f32 AgeScale;       // Age units per second, see SetAgeScale()
+    u32 AgeLimit;
+#else
     v3 *dP = nullptr;
     f32 *Duration = nullptr;
     f32 *Elapsed = nullptr;
+#endif
+    u8 *Flags = nullptr;
+    u8 *LastStep = nullptr; // Low bits of the FrameIndex the particle was last stepped in
     
     thread_context *ThreadContext;
+    particle_lod Lod;
+    
+    mapped_file Checkpoint; // When restored from a checkpoint the attributes lives in this mapping
     
     v3 Po = v3_zero;
     v3 ddPg = V3(0.0f, -9.8f, 0.0f); // Gravity acceleration
     
     u32 ParticleCount;
+    u32 RestingCount = 0;
+    u32 CollisionCount = 0; // In the last Update()
+    u32 FrameIndex = 0;
     
     f32 dt;
+    f32 Lifetime = 8.0f; // Duration of all particles emitted
     f32 Force = 10.0f;
+    f32 Friction = 0.0f;    // Damping of the tangential velocity while in contact with the terrain
+    f32 RestSpeed = 0.25f;
+    u32 RestStepCount = 0;  // At most 127
+    b32 WakeRequested = false;
     b32 IsSimulating = true;
 };
 
+//
+// All per particle arrays, used when the arrays are handled as a whole (allocation, checkpoints)
+//
+u32 constexpr kParticleAttributeCountMax = 6;
+
+struct particle_attribute
+{
+    char const *Name;
+    void **Data;
+    u32 ElementSize;
+};
+
+inline u32 GetAttributes(particle_system *ParticleSystem, particle_attribute *Attributes)
+{
+    u32 Count = 0;
+    Attributes[Count++] = {"P", (void **)&ParticleSystem->P, sizeof(v3)};
+#if PARTICLE_COMPACT_LAYOUT
+    Attributes[Count++] = {"dP", (void **)&ParticleSystem->dP, 3 * sizeof(u16)};
+    Attributes[Count++] = {"Age", (void **)&ParticleSystem->Age, sizeof(u16)};
+#else
+    Attributes[Count++] = {"dP", (void **)&ParticleSystem->dP, sizeof(v3)};
+    Attributes[Count++] = {"Duration", (void **)&ParticleSystem->Duration, sizeof(f32)};
+    Attributes[Count++] = {"Elapsed", (void **)&ParticleSystem->Elapsed, sizeof(f32)};
+#endif
+    Attributes[Count++] = {"Flags", (void **)&ParticleSystem->Flags, sizeof(u8)};
+    Attributes[Count++] = {"LastStep", (void **)&ParticleSystem->LastStep, sizeof(u8)};
+    
+    return Count;
+}
+
+
+
+//
+// Attribute access, hides how the velocity and the age are stored
+//
+#if PARTICLE_COMPACT_LAYOUT
+inline v3 LoadVelocity(particle_system *ParticleSystem, u32 Index)
+{
+    u16 *Half = &ParticleSystem->dP[3 * Index];
+    __m128i H = _mm_cvtsi32_si128(*(s32 *)Half);
+    H = _mm_insert_epi16(H, Half[2], 2);
+    
+    f32 E[4];
+    _mm_storeu_ps(E, _mm_cvtph_ps(H));
+    
+    return V3(E[0], E[1], E[2]);
+}
+
+inline void StoreVelocity(particle_system *ParticleSystem, u32 Index, v3 dP)
+{
+    u16 *Half = &ParticleSystem->dP[3 * Index];
+    __m128i H = _mm_cvtps_ph(_mm_setr_ps(dP.x, dP.y, dP.z, 0.0f), _MM_FROUND_TO_NEAREST_INT);
+    
+    // NOTE(Marcus): Exactly 6 bytes are written, the neighbouring particle might belong to another thread
+    *(s32 *)Half = _mm_cvtsi128_si32(H);
+    Half[2] = (u16)_mm_extract_epi16(H, 2);
+}
+
+inline f32 GetElapsed(particle_system *ParticleSystem, u32 Index)
+{
+    return (f32)ParticleSystem->Age[Index] / ParticleSystem->AgeScale;
+}
+
+// NOTE(Marcus): A step advances the age by a whole number of units, and the lifetime is a whole
+//               number of steps, so the particle expires on the same step as in the float layout.
+//               Scaling 0xFFFF by the lifetime instead rounds the units per step up, 137 rather
+//               than 136.5 for 480 steps, and the particle expires two steps early.
+inline void SetAgeScale(particle_system *ParticleSystem)
+{
+    f32 Steps = ParticleSystem->Lifetime / ParticleSystem->dt + 0.5f;
+    u32 StepCount = Steps < 1.0f ? 1 : (Steps > (f32)0xFFFF ? 0xFFFF : (u32)Steps);
+    u32 UnitsPerStep = 0xFFFF / StepCount;
+    
+    ParticleSystem->AgeScale = (f32)UnitsPerStep / ParticleSystem->dt;
+    ParticleSystem->AgeLimit = UnitsPerStep * StepCount;
+}
+
+inline void ResetAge(particle_system *ParticleSystem, u32 Index)
+{
+    ParticleSystem->Age[Index] = 0;
+}
+
+// Returns true if the particle has expired, the age saturates at the end of the lifetime
+inline b32 AdvanceAge(particle_system *ParticleSystem, u32 Index, f32 dt)
+{
+    u32 Age = ParticleSystem->Age[Index] + (u32)(dt * ParticleSystem->AgeScale + 0.5f);
+    ParticleSystem->Age[Index] = (u16)(Age < ParticleSystem->AgeLimit ? Age : ParticleSystem->AgeLimit);
+    
+    return Age >= ParticleSystem->AgeLimit;
+}
+#else
+inline v3 LoadVelocity(particle_system *ParticleSystem, u32 Index)
+{
+    return ParticleSystem->dP[Index];
+}
+
+inline void StoreVelocity(particle_system *ParticleSystem, u32 Index, v3 dP)
+{
+    ParticleSystem->dP[Index] = dP;
+}
+
+inline f32 GetElapsed(particle_system *ParticleSystem, u32 Index)
+{
+    return ParticleSystem->Elapsed[Index];
+}
+
+inline void ResetAge(particle_system *ParticleSystem, u32 Index)
+{
+    ParticleSystem->Elapsed[Index] = 0.0f;
+}
+
+// Returns true if the particle has expired
+inline b32 AdvanceAge(particle_system *ParticleSystem, u32 Index, f32 dt)
+{
+    ParticleSystem->Elapsed[Index] += dt;
+    return ParticleSystem->Elapsed[Index] > ParticleSystem->Duration[Index];
+}
+#endif
+
+
+
 void Init(particle_system *ParticleSystem, u32 ParticleCount, u32 ThreadCount, f32 dt, 
           u32 *Heights, u32 Width, u32 Height, v3 *Normals);
 void Update(particle_system *ParticleSystem);
+void Wake(particle_system *ParticleSystem);
+void SetLodCamera(particle_system *ParticleSystem, v3 CameraP, f32 Fov, u32 ViewportWidth);
 void ShutDown(particle_system *ParticleSystem);
+
+// NOTE(Marcus): A checkpoint can only be loaded into a particle system with the same particle count
+//               and layout, and not while Update() is running.
+b32 SaveCheckpoint(particle_system *ParticleSystem, char const *FileName);
+b32 LoadCheckpoint(particle_system *ParticleSystem, char const *FileName);
+void RebuildRestingSets(particle_system *ParticleSystem);
@@ -0,0 +1,259 @@
+// 
+// MIT License
+// 
+// Copyright (c) 2018 Marcus Larsson
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+#include "perf_counters.h"
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <sys/types.h>
+#include <dirent.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdlib.h>
+#endif
+
+#if 0
+#include <stdio.h>
+#else
+#define printf(...)
+#endif
+
+
+
+char const *GetPerfCounterName(perf_counter Counter)
+{
+    switch (Counter)
+    {
+        case PerfCounter_Cycles:       return "cycles";
+        case PerfCounter_Instructions: return "instructions";
+        case PerfCounter_CacheMisses:  return "LLC misses";
+        case PerfCounter_BranchMisses: return "branch misses";
+        default:                       return "unknown";
+    }
+}
+
+
+
+#if defined(__linux__)
+//
+// perf_event
+//
+static int OpenPerfEvent(pid_t ThreadID, u64 Config)
+{
+    perf_event_attr Attribute = {};
+    Attribute.type = PERF_TYPE_HARDWARE;
+    Attribute.size = sizeof(perf_event_attr);
+    Attribute.config = Config;
+    Attribute.disabled = 1;
+    Attribute.exclude_kernel = 1;
+    Attribute.exclude_hv = 1;
+    Attribute.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    
+    int Result = (int)syscall(__NR_perf_event_open, &Attribute, ThreadID, -1, -1, 0);
+    return Result;
+}
+
+
+b32 OpenPerfCounters(perf_counters *Counters, HANDLE *Threads, u32 ThreadCount)
+{
+    *Counters = {};
+    Counters->Backend = "perf_event";
+    
+    u64 const Configs[PerfCounter_Count] = 
+    {
+        PERF_COUNT_HW_CPU_CYCLES,
+        PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CACHE_MISSES,
+        PERF_COUNT_HW_BRANCH_MISSES,
+    };
+    
+    for (u32 Counter = 0; Counter < PerfCounter_Count; ++Counter)
+    {
+        Counters->Available[Counter] = true;
+    }
+    
+    //
+    // Every thread of the process, including the workers that are already running
+    DIR *Directory = opendir("/proc/self/task");
+    if (!Directory)
+    {
+        return false;
+    }
+    
+    while (dirent *Entry = readdir(Directory))
+    {
+        if (Entry->d_name[0] == '.' || Counters->ThreadCount == kPerfThreadCountMax)
+        {
+            continue;
+        }
+        
+        pid_t ThreadID = (pid_t)atoi(Entry->d_name);
+        int *Descriptors = Counters->Descriptors[Counters->ThreadCount++];
+        for (u32 Counter = 0; Counter < PerfCounter_Count; ++Counter)
+        {
+            Descriptors[Counter] = OpenPerfEvent(ThreadID, Configs[Counter]);
+            if (Descriptors[Counter] < 0)
+            {
+                printf("perf_event_open, %s, error: %d\n", GetPerfCounterName((perf_counter)Counter), errno);
+                Counters->Available[Counter] = false;
+            }
+        }
+    }
+    closedir(Directory);
+    
+    b32 Result = false;
+    for (u32 Counter = 0; Counter < PerfCounter_Count; ++Counter)
+    {
+        Result |= Counters->Available[Counter];
+    }
+    
+    return Result;
+}
+
+
+void StartPerfCounters(perf_counters *Counters)
+{
+    for (u32 Thread = 0; Thread < Counters->ThreadCount; ++Thread)
+    {
+        for (u32 Counter = 0; Counter < PerfCounter_Count; ++Counter)
+        {
+            int Descriptor = Counters->Descriptors[Thread][Counter];
+            if (Descriptor >= 0)
+            {
+                ioctl(Descriptor, PERF_EVENT_IOC_RESET, 0);
+                ioctl(Descriptor, PERF_EVENT_IOC_ENABLE, 0);
+            }
+        }
+    }
+}
+
+
+void StopPerfCounters(perf_counters *Counters)
+{
+    for (u32 Counter = 0; Counter < PerfCounter_Count; ++Counter)
+    {
+        Counters->Values[Counter] = 0;
+    }
+    
+    for (u32 Thread = 0; Thread < Counters->ThreadCount; ++Thread)
+    {
+        for (u32 Counter = 0; Counter < PerfCounter_Count; ++Counter)
+        {
+            int Descriptor = Counters->Descriptors[Thread][Counter];
+            if (Descriptor < 0)
+            {
+                continue;
+            }
+            
+            ioctl(Descriptor, PERF_EVENT_IOC_DISABLE, 0);
+            
+            // Scale up counts that were multiplexed with other events
+            u64 Data[3] = {}; // Value, time enabled, time running
+            if (read(Descriptor, Data, sizeof(Data)) == sizeof(Data) && Data[2] > 0)
+            {
+                Counters->Values[Counter] += (u64)((f64)Data[0] * (f64)Data[1] / (f64)Data[2]);
+            }
+        }
+    }
+    
+    for (u32 Counter = 0; Counter < PerfCounter_Count; ++Counter)
+    {
+        if (!Counters->Available[Counter])
+        {
+            Counters->Values[Counter] = 0;
+        }
+    }
+}
+
+
+void ClosePerfCounters(perf_counters *Counters)
+{
+    for (u32 Thread = 0; Thread < Counters->ThreadCount; ++Thread)
+    {
+        for (u32 Counter = 0; Counter < PerfCounter_Count; ++Counter)
+        {
+            if (Counters->Descriptors[Thread][Counter] >= 0)
+            {
+                close(Counters->Descriptors[Thread][Counter]);
+            }
+        }
+    }
+    Counters->ThreadCount = 0;
+}
+
+
+#else
+//
+// Thread cycle time, the only counter that does not need a driver
+//
+b32 OpenPerfCounters(perf_counters *Counters, HANDLE *Threads, u32 ThreadCount)
+{
+    *Counters = {};
+    Counters->Backend = "QueryThreadCycleTime";
+    Counters->Available[PerfCounter_Cycles] = true;
+    
+    Counters->ThreadCount = ThreadCount < kPerfThreadCountMax ? ThreadCount : kPerfThreadCountMax;
+    for (u32 Thread = 0; Thread < Counters->ThreadCount; ++Thread)
+    {
+        Counters->Threads[Thread] = Threads[Thread];
+    }
+    
+    return true;
+}
+
+
+void StartPerfCounters(perf_counters *Counters)
+{
+    for (u32 Thread = 0; Thread < Counters->ThreadCount; ++Thread)
+    {
+        ULONG64 Cycles = 0;
+        QueryThreadCycleTime(Counters->Threads[Thread], &Cycles);
+        Counters->StartingCycles[Thread] = Cycles;
+    }
+}
+
+
+void StopPerfCounters(perf_counters *Counters)
+{
+    for (u32 Counter = 0; Counter < PerfCounter_Count; ++Counter)
+    {
+        Counters->Values[Counter] = 0;
+    }
+    
+    for (u32 Thread = 0; Thread < Counters->ThreadCount; ++Thread)
+    {
+        ULONG64 Cycles = 0;
+        QueryThreadCycleTime(Counters->Threads[Thread], &Cycles);
+        Counters->Values[PerfCounter_Cycles] += Cycles - Counters->StartingCycles[Thread];
+    }
+}
+
+
+void ClosePerfCounters(perf_counters *Counters)
+{
+    Counters->ThreadCount = 0;
+}
+#endif
@@ -0,0 +1,82 @@
+// 
+// MIT License
+// 
+// Copyright (c) 2018 Marcus Larsson
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+
+#ifndef PerfCounters__h
+#define PerfCounters__h
+
+#define UNICODE
+#define STRICT
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+#include "types.h"
+
+
+
+//
+// Hardware counters summed over a set of threads, read around a block of work.
+//
+// On Linux the counters come from perf_event_open() and every thread of the process is counted
+// (the thread handles are ignored). Elsewhere only the cycles are available, from
+// QueryThreadCycleTime() for the given threads, the other counters need a kernel driver or an
+// admin ETW session on Windows and are marked unavailable. Counters that can not be opened, e.g.
+// because of perf_event_paranoid or a virtual machine without a PMU, are marked unavailable as
+// well. Unavailable counters read as zero and are reported as n/a.
+//
+enum perf_counter
+{
+    PerfCounter_Cycles,
+    PerfCounter_Instructions,
+    PerfCounter_CacheMisses,    // Last level cache
+    PerfCounter_BranchMisses,
+    
+    PerfCounter_Count,
+};
+
+u32 constexpr kPerfThreadCountMax = 128;
+
+struct perf_counters
+{
+    char const *Backend;
+    b32 Available[PerfCounter_Count];
+    u64 Values[PerfCounter_Count];  // Set by StopPerfCounters()
+    
+    u32 ThreadCount;
+#if defined(__linux__)
+    int Descriptors[kPerfThreadCountMax][PerfCounter_Count];
+#else
+    HANDLE Threads[kPerfThreadCountMax];
+    u64 StartingCycles[kPerfThreadCountMax];
+#endif
+};
+
+b32 OpenPerfCounters(perf_counters *Counters, HANDLE *Threads, u32 ThreadCount);
+void StartPerfCounters(perf_counters *Counters);
+void StopPerfCounters(perf_counters *Counters);
+void ClosePerfCounters(perf_counters *Counters);
+char const *GetPerfCounterName(perf_counter Counter);
+
+
+#endif
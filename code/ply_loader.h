@@ -25,25 +25,27 @@
 
 
 //
-// TODO(Marcus): Clean up this code, it works but it's a bit messy!
+// NOTE(Marcus): The header is parsed into a schema of every element and property in the file, see
+//               ply_schema. The body is then decoded into the columns the caller asks for, see
+//               ReadPlyElements, and everything else is skipped without being converted.
 //
-
-//
-// NOTE(Marcus): Supported elements (only the mentioned elements and properties are supported):        
+//               LoadPlyFile reads the columns of a mesh:
 //               - vertex
-//                 - Requiered property:
-//                   - Positions, named x y z, type float
+//                 - Required properties:
+//                   - positions, named x y z
 //
 //                 - Optional properties:
-//                   - normals, named nx ny nz, type float
-//                   - texture coordinates, named s t, type float
+//                   - normals, named nx ny nz
+//                   - texture coordinates, named s t
 //
 //               - face
-//                 - Required property
-//                   - none
-// 
 //                 - Optional property
-//                   - none
+//                   - vertex indices, a list named vertex_indices or vertex_index, faces with
+//                     more than three corners are triangulated
+//
+//               Any numeric type is converted to the type of the column, and other elements
+//               and properties are skipped. The format can be ascii, binary_little_endian or
+//               binary_big_endian.
 //
 
 
@@ -53,16 +55,19 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include "tokenizer.h"
+#include "mapped_file.h"
 #include "mathematics.h"
+#include "profiler.h"
+#include "mesh_normals.h"
+#include <emmintrin.h>
 
 
 #ifdef DEBUG
 #include <assert.h>
-#define Assertu16(x) assert(x < 65536)
 #else
 #define assert(x)
-#define Assertu16(x)
 #endif
 
 
@@ -74,6 +79,7 @@ enum ply_token
     PlyToken_MagicNumber,
     PlyToken_Format,
     PlyToken_Comment,
+    PlyToken_ObjInfo,
     PlyToken_Element,
     PlyToken_Property,
     PlyToken_EndHeader,
@@ -95,6 +101,10 @@ static ply_token TranslateToPlyToken(token *Token)
     {
         return PlyToken_Comment;
     }
+    else if (StringsAreEqual(Token->Text, "obj_info"))
+    {
+        return PlyToken_ObjInfo;
+    }
     else if (StringsAreEqual(Token->Text, "element"))
     {
         return PlyToken_Element;
@@ -114,392 +124,1571 @@ static ply_token TranslateToPlyToken(token *Token)
 }
 
 
-struct ply_state
+enum ply_format
 {
-    v3 *Positions  = nullptr;
-    v3 *Normals   = nullptr;
-    v2 *TexCoords = nullptr;
-    u16 *Indices = nullptr;
+    PlyFormat_Ascii,
+    PlyFormat_BinaryLittleEndian,
+    PlyFormat_BinaryBigEndian,
+};
+
+
+enum ply_type
+{
+    PlyType_Char,
+    PlyType_UChar,
+    PlyType_Short,
+    PlyType_UShort,
+    PlyType_Int,
+    PlyType_UInt,
+    PlyType_Float,
+    PlyType_Double,
     
-    u32 PositionElementCount = 0;
-    u32 NormalElementCount = 0;
-    u32 TexCoordElementCount = 0;
+    PlyType_Unknown,
+};
+
+
+// Both the old and the sized names are in use
+static ply_type TranslateToPlyType(token *Token)
+{
+    if (StringsAreEqual(Token->Text, "char")   || StringsAreEqual(Token->Text, "int8"))    return PlyType_Char;
+    if (StringsAreEqual(Token->Text, "uchar")  || StringsAreEqual(Token->Text, "uint8"))   return PlyType_UChar;
+    if (StringsAreEqual(Token->Text, "short")  || StringsAreEqual(Token->Text, "int16"))   return PlyType_Short;
+    if (StringsAreEqual(Token->Text, "ushort") || StringsAreEqual(Token->Text, "uint16"))  return PlyType_UShort;
+    if (StringsAreEqual(Token->Text, "int")    || StringsAreEqual(Token->Text, "int32"))   return PlyType_Int;
+    if (StringsAreEqual(Token->Text, "uint")   || StringsAreEqual(Token->Text, "uint32"))  return PlyType_UInt;
+    if (StringsAreEqual(Token->Text, "float")  || StringsAreEqual(Token->Text, "float32")) return PlyType_Float;
+    if (StringsAreEqual(Token->Text, "double") || StringsAreEqual(Token->Text, "float64")) return PlyType_Double;
+    return PlyType_Unknown;
+}
+
+
+static u32 GetPlyTypeSize(ply_type Type)
+{
+    static u32 const Sizes[] = { 1, 1, 2, 2, 4, 4, 4, 8, 0 };
+    return Sizes[Type];
+}
+
+
+
+//
+// Schema
+//
+u32 constexpr kPlyNameLengthMax = 32;
+u32 constexpr kPlyPropertyCountMax = 32;
+u32 constexpr kPlyElementCountMax = 8;
+
+struct ply_property
+{
+    char Name[kPlyNameLengthMax];
+    ply_type Type;
+    ply_type CountType;     // PlyType_Unknown unless the property is a list
+    u32 Offset;             // In a binary row, only valid when the row has a fixed size
+};
+
+struct ply_element
+{
+    char Name[kPlyNameLengthMax];
+    u32 Count;
     
-    u32 VertexCount = 0;
-    u32 VertexSize;
-    u32 FaceCount = 0;
-    u32 IndexCount = 0;
+    ply_property Properties[kPlyPropertyCountMax];
+    u32 PropertyCount;
+    u32 RowSize;            // Of a binary row, zero when the row has lists and varies in size
     
-    b32 FinishedWithHeader = false;
+    // Binary only, set when the body is read. Data is the first row, in the mapping of the file
+    // or, for big endian rows of nothing but 32 bit properties, in Swapped.
+    u8 *Data;
+    u8 *Swapped;
+};
+
+struct ply_schema
+{
+    ply_format Format;
+    ply_element Elements[kPlyElementCountMax];
+    u32 ElementCount;
 };
 
 
-static token ProcessFormat(tokenizer *Tokenizer, ply_state *State)
+static ply_element *FindPlyElement(ply_schema *Schema, char const *Name)
 {
-    token Token = RequireIdentifierNamed(Tokenizer, "ascii"); // ascii
-    Token = RequireNumberWithValue(Tokenizer, 1.0f); // 1.0
-    
-    Token = GetToken(Tokenizer);
-    return Token;
+    for (u32 Index = 0; Index < Schema->ElementCount; ++Index)
+    {
+        if (strcmp(Schema->Elements[Index].Name, Name) == 0)
+        {
+            return &Schema->Elements[Index];
+        }
+    }
+    return nullptr;
+}
+
+
+static ply_property *FindPlyProperty(ply_element *Element, char const *Name)
+{
+    for (u32 Index = 0; Index < Element->PropertyCount; ++Index)
+    {
+        if (strcmp(Element->Properties[Index].Name, Name) == 0)
+        {
+            return &Element->Properties[Index];
+        }
+    }
+    return nullptr;
 }
 
 
-static token RequireFloatPropertyNamed(tokenizer *Tokenizer, char const *Name)
+static b32 CopyPlyName(tokenizer *Tokenizer, token Token, char *Name)
 {
-    token Token = RequireIdentifierNamed(Tokenizer, "property");
-    Token = RequireIdentifierNamed(Tokenizer, "float");
-    Token = RequireIdentifierNamed(Tokenizer, Name);
+    if (Token.Type != Token_Identifier || Token.Text.Count >= kPlyNameLengthMax)
+    {
+        Error(Tokenizer, Token, "Expected a name shorter than %u characters", kPlyNameLengthMax);
+        return false;
+    }
     
-    return Token;
+    memcpy(Name, Token.Text.Data, Token.Text.Count);
+    Name[Token.Text.Count] = 0;
+    return true;
 }
 
 
-static token ProcessElement(tokenizer *Tokenizer, ply_state *State)
+static token ProcessFormat(tokenizer *Tokenizer, ply_schema *Schema)
 {
     token Token = GetToken(Tokenizer);
-    
-    if (StringsAreEqual(Token.Text, "vertex"))
+    if (StringsAreEqual(Token.Text, "ascii"))
     {
-        Token = RequireNumber(Tokenizer);
-        State->VertexCount = Token.s32;
-        
-        // NOTE(Marcus): We're requiring that the vertices has at least three properties:
-        //               x, y and z (floats), the position
-        //
-        //               In addition to this they _can_ have (they are optional) two additional properties:
-        //               - nx, ny and nz (floats), this is the normal of the vertex
-        //               - s and t, this is the texture coordinate
-        
-        Token = RequireFloatPropertyNamed(Tokenizer, "x");
-        Token = RequireFloatPropertyNamed(Tokenizer, "y");
-        Token = RequireFloatPropertyNamed(Tokenizer, "z");
-        
-        State->VertexSize = sizeof(v3);
-        State->PositionElementCount = 3;
-        
-        //
-        // Check if there are any other properties of the vertex
-        Token = GetToken(Tokenizer);
-        ply_token PlyToken = TranslateToPlyToken(&Token);
-        while (Parsing(Tokenizer) && (PlyToken == PlyToken_Property))
-        {
-            Token = RequireIdentifierNamed(Tokenizer, "float");
-            Token = GetToken(Tokenizer);
-            
-            if (StringsAreEqual(Token.Text, "nx"))
-            {
-                Token = RequireFloatPropertyNamed(Tokenizer, "ny");
-                Token = RequireFloatPropertyNamed(Tokenizer, "nz");
-                
-                State->VertexSize += sizeof(v3);
-                State->NormalElementCount = 3;
-            }
-            else if (StringsAreEqual(Token.Text, "s"))
-            {
-                Token = RequireFloatPropertyNamed(Tokenizer, "t");
-                
-                State->VertexSize += sizeof(v2);
-                State->TexCoordElementCount = 2;
-            }
-            Token = GetToken(Tokenizer);
-            PlyToken = TranslateToPlyToken(&Token);
-        }
+        Schema->Format = PlyFormat_Ascii;
+    }
+    else if (StringsAreEqual(Token.Text, "binary_little_endian"))
+    {
+        Schema->Format = PlyFormat_BinaryLittleEndian;
     }
-    else if (StringsAreEqual(Token.Text, "face"))
+    else if (StringsAreEqual(Token.Text, "binary_big_endian"))
     {
-        // NOTE(Marcus): We're requring the face to consist out of three indices, i.e. we're
-        //               requiring the faces to be triangulated.
-        Token = RequireNumber(Tokenizer);
-        State->FaceCount = Token.s32;
-        State->IndexCount = 3*State->FaceCount;
-        Token = GetFirstTokenOfNextLine(Tokenizer);
+        Schema->Format = PlyFormat_BinaryBigEndian;
     }
     else
     {
-        // TODO(Marcus): Support arbitrary named elements? For now we'll stop parsing here because
-        //               we did not expect this unknown element -- perhaps there were errors in 
-        //               the export?
-        Error(Tokenizer, "%d: Unsupported element", Token.LineNumber);
+        Error(Tokenizer, Token, "Unsupported format");
     }
+    Token = RequireNumberWithValue(Tokenizer, 1.0f); // 1.0
     
+    Token = GetToken(Tokenizer);
     return Token;
 }
 
 
-static token ProcessHeader(tokenizer *Tokenizer, ply_state *State)
+static token ProcessElement(tokenizer *Tokenizer, ply_schema *Schema)
 {
-    //
-    // TODO(Marcus): Ugly solution this is, fix it I must!
-    //
-    if (State->VertexCount == 0 || State->PositionElementCount < 3)
+    token Token = GetToken(Tokenizer);
+    if (Schema->ElementCount == kPlyElementCountMax)
     {
-        Error(Tokenizer, "Finished parsing the header but found no vertices, or no vertices which also has positions");
+        Error(Tokenizer, Token, "More than %u elements", kPlyElementCountMax);
+        return Token;
     }
-    else
+    
+    ply_element *Element = &Schema->Elements[Schema->ElementCount++];
+    *Element = {};
+    CopyPlyName(Tokenizer, Token, Element->Name);
+    
+    Token = RequireNumber(Tokenizer);
+    if (Token.s64 < 0 || Token.s64 > u32Max)
     {
-        if (State->PositionElementCount != 3)
-        {
-            Error(Tokenizer, "Expected 3 elements in the position coordinate, got %d", State->PositionElementCount);
-        }
-        else
-        {
-            State->Positions = (v3 *)malloc(State->VertexCount * sizeof(v3));
-        }
-        
-        if (State->NormalElementCount > 0)
-        {
-            if (State->NormalElementCount != 3)
-            {
-                Error(Tokenizer, "Expected 3 elements in the normal coordinate, got %d", State->NormalElementCount);
-            }
-            else
-            {
-                State->Normals = (v3 *)malloc(State->VertexCount * sizeof(v3));
-            }
-        }
-        
-        if (State->TexCoordElementCount > 0)
-        {
-            if (State->TexCoordElementCount != 2)
-            {
-                Error(Tokenizer, "Expected 2 elements in the texture coordinate, got %d", State->TexCoordElementCount);
-            }
-            else
-            {
-                State->TexCoords = (v2 *)malloc(State->VertexCount * sizeof(v2));
-            }
-        }
-        
-        if (State->IndexCount > 0)
-        {
-            State->Indices = (u16 *)malloc(State->IndexCount * sizeof(u16));
-        }
-        
-        State->FinishedWithHeader = true;
+        Error(Tokenizer, Token, "Expected a count of %s that fits in 32 bits", Element->Name);
     }
+    Element->Count = (u32)Token.s64;
     
-    token Token = GetToken(Tokenizer);
+    Token = GetToken(Tokenizer);
     return Token;
 }
 
 
-static void Free(ply_state *State)
+static token ProcessProperty(tokenizer *Tokenizer, ply_schema *Schema)
 {
-    if (State->Positions)
+    token Token = GetToken(Tokenizer);
+    if (Schema->ElementCount == 0)
     {
-        free(State->Positions);
-        State->Positions = nullptr;
+        Error(Tokenizer, Token, "Found a property before any element");
+        return Token;
     }
     
-    if (State->Normals)
+    ply_element *Element = &Schema->Elements[Schema->ElementCount - 1];
+    if (Element->PropertyCount == kPlyPropertyCountMax)
     {
-        free(State->Normals);
-        State->Normals = nullptr;
+        Error(Tokenizer, Token, "More than %u properties in %s", kPlyPropertyCountMax, Element->Name);
+        return Token;
     }
     
-    if (State->TexCoords)
+    ply_property *Property = &Element->Properties[Element->PropertyCount++];
+    *Property = {};
+    Property->CountType = PlyType_Unknown;
+    
+    if (StringsAreEqual(Token.Text, "list"))
     {
-        free(State->TexCoords);
-        State->TexCoords = nullptr;
+        Token = GetToken(Tokenizer);
+        Property->CountType = TranslateToPlyType(&Token);
+        if (Property->CountType >= PlyType_Float)
+        {
+            Error(Tokenizer, Token, "Expected an integer type for the length of the list");
+        }
+        Token = GetToken(Tokenizer);
     }
     
-    if (State->Indices)
+    Property->Type = TranslateToPlyType(&Token);
+    if (Property->Type == PlyType_Unknown)
     {
-        free(State->Indices);
-        State->Indices = nullptr;
+        Error(Tokenizer, Token, "Unknown type");
     }
     
-    State->PositionElementCount = 0;
-    State->NormalElementCount = 0;
-    State->TexCoordElementCount = 0;
-    State->VertexCount = 0;
-    State->VertexSize = 0;
-    State->IndexCount = 0;
-    State->FinishedWithHeader = false;
+    Token = GetToken(Tokenizer);
+    CopyPlyName(Tokenizer, Token, Property->Name);
+    
+    Token = GetToken(Tokenizer);
+    return Token;
 }
 
 
+// Lays out the binary rows, the offsets stop at the first list as the rest depend on its length
+static void FinishPlySchema(ply_schema *Schema)
+{
+    for (u32 ElementIndex = 0; ElementIndex < Schema->ElementCount; ++ElementIndex)
+    {
+        ply_element *Element = &Schema->Elements[ElementIndex];
+        
+        u32 Offset = 0;
+        b32 HasList = false;
+        for (u32 Index = 0; Index < Element->PropertyCount && !HasList; ++Index)
+        {
+            ply_property *Property = &Element->Properties[Index];
+            Property->Offset = Offset;
+            Offset += GetPlyTypeSize(Property->Type);
+            HasList = Property->CountType != PlyType_Unknown;
+        }
+        
+        Element->RowSize = HasList ? 0 : Offset;
+    }
+}
+
 
-//
-// Main
-static b32 LoadPlyFile(char const *FileName, ply_state *State)
+// The tokenizer is left at the end_header token
+static b32 ParsePlyHeader(tokenizer *Tokenizer, ply_schema *Schema)
 {
-    //
-    // Read file
-    FILE *File;
-    fopen_s(&File, FileName, "r");
-    fseek(File, 0L, SEEK_END);
-    size_t Size = ftell(File);
-    rewind(File);
-    
-    string FileString;
-    FileString.Data = (u8 *)malloc(Size + 1);
-    fread(FileString.Data, Size, 1, File);
-    fclose(File);
-    
-    
-    //
-    // Alloc and copy
-    FileString.Count = Size;
-    tokenizer Tokenizer = Tokenize(FileString);
-    size_t FileNameSize = sizeof(FileName) + 1;
-    Tokenizer.FileName = (char *)malloc(FileNameSize);
-    snprintf(Tokenizer.FileName, FileNameSize, FileName);
+    PROFILE_SCOPE("ParsePlyHeader");
     
+    *Schema = {};
     
-    //
-    // Tokenize and parse
-    token Token;
-    Token = RequireIdentifierNamed(&Tokenizer, "ply");
-    if (!Parsing(&Tokenizer))
+    token Token = RequireIdentifierNamed(Tokenizer, "ply");
+    if (!Parsing(Tokenizer))
     {
-        Error(&Tokenizer, "First line did not contain the magic number, is this really a .ply file?");
+        Error(Tokenizer, "First line did not contain the magic number, is this really a .ply file?");
+        return false;
     }
-    Token = GetToken(&Tokenizer);
+    Token = GetToken(Tokenizer);
     
-    while(Parsing(&Tokenizer))
+    while (Parsing(Tokenizer))
     {
-        //Token = GetToken(&Tokenizer);
         // NOTE(Marcus): Each process function in the switch case below will advance the tokenizer
         //               and return the next token (i.e. the token that comes after the last token
         //               the function processed).
-        
-        switch (Token.Type)
+        ply_token PlyToken = Token.Type == Token_Identifier ? TranslateToPlyToken(&Token) : PlyToken_Unknown;
+        switch (PlyToken)
         {
-            case Token_Identifier:
+            case PlyToken_Format   : { Token = ProcessFormat(Tokenizer, Schema);      } break;
+            case PlyToken_Element  : { Token = ProcessElement(Tokenizer, Schema);     } break;
+            case PlyToken_Property : { Token = ProcessProperty(Tokenizer, Schema);    } break;
+            case PlyToken_Comment  : { Token = GetFirstTokenOfNextLine(Tokenizer);    } break;
+            case PlyToken_ObjInfo  : { Token = GetFirstTokenOfNextLine(Tokenizer);    } break;
+            case PlyToken_EndHeader:
             {
-                ply_token PlyToken = TranslateToPlyToken(&Token); 
-                switch (PlyToken)
-                {
-                    case PlyToken_Format   : { Token = ProcessFormat(&Tokenizer, State);      } break;
-                    case PlyToken_Element  : { Token = ProcessElement(&Tokenizer, State);     } break;
-                    case PlyToken_EndHeader: { Token = ProcessHeader(&Tokenizer, State);      } break;
-                    case PlyToken_Comment  : { Token = GetFirstTokenOfNextLine(&Tokenizer);    } break;
-                    case PlyToken_Property : { Token = GetFirstTokenOfNextLine(&Tokenizer);    } break;
-                    case PlyToken_Unknown  : { Error(&Tokenizer, Token, "Unknown identifier"); } break;
-                }
+                FinishPlySchema(Schema);
+                return true;
             } break;
             
-            case Token_Number:
-            {
-                if (!State->FinishedWithHeader)
-                {
-                    Error(&Tokenizer, Token, "Encountered free form numbers before the header was parsed");
-                }
-                else
-                {
-                    // NOTE(Marcus): We're assuming that the first time we encounter a number, _and_
-                    //               the header was parsed, then it is the start of the vertex data.
-                    for (u32 Index = 0; Index < State->VertexCount && Parsing(&Tokenizer); ++Index)
-                    {
-                        f32 x = Token.f32;
-                        Token = RequireNumber(&Tokenizer);
-                        f32 y = Token.f32;
-                        Token = RequireNumber(&Tokenizer);
-                        f32 z = Token.f32;
-                        State->Positions[Index] = V3(x, y, z);
-                        
-                        Token = GetToken(&Tokenizer);
-                        if (State->NormalElementCount == 3 && Token.Type == Token_Number)
-                        {
-                            f32 nx = Token.f32;
-                            Token = RequireNumber(&Tokenizer);
-                            f32 ny = Token.f32;
-                            Token = RequireNumber(&Tokenizer);
-                            f32 nz = Token.f32;
-                            State->Normals[Index] = V3(nx, ny, nz);
-                        }
-                        
-                        Token = GetToken(&Tokenizer);
-                        if (State->TexCoordElementCount == 2 && Token.Type == Token_Number)
-                        {
-                            f32 s = Token.f32;
-                            Token = RequireNumber(&Tokenizer);
-                            f32 t = Token.f32;
-                            State->TexCoords[Index] = V2(s, t);
-                            
-                            Token = GetToken(&Tokenizer);
-                        }
-                        
-                    }
-                    
-                    for (u32 Index = 0; Index < State->FaceCount && Parsing(&Tokenizer); ++Index)
-                    {
-                        if (Token.s32 != 3)
-                        {
-                            Error(&Tokenizer, Token, "Expected 3 indices per face but got %d", Token.s32);
-                        }
-                        else
-                        {
-                            Token = RequireNumber(&Tokenizer);
-                            Assertu16(Token.s32);
-                            State->Indices[3*Index] = (u16)Token.s32;
-                            
-                            Token = RequireNumber(&Tokenizer);
-                            Assertu16(Token.s32);
-                            State->Indices[3*Index + 1] = (u16)Token.s32;
-                            
-                            Token = RequireNumber(&Tokenizer);
-                            Assertu16(Token.s32);
-                            State->Indices[3*Index + 2] = (u16)Token.s32;
-                            
-                            if (Index < State->FaceCount - 1)
-                            {
-                                Token = RequireNumber(&Tokenizer);
-                            } else
-                            {
-                                Token = GetToken(&Tokenizer);
-                            }
-                        }
-                    }
-                }
-            } break;
+            case PlyToken_MagicNumber:
+            case PlyToken_Unknown  : { Error(Tokenizer, Token, "Unknown identifier");  } break;
         }
     }
     
-#if 0
-    if (!Tokenizer.Error)
+    if (!Tokenizer->Error)
     {
-        for (u32 Index = 0; Index < State->VertexCount; ++Index)
-        {
-            printf("%2d. P = (%6.2f, %6.2f, %6.2f)",  Index,
-                   State->Positions[Index].x, State->Positions[Index].y, State->Positions[Index].z);
-            
-            if (State->NormalElementCount > 0)
-            {
-                printf(", N = (%6.2f, %6.2f, %6.2f)",
-                       State->Normals[Index].x, State->Normals[Index].y, State->Normals[Index].z);
-            }
-            
-            if (State->TexCoordElementCount > 0)
-            {
-                printf(", T = (%6.2f, %6.2f)",
-                       State->TexCoords[Index].x, State->TexCoords[Index].y);
-            }
-            
-            printf("\n");
-        }
-        
-        for (u32 Index = 0; Index < State->IndexCount; Index += 3)
-        {
-            printf("%2d. %3d - %3d - %3d\n", Index,
-                   State->Indices[Index], State->Indices[Index + 1], State->Indices[Index + 2]);
-        }
+        Error(Tokenizer, "The header has no end_header");
     }
-#endif
+    return false;
+}
+
+
+
+//
+// Decoding
+//
+// Every element is decoded by a plan with a step per property, a step converts the value into
+// the column asked for or, with no column, skips it. Binary rows of a fixed size only have steps
+// for the columns, the other properties are stepped over by the offsets.
+//
+
+//
+// Where the values of one property are written, the value of row N goes to Data + N*Stride. The
+// values of a list go one after the other from there, a list must then have ListSize values.
+//
+struct ply_column
+{
+    char const *Element;
+    char const *Property;
+    ply_type Type;          // The values are converted to this type
+    void *Data;
+    u32 Stride;
+    u32 ListSize;           // Zero unless the property is a list
     
-    free(Tokenizer.FileName);
-    free(FileString.Data);
+    // Lists only, the lists are polygons that are triangulated into this rather than written to
+    // Data, which is then unused
+    struct ply_triangulation *Triangulation;
+};
+
+struct ply_decode_step
+{
+    ply_type Type;
+    ply_type CountType;     // Lists only
+    u32 Offset;             // Fixed size binary rows only
     
-    if (Tokenizer.Error)
+    u8 *Destination;        // Null when the property is skipped
+    ply_type DestinationType;
+    u32 DestinationSize;
+    u32 Stride;
+    u32 ListSize;
+    ply_triangulation *Triangulation;
+};
+
+
+struct ply_value
+{
+    f32 Float32;
+    f64 Float64;
+    s64 Integer;
+};
+
+
+static void WritePlyInteger(u8 *Destination, ply_type Type, s64 Value)
+{
+    switch (Type)
     {
-        Free(State);
-        return false;
+        case PlyType_Char  : { s8  V = (s8)Value;  memcpy(Destination, &V, sizeof(V)); } break;
+        case PlyType_UChar : { u8  V = (u8)Value;  memcpy(Destination, &V, sizeof(V)); } break;
+        case PlyType_Short : { s16 V = (s16)Value; memcpy(Destination, &V, sizeof(V)); } break;
+        case PlyType_UShort: { u16 V = (u16)Value; memcpy(Destination, &V, sizeof(V)); } break;
+        case PlyType_Int   : { s32 V = (s32)Value; memcpy(Destination, &V, sizeof(V)); } break;
+        case PlyType_UInt  : { u32 V = (u32)Value; memcpy(Destination, &V, sizeof(V)); } break;
+        default: break;
+    }
+}
+
+
+static void WritePlyValue(u8 *Destination, ply_type Type, ply_value Value)
+{
+    if (Type == PlyType_Float)
+    {
+        memcpy(Destination, &Value.Float32, sizeof(f32));
+    }
+    else if (Type == PlyType_Double)
+    {
+        memcpy(Destination, &Value.Float64, sizeof(f64));
     }
     else
     {
-        return true;
+        WritePlyInteger(Destination, Type, Value.Integer);
     }
 }
 
-#endif
\ No newline at end of file
+
+static ply_value ToPlyValue(token *Token)
+{
+    ply_value Result;
+    Result.Float32 = Token->f32;
+    Result.Float64 = Token->f64;
+    Result.Integer = Token->s64;
+    return Result;
+}
+
+
+static u16 SwapBytes16(u16 Value)
+{
+    return (u16)((Value << 8) | (Value >> 8));
+}
+
+
+static u32 SwapBytes32(u32 Value)
+{
+    return (Value << 24) | ((Value << 8) & 0x00FF0000) | ((Value >> 8) & 0x0000FF00) | (Value >> 24);
+}
+
+
+static s64 ReadPlyInteger(u8 const *At, ply_type Type, b32 BigEndian)
+{
+    switch (Type)
+    {
+        case PlyType_Char  : { return (s8)At[0]; }
+        case PlyType_UChar : { return At[0];     }
+        
+        case PlyType_Short:
+        case PlyType_UShort:
+        {
+            u16 V;
+            memcpy(&V, At, sizeof(V));
+            V = BigEndian ? SwapBytes16(V) : V;
+            return Type == PlyType_Short ? (s64)(s16)V : (s64)V;
+        }
+        
+        case PlyType_Int:
+        case PlyType_UInt:
+        {
+            u32 V;
+            memcpy(&V, At, sizeof(V));
+            V = BigEndian ? SwapBytes32(V) : V;
+            return Type == PlyType_Int ? (s64)(s32)V : (s64)V;
+        }
+        
+        default: return 0;
+    }
+}
+
+
+// Same type to same type, with the sizes known to the compiler
+static void CopyPlyValue(u8 *Destination, u8 const *Source, u32 Size)
+{
+    switch (Size)
+    {
+        case 1: { memcpy(Destination, Source, 1); } break;
+        case 2: { memcpy(Destination, Source, 2); } break;
+        case 4: { memcpy(Destination, Source, 4); } break;
+        case 8: { memcpy(Destination, Source, 8); } break;
+    }
+}
+
+
+// NOTE(Marcus): Floats are truncated to integers and saturate, like the tokenizer does
+static ply_value ReadPlyValue(u8 const *At, ply_type Type, b32 BigEndian)
+{
+    ply_value Result = {};
+    if (Type < PlyType_Float)
+    {
+        Result.Integer = ReadPlyInteger(At, Type, BigEndian);
+        Result.Float64 = (f64)Result.Integer;
+        Result.Float32 = (f32)Result.Integer;
+        return Result;
+    }
+    
+    u8 Bytes[8];
+    u32 Size = GetPlyTypeSize(Type);
+    for (u32 Index = 0; Index < Size; ++Index)
+    {
+        Bytes[Index] = At[BigEndian ? Size - 1 - Index : Index];
+    }
+    
+    if (Type == PlyType_Float)
+    {
+        memcpy(&Result.Float32, Bytes, sizeof(f32));
+        Result.Float64 = Result.Float32;
+    }
+    else
+    {
+        memcpy(&Result.Float64, Bytes, sizeof(f64));
+        Result.Float32 = (f32)Result.Float64;
+    }
+    
+    if (Result.Float64 > -9.2e18 && Result.Float64 < 9.2e18)
+    {
+        Result.Integer = (s64)Result.Float64;
+    }
+    else
+    {
+        Result.Integer = Result.Float64 < 0.0 ? INT64_MIN : INT64_MAX;
+    }
+    
+    return Result;
+}
+
+
+// Integers are converted without going through the floats
+static void ConvertPlyValue(u8 *Destination, ply_type DestinationType, u8 const *Source, ply_type Type, b32 BigEndian)
+{
+    if (Type < PlyType_Float && DestinationType < PlyType_Float)
+    {
+        WritePlyInteger(Destination, DestinationType, ReadPlyInteger(Source, Type, BigEndian));
+    }
+    else
+    {
+        WritePlyValue(Destination, DestinationType, ReadPlyValue(Source, Type, BigEndian));
+    }
+}
+
+
+// Swaps the bytes of every 32 bit word, SSE2 has no byte shuffle so the halves are swapped first
+// and then the bytes within them.
+static void ByteSwap32(u8 *Destination, u8 const *Source, u64 WordCount)
+{
+    u64 Index = 0;
+    for (; Index + 4 <= WordCount; Index += 4)
+    {
+        __m128i Words = _mm_loadu_si128((__m128i const *)(Source + 4*Index));
+        Words = _mm_shufflelo_epi16(Words, _MM_SHUFFLE(2, 3, 0, 1));
+        Words = _mm_shufflehi_epi16(Words, _MM_SHUFFLE(2, 3, 0, 1));
+        Words = _mm_or_si128(_mm_slli_epi16(Words, 8), _mm_srli_epi16(Words, 8));
+        _mm_storeu_si128((__m128i *)(Destination + 4*Index), Words);
+    }
+    
+    for (; Index < WordCount; ++Index)
+    {
+        u8 const *Word = Source + 4*Index;
+        u8 Swapped[4] = { Word[3], Word[2], Word[1], Word[0] };
+        memcpy(Destination + 4*Index, Swapped, 4);
+    }
+}
+
+
+
+//
+// Triangulation
+//
+// A polygon is ear clipped in the plane it is most facing, which also handles concave polygons.
+// Without positions, or when no ear can be found in a degenerate polygon, the rest of it is split
+// into a fan. Either way a polygon of N corners gives N - 2 triangles with the winding it had.
+//
+u32 constexpr kPlyPolygonSizeMax = 256;
+
+struct ply_triangulation
+{
+    v3 const *Positions;    // Null gives fans
+    u32 VertexCount;        // Every index must be below it
+    
+    // Three indices per triangle, of IndexType which is PlyType_UShort or PlyType_UInt. They are
+    // grown when there is no room left, which does not happen if the capacity was counted first.
+    ply_type IndexType;
+    void *Indices;
+    u32 TriangleCount;
+    u32 TriangleCapacity;
+};
+
+
+static f32 Cross2(v2 A, v2 B)
+{
+    return A.x*B.y - A.y*B.x;
+}
+
+
+// Counter clockwise triangles only, points on an edge are inside
+static b32 IsInsideTriangle(v2 P, v2 A, v2 B, v2 C)
+{
+    return Cross2(B - A, P - A) >= 0.0f && Cross2(C - B, P - B) >= 0.0f && Cross2(A - C, P - C) >= 0.0f;
+}
+
+
+static u32 TriangulatePolygon(u32 const *Polygon, u32 Count, v3 const *Positions, u32 *Triangles)
+{
+    u32 Remaining[kPlyPolygonSizeMax];
+    for (u32 Index = 0; Index < Count; ++Index)
+    {
+        Remaining[Index] = Index;
+    }
+    u32 RemainingCount = Count;
+    u32 TriangleCount = 0;
+    
+    if (Positions && Count > 3)
+    {
+        //
+        // Project on the plane of the largest component of the Newell normal, and flip the
+        // second axis when needed so the polygon is counter clockwise
+        v3 Normal = V3(0.0f, 0.0f, 0.0f);
+        for (u32 Index = 0; Index < Count; ++Index)
+        {
+            v3 A = Positions[Polygon[Index]];
+            v3 B = Positions[Polygon[(Index + 1) % Count]];
+            Normal.x += (A.y - B.y)*(A.z + B.z);
+            Normal.y += (A.z - B.z)*(A.x + B.x);
+            Normal.z += (A.x - B.x)*(A.y + B.y);
+        }
+        
+        u32 Axis = fabsf(Normal.x) > fabsf(Normal.y) ? 0 : 1;
+        Axis = fabsf(Normal.z) > fabsf(Normal.E[Axis]) ? 2 : Axis;
+        u32 U = (Axis + 1) % 3;
+        u32 V = (Axis + 2) % 3;
+        f32 Flip = Normal.E[Axis] < 0.0f ? -1.0f : 1.0f;
+        
+        v2 Points[kPlyPolygonSizeMax];
+        for (u32 Index = 0; Index < Count; ++Index)
+        {
+            v3 P = Positions[Polygon[Index]];
+            Points[Index] = V2(P.E[U], Flip*P.E[V]);
+        }
+        
+        //
+        // Clip an ear at a time, a polygon with no area has no ears and is left to the fan
+        u32 Misses = 0;
+        u32 Corner = 0;
+        while (Normal.E[Axis] != 0.0f && RemainingCount > 3 && Misses < RemainingCount)
+        {
+            u32 Previous = Remaining[(Corner + RemainingCount - 1) % RemainingCount];
+            u32 Current = Remaining[Corner];
+            u32 Next = Remaining[(Corner + 1) % RemainingCount];
+            v2 A = Points[Previous];
+            v2 B = Points[Current];
+            v2 C = Points[Next];
+            
+            b32 IsEar = Cross2(B - A, C - B) > 0.0f;
+            for (u32 Index = 0; Index < RemainingCount && IsEar; ++Index)
+            {
+                u32 Other = Remaining[Index];
+                if (Other != Previous && Other != Current && Other != Next)
+                {
+                    IsEar = !IsInsideTriangle(Points[Other], A, B, C);
+                }
+            }
+            
+            if (IsEar)
+            {
+                Triangles[3*TriangleCount + 0] = Polygon[Previous];
+                Triangles[3*TriangleCount + 1] = Polygon[Current];
+                Triangles[3*TriangleCount + 2] = Polygon[Next];
+                ++TriangleCount;
+                
+                --RemainingCount;
+                for (u32 Index = Corner; Index < RemainingCount; ++Index)
+                {
+                    Remaining[Index] = Remaining[Index + 1];
+                }
+                Corner = Corner % RemainingCount;
+                Misses = 0;
+            }
+            else
+            {
+                Corner = (Corner + 1) % RemainingCount;
+                ++Misses;
+            }
+        }
+    }
+    
+    for (u32 Index = 1; Index + 1 < RemainingCount; ++Index)
+    {
+        Triangles[3*TriangleCount + 0] = Polygon[Remaining[0]];
+        Triangles[3*TriangleCount + 1] = Polygon[Remaining[Index]];
+        Triangles[3*TriangleCount + 2] = Polygon[Remaining[Index + 1]];
+        ++TriangleCount;
+    }
+    
+    return TriangleCount;
+}
+
+
+// Polygons with less than three corners have no triangles and are skipped
+static void AddPlyPolygon(tokenizer *Tokenizer, ply_triangulation *Triangulation, u32 const *Polygon, u32 Count)
+{
+    for (u32 Index = 0; Index < Count; ++Index)
+    {
+        if (Polygon[Index] >= Triangulation->VertexCount)
+        {
+            Error(Tokenizer, "The index %u is past the %u vertices", Polygon[Index], Triangulation->VertexCount);
+            return;
+        }
+    }
+    
+    if (Count < 3)
+    {
+        return;
+    }
+    
+    u32 NewCount = Count - 2;
+    if (Triangulation->TriangleCount + NewCount > Triangulation->TriangleCapacity)
+    {
+        u32 Capacity = 2*Triangulation->TriangleCapacity + NewCount;
+        u32 IndexSize = GetPlyTypeSize(Triangulation->IndexType);
+        void *Indices = realloc(Triangulation->Indices, (size_t)3*Capacity*IndexSize);
+        if (!Indices)
+        {
+            Error(Tokenizer, "Could not grow the indices to %u triangles", Capacity);
+            return;
+        }
+        Triangulation->Indices = Indices;
+        Triangulation->TriangleCapacity = Capacity;
+    }
+    
+    u32 Triangles[3*(kPlyPolygonSizeMax - 2)];
+    TriangulatePolygon(Polygon, Count, Triangulation->Positions, Triangles);
+    
+    if (Triangulation->IndexType == PlyType_UShort)
+    {
+        u16 *Indices = (u16 *)Triangulation->Indices + 3*Triangulation->TriangleCount;
+        for (u32 Index = 0; Index < 3*NewCount; ++Index)
+        {
+            Indices[Index] = (u16)Triangles[Index];
+        }
+    }
+    else
+    {
+        u32 *Indices = (u32 *)Triangulation->Indices + 3*Triangulation->TriangleCount;
+        memcpy(Indices, Triangles, 3*NewCount*sizeof(u32));
+    }
+    Triangulation->TriangleCount += NewCount;
+}
+
+
+// Indices that do not fit in 32 bits are kept past any vertex count
+static u32 ToPlyIndex(s64 Value)
+{
+    return (Value >= 0 && Value <= u32Max) ? (u32)Value : u32Max;
+}
+
+
+
+//
+// A ply file with its header parsed, the body is read by ReadPlyElements
+//
+struct ply_file
+{
+    ply_schema Schema;
+    tokenizer Tokenizer;
+    
+    // Binary only, the body is read from a mapping of the whole file
+    mapped_file File;
+    u64 BodyOffset;
+};
+
+
+static void ClosePlyFile(ply_file *File)
+{
+    for (u32 Index = 0; Index < File->Schema.ElementCount; ++Index)
+    {
+        ply_element *Element = &File->Schema.Elements[Index];
+        if (Element->Swapped)
+        {
+            free(Element->Swapped);
+            Element->Swapped = nullptr;
+        }
+    }
+    
+    FreeTokenChunks(&File->Tokenizer);
+    free(File->Tokenizer.FileName);
+    File->Tokenizer.FileName = nullptr;
+    CloseTokenizerFile(&File->Tokenizer);
+    CloseMappedFile(&File->File);
+}
+
+
+// NOTE(Marcus): With more than one thread the body of large ascii files is tokenised in parallel
+static b32 OpenPlyFile(char const *FileName, ply_file *File, u32 ThreadCount = 1)
+{
+    PROFILE_SCOPE("OpenPlyFile");
+    
+    *File = {};
+    
+    // Only a window of the file is mapped unless the body is to be tokenised in parallel
+    tokenizer *Tokenizer = &File->Tokenizer;
+    if (!OpenTokenizerFile(FileName, ThreadCount > 1 ? 0 : kTokenWindowSize, Tokenizer))
+    {
+        printf("Could not open %s\n", FileName);
+        return false;
+    }
+    
+    size_t FileNameSize = strlen(FileName) + 1;
+    Tokenizer->FileName = (char *)malloc(FileNameSize);
+    memcpy(Tokenizer->FileName, FileName, FileNameSize);
+    
+    if (ParsePlyHeader(Tokenizer, &File->Schema))
+    {
+        if (File->Schema.Format == PlyFormat_Ascii)
+        {
+            // NOTE(Marcus): The body has nothing but numbers, so it can be split anywhere between lines
+            TokenizeParallel(Tokenizer, ThreadCount);
+        }
+        else
+        {
+            // The tokenizer is done, the body is read from a mapping that stays until the file is closed
+            b32 HasOffset = GetNextLineFileOffset(Tokenizer, &File->BodyOffset);
+            CloseTokenizerFile(Tokenizer);
+            
+            if (!HasOffset || !OpenMappedFile(FileName, &File->File))
+            {
+                Error(Tokenizer, "Could not map the binary body of %s", FileName);
+            }
+        }
+    }
+    
+    if (Tokenizer->Error)
+    {
+        ClosePlyFile(File);
+        return false;
+    }
+    
+    return true;
+}
+
+
+// Returns the number of steps, which for fixed size binary rows are only the ones with a column
+static u32 MakePlyDecodePlan(ply_file *File, ply_element *Element, ply_column *Columns, u32 ColumnCount,
+                             ply_decode_step *Plan)
+{
+    b32 OnlyColumns = File->Schema.Format != PlyFormat_Ascii && Element->RowSize > 0;
+    
+    u32 StepCount = 0;
+    for (u32 Index = 0; Index < Element->PropertyCount; ++Index)
+    {
+        ply_property *Property = &Element->Properties[Index];
+        
+        ply_decode_step Step = {};
+        Step.Type = Property->Type;
+        Step.CountType = Property->CountType;
+        Step.Offset = Property->Offset;
+        
+        for (u32 ColumnIndex = 0; ColumnIndex < ColumnCount; ++ColumnIndex)
+        {
+            ply_column *Column = &Columns[ColumnIndex];
+            if (strcmp(Column->Element, Element->Name) == 0 && strcmp(Column->Property, Property->Name) == 0)
+            {
+                Step.Destination = (u8 *)Column->Data;
+                Step.DestinationType = Column->Type;
+                Step.DestinationSize = GetPlyTypeSize(Column->Type);
+                Step.Stride = Column->Stride;
+                Step.ListSize = Column->ListSize;
+                Step.Triangulation = Column->Triangulation;
+            }
+        }
+        
+        if (Step.Destination || Step.Triangulation || !OnlyColumns)
+        {
+            Plan[StepCount++] = Step;
+        }
+    }
+    
+    return StepCount;
+}
+
+
+static void ReadAsciiElement(tokenizer *Tokenizer, ply_element *Element, ply_decode_step *Plan, u32 StepCount)
+{
+    for (u32 Row = 0; Row < Element->Count && Parsing(Tokenizer); ++Row)
+    {
+        for (u32 Index = 0; Index < StepCount; ++Index)
+        {
+            ply_decode_step *Step = &Plan[Index];
+            token Token = RequireNumber(Tokenizer);
+            u8 *Destination = Step->Destination ? Step->Destination + (size_t)Row*Step->Stride : nullptr;
+            
+            if (Step->CountType == PlyType_Unknown)
+            {
+                if (Destination)
+                {
+                    WritePlyValue(Destination, Step->DestinationType, ToPlyValue(&Token));
+                }
+                continue;
+            }
+            
+            s64 Count = Token.s64;
+            if (Step->Triangulation)
+            {
+                if (Count < 0 || Count > kPlyPolygonSizeMax)
+                {
+                    Error(Tokenizer, Token, "Expected a face with at most %u corners but got %d", 
+                          kPlyPolygonSizeMax, Token.s32);
+                    return;
+                }
+                
+                u32 Polygon[kPlyPolygonSizeMax];
+                for (u32 Value = 0; Value < (u32)Count; ++Value)
+                {
+                    Token = RequireNumber(Tokenizer);
+                    Polygon[Value] = ToPlyIndex(Token.s64);
+                }
+                AddPlyPolygon(Tokenizer, Step->Triangulation, Polygon, (u32)Count);
+                continue;
+            }
+            
+            if (Count < 0 || (Step->Destination && Count != Step->ListSize))
+            {
+                Error(Tokenizer, Token, "Expected %u values in the list but got %d", Step->ListSize, Token.s32);
+                return;
+            }
+            
+            for (s64 Value = 0; Value < Count; ++Value)
+            {
+                Token = RequireNumber(Tokenizer);
+                if (Destination)
+                {
+                    WritePlyValue(Destination, Step->DestinationType, ToPlyValue(&Token));
+                    Destination += Step->DestinationSize;
+                }
+            }
+        }
+    }
+}
+
+
+static u8 *ReadBinaryElement(tokenizer *Tokenizer, ply_element *Element, ply_decode_step *Plan, u32 StepCount,
+                             u8 *At, u8 *End, b32 BigEndian)
+{
+    Element->Data = At;
+    
+    if (Element->RowSize > 0)
+    {
+        u64 Size = (u64)Element->Count * Element->RowSize;
+        if ((u64)(End - At) < Size)
+        {
+            Error(Tokenizer, "The binary body is smaller than the header says");
+            return End;
+        }
+        
+        // NOTE(Marcus): Rows of nothing but 32 bit properties are swapped as a block, and then
+        //               decoded as little endian
+        b32 All32Bit = true;
+        for (u32 Index = 0; Index < Element->PropertyCount; ++Index)
+        {
+            All32Bit = All32Bit && GetPlyTypeSize(Element->Properties[Index].Type) == 4;
+        }
+        
+        if (BigEndian && All32Bit && Size > 0)
+        {
+            Element->Swapped = (u8 *)malloc(Size);
+            if (Element->Swapped)
+            {
+                ByteSwap32(Element->Swapped, At, Size / 4);
+                Element->Data = Element->Swapped;
+                BigEndian = false;
+            }
+        }
+        
+        u8 *Row = Element->Data;
+        for (u32 RowIndex = 0; RowIndex < Element->Count && StepCount > 0; ++RowIndex)
+        {
+            for (u32 Index = 0; Index < StepCount; ++Index)
+            {
+                ply_decode_step *Step = &Plan[Index];
+                u8 *Destination = Step->Destination + (size_t)RowIndex*Step->Stride;
+                if (Step->Type == Step->DestinationType && !BigEndian)
+                {
+                    CopyPlyValue(Destination, Row + Step->Offset, Step->DestinationSize);
+                }
+                else
+                {
+                    ConvertPlyValue(Destination, Step->DestinationType, Row + Step->Offset, Step->Type, BigEndian);
+                }
+            }
+            Row += Element->RowSize;
+        }
+        
+        return At + Size;
+    }
+    
+    //
+    // Rows with lists are walked a property at a time
+    for (u32 RowIndex = 0; RowIndex < Element->Count; ++RowIndex)
+    {
+        for (u32 Index = 0; Index < StepCount; ++Index)
+        {
+            ply_decode_step *Step = &Plan[Index];
+            u8 *Destination = Step->Destination ? Step->Destination + (size_t)RowIndex*Step->Stride : nullptr;
+            u32 TypeSize = GetPlyTypeSize(Step->Type);
+            
+            s64 Count = 1;
+            if (Step->CountType != PlyType_Unknown)
+            {
+                u32 CountSize = GetPlyTypeSize(Step->CountType);
+                if ((u64)(End - At) < CountSize)
+                {
+                    Error(Tokenizer, "The binary body is smaller than the header says");
+                    return End;
+                }
+                
+                Count = ReadPlyInteger(At, Step->CountType, BigEndian);
+                At += CountSize;
+                if (Step->Triangulation && (Count < 0 || Count > kPlyPolygonSizeMax))
+                {
+                    Error(Tokenizer, "Expected %s %u to have at most %u corners but got %d", 
+                          Element->Name, RowIndex, kPlyPolygonSizeMax, (s32)Count);
+                    return End;
+                }
+                else if (Count < 0 || (Step->Destination && Count != Step->ListSize))
+                {
+                    Error(Tokenizer, "Expected %u values in the list of %s %u but got %d", 
+                          Step->ListSize, Element->Name, RowIndex, (s32)Count);
+                    return End;
+                }
+            }
+            
+            if ((u64)(End - At) < (u64)Count * TypeSize)
+            {
+                Error(Tokenizer, "The binary body is smaller than the header says");
+                return End;
+            }
+            
+            if (Step->Triangulation)
+            {
+                u32 Polygon[kPlyPolygonSizeMax];
+                for (s64 Value = 0; Value < Count; ++Value)
+                {
+                    Polygon[Value] = ToPlyIndex(ReadPlyInteger(At + Value*TypeSize, Step->Type, BigEndian));
+                }
+                AddPlyPolygon(Tokenizer, Step->Triangulation, Polygon, (u32)Count);
+                if (Tokenizer->Error)
+                {
+                    return End;
+                }
+            }
+            else if (Destination)
+            {
+                for (s64 Value = 0; Value < Count; ++Value)
+                {
+                    ConvertPlyValue(Destination, Step->DestinationType, At + Value*TypeSize, Step->Type, BigEndian);
+                    Destination += Step->DestinationSize;
+                }
+            }
+            At += Count * TypeSize;
+        }
+    }
+    
+    return At;
+}
+
+
+//
+// Decodes the body into the columns in one pass, in the order of the elements in the file. The
+// columns must be large enough for the counts in the schema, and name properties that exist.
+//
+static b32 ReadPlyElements(ply_file *File, ply_column *Columns, u32 ColumnCount)
+{
+    PROFILE_SCOPE("ReadPlyElements");
+    
+    ply_schema *Schema = &File->Schema;
+    tokenizer *Tokenizer = &File->Tokenizer;
+    
+    for (u32 Index = 0; Index < ColumnCount; ++Index)
+    {
+        ply_column *Column = &Columns[Index];
+        ply_element *Element = FindPlyElement(Schema, Column->Element);
+        ply_property *Property = Element ? FindPlyProperty(Element, Column->Property) : nullptr;
+        
+        if (!Property)
+        {
+            Error(Tokenizer, "No property %s in %s", Column->Property, Column->Element);
+        }
+        else if ((Property->CountType != PlyType_Unknown) != (Column->ListSize > 0 || Column->Triangulation != nullptr))
+        {
+            Error(Tokenizer, "The property %s in %s is %s", Column->Property, Column->Element,
+                  Property->CountType == PlyType_Unknown ? "not a list" : "a list");
+        }
+        else if (Column->Triangulation && Property->Type >= PlyType_Float)
+        {
+            Error(Tokenizer, "The indices in %s of %s are not integers", Column->Property, Column->Element);
+        }
+    }
+    
+    b32 BigEndian = Schema->Format == PlyFormat_BinaryBigEndian;
+    u8 *At = File->File.Data + File->BodyOffset;
+    u8 *End = File->File.Data + File->File.Size;
+    
+    for (u32 Index = 0; Index < Schema->ElementCount && !Tokenizer->Error; ++Index)
+    {
+        ply_element *Element = &Schema->Elements[Index];
+        
+        ply_decode_step Plan[kPlyPropertyCountMax];
+        u32 StepCount = MakePlyDecodePlan(File, Element, Columns, ColumnCount, Plan);
+        
+        if (Schema->Format == PlyFormat_Ascii)
+        {
+            ReadAsciiElement(Tokenizer, Element, Plan, StepCount);
+        }
+        else
+        {
+            At = ReadBinaryElement(Tokenizer, Element, Plan, StepCount, At, End, BigEndian);
+        }
+    }
+    
+    return !Tokenizer->Error;
+}
+
+
+//
+// The number of triangles the polygons in a list property give, so the indices can be allocated
+// once. Only binary files can be counted without decoding them, for ascii files this is one
+// triangle per row.
+//
+static u64 CountPlyTriangles(ply_file *File, char const *ElementName, char const *PropertyName)
+{
+    PROFILE_SCOPE("CountPlyTriangles");
+    
+    ply_schema *Schema = &File->Schema;
+    if (Schema->Format == PlyFormat_Ascii)
+    {
+        ply_element *Element = FindPlyElement(Schema, ElementName);
+        return Element ? Element->Count : 0;
+    }
+    
+    b32 BigEndian = Schema->Format == PlyFormat_BinaryBigEndian;
+    u8 *At = File->File.Data + File->BodyOffset;
+    u8 *End = File->File.Data + File->File.Size;
+    
+    // NOTE(Marcus): A body that is too small is counted as far as it goes, reading it reports it
+    for (u32 ElementIndex = 0; ElementIndex < Schema->ElementCount; ++ElementIndex)
+    {
+        ply_element *Element = &Schema->Elements[ElementIndex];
+        b32 IsCounted = strcmp(Element->Name, ElementName) == 0;
+        
+        if (Element->RowSize > 0 && !IsCounted)
+        {
+            if ((u64)(End - At) < (u64)Element->Count * Element->RowSize)
+            {
+                return 0;
+            }
+            At += (u64)Element->Count * Element->RowSize;
+            continue;
+        }
+        
+        u64 TriangleCount = 0;
+        for (u32 RowIndex = 0; RowIndex < Element->Count; ++RowIndex)
+        {
+            for (u32 Index = 0; Index < Element->PropertyCount; ++Index)
+            {
+                ply_property *Property = &Element->Properties[Index];
+                s64 Count = 1;
+                if (Property->CountType != PlyType_Unknown)
+                {
+                    if ((u64)(End - At) < GetPlyTypeSize(Property->CountType))
+                    {
+                        return TriangleCount;
+                    }
+                    Count = ReadPlyInteger(At, Property->CountType, BigEndian);
+                    At += GetPlyTypeSize(Property->CountType);
+                    
+                    if (IsCounted && Count > 2 && strcmp(Property->Name, PropertyName) == 0)
+                    {
+                        TriangleCount += Count - 2;
+                    }
+                }
+                
+                if (Count < 0 || (u64)(End - At) < (u64)Count * GetPlyTypeSize(Property->Type))
+                {
+                    return TriangleCount;
+                }
+                At += Count * GetPlyTypeSize(Property->Type);
+            }
+        }
+        
+        if (IsCounted)
+        {
+            return TriangleCount;
+        }
+    }
+    
+    return 0;
+}
+
+
+
+//
+// Mesh
+//
+struct ply_state
+{
+    v3 *Positions  = nullptr;
+    v3 *Normals   = nullptr;
+    v2 *TexCoords = nullptr;
+    
+    // Three per triangle, u16 when every vertex can be indexed with them and u32 otherwise
+    void *Indices = nullptr;
+    u32 IndexSize = 0;
+    
+    u32 PositionElementCount = 0;
+    u32 NormalElementCount = 0;
+    u32 TexCoordElementCount = 0;
+    
+    u32 VertexCount = 0;
+    u32 VertexSize;         // Of one vertex in Positions, Normals and TexCoords together
+    u32 FaceCount = 0;      // Before triangulation
+    u32 IndexCount = 0;
+    
+    b32 FinishedWithHeader = false;
+    
+    // Binary files stay mapped until Free. Vertices are the vertices as they are stored in the
+    // file, VertexStride bytes apart, or null when the rows vary in size or could not be swapped.
+    // In a file with nothing but float x y z, Positions point at them as well, and are then read
+    // only since the file is mapped read only. Copy them before changing them in place.
+    ply_format Format = PlyFormat_Ascii;
+    mapped_file File;
+    u8 *Vertices = nullptr;
+    u32 VertexStride = 0;
+    
+    // Loaded from a mesh cache, every array points into File (see mesh_cache.h)
+    b32 Cached = false;
+};
+
+
+static void Free(ply_state *State)
+{
+    if (State->Cached)
+    {
+        State->Positions = nullptr;
+        State->Normals = nullptr;
+        State->TexCoords = nullptr;
+        State->Indices = nullptr;
+        State->Cached = false;
+    }
+    
+    if (State->Positions)
+    {
+        if (State->Positions != (v3 *)State->Vertices)
+        {
+            free(State->Positions);
+        }
+        State->Positions = nullptr;
+    }
+    
+    if (State->Vertices)
+    {
+        if (State->Format == PlyFormat_BinaryBigEndian)
+        {
+            free(State->Vertices);
+        }
+        State->Vertices = nullptr;
+    }
+    CloseMappedFile(&State->File);
+    
+    if (State->Normals)
+    {
+        free(State->Normals);
+        State->Normals = nullptr;
+    }
+    
+    if (State->TexCoords)
+    {
+        free(State->TexCoords);
+        State->TexCoords = nullptr;
+    }
+    
+    if (State->Indices)
+    {
+        free(State->Indices);
+        State->Indices = nullptr;
+    }
+    
+    State->PositionElementCount = 0;
+    State->NormalElementCount = 0;
+    State->TexCoordElementCount = 0;
+    State->VertexCount = 0;
+    State->VertexSize = 0;
+    State->VertexStride = 0;
+    State->FaceCount = 0;
+    State->IndexCount = 0;
+    State->IndexSize = 0;
+    State->FinishedWithHeader = false;
+    State->Format = PlyFormat_Ascii;
+}
+
+
+// Hands new arrays to the state in place of the ones it has. The old arrays are freed, the file
+// they may point into is closed, and the state owns the new ones. Any of them may be null.
+static void ReplacePlyArrays(ply_state *State, v3 *Positions, v3 *Normals, v2 *TexCoords, u32 VertexCount,
+                             void *Indices, u32 IndexSize, u32 IndexCount)
+{
+    if (!State->Cached)
+    {
+        if (State->Positions != (v3 *)State->Vertices)
+        {
+            free(State->Positions);
+        }
+        
+        free(State->Normals);
+        free(State->TexCoords);
+        free(State->Indices);
+    }
+    
+    if (State->Vertices && State->Format == PlyFormat_BinaryBigEndian)
+    {
+        free(State->Vertices);
+    }
+    State->Vertices = nullptr;
+    State->VertexStride = 0;
+    State->Cached = false;
+    CloseMappedFile(&State->File);
+    
+    State->Positions = Positions;
+    State->Normals = Normals;
+    State->TexCoords = TexCoords;
+    State->Indices = Indices;
+    
+    State->PositionElementCount = Positions ? 3 : 0;
+    State->NormalElementCount = Normals ? 3 : 0;
+    State->TexCoordElementCount = TexCoords ? 2 : 0;
+    State->VertexCount = VertexCount;
+    State->VertexSize = sizeof(f32)*(State->PositionElementCount + State->NormalElementCount + State->TexCoordElementCount);
+    State->IndexSize = IndexSize;
+    State->IndexCount = IndexCount;
+}
+
+
+// Computes normals for a state that has none, see mesh_normals.h. A state from the mesh cache is
+// left alone, its arrays point into the cache file and it has normals whenever it has triangles.
+static b32 GeneratePlyNormals(ply_state *State, normal_weighting Weighting = NormalWeighting_Area, u32 ThreadCount = 1)
+{
+    if (State->Normals)
+    {
+        return true;
+    }
+    if (State->Cached || !State->Indices || State->IndexCount < 3)
+    {
+        return false;
+    }
+    
+    v3 *Normals = (v3 *)malloc((size_t)State->VertexCount*sizeof(v3));
+    if (!Normals || !ComputeVertexNormals(State->Positions, State->VertexCount, State->Indices, State->IndexSize, 
+                                          State->IndexCount, Normals, Weighting, ThreadCount))
+    {
+        free(Normals);
+        return false;
+    }
+    
+    State->Normals = Normals;
+    State->NormalElementCount = 3;
+    State->VertexSize += sizeof(v3);
+    return true;
+}
+
+
+static u32 GetPlyIndex(ply_state *State, u32 Index)
+{
+    return State->IndexSize == sizeof(u16) ? ((u16 *)State->Indices)[Index] : ((u32 *)State->Indices)[Index];
+}
+
+
+static b32 HasPlyProperties(ply_element *Element, char const *A, char const *B, char const *C = nullptr)
+{
+    return FindPlyProperty(Element, A) && FindPlyProperty(Element, B) && (!C || FindPlyProperty(Element, C));
+}
+
+
+static ply_column PlyColumn(char const *Element, char const *Property, ply_type Type, void *Data, u32 Stride, 
+                            u32 ListSize = 0)
+{
+    ply_column Result;
+    Result.Element = Element;
+    Result.Property = Property;
+    Result.Type = Type;
+    Result.Data = Data;
+    Result.Stride = Stride;
+    Result.ListSize = ListSize;
+    Result.Triangulation = nullptr;
+    return Result;
+}
+
+
+// True when the vertices at the start of a little endian body are the positions as they are, so
+// they need not be copied
+static b32 VerticesArePositions(ply_schema *Schema, ply_element *Vertex)
+{
+    if (Schema->Format != PlyFormat_BinaryLittleEndian || Vertex != &Schema->Elements[0] || Vertex->PropertyCount != 3)
+    {
+        return false;
+    }
+    
+    char const *Names[] = { "x", "y", "z" };
+    for (u32 Index = 0; Index < 3; ++Index)
+    {
+        ply_property *Property = &Vertex->Properties[Index];
+        if (Property->Type != PlyType_Float || strcmp(Property->Name, Names[Index]) != 0)
+        {
+            return false;
+        }
+    }
+    
+    return true;
+}
+
+
+//
+// Main
+static b32 LoadPlyFile(char const *FileName, ply_state *State, u32 ThreadCount = 1)
+{
+    PROFILE_SCOPE("LoadPlyFile");
+    
+    ply_file File;
+    if (!OpenPlyFile(FileName, &File, ThreadCount))
+    {
+        return false;
+    }
+    
+    ply_schema *Schema = &File.Schema;
+    tokenizer *Tokenizer = &File.Tokenizer;
+    
+    ply_element *Vertex = FindPlyElement(Schema, "vertex");
+    ply_element *Face = FindPlyElement(Schema, "face");
+    if (!Vertex || Vertex->Count == 0 || !HasPlyProperties(Vertex, "x", "y", "z"))
+    {
+        Error(Tokenizer, "Finished parsing the header but found no vertices, or no vertices which also has positions");
+        ClosePlyFile(&File);
+        return false;
+    }
+    
+    char const *IndexName = nullptr;
+    if (Face && FindPlyProperty(Face, "vertex_indices"))
+    {
+        IndexName = "vertex_indices";
+    }
+    else if (Face && FindPlyProperty(Face, "vertex_index"))
+    {
+        IndexName = "vertex_index";
+    }
+    
+    //
+    // Columns
+    *State = {};
+    State->Format = Schema->Format;
+    State->VertexCount = Vertex->Count;
+    State->VertexSize = sizeof(v3);
+    State->PositionElementCount = 3;
+    
+    ply_column Columns[9];
+    u32 ColumnCount = 0;
+    
+    // NOTE(Marcus): The header can end anywhere, the positions are only used in place when they
+    //               are aligned for v3, otherwise they are copied like any other layout
+    b32 ZeroCopy = VerticesArePositions(Schema, Vertex) && File.BodyOffset % alignof(v3) == 0;
+    if (!ZeroCopy)
+    {
+        State->Positions = (v3 *)malloc(State->VertexCount * sizeof(v3));
+        Columns[ColumnCount++] = PlyColumn("vertex", "x", PlyType_Float, &State->Positions[0].x, sizeof(v3));
+        Columns[ColumnCount++] = PlyColumn("vertex", "y", PlyType_Float, &State->Positions[0].y, sizeof(v3));
+        Columns[ColumnCount++] = PlyColumn("vertex", "z", PlyType_Float, &State->Positions[0].z, sizeof(v3));
+    }
+    
+    if (HasPlyProperties(Vertex, "nx", "ny", "nz"))
+    {
+        State->Normals = (v3 *)malloc(State->VertexCount * sizeof(v3));
+        State->NormalElementCount = 3;
+        State->VertexSize += sizeof(v3);
+        Columns[ColumnCount++] = PlyColumn("vertex", "nx", PlyType_Float, &State->Normals[0].x, sizeof(v3));
+        Columns[ColumnCount++] = PlyColumn("vertex", "ny", PlyType_Float, &State->Normals[0].y, sizeof(v3));
+        Columns[ColumnCount++] = PlyColumn("vertex", "nz", PlyType_Float, &State->Normals[0].z, sizeof(v3));
+    }
+    
+    if (HasPlyProperties(Vertex, "s", "t"))
+    {
+        State->TexCoords = (v2 *)malloc(State->VertexCount * sizeof(v2));
+        State->TexCoordElementCount = 2;
+        State->VertexSize += sizeof(v2);
+        Columns[ColumnCount++] = PlyColumn("vertex", "s", PlyType_Float, &State->TexCoords[0].x, sizeof(v2));
+        Columns[ColumnCount++] = PlyColumn("vertex", "t", PlyType_Float, &State->TexCoords[0].y, sizeof(v2));
+    }
+    
+    // NOTE(Marcus): The faces are triangulated, the positions are used for it when they are read
+    //               before the faces
+    ply_triangulation Triangulation = {};
+    if (IndexName && Face->Count > 0)
+    {
+        State->FaceCount = Face->Count;
+        State->IndexSize = State->VertexCount <= 65536 ? sizeof(u16) : sizeof(u32);
+        
+        Triangulation.VertexCount = State->VertexCount;
+        Triangulation.IndexType = State->IndexSize == sizeof(u16) ? PlyType_UShort : PlyType_UInt;
+        if (ZeroCopy)
+        {
+            Triangulation.Positions = (v3 *)(File.File.Data + File.BodyOffset);
+        }
+        else if (Vertex < Face)
+        {
+            Triangulation.Positions = State->Positions;
+        }
+        
+        u64 TriangleCount = CountPlyTriangles(&File, "face", IndexName);
+        TriangleCount = TriangleCount > 0 ? TriangleCount : 1;
+        if (3*TriangleCount > u32Max)
+        {
+            Error(Tokenizer, "More than %u indices", u32Max);
+        }
+        else
+        {
+            Triangulation.TriangleCapacity = (u32)TriangleCount;
+            Triangulation.Indices = malloc((size_t)3*TriangleCount*State->IndexSize);
+        }
+        
+        ply_column Column = PlyColumn("face", IndexName, PlyType_UInt, nullptr, 0);
+        Column.Triangulation = &Triangulation;
+        Columns[ColumnCount++] = Column;
+    }
+    
+    if ((!ZeroCopy && !State->Positions) || (State->NormalElementCount && !State->Normals) ||
+        (State->TexCoordElementCount && !State->TexCoords) || (State->FaceCount && !Triangulation.Indices))
+    {
+        Error(Tokenizer, "Could not allocate the arrays for %u vertices", State->VertexCount);
+    }
+    
+    //
+    // Body
+    State->FinishedWithHeader = true;
+    if (!Tokenizer->Error)
+    {
+        ReadPlyElements(&File, Columns, ColumnCount);
+    }
+    
+    State->Indices = Triangulation.Indices;
+    State->IndexCount = 3*Triangulation.TriangleCount;
+    
+    // NOTE(Marcus): The mapping of a binary file moves to the state, the vertices can point into it
+    b32 Result = !Tokenizer->Error;
+    if (Result && Schema->Format != PlyFormat_Ascii)
+    {
+        if (Vertex->RowSize > 0 && (Schema->Format == PlyFormat_BinaryLittleEndian || Vertex->Swapped))
+        {
+            State->Vertices = Vertex->Data;
+            State->VertexStride = Vertex->RowSize;
+            Vertex->Swapped = nullptr;
+        }
+        
+        if (ZeroCopy)
+        {
+            State->Positions = (v3 *)State->Vertices;
+            if (!State->Positions)
+            {
+                Error(Tokenizer, "Could not swap the vertices");
+                Result = false;
+            }
+        }
+        
+        State->File = File.File;
+        File.File = {};
+    }
+    
+#if 0
+    if (!Tokenizer->Error)
+    {
+        for (u32 Index = 0; Index < State->VertexCount; ++Index)
+        {
+            printf("%2d. P = (%6.2f, %6.2f, %6.2f)",  Index,
+                   State->Positions[Index].x, State->Positions[Index].y, State->Positions[Index].z);
+            
+            if (State->NormalElementCount > 0)
+            {
+                printf(", N = (%6.2f, %6.2f, %6.2f)",
+                       State->Normals[Index].x, State->Normals[Index].y, State->Normals[Index].z);
+            }
+            
+            if (State->TexCoordElementCount > 0)
+            {
+                printf(", T = (%6.2f, %6.2f)",
+                       State->TexCoords[Index].x, State->TexCoords[Index].y);
+            }
+            
+            printf("\n");
+        }
+        
+        for (u32 Index = 0; Index < State->IndexCount; Index += 3)
+        {
+            printf("%2d. %3d - %3d - %3d\n", Index,
+                   GetPlyIndex(State, Index), GetPlyIndex(State, Index + 1), GetPlyIndex(State, Index + 2));
+        }
+    }
+#endif
+    
+    ClosePlyFile(&File);
+    
+    if (!Result)
+    {
+        Free(State);
+        return false;
+    }
+    else
+    {
+        return true;
+    }
+}
+
+#endif
@@ -0,0 +1,569 @@
+// 
+// MIT License
+// 
+// Copyright (c) 2018 Marcus Larsson
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+#include "profiler.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+
+profiler GlobalProfiler;
+
+// The ring of the calling thread, registered on first use
+static thread_local profile_thread *CurrentProfileThread = nullptr;
+
+
+
+//
+// Recording, called from any thread
+//
+#if PROFILER_ENABLED
+void ProfileRegisterThread(char const *Name)
+{
+    if (CurrentProfileThread)
+    {
+        CurrentProfileThread->Name = Name;
+        return;
+    }
+    
+    //
+    // Reuse the ring of a thread that has exited, the events it left are still drained
+    u32 ThreadCount = (u32)GlobalProfiler.ThreadCount;
+    ThreadCount = ThreadCount < kProfileThreadCountMax ? ThreadCount : kProfileThreadCountMax;
+    for (u32 Index = 0; Index < ThreadCount; ++Index)
+    {
+        profile_thread *Thread = GlobalProfiler.Threads[Index];
+        if (Thread && Thread->IsFree && InterlockedCompareExchange(&Thread->IsFree, 0, 1) == 1)
+        {
+            Thread->Name = Name;
+            Thread->ThreadID = GetCurrentThreadId();
+            Thread->Depth = 0;
+            
+            CurrentProfileThread = Thread;
+            return;
+        }
+    }
+    
+    LONG Index = InterlockedIncrement(&GlobalProfiler.ThreadCount) - 1;
+    if (Index >= (LONG)kProfileThreadCountMax)
+    {
+        InterlockedDecrement(&GlobalProfiler.ThreadCount);
+        return;
+    }
+    
+    profile_thread *Thread = (profile_thread *)calloc(1, sizeof(profile_thread));
+    assert(Thread);
+    Thread->Name = Name;
+    Thread->ThreadID = GetCurrentThreadId();
+    
+    CurrentProfileThread = Thread;
+    InterlockedExchangePointer((void * volatile *)&GlobalProfiler.Threads[Index], Thread);
+}
+
+
+// Called before a registered thread exits, so threads that come and go do not run out of rings
+void ProfileUnregisterThread()
+{
+    profile_thread *Thread = CurrentProfileThread;
+    if (!Thread)
+    {
+        return;
+    }
+    
+    CurrentProfileThread = nullptr;
+    InterlockedExchange(&Thread->IsFree, 1);
+}
+
+
+void ProfileBegin(char const *Name)
+{
+    if (!CurrentProfileThread)
+    {
+        ProfileRegisterThread("Thread");
+    }
+    
+    if (CurrentProfileThread)
+    {
+        ++CurrentProfileThread->Depth;
+    }
+}
+
+
+static void PushEvent(profile_thread *Thread, char const *Name, u64 Begin, u64 End, profile_event_type Type)
+{
+    LONG WriteIndex = Thread->WriteIndex;
+    if ((u32)(WriteIndex - Thread->ReadIndex) >= kProfileEventCountMax)
+    {
+        ++Thread->DroppedCount;
+        return;
+    }
+    
+    profile_event *Event = &Thread->Events[WriteIndex & (kProfileEventCountMax - 1)];
+    Event->Name = Name;
+    Event->Begin = Begin;
+    Event->End = End;
+    Event->Depth = (u16)Thread->Depth;
+    Event->Type = (u16)Type;
+    
+    // Publish the event after it has been written
+    InterlockedExchange(&Thread->WriteIndex, WriteIndex + 1);
+}
+
+
+void ProfileEnd(char const *Name, u64 Begin)
+{
+    u64 End = ReadTimestamp();
+    
+    profile_thread *Thread = CurrentProfileThread;
+    if (!Thread)
+    {
+        return;
+    }
+    
+    --Thread->Depth;
+    PushEvent(Thread, Name, Begin, End, ProfileEvent_Scope);
+}
+
+
+// The timestamp has to be inside a scope on the calling thread, flows are drawn between scopes
+void ProfileFlow(char const *Name, u64 Timestamp, u64 FlowID, b32 IsEnd)
+{
+    if (!GlobalProfiler.IsTracing)
+    {
+        return;
+    }
+    
+    if (!CurrentProfileThread)
+    {
+        ProfileRegisterThread("Thread");
+    }
+    
+    if (CurrentProfileThread)
+    {
+        PushEvent(CurrentProfileThread, Name, Timestamp, FlowID, IsEnd ? ProfileEvent_FlowEnd : ProfileEvent_FlowStart);
+    }
+}
+
+
+void ProfileCounter(char const *Name, u64 Value)
+{
+    if (!GlobalProfiler.IsTracing)
+    {
+        return;
+    }
+    
+    if (!CurrentProfileThread)
+    {
+        ProfileRegisterThread("Thread");
+    }
+    
+    if (CurrentProfileThread)
+    {
+        PushEvent(CurrentProfileThread, Name, ReadTimestamp(), Value, ProfileEvent_Counter);
+    }
+}
+#endif
+
+
+
+//
+// Initialisation, called from the main thread
+//
+void InitProfiler()
+{
+    // Calibrate the time stamp counter against the performance counter
+    LARGE_INTEGER Frequency, StartingTime, EndingTime;
+    QueryPerformanceFrequency(&Frequency);
+    QueryPerformanceCounter(&StartingTime);
+    u64 StartingTicks = ReadTimestamp();
+    Sleep(20);
+    QueryPerformanceCounter(&EndingTime);
+    u64 EndingTicks = ReadTimestamp();
+    
+    f64 Ms = 1000.0 * (f64)(EndingTime.QuadPart - StartingTime.QuadPart) / (f64)Frequency.QuadPart;
+    GlobalProfiler.TicksPerMs = (f64)(EndingTicks - StartingTicks) / Ms;
+    
+    GlobalProfiler.FrameBegin = ReadTimestamp();
+}
+
+
+void FreeProfiler()
+{
+    StopTrace();
+    
+    u32 ThreadCount = (u32)GlobalProfiler.ThreadCount;
+    ThreadCount = ThreadCount < kProfileThreadCountMax ? ThreadCount : kProfileThreadCountMax;
+    for (u32 Index = 0; Index < ThreadCount; ++Index)
+    {
+        free(GlobalProfiler.Threads[Index]);
+        GlobalProfiler.Threads[Index] = nullptr;
+    }
+    GlobalProfiler.ThreadCount = 0;
+    GlobalProfiler.ScopeCount = 0;
+    
+    // The calling thread is the only one still running
+    CurrentProfileThread = nullptr;
+}
+
+
+//
+// Trace
+//
+// NOTE(Marcus): Names are written as they are, they must not contain quotes or backslashes
+//
+b32 StartTrace(char const *FileName)
+{
+    profiler *Profiler = &GlobalProfiler;
+    if (Profiler->IsTracing)
+    {
+        return false;
+    }
+    
+    FILE *File;
+    if (fopen_s(&File, FileName, "w"))
+    {
+        return false;
+    }
+    
+    fprintf(File, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(File, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"particles\"}}");
+    
+    Profiler->TraceFile = File;
+    Profiler->TraceBegin = ReadTimestamp();
+    Profiler->TraceEventCount = 0;
+    for (u32 Index = 0; Index < kProfileThreadCountMax; ++Index)
+    {
+        Profiler->TraceThreadNames[Index] = nullptr;
+    }
+    Profiler->IsTracing = true;
+    
+    return true;
+}
+
+
+void StopTrace()
+{
+    profiler *Profiler = &GlobalProfiler;
+    if (!Profiler->IsTracing)
+    {
+        return;
+    }
+    
+    // Events still in the rings are dropped
+    Profiler->IsTracing = false;
+    fprintf(Profiler->TraceFile, "\n]}\n");
+    fclose(Profiler->TraceFile);
+    Profiler->TraceFile = nullptr;
+}
+
+
+static void WriteTraceEvent(profile_thread *Thread, u32 ThreadIndex, profile_event *Event)
+{
+    profiler *Profiler = &GlobalProfiler;
+    FILE *File = Profiler->TraceFile;
+    
+    // Named again when the ring is taken over by another thread
+    if (Profiler->TraceThreadNames[ThreadIndex] != Thread->Name)
+    {
+        fprintf(File, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s %u\"}}",
+                ThreadIndex, Thread->Name, ThreadIndex);
+        Profiler->TraceThreadNames[ThreadIndex] = Thread->Name;
+    }
+    
+    // Events recorded before the trace started have timestamps before TraceBegin
+    if (Event->Begin < Profiler->TraceBegin)
+    {
+        return;
+    }
+    
+    f64 TicksPerUs = Profiler->TicksPerMs / 1000.0;
+    f64 Timestamp = (f64)(Event->Begin - Profiler->TraceBegin) / TicksPerUs;
+    
+    switch (Event->Type)
+    {
+        case ProfileEvent_Scope:
+        {
+            fprintf(File, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+                    Event->Name, ThreadIndex, Timestamp, (f64)(Event->End - Event->Begin) / TicksPerUs);
+        } break;
+        
+        case ProfileEvent_FlowStart:
+        case ProfileEvent_FlowEnd:
+        {
+            fprintf(File, ",\n{\"name\":\"%s\",\"cat\":\"flow\",\"ph\":\"%s\",\"bp\":\"e\",\"id\":%llu,\"pid\":1,\"tid\":%u,\"ts\":%.3f}",
+                    Event->Name, Event->Type == ProfileEvent_FlowStart ? "s" : "f", 
+                    (unsigned long long)Event->FlowID, ThreadIndex, Timestamp);
+        } break;
+        
+        case ProfileEvent_Counter:
+        {
+            fprintf(File, ",\n{\"name\":\"%s\",\"ph\":\"C\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"args\":{\"value\":%llu}}",
+                    Event->Name, ThreadIndex, Timestamp, (unsigned long long)Event->Value);
+        } break;
+    }
+    
+    ++Profiler->TraceEventCount;
+}
+
+
+
+//
+// Aggregation, called from the main thread
+//
+static profile_scope_stats *GetScopeStats(char const *Name, u32 ThreadIndex, u32 Depth)
+{
+    profiler *Profiler = &GlobalProfiler;
+    for (u32 Index = 0; Index < Profiler->ScopeCount; ++Index)
+    {
+        profile_scope_stats *Stats = &Profiler->Scopes[Index];
+        if (Stats->Name == Name && Stats->ThreadIndex == ThreadIndex && Stats->Depth == Depth)
+        {
+            return Stats;
+        }
+    }
+    
+    if (Profiler->ScopeCount == kProfileScopeCountMax)
+    {
+        return nullptr;
+    }
+    
+    profile_scope_stats *Stats = &Profiler->Scopes[Profiler->ScopeCount++];
+    *Stats = {};
+    Stats->Name = Name;
+    Stats->ThreadIndex = ThreadIndex;
+    Stats->Depth = Depth;
+    
+    return Stats;
+}
+
+
+#if PROFILER_ENABLED
+void ProfileBarrier(char const *Name, u64 Begin, u64 End, u64 const *BusyTicks, u32 WorkerCount)
+{
+    profiler *Profiler = &GlobalProfiler;
+    
+    profile_barrier_stats *Stats = nullptr;
+    for (u32 Index = 0; Index < Profiler->BarrierCount; ++Index)
+    {
+        if (Profiler->Barriers[Index].Name == Name)
+        {
+            Stats = &Profiler->Barriers[Index];
+        }
+    }
+    
+    if (!Stats)
+    {
+        if (Profiler->BarrierCount == kProfileBarrierCountMax)
+        {
+            return;
+        }
+        Stats = &Profiler->Barriers[Profiler->BarrierCount++];
+        *Stats = {};
+        Stats->Name = Name;
+    }
+    
+    //
+    // A worker waits from the moment it is done until the last worker is done
+    f64 TotalMs = (f64)(End - Begin) / Profiler->TicksPerMs;
+    f64 MinBusyMs = TotalMs;
+    f64 MaxBusyMs = 0.0;
+    f64 BusyMs = 0.0;
+    for (u32 Index = 0; Index < WorkerCount; ++Index)
+    {
+        f64 Ms = (f64)BusyTicks[Index] / Profiler->TicksPerMs;
+        MinBusyMs = Ms < MinBusyMs ? Ms : MinBusyMs;
+        MaxBusyMs = Ms > MaxBusyMs ? Ms : MaxBusyMs;
+        BusyMs += Ms;
+    }
+    
+    Stats->WorkerCount = WorkerCount;
+    Stats->BusyMs += BusyMs;
+    Stats->WaitMs += WorkerCount * TotalMs - BusyMs;
+    Stats->MaxWaitMs = TotalMs - MinBusyMs > Stats->MaxWaitMs ? TotalMs - MinBusyMs : Stats->MaxWaitMs;
+    Stats->MinBusyMs = !Stats->SampleCount || MinBusyMs < Stats->MinBusyMs ? MinBusyMs : Stats->MinBusyMs;
+    Stats->MaxBusyMs = MaxBusyMs > Stats->MaxBusyMs ? MaxBusyMs : Stats->MaxBusyMs;
+    ++Stats->SampleCount;
+}
+#endif
+
+
+void ProfileEndFrame()
+{
+    profiler *Profiler = &GlobalProfiler;
+    
+    u64 FrameEnd = ReadTimestamp();
+    Profiler->FrameHistory[Profiler->FrameIndex % kProfileFrameHistoryCount] = 
+        (f32)((f64)(FrameEnd - Profiler->FrameBegin) / Profiler->TicksPerMs);
+    Profiler->FrameBegin = FrameEnd;
+    ++Profiler->FrameIndex;
+    
+    //
+    // Drain the rings
+    u32 ThreadCount = (u32)Profiler->ThreadCount;
+    ThreadCount = ThreadCount < kProfileThreadCountMax ? ThreadCount : kProfileThreadCountMax;
+    for (u32 ThreadIndex = 0; ThreadIndex < ThreadCount; ++ThreadIndex)
+    {
+        profile_thread *Thread = Profiler->Threads[ThreadIndex];
+        if (!Thread)
+        {
+            continue;
+        }
+        
+        LONG ReadIndex = Thread->ReadIndex;
+        LONG WriteIndex = Thread->WriteIndex;
+        for (LONG Index = ReadIndex; Index != WriteIndex; ++Index)
+        {
+            profile_event *Event = &Thread->Events[Index & (kProfileEventCountMax - 1)];
+            if (Profiler->IsTracing)
+            {
+                WriteTraceEvent(Thread, ThreadIndex, Event);
+            }
+            
+            if (Event->Type != ProfileEvent_Scope)
+            {
+                continue;
+            }
+            
+            profile_scope_stats *Stats = GetScopeStats(Event->Name, ThreadIndex, Event->Depth);
+            if (Stats)
+            {
+                Stats->FrameTicks += Event->End - Event->Begin;
+                ++Stats->FrameCallCount;
+            }
+        }
+        
+        // Hand the slots back to the thread once the events have been read
+        InterlockedExchange(&Thread->ReadIndex, WriteIndex);
+    }
+    
+    //
+    // Scopes that were not entered this frame keep their history
+    for (u32 Index = 0; Index < Profiler->ScopeCount; ++Index)
+    {
+        profile_scope_stats *Stats = &Profiler->Scopes[Index];
+        if (Stats->FrameCallCount)
+        {
+            Stats->History[Stats->HistoryCount % kProfileFrameHistoryCount] = 
+                (f32)((f64)Stats->FrameTicks / Profiler->TicksPerMs);
+            ++Stats->HistoryCount;
+            
+            Stats->CallCount = Stats->FrameCallCount;
+            Stats->FrameTicks = 0;
+            Stats->FrameCallCount = 0;
+        }
+    }
+}
+
+
+
+//
+// Report
+//
+static int CompareF32(void const *A, void const *B)
+{
+    f32 a = *(f32 const *)A;
+    f32 b = *(f32 const *)B;
+    return (a > b) - (a < b);
+}
+
+
+static void GetHistoryStats(f32 const *History, u32 Count, f32 *MinMs, f32 *MeanMs, f32 *P99Ms)
+{
+    f32 Sorted[kProfileFrameHistoryCount];
+    Count = Count < kProfileFrameHistoryCount ? Count : kProfileFrameHistoryCount;
+    
+    f32 Sum = 0.0f;
+    for (u32 Index = 0; Index < Count; ++Index)
+    {
+        Sorted[Index] = History[Index];
+        Sum += History[Index];
+    }
+    qsort(Sorted, Count, sizeof(f32), CompareF32);
+    
+    *MinMs = Count ? Sorted[0] : 0.0f;
+    *MeanMs = Count ? Sum / (f32)Count : 0.0f;
+    *P99Ms = Count ? Sorted[(99 * (Count - 1)) / 100] : 0.0f;
+}
+
+
+void ProfileReport()
+{
+    profiler *Profiler = &GlobalProfiler;
+    
+    f32 MinMs, MeanMs, P99Ms;
+    GetHistoryStats(Profiler->FrameHistory, Profiler->FrameIndex, &MinMs, &MeanMs, &P99Ms);
+    printf("Frame %u: min %.3f ms, mean %.3f ms, p99 %.3f ms\n", Profiler->FrameIndex, MinMs, MeanMs, P99Ms);
+    
+    u32 ThreadCount = (u32)Profiler->ThreadCount;
+    ThreadCount = ThreadCount < kProfileThreadCountMax ? ThreadCount : kProfileThreadCountMax;
+    for (u32 ThreadIndex = 0; ThreadIndex < ThreadCount; ++ThreadIndex)
+    {
+        profile_thread *Thread = Profiler->Threads[ThreadIndex];
+        if (!Thread)
+        {
+            continue;
+        }
+        
+        printf("  %s (%u)%s%s\n", Thread->Name, Thread->ThreadID, Thread->IsFree ? ", exited" : "",
+               Thread->DroppedCount ? ", events dropped" : "");
+        
+        // Parents are listed before the scopes nested in them
+        for (u32 Depth = 0, Printed = 1; Printed; ++Depth)
+        {
+            Printed = 0;
+            for (u32 Index = 0; Index < Profiler->ScopeCount; ++Index)
+            {
+                profile_scope_stats *Stats = &Profiler->Scopes[Index];
+                if (Stats->ThreadIndex == ThreadIndex && Stats->Depth == Depth)
+                {
+                    GetHistoryStats(Stats->History, Stats->HistoryCount, &MinMs, &MeanMs, &P99Ms);
+                    s32 Indent = (s32)(2 * Depth);
+                    printf("    %*s%-*s min %8.3f  mean %8.3f  p99 %8.3f ms  (%u calls)\n", Indent, "", 
+                           32 - Indent, Stats->Name, MinMs, MeanMs, P99Ms, Stats->CallCount);
+                    ++Printed;
+                }
+            }
+        }
+    }
+    
+    //
+    // Barriers, averaged since the last report
+    for (u32 Index = 0; Index < Profiler->BarrierCount; ++Index)
+    {
+        profile_barrier_stats *Stats = &Profiler->Barriers[Index];
+        if (!Stats->SampleCount)
+        {
+            continue;
+        }
+        
+        f64 Samples = (f64)Stats->SampleCount * (f64)Stats->WorkerCount;
+        f64 Utilisation = 100.0 * Stats->BusyMs / (Stats->BusyMs + Stats->WaitMs);
+        printf("  %s barrier, %u workers: busy %.3f ms (min %.3f, max %.3f), wait %.3f ms (max %.3f), %.1f%% busy\n",
+               Stats->Name, Stats->WorkerCount, Stats->BusyMs / Samples, Stats->MinBusyMs, Stats->MaxBusyMs,
+               Stats->WaitMs / Samples, Stats->MaxWaitMs, Utilisation);
+        
+        char const *Name = Stats->Name;
+        *Stats = {};
+        Stats->Name = Name;
+    }
+}
@@ -0,0 +1,219 @@
+// 
+// MIT License
+// 
+// Copyright (c) 2018 Marcus Larsson
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+
+#ifndef Profiler__h
+#define Profiler__h
+
+#define UNICODE
+#define STRICT
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <intrin.h>
+#include <stdio.h>
+
+#include "types.h"
+
+// Compile the scopes and the recording calls away completely with PROFILER_ENABLED=0
+#ifndef PROFILER_ENABLED
+#define PROFILER_ENABLED 1
+#endif
+
+
+
+//
+// Frame profiler
+//
+// Each thread writes the scopes it closes into its own ring buffer, the main thread drains the
+// rings in ProfileEndFrame() and sums the time spent in each scope over the frame. The rings are
+// single producer single consumer, so recording a scope is two timestamps and a store. Names have
+// to be string literals (or live as long as the profiler), they are compared by pointer.
+//
+// A thread gets a ring when it registers or opens its first scope, and should call
+// ProfileUnregisterThread() before it exits so the ring is handed to the next thread that starts.
+// The scopes are kept per ring, so a reused ring carries on the statistics of the one before it.
+// Once kProfileThreadCountMax rings are in use new threads are not profiled.
+//
+// While a trace is running the drained events are also written as Chrome trace-event JSON, which
+// can be opened in chrome://tracing or Perfetto. Flow events and counters are only recorded while
+// tracing, otherwise they cost a load and a branch.
+//
+u32 constexpr kProfileThreadCountMax = 64;
+u32 constexpr kProfileEventCountMax = 4096;     // Per thread, a power of two
+u32 constexpr kProfileScopeCountMax = 256;
+u32 constexpr kProfileFrameHistoryCount = 128;  // Frames that min/mean/p99 are computed over
+u32 constexpr kProfileBarrierCountMax = 8;
+
+inline u64 ReadTimestamp()
+{
+    return __rdtsc();
+}
+
+enum profile_event_type
+{
+    ProfileEvent_Scope,
+    ProfileEvent_FlowStart,
+    ProfileEvent_FlowEnd,
+    ProfileEvent_Counter,
+};
+
+struct profile_event
+{
+    char const *Name;
+    u64 Begin;
+    union
+    {
+        u64 End;    // Scope
+        u64 FlowID; // Flow start and end
+        u64 Value;  // Counter
+    };
+    u16 Depth;
+    u16 Type;
+};
+
+struct profile_thread
+{
+    char const *Name;
+    u32 ThreadID;
+    
+    profile_event Events[kProfileEventCountMax];
+    LONG volatile WriteIndex;   // Only written by the thread that owns the ring
+    LONG volatile ReadIndex;    // Only written by the thread calling ProfileEndFrame()
+    u32 DroppedCount;
+    
+    u32 Depth;
+    LONG volatile IsFree;       // Set when the thread exits, the next thread to register takes the ring
+};
+
+// The time spent in one scope on one thread, summed over each frame
+struct profile_scope_stats
+{
+    char const *Name;
+    u32 ThreadIndex;
+    u32 Depth;
+    
+    u64 FrameTicks;
+    u32 FrameCallCount;
+    
+    f32 History[kProfileFrameHistoryCount]; // Milliseconds per frame
+    u32 HistoryCount;
+    u32 CallCount;                          // Calls in the last frame
+};
+
+// Busy and wait time of the workers released by a fork/join barrier, see ProfileBarrier()
+struct profile_barrier_stats
+{
+    char const *Name;
+    u32 WorkerCount;
+    
+    f64 BusyMs;
+    f64 WaitMs;
+    f64 MaxWaitMs;
+    f64 MinBusyMs;
+    f64 MaxBusyMs;
+    u32 SampleCount;
+};
+
+struct profiler
+{
+    profile_thread *Threads[kProfileThreadCountMax];
+    LONG volatile ThreadCount;
+    
+    profile_scope_stats Scopes[kProfileScopeCountMax];
+    u32 ScopeCount;
+    
+    profile_barrier_stats Barriers[kProfileBarrierCountMax];
+    u32 BarrierCount;
+    
+    f64 TicksPerMs;
+    u64 FrameBegin;
+    u32 FrameIndex;
+    f32 FrameHistory[kProfileFrameHistoryCount];
+    
+    // Trace
+    FILE *TraceFile;
+    u64 TraceBegin;
+    u32 TraceEventCount;
+    char const *TraceThreadNames[kProfileThreadCountMax];
+    b32 volatile IsTracing;
+};
+
+extern profiler GlobalProfiler;
+
+void InitProfiler();
+void FreeProfiler();    // Once every registered thread has exited
+#if PROFILER_ENABLED
+void ProfileRegisterThread(char const *Name);
+void ProfileUnregisterThread();
+void ProfileBegin(char const *Name);
+void ProfileEnd(char const *Name, u64 Begin);
+void ProfileFlow(char const *Name, u64 Timestamp, u64 FlowID, b32 IsEnd);
+void ProfileCounter(char const *Name, u64 Value);
+void ProfileBarrier(char const *Name, u64 Begin, u64 End, u64 const *BusyTicks, u32 WorkerCount);
+#else
+// NOTE(Marcus): Empty inline functions rather than empty macros, so the timestamps taken for the
+// calls still count as used and nothing is recorded
+inline void ProfileRegisterThread(char const *) {}
+inline void ProfileUnregisterThread() {}
+inline void ProfileBegin(char const *) {}
+inline void ProfileEnd(char const *, u64) {}
+inline void ProfileFlow(char const *, u64, u64, b32) {}
+inline void ProfileCounter(char const *, u64) {}
+inline void ProfileBarrier(char const *, u64, u64, u64 const *, u32) {}
+#endif
+void ProfileEndFrame();
+void ProfileReport();
+
+b32 StartTrace(char const *FileName);
+void StopTrace();
+
+struct profile_scope
+{
+    char const *Name;
+    u64 Begin;
+    
+    profile_scope(char const *ScopeName)
+    {
+        Name = ScopeName;
+        ProfileBegin(Name);
+        Begin = ReadTimestamp();
+    }
+    
+    ~profile_scope()
+    {
+        ProfileEnd(Name, Begin);
+    }
+};
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+
+#if PROFILER_ENABLED
+#define PROFILE_SCOPE(Name) profile_scope PROFILE_CONCAT(ProfileScope, __LINE__)(Name)
+#else
+#define PROFILE_SCOPE(Name)
+#endif
+
+
+#endif
@@ -0,0 +1,680 @@
+// 
+// MIT License
+// 
+// Copyright (c) 2018 Marcus Larsson
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+#include "benchmark.h"
+#include "particle_system.h"
+#include "terrain.h"
+#include "tokenizer.h"
+#include "ply_loader.h"
+#include "hash.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#if defined(_WIN32)
+#include <intrin.h>
+#endif
+
+u32 constexpr kRegressionCaseCountMax = 16;
+u32 constexpr kRegressionSampleCountMax = 64;
+u32 constexpr kRegressionSampleCount = 15;
+u32 constexpr kRegressionNameLength = 64;
+
+// A case is slower when the one sided Mann-Whitney test gives p < 0.01 and the median moved more
+// than the threshold, the threshold keeps tiny but consistent shifts from failing the suite
+f64 constexpr kRegressionZ = 2.326;
+f64 constexpr kRegressionThreshold = 0.03;
+
+
+
+//
+// Results, one per case, all in time per unit of work so smaller is better
+//
+struct regression_result
+{
+    char Name[kRegressionNameLength];
+    char const *Unit;
+    f64 Samples[kRegressionSampleCountMax];
+    u32 SampleCount;
+};
+
+struct regression_results
+{
+    char Fingerprint[17];
+    char Cpu[49];
+    u32 ProcessorCount;
+    
+    regression_result Cases[kRegressionCaseCountMax];
+    u32 CaseCount;
+};
+
+
+
+//
+// Machine fingerprint, the cpu, the number of processors and the build options that change the
+// performance. Baselines are only compared on the same fingerprint.
+//
+static void GetMachineFingerprint(regression_results *Results)
+{
+    int Info[4];
+    char Brand[49] = {};
+    __cpuid(Info, 0x80000000);
+    if ((u32)Info[0] >= 0x80000004)
+    {
+        for (u32 Index = 0; Index < 3; ++Index)
+        {
+            __cpuid(Info, 0x80000002 + Index);
+            memcpy(Brand + 16 * Index, Info, 16);
+        }
+    }
+    
+    // Trim the leading spaces some cpus pad the brand string with
+    char *At = Brand;
+    while (*At == ' ')
+    {
+        ++At;
+    }
+    snprintf(Results->Cpu, sizeof(Results->Cpu), "%s", At);
+    
+    SYSTEM_INFO SystemInfo;
+    GetSystemInfo(&SystemInfo);
+    Results->ProcessorCount = SystemInfo.dwNumberOfProcessors;
+    
+    char Description[128];
+    int Length = snprintf(Description, sizeof(Description), "%s|%u|layout %u|profiler %u", 
+                          Results->Cpu, Results->ProcessorCount, PARTICLE_COMPACT_LAYOUT, PROFILER_ENABLED);
+    u64 Hash = Hash64(Description, (size_t)Length);
+    snprintf(Results->Fingerprint, sizeof(Results->Fingerprint), "%016llx", (unsigned long long)Hash);
+}
+
+
+
+//
+// Cases
+//
+struct regression_timer
+{
+    LARGE_INTEGER Frequency;
+    LARGE_INTEGER StartingTime;
+};
+
+static void StartTimer(regression_timer *Timer)
+{
+    QueryPerformanceFrequency(&Timer->Frequency);
+    QueryPerformanceCounter(&Timer->StartingTime);
+}
+
+static f64 GetElapsedNanoseconds(regression_timer *Timer)
+{
+    LARGE_INTEGER EndingTime;
+    QueryPerformanceCounter(&EndingTime);
+    return 1e9 * (f64)(EndingTime.QuadPart - Timer->StartingTime.QuadPart) / (f64)Timer->Frequency.QuadPart;
+}
+
+
+static regression_result *AddCase(regression_results *Results, char const *Name, char const *Unit)
+{
+    assert(Results->CaseCount < kRegressionCaseCountMax);
+    regression_result *Result = &Results->Cases[Results->CaseCount++];
+    snprintf(Result->Name, sizeof(Result->Name), "%s", Name);
+    Result->Unit = Unit;
+    Result->SampleCount = 0;
+    return Result;
+}
+
+
+static void RunParticleUpdateCase(regression_results *Results, terrain *Terrain)
+{
+    regression_result *Result = AddCase(Results, "particle_update", "ns/step");
+    
+    particle_system ParticleSystem;
+    ParticleSystem.Lod.Enabled = false;
+    InitScene(&ParticleSystem, Terrain, 200000, 4);
+    
+    for (u32 Frame = 0; Frame < 60; ++Frame)
+    {
+        Update(&ParticleSystem);
+    }
+    
+    for (u32 Sample = 0; Sample < kRegressionSampleCount; ++Sample)
+    {
+        u64 StepCount = 0;
+        regression_timer Timer;
+        StartTimer(&Timer);
+        for (u32 Frame = 0; Frame < 10; ++Frame)
+        {
+            Update(&ParticleSystem);
+            StepCount += ParticleSystem.Lod.StepCount;
+        }
+        Result->Samples[Result->SampleCount++] = GetElapsedNanoseconds(&Timer) / (f64)(StepCount ? StepCount : 1);
+    }
+    
+    ShutDown(&ParticleSystem);
+}
+
+
+static void RunTerrainCase(regression_results *Results, char const *FileName)
+{
+    regression_result *Result = AddCase(Results, "terrain_preprocess", "us/terrain");
+    
+    for (u32 Sample = 0; Sample < kRegressionSampleCount; ++Sample)
+    {
+        terrain Terrain;
+        regression_timer Timer;
+        StartTimer(&Timer);
+        b32 Loaded = LoadTerrain(FileName, 61, 87, &Terrain);
+        Result->Samples[Result->SampleCount++] = GetElapsedNanoseconds(&Timer) / 1000.0;
+        
+        if (Loaded)
+        {
+            FreeTerrain(&Terrain);
+        }
+    }
+}
+
+
+static void RunTokenizerCase(regression_results *Results)
+{
+    regression_result *Result = AddCase(Results, "tokenizer", "ns/byte");
+    
+    //
+    // Synthetic input with the kinds of tokens found in ply headers and vertex data
+    size_t constexpr Size = 4 * 1024 * 1024;
+    char *Text = (char *)malloc(Size + 128);
+    assert(Text);
+    
+    size_t Length = 0;
+    for (u32 Line = 0; Length < Size; ++Line)
+    {
+        Length += snprintf(Text + Length, 128, "property_%u %d.%04u -%u.%03u \"name %u\" (%u, %u);\n", 
+                           Line % 97, (s32)(Line % 1000) - 500, Line % 10000, Line % 71, Line % 1000, Line, Line % 13, Line % 7);
+    }
+    
+    u32 TokenCount = 0;
+    for (u32 Sample = 0; Sample < kRegressionSampleCount; ++Sample)
+    {
+        string Input = {Length, (u8 *)Text};
+        tokenizer Tokenizer = Tokenize(Input);
+        
+        regression_timer Timer;
+        StartTimer(&Timer);
+        TokenCount = 0;
+        for (token Token = GetToken(&Tokenizer); Token.Type != Token_EndOfStream; Token = GetToken(&Tokenizer))
+        {
+            ++TokenCount;
+        }
+        Result->Samples[Result->SampleCount++] = GetElapsedNanoseconds(&Timer) / (f64)Length;
+    }
+    
+    free(Text);
+}
+
+
+static void RunPlyCase(regression_results *Results, char const *FileName)
+{
+    regression_result *Result = AddCase(Results, "ply_load", "us/mesh");
+    
+    for (u32 Sample = 0; Sample < kRegressionSampleCount; ++Sample)
+    {
+        ply_state PlyState;
+        regression_timer Timer;
+        StartTimer(&Timer);
+        b32 Loaded = LoadPlyFile(FileName, &PlyState);
+        Result->Samples[Result->SampleCount++] = GetElapsedNanoseconds(&Timer) / 1000.0;
+        
+        if (Loaded)
+        {
+            Free(&PlyState);
+        }
+    }
+}
+
+
+// Written by the cases so the compiler can not remove the work that is timed
+static f32 volatile RegressionSink;
+
+static void RunMatrixCase(regression_results *Results)
+{
+    regression_result *MultiplyResult = AddCase(Results, "m4_multiply", "ns/op");
+    regression_result *TransformResult = AddCase(Results, "v4_transform", "ns/op");
+    regression_result *InverseResult = AddCase(Results, "m4_inverse", "ns/op");
+    regression_result *AffineInverseResult = AddCase(Results, "m4_affine_inverse", "ns/op");
+    regression_result *RigidInverseResult = AddCase(Results, "m4_rigid_inverse", "ns/op");
+    regression_result *LookAtResult = AddCase(Results, "m4_look_at", "ns/op");
+    
+    u32 constexpr Count = 4096;
+    m4 *Matrices = (m4 *)malloc(Count * sizeof(m4));
+    v4 *Vectors = (v4 *)malloc(Count * sizeof(v4));
+    assert(Matrices && Vectors);
+    
+    for (u32 Index = 0; Index < Count; ++Index)
+    {
+        f32 Angle = 0.001f * (f32)Index;
+        Matrices[Index] = M4RotationY(Angle) * M4RotationX(0.5f * Angle) * M4Translation(V3((f32)Index, 1.0f, -2.0f));
+        Vectors[Index] = V4((f32)Index, 2.0f, 3.0f, 1.0f);
+    }
+    
+    f32 Sum = 0.0f;
+    for (u32 Sample = 0; Sample < kRegressionSampleCount; ++Sample)
+    {
+        regression_timer Timer;
+        
+        StartTimer(&Timer);
+        m4 M = m4_identity;
+        for (u32 Index = 0; Index < Count; ++Index)
+        {
+            M = Matrices[Index] * Matrices[(Index + 1) & (Count - 1)];
+            Sum += M.E[0][0];
+        }
+        MultiplyResult->Samples[MultiplyResult->SampleCount++] = GetElapsedNanoseconds(&Timer) / Count;
+        
+        StartTimer(&Timer);
+        for (u32 Index = 0; Index < Count; ++Index)
+        {
+            v4 V = Vectors[Index] * Matrices[Index];
+            Sum += V.x;
+        }
+        TransformResult->Samples[TransformResult->SampleCount++] = GetElapsedNanoseconds(&Timer) / Count;
+        
+        StartTimer(&Timer);
+        for (u32 Index = 0; Index < Count; ++Index)
+        {
+            M = M4Inverse(&Matrices[Index]);
+            Sum += M.E[3][0];
+        }
+        InverseResult->Samples[InverseResult->SampleCount++] = GetElapsedNanoseconds(&Timer) / Count;
+        
+        StartTimer(&Timer);
+        for (u32 Index = 0; Index < Count; ++Index)
+        {
+            M = M4AffineInverse(&Matrices[Index]);
+            Sum += M.E[3][0];
+        }
+        AffineInverseResult->Samples[AffineInverseResult->SampleCount++] = GetElapsedNanoseconds(&Timer) / Count;
+        
+        StartTimer(&Timer);
+        for (u32 Index = 0; Index < Count; ++Index)
+        {
+            M = M4RigidInverse(&Matrices[Index]);
+            Sum += M.E[3][0];
+        }
+        RigidInverseResult->Samples[RigidInverseResult->SampleCount++] = GetElapsedNanoseconds(&Timer) / Count;
+        
+        StartTimer(&Timer);
+        for (u32 Index = 0; Index < Count; ++Index)
+        {
+            M = M4LookAt(Vectors[Index].xyz(), V3(0.0f, 0.0f, 0.0f));
+            Sum += M.E[3][0];
+        }
+        LookAtResult->Samples[LookAtResult->SampleCount++] = GetElapsedNanoseconds(&Timer) / Count;
+    }
+    
+    RegressionSink = Sum;
+    
+    free(Matrices);
+    free(Vectors);
+}
+
+
+
+//
+// Baseline file
+//
+static void WriteBaseline(char const *FileName, regression_results *Results)
+{
+    FILE *File;
+    if (fopen_s(&File, FileName, "w"))
+    {
+        printf("Failed to write the baseline %s\n", FileName);
+        return;
+    }
+    
+    fprintf(File, "{\n");
+    fprintf(File, "    \"fingerprint\": \"%s\",\n", Results->Fingerprint);
+    fprintf(File, "    \"cpu\": \"%s\",\n", Results->Cpu);
+    fprintf(File, "    \"processors\": %u,\n", Results->ProcessorCount);
+    fprintf(File, "    \"cases\": [\n");
+    for (u32 Index = 0; Index < Results->CaseCount; ++Index)
+    {
+        regression_result *Result = &Results->Cases[Index];
+        fprintf(File, "        {\"name\": \"%s\", \"unit\": \"%s\", \"samples\": [", Result->Name, Result->Unit);
+        for (u32 Sample = 0; Sample < Result->SampleCount; ++Sample)
+        {
+            fprintf(File, "%s%.4f", Sample ? ", " : "", Result->Samples[Sample]);
+        }
+        fprintf(File, "]}%s\n", Index + 1 < Results->CaseCount ? "," : "");
+    }
+    fprintf(File, "    ]\n");
+    fprintf(File, "}\n");
+    
+    fclose(File);
+}
+
+
+// NOTE(Marcus): The tokenizer keeps the opening quote in the text of a string token
+static b32 StringTokenIs(token Token, char const *Value)
+{
+    size_t Length = strlen(Value);
+    return (Token.Type == Token_String && Token.Text.Count == Length + 1 && 
+            memcmp(Token.Text.Data + 1, Value, Length) == 0);
+}
+
+
+// Skips a value that the reader does not use, with everything nested in it
+static void SkipValue(tokenizer *Tokenizer, token Token)
+{
+    s32 Depth = 0;
+    for (;;)
+    {
+        if (Token.Type == Token_OpenBrace || Token.Type == Token_OpenBracket)
+        {
+            ++Depth;
+        }
+        else if (Token.Type == Token_CloseBrace || Token.Type == Token_CloseBracket)
+        {
+            --Depth;
+        }
+        else if (Token.Type == Token_EndOfStream)
+        {
+            Tokenizer->Error = true;
+            return;
+        }
+        
+        if (Depth <= 0)
+        {
+            return;
+        }
+        Token = GetToken(Tokenizer);
+    }
+}
+
+
+static void ParseCase(tokenizer *Tokenizer, regression_result *Result)
+{
+    for (token Key = GetToken(Tokenizer); Parsing(Tokenizer) && Key.Type != Token_CloseBrace; Key = GetToken(Tokenizer))
+    {
+        if (Key.Type == Token_Comma)
+        {
+            continue;
+        }
+        
+        RequireToken(Tokenizer, Token_Colon);
+        if (StringTokenIs(Key, "name"))
+        {
+            token Name = RequireToken(Tokenizer, Token_String);
+            snprintf(Result->Name, sizeof(Result->Name), "%.*s", (int)(Name.Text.Count - 1), Name.Text.Data + 1);
+        }
+        else if (StringTokenIs(Key, "samples"))
+        {
+            RequireToken(Tokenizer, Token_OpenBracket);
+            for (token Token = GetToken(Tokenizer); Parsing(Tokenizer) && Token.Type != Token_CloseBracket; Token = GetToken(Tokenizer))
+            {
+                if (Token.Type == Token_Number && Result->SampleCount < kRegressionSampleCountMax)
+                {
+                    Result->Samples[Result->SampleCount++] = Token.f64;
+                }
+            }
+        }
+        else
+        {
+            SkipValue(Tokenizer, GetToken(Tokenizer));
+        }
+    }
+}
+
+
+static b32 ReadBaseline(char const *FileName, regression_results *Baseline)
+{
+    FILE *File;
+    if (fopen_s(&File, FileName, "rb"))
+    {
+        return false;
+    }
+    
+    fseek(File, 0L, SEEK_END);
+    size_t Size = ftell(File);
+    rewind(File);
+    
+    string Input;
+    Input.Data = (u8 *)malloc(Size + 1);
+    Input.Count = fread(Input.Data, 1, Size, File);
+    fclose(File);
+    
+    *Baseline = {};
+    tokenizer Tokenizer = Tokenize(Input);
+    RequireToken(&Tokenizer, Token_OpenBrace);
+    
+    for (token Key = GetToken(&Tokenizer); Parsing(&Tokenizer) && Key.Type != Token_CloseBrace; Key = GetToken(&Tokenizer))
+    {
+        if (Key.Type == Token_Comma)
+        {
+            continue;
+        }
+        
+        RequireToken(&Tokenizer, Token_Colon);
+        if (StringTokenIs(Key, "cases"))
+        {
+            RequireToken(&Tokenizer, Token_OpenBracket);
+            for (token Token = GetToken(&Tokenizer); Parsing(&Tokenizer) && Token.Type != Token_CloseBracket; Token = GetToken(&Tokenizer))
+            {
+                if (Token.Type == Token_OpenBrace && Baseline->CaseCount < kRegressionCaseCountMax)
+                {
+                    ParseCase(&Tokenizer, &Baseline->Cases[Baseline->CaseCount++]);
+                }
+            }
+        }
+        else
+        {
+            SkipValue(&Tokenizer, GetToken(&Tokenizer));
+        }
+    }
+    
+    b32 Result = !Tokenizer.Error;
+    free(Input.Data);
+    
+    return Result;
+}
+
+
+
+//
+// Comparison
+//
+static int CompareF64(void const *A, void const *B)
+{
+    f64 a = *(f64 const *)A;
+    f64 b = *(f64 const *)B;
+    return (a > b) - (a < b);
+}
+
+
+static f64 GetMedian(f64 const *Samples, u32 Count)
+{
+    f64 Sorted[kRegressionSampleCountMax];
+    memcpy(Sorted, Samples, Count * sizeof(f64));
+    qsort(Sorted, Count, sizeof(f64), CompareF64);
+    return Count % 2 ? Sorted[Count / 2] : 0.5 * (Sorted[Count / 2 - 1] + Sorted[Count / 2]);
+}
+
+
+// Normal approximation of the Mann-Whitney U statistic of B against A, with the tie correction. A
+// positive z means that the samples in B tend to be larger.
+static f64 GetMannWhitneyZ(f64 const *A, u32 CountA, f64 const *B, u32 CountB)
+{
+    struct ranked_sample
+    {
+        f64 Value;
+        u32 Group;
+    };
+    
+    ranked_sample Samples[2 * kRegressionSampleCountMax];
+    u32 Count = 0;
+    for (u32 Index = 0; Index < CountA; ++Index)
+    {
+        Samples[Count++] = {A[Index], 0};
+    }
+    for (u32 Index = 0; Index < CountB; ++Index)
+    {
+        Samples[Count++] = {B[Index], 1};
+    }
+    qsort(Samples, Count, sizeof(ranked_sample), CompareF64);
+    
+    //
+    // Rank sum of B, tied values share their mean rank
+    f64 RankSumB = 0.0;
+    f64 TieSum = 0.0;
+    for (u32 Index = 0; Index < Count;)
+    {
+        u32 End = Index + 1;
+        while (End < Count && Samples[End].Value == Samples[Index].Value)
+        {
+            ++End;
+        }
+        
+        f64 Rank = 0.5 * (f64)(Index + 1 + End);
+        for (u32 Tied = Index; Tied < End; ++Tied)
+        {
+            RankSumB += Samples[Tied].Group ? Rank : 0.0;
+        }
+        
+        f64 TieCount = (f64)(End - Index);
+        TieSum += TieCount * TieCount * TieCount - TieCount;
+        Index = End;
+    }
+    
+    f64 n1 = (f64)CountA;
+    f64 n2 = (f64)CountB;
+    f64 N = n1 + n2;
+    f64 U = RankSumB - 0.5 * n2 * (n2 + 1.0);
+    f64 Mean = 0.5 * n1 * n2;
+    f64 Variance = n1 * n2 / 12.0 * ((N + 1.0) - TieSum / (N * (N - 1.0)));
+    
+    f64 Result = Variance > 0.0 ? (U - Mean) / sqrt(Variance) : 0.0;
+    return Result;
+}
+
+
+
+//
+// Suite
+//
+int RunRegressionSuite(char const *CommandLine)
+{
+    char const *TerrainFileName = "..\\data\\volcano.txt";
+    char const *PlyFileName = "..\\data\\monkey.ply";
+    
+    b32 UpdateBaseline = false;
+    char const *Arguments = strstr(CommandLine, "-regress");
+    if (Arguments)
+    {
+        UpdateBaseline = strstr(Arguments, "update") != nullptr;
+    }
+    
+    regression_results *Results = (regression_results *)calloc(1, sizeof(regression_results));
+    regression_results *Baseline = (regression_results *)calloc(1, sizeof(regression_results));
+    assert(Results && Baseline);
+    
+    GetMachineFingerprint(Results);
+    printf("Machine %s: %s, %u processors\n", Results->Fingerprint, Results->Cpu, Results->ProcessorCount);
+    
+    terrain Terrain;
+    if (!LoadTerrain(TerrainFileName, 61, 87, &Terrain))
+    {
+        printf("Failed to load the terrain\n");
+        return 1;
+    }
+    
+    RunParticleUpdateCase(Results, &Terrain);
+    RunTerrainCase(Results, TerrainFileName);
+    RunTokenizerCase(Results);
+    RunPlyCase(Results, PlyFileName);
+    RunMatrixCase(Results);
+    FreeTerrain(&Terrain);
+    
+    
+    //
+    // Compare with the baseline of this machine
+    char BaselineFileName[128];
+    snprintf(BaselineFileName, sizeof(BaselineFileName), "..\\data\\baseline_%s.json", Results->Fingerprint);
+    
+    b32 HasBaseline = !UpdateBaseline && ReadBaseline(BaselineFileName, Baseline);
+    u32 SlowerCount = 0;
+    
+    printf("%-20s %12s %12s %8s %8s\n", "case", "baseline", "median", "change", "z");
+    for (u32 Index = 0; Index < Results->CaseCount; ++Index)
+    {
+        regression_result *Result = &Results->Cases[Index];
+        f64 Median = GetMedian(Result->Samples, Result->SampleCount);
+        
+        regression_result *Reference = nullptr;
+        for (u32 BaselineIndex = 0; HasBaseline && BaselineIndex < Baseline->CaseCount; ++BaselineIndex)
+        {
+            if (strcmp(Baseline->Cases[BaselineIndex].Name, Result->Name) == 0 && Baseline->Cases[BaselineIndex].SampleCount > 1)
+            {
+                Reference = &Baseline->Cases[BaselineIndex];
+            }
+        }
+        
+        if (!Reference)
+        {
+            printf("%-20s %12s %12.4f %8s %8s %s\n", Result->Name, "-", Median, "-", "-", Result->Unit);
+            continue;
+        }
+        
+        f64 BaselineMedian = GetMedian(Reference->Samples, Reference->SampleCount);
+        f64 Change = BaselineMedian > 0.0 ? Median / BaselineMedian - 1.0 : 0.0;
+        f64 z = GetMannWhitneyZ(Reference->Samples, Reference->SampleCount, Result->Samples, Result->SampleCount);
+        
+        char const *Verdict = "";
+        if (z > kRegressionZ && Change > kRegressionThreshold)
+        {
+            Verdict = "SLOWER";
+            ++SlowerCount;
+        }
+        else if (z < -kRegressionZ && Change < -kRegressionThreshold)
+        {
+            Verdict = "faster";
+        }
+        
+        printf("%-20s %12.4f %12.4f %+7.1f%% %8.2f %s %s\n", 
+               Result->Name, BaselineMedian, Median, 100.0 * Change, z, Result->Unit, Verdict);
+    }
+    
+    if (!HasBaseline)
+    {
+        WriteBaseline(BaselineFileName, Results);
+        printf("Stored the baseline in %s\n", BaselineFileName);
+    }
+    else if (SlowerCount)
+    {
+        printf("%u case%s got significantly slower\n", SlowerCount, SlowerCount > 1 ? "s" : "");
+    }
+    
+    free(Results);
+    free(Baseline);
+    
+    return SlowerCount > 0 ? 1 : 0;
+}
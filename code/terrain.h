@@ -0,0 +1,236 @@
+// 
+// MIT License
+// 
+// Copyright (c) 2018 Marcus Larsson
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+
+#ifndef Terrain__h
+#define Terrain__h
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+
+#include "types.h"
+#include "mathematics.h"
+#include "profiler.h"
+#include "parallel.h"
+#include "mesh_normals.h"
+
+
+
+//
+// Height field terrain, the heights are read from a text file with Width * Height whitespace
+// separated integers, row by row. The heights are smoothed with their four neighbours, and the
+// normals are the grid weighting of mesh_normals.h.
+//
+struct terrain
+{
+    u32 Width;
+    u32 Height;
+    
+    u32 *Heights = nullptr;
+    v3 *Vertices = nullptr;
+    v3 *Normals = nullptr;
+    u32 VertexCount;
+    
+    u32 *Indices = nullptr;
+    u64 IndexCount;         // Six per grid cell, more than 32 bits can count from 26756 x 26756 up
+    
+    f32 MinHeight;
+    f32 MaxHeight;
+};
+
+
+static void FreeTerrain(terrain *Terrain)
+{
+    free(Terrain->Heights);
+    free(Terrain->Vertices);
+    free(Terrain->Normals);
+    free(Terrain->Indices);
+    *Terrain = {};
+}
+
+
+static b32 LoadTerrain(char const *FileName, u32 Width, u32 Height, terrain *Terrain, u32 ThreadCount = 1)
+{
+    PROFILE_SCOPE("LoadTerrain");
+    
+    u32 const w = Width;
+    u32 const h = Height;
+    u32 const t = w * h;
+    
+    *Terrain = {};
+    Terrain->Width = w;
+    Terrain->Height = h;
+    
+    // NOTE(Marcus): A bit of a waste, the max number is less than 255... 
+    u32 *Heights = (u32 *)malloc(t * sizeof(u32)); 
+    Terrain->Heights = Heights;
+    if (!Heights)
+    {
+        FreeTerrain(Terrain);
+        return false;
+    }
+    
+    {
+        FILE *File;
+        errno_t Error = fopen_s(&File, FileName, "r");
+        if (Error)
+        {
+            printf("Failed to open file, error: %u\n", Error);
+            FreeTerrain(Terrain);
+            return false;
+        }
+        
+        for (u32 Index = 0; Index < t; ++Index)
+        {
+            int ArgumentsScanned = fscanf_s(File, "%u", &Heights[Index]);
+            if (ArgumentsScanned != 1)
+            {
+                fclose(File);
+                FreeTerrain(Terrain);
+                return false;
+            }
+        }
+        fclose(File);
+    }
+    
+    Terrain->VertexCount = t;
+    v3 *Vertices = (v3 *)malloc(t * sizeof(v3));
+    Terrain->Vertices = Vertices;
+    if (!Vertices)
+    {
+        FreeTerrain(Terrain);
+        return false;
+    }
+    
+    f32 Max = 0.0f;
+    f32 Min = f32Max;
+    
+    u32 Index = 0;
+    for (u32 z = 0; z < h; ++z)
+    {
+        for (u32 x = 0; x < w; ++x)
+        {
+            f32 Height = (f32)Heights[Index];
+            
+#if 1
+            //
+            // Smoothing
+            u32 Count = 1;
+            
+            if (x > 0) // Left
+            {
+                Height += (f32)Heights[Index - 1];
+                ++Count;
+            }
+            
+            if (x < (w - 1)) // Right
+            {
+                Height += (f32)Heights[Index + 1];
+                ++Count;
+            }
+            
+            if (z > 0) // Up
+            {
+                Height += (f32)Heights[Index - w];
+                ++Count;
+            }
+            
+            if (z < (h - 1)) // Down
+            {
+                Height += (f32)Heights[Index + w];
+                ++Count;
+            }
+            
+            Height /= (f32)Count;
+            Heights[Index] = (u32)Height;
+#endif
+            
+            Max = Height > Max ? Height : Max;
+            Min = Height < Min ? Height : Min;
+            
+            Vertices[Index++] = V3((f32)x, Height, (f32)z);
+        }
+    }
+    assert(Index == Terrain->VertexCount);
+    
+    Terrain->MinHeight = Min;
+    Terrain->MaxHeight = Max;
+    
+    
+    //
+    // Generate indices
+    // NOTE(Marcus): The vertex indices fit in 32 bits, the number of them does not on large grids
+    Terrain->IndexCount = 6ull * (w - 1) * (h - 1);
+    u32 *Indices = (u32 *)malloc(Terrain->IndexCount * sizeof(u32));
+    Terrain->Indices = Indices;
+    if (!Indices)
+    {
+        FreeTerrain(Terrain);
+        return false;
+    }
+    
+    u64 IndexAt = 0;
+    for (u32 z = 0; z < (h - 1); ++z)
+    {
+        for (u32 x = 0; x < (w - 1); ++x)
+        {
+            Indices[IndexAt] = (w * z) + x;
+            Indices[IndexAt + 1] = (w * (z + 1)) + x;
+            Indices[IndexAt + 2] = (w * (z + 1)) + x + 1;
+            
+            Indices[IndexAt + 3] = (w * z) + x;
+            Indices[IndexAt + 4] = (w * (z + 1)) + x + 1;
+            Indices[IndexAt + 5] = (w * z) + x + 1;
+            
+            IndexAt += 6;
+        }
+    }
+    assert(IndexAt == Terrain->IndexCount);
+    
+    
+    //
+    // Normals
+    v3 *Normals = (v3 *)malloc(t * sizeof(v3));
+    Terrain->Normals = Normals;
+    if (!Normals)
+    {
+        FreeTerrain(Terrain);
+        return false;
+    }
+    
+    mesh_normals MeshNormals;
+    if (!InitGridNormals(&MeshNormals, w, h, ThreadCount))
+    {
+        FreeTerrain(Terrain);
+        return false;
+    }
+    UpdateMeshNormals(&MeshNormals, Vertices, Normals);
+    FreeMeshNormals(&MeshNormals);
+    
+    return true;
+}
+
+
+#endif
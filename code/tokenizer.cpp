@@ -23,13 +23,33 @@
 //
 
 #include "tokenizer.h"
+#include "mapped_file.h"
+#include "parallel.h"
+#include "profiler.h"
 #include <stdarg.h>
+#include <math.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <emmintrin.h>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
 
 
 
 b32 Parsing(tokenizer *Tokenizer)
 {
+    if (Tokenizer->Chunks)
+    {
+        return !Tokenizer->Error && Tokenizer->ChunkIndex < Tokenizer->ChunkCount;
+    }
+    if (Tokenizer->Window)
+    {
+        mapped_window *Window = Tokenizer->Window;
+        return !Tokenizer->Error && (Tokenizer->Input.Count > 0 || Window->Offset + Window->Size < Window->FileSize);
+    }
     return !Tokenizer->Error && Tokenizer->Input.Count > 0;
 }
 
@@ -61,6 +81,591 @@ void AdvanceAndRefill(tokenizer *Tokenizer, u32 Count)
 }
 
 
+
+//
+// Scanning 16 bytes at a time
+//
+// Each mask function classifies a block of input with SSE2 and returns one bit per byte. The first
+// few bytes and the tail of the input are tested one at a time, and the tokenizer is only advanced
+// and refilled once the end of the run has been found.
+//
+static u32 FindFirstBit(u32 Mask)
+{
+#if defined(_MSC_VER)
+    unsigned long Index;
+    _BitScanForward(&Index, Mask);
+    return (u32)Index;
+#else
+    return (u32)__builtin_ctz(Mask);
+#endif
+}
+
+
+static u32 CountBits(u32 Mask)
+{
+#if defined(_MSC_VER)
+    return (u32)__popcnt(Mask);
+#else
+    return (u32)__builtin_popcount(Mask);
+#endif
+}
+
+
+// Unsigned Min <= C <= Max for each byte
+static __m128i InRange(__m128i C, u8 Min, u8 Max)
+{
+    __m128i Offset = _mm_sub_epi8(C, _mm_set1_epi8((char)Min));
+    __m128i Result = _mm_cmpeq_epi8(_mm_min_epu8(Offset, _mm_set1_epi8((char)(Max - Min))), Offset);
+    return Result;
+}
+
+
+// Whitespaces are ' ' and '\t' through '\r'
+static u32 GetWhiteSpaceMask(__m128i C, u32 *EndOfLineMask)
+{
+    __m128i EndOfLine = _mm_or_si128(_mm_cmpeq_epi8(C, _mm_set1_epi8('\n')), _mm_cmpeq_epi8(C, _mm_set1_epi8('\r')));
+    __m128i WhiteSpace = _mm_or_si128(_mm_cmpeq_epi8(C, _mm_set1_epi8(' ')), InRange(C, '\t', '\r'));
+    
+    *EndOfLineMask = (u32)_mm_movemask_epi8(EndOfLine);
+    return (u32)_mm_movemask_epi8(WhiteSpace);
+}
+
+
+static u32 GetIdentifierMask(__m128i C)
+{
+    __m128i Alpha = InRange(_mm_or_si128(C, _mm_set1_epi8(0x20)), 'a', 'z');
+    __m128i Digit = InRange(C, '0', '9');
+    __m128i Underscore = _mm_cmpeq_epi8(C, _mm_set1_epi8('_'));
+    
+    return (u32)_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(Alpha, Digit), Underscore));
+}
+
+
+// Everything but '"' and the terminating zero
+static u32 GetStringBodyMask(__m128i C)
+{
+    __m128i Quote = _mm_cmpeq_epi8(C, _mm_set1_epi8('"'));
+    __m128i Zero = _mm_cmpeq_epi8(C, _mm_setzero_si128());
+    
+    return ~(u32)_mm_movemask_epi8(_mm_or_si128(Quote, Zero)) & 0xFFFF;
+}
+
+
+static u32 GetLineBodyMask(__m128i C)
+{
+    __m128i EndOfLine = _mm_or_si128(_mm_cmpeq_epi8(C, _mm_set1_epi8('\n')), _mm_cmpeq_epi8(C, _mm_set1_epi8('\r')));
+    return ~(u32)_mm_movemask_epi8(EndOfLine) & 0xFFFF;
+}
+
+
+// NOTE(Marcus): Most runs in the asset files are a single space or a few digits, those are cheaper to
+// test one byte at a time than to load and classify a whole block.
+constexpr uintptr_t kScalarPrefix = 4;
+
+
+// Number of bytes from the start of the input for which the mask function is true
+template <u32 (*GetMask)(__m128i), b32 (*Test)(char)>
+static uintptr_t ScanWhile(string Input)
+{
+    uintptr_t Count = 0;
+    for (; Count < kScalarPrefix && Count < Input.Count; ++Count)
+    {
+        if (!Test((char)Input.Data[Count]))
+        {
+            return Count;
+        }
+    }
+    
+    while (Input.Count - Count >= 16)
+    {
+        __m128i C = _mm_loadu_si128((__m128i const *)(Input.Data + Count));
+        u32 Stop = ~GetMask(C) & 0xFFFF;
+        if (Stop)
+        {
+            return Count + FindFirstBit(Stop);
+        }
+        Count += 16;
+    }
+    
+    while (Count < Input.Count && Test((char)Input.Data[Count]))
+    {
+        ++Count;
+    }
+    
+    return Count;
+}
+
+
+static b32 IsIdentifierCharacter(char C)
+{
+    return IsAlpha(C) || IsNumber(C) || C == '_';
+}
+
+static b32 IsNotStringEnd(char C)
+{
+    return C != '"' && C != 0;
+}
+
+static b32 IsNotEndOfLine(char C)
+{
+    return !IsEndOfLine(C);
+}
+
+
+
+//
+// Numbers
+//
+// Decimal numbers are read into a 64 bit mantissa w and a power of ten q, and converted with the
+// Eisel-Lemire algorithm: w is multiplied by a 128 bit approximation of 5^q and the result is
+// rounded to the nearest float or double. Small values that are exact in floating point take the
+// Clinger fast path, and mantissas longer than 19 digits or powers outside the table fall back to
+// strtod and strtof.
+//
+// Daniel Lemire, "Number Parsing at a Gigabyte per Second", 2021.
+//
+s32 constexpr kPowerOfFiveMin = -65;
+s32 constexpr kPowerOfFiveMax = 38;
+u32 constexpr kMantissaDigitsMax = 19;
+u32 constexpr kNumberTextMax = 256;
+
+// Normalised 5^q truncated to 128 bits, the high word first. Negative powers are rounded up.
+static u64 const PowerOfFive128[2*(kPowerOfFiveMax - kPowerOfFiveMin + 1)] = 
+{
+    0x86CCBB52EA94BAEA, 0x98E947129FC2B4E9, // 5^-65
+    0xA87FEA27A539E9A5, 0x3F2398D747B36224, // 5^-64
+    0xD29FE4B18E88640E, 0x8EEC7F0D19A03AAD, // 5^-63
+    0x83A3EEEEF9153E89, 0x1953CF68300424AC, // 5^-62
+    0xA48CEAAAB75A8E2B, 0x5FA8C3423C052DD7, // 5^-61
+    0xCDB02555653131B6, 0x3792F412CB06794D, // 5^-60
+    0x808E17555F3EBF11, 0xE2BBD88BBEE40BD0, // 5^-59
+    0xA0B19D2AB70E6ED6, 0x5B6ACEAEAE9D0EC4, // 5^-58
+    0xC8DE047564D20A8B, 0xF245825A5A445275, // 5^-57
+    0xFB158592BE068D2E, 0xEED6E2F0F0D56712, // 5^-56
+    0x9CED737BB6C4183D, 0x55464DD69685606B, // 5^-55
+    0xC428D05AA4751E4C, 0xAA97E14C3C26B886, // 5^-54
+    0xF53304714D9265DF, 0xD53DD99F4B3066A8, // 5^-53
+    0x993FE2C6D07B7FAB, 0xE546A8038EFE4029, // 5^-52
+    0xBF8FDB78849A5F96, 0xDE98520472BDD033, // 5^-51
+    0xEF73D256A5C0F77C, 0x963E66858F6D4440, // 5^-50
+    0x95A8637627989AAD, 0xDDE7001379A44AA8, // 5^-49
+    0xBB127C53B17EC159, 0x5560C018580D5D52, // 5^-48
+    0xE9D71B689DDE71AF, 0xAAB8F01E6E10B4A6, // 5^-47
+    0x9226712162AB070D, 0xCAB3961304CA70E8, // 5^-46
+    0xB6B00D69BB55C8D1, 0x3D607B97C5FD0D22, // 5^-45
+    0xE45C10C42A2B3B05, 0x8CB89A7DB77C506A, // 5^-44
+    0x8EB98A7A9A5B04E3, 0x77F3608E92ADB242, // 5^-43
+    0xB267ED1940F1C61C, 0x55F038B237591ED3, // 5^-42
+    0xDF01E85F912E37A3, 0x6B6C46DEC52F6688, // 5^-41
+    0x8B61313BBABCE2C6, 0x2323AC4B3B3DA015, // 5^-40
+    0xAE397D8AA96C1B77, 0xABEC975E0A0D081A, // 5^-39
+    0xD9C7DCED53C72255, 0x96E7BD358C904A21, // 5^-38
+    0x881CEA14545C7575, 0x7E50D64177DA2E54, // 5^-37
+    0xAA242499697392D2, 0xDDE50BD1D5D0B9E9, // 5^-36
+    0xD4AD2DBFC3D07787, 0x955E4EC64B44E864, // 5^-35
+    0x84EC3C97DA624AB4, 0xBD5AF13BEF0B113E, // 5^-34
+    0xA6274BBDD0FADD61, 0xECB1AD8AEACDD58E, // 5^-33
+    0xCFB11EAD453994BA, 0x67DE18EDA5814AF2, // 5^-32
+    0x81CEB32C4B43FCF4, 0x80EACF948770CED7, // 5^-31
+    0xA2425FF75E14FC31, 0xA1258379A94D028D, // 5^-30
+    0xCAD2F7F5359A3B3E, 0x096EE45813A04330, // 5^-29
+    0xFD87B5F28300CA0D, 0x8BCA9D6E188853FC, // 5^-28
+    0x9E74D1B791E07E48, 0x775EA264CF55347E, // 5^-27
+    0xC612062576589DDA, 0x95364AFE032A819E, // 5^-26
+    0xF79687AED3EEC551, 0x3A83DDBD83F52205, // 5^-25
+    0x9ABE14CD44753B52, 0xC4926A9672793543, // 5^-24
+    0xC16D9A0095928A27, 0x75B7053C0F178294, // 5^-23
+    0xF1C90080BAF72CB1, 0x5324C68B12DD6339, // 5^-22
+    0x971DA05074DA7BEE, 0xD3F6FC16EBCA5E04, // 5^-21
+    0xBCE5086492111AEA, 0x88F4BB1CA6BCF585, // 5^-20
+    0xEC1E4A7DB69561A5, 0x2B31E9E3D06C32E6, // 5^-19
+    0x9392EE8E921D5D07, 0x3AFF322E62439FD0, // 5^-18
+    0xB877AA3236A4B449, 0x09BEFEB9FAD487C3, // 5^-17
+    0xE69594BEC44DE15B, 0x4C2EBE687989A9B4, // 5^-16
+    0x901D7CF73AB0ACD9, 0x0F9D37014BF60A11, // 5^-15
+    0xB424DC35095CD80F, 0x538484C19EF38C95, // 5^-14
+    0xE12E13424BB40E13, 0x2865A5F206B06FBA, // 5^-13
+    0x8CBCCC096F5088CB, 0xF93F87B7442E45D4, // 5^-12
+    0xAFEBFF0BCB24AAFE, 0xF78F69A51539D749, // 5^-11
+    0xDBE6FECEBDEDD5BE, 0xB573440E5A884D1C, // 5^-10
+    0x89705F4136B4A597, 0x31680A88F8953031, // 5^-9
+    0xABCC77118461CEFC, 0xFDC20D2B36BA7C3E, // 5^-8
+    0xD6BF94D5E57A42BC, 0x3D32907604691B4D, // 5^-7
+    0x8637BD05AF6C69B5, 0xA63F9A49C2C1B110, // 5^-6
+    0xA7C5AC471B478423, 0x0FCF80DC33721D54, // 5^-5
+    0xD1B71758E219652B, 0xD3C36113404EA4A9, // 5^-4
+    0x83126E978D4FDF3B, 0x645A1CAC083126EA, // 5^-3
+    0xA3D70A3D70A3D70A, 0x3D70A3D70A3D70A4, // 5^-2
+    0xCCCCCCCCCCCCCCCC, 0xCCCCCCCCCCCCCCCD, // 5^-1
+    0x8000000000000000, 0x0000000000000000, // 5^0
+    0xA000000000000000, 0x0000000000000000, // 5^1
+    0xC800000000000000, 0x0000000000000000, // 5^2
+    0xFA00000000000000, 0x0000000000000000, // 5^3
+    0x9C40000000000000, 0x0000000000000000, // 5^4
+    0xC350000000000000, 0x0000000000000000, // 5^5
+    0xF424000000000000, 0x0000000000000000, // 5^6
+    0x9896800000000000, 0x0000000000000000, // 5^7
+    0xBEBC200000000000, 0x0000000000000000, // 5^8
+    0xEE6B280000000000, 0x0000000000000000, // 5^9
+    0x9502F90000000000, 0x0000000000000000, // 5^10
+    0xBA43B74000000000, 0x0000000000000000, // 5^11
+    0xE8D4A51000000000, 0x0000000000000000, // 5^12
+    0x9184E72A00000000, 0x0000000000000000, // 5^13
+    0xB5E620F480000000, 0x0000000000000000, // 5^14
+    0xE35FA931A0000000, 0x0000000000000000, // 5^15
+    0x8E1BC9BF04000000, 0x0000000000000000, // 5^16
+    0xB1A2BC2EC5000000, 0x0000000000000000, // 5^17
+    0xDE0B6B3A76400000, 0x0000000000000000, // 5^18
+    0x8AC7230489E80000, 0x0000000000000000, // 5^19
+    0xAD78EBC5AC620000, 0x0000000000000000, // 5^20
+    0xD8D726B7177A8000, 0x0000000000000000, // 5^21
+    0x878678326EAC9000, 0x0000000000000000, // 5^22
+    0xA968163F0A57B400, 0x0000000000000000, // 5^23
+    0xD3C21BCECCEDA100, 0x0000000000000000, // 5^24
+    0x84595161401484A0, 0x0000000000000000, // 5^25
+    0xA56FA5B99019A5C8, 0x0000000000000000, // 5^26
+    0xCECB8F27F4200F3A, 0x0000000000000000, // 5^27
+    0x813F3978F8940984, 0x4000000000000000, // 5^28
+    0xA18F07D736B90BE5, 0x5000000000000000, // 5^29
+    0xC9F2C9CD04674EDE, 0xA400000000000000, // 5^30
+    0xFC6F7C4045812296, 0x4D00000000000000, // 5^31
+    0x9DC5ADA82B70B59D, 0xF020000000000000, // 5^32
+    0xC5371912364CE305, 0x6C28000000000000, // 5^33
+    0xF684DF56C3E01BC6, 0xC732000000000000, // 5^34
+    0x9A130B963A6C115C, 0x3C7F400000000000, // 5^35
+    0xC097CE7BC90715B3, 0x4B9F100000000000, // 5^36
+    0xF0BDC21ABB48DB20, 0x1E86D40000000000, // 5^37
+    0x96769950B50D88F4, 0x1314448000000000, // 5^38
+};
+
+
+struct float_format
+{
+    s32 MantissaBits;       // Explicit bits, without the hidden one
+    s32 MinimumExponent;
+    s32 InfinitePower;
+    s32 SmallestPowerOfTen;
+    s32 LargestPowerOfTen;
+    s32 MinRoundToEven;
+    s32 MaxRoundToEven;
+};
+
+static float_format const Float64Format = { 52, -1023, 0x7FF, -342, 308, -4, 23 };
+static float_format const Float32Format = { 23,  -127,  0xFF,  -65,  38, -17, 10 };
+
+
+static u64 Multiply128(u64 A, u64 B, u64 *High)
+{
+#if defined(_MSC_VER)
+    return _umul128(A, B, High);
+#else
+    unsigned __int128 Product = (unsigned __int128)A * B;
+    *High = (u64)(Product >> 64);
+    return (u64)Product;
+#endif
+}
+
+
+static u32 CountLeadingZeros64(u64 Value)
+{
+#if defined(_MSC_VER)
+    unsigned long Index;
+    _BitScanReverse64(&Index, Value);
+    return 63 - (u32)Index;
+#else
+    return (u32)__builtin_clzll(Value);
+#endif
+}
+
+
+// Returns false when the power of ten is outside the table, otherwise the bits of the correctly
+// rounded value in the format, without the sign
+static b32 EiselLemire(u64 w, s32 q, float_format const *Format, u64 *Bits)
+{
+    if (w == 0 || q < Format->SmallestPowerOfTen)
+    {
+        *Bits = 0;
+        return true;
+    }
+    if (q > Format->LargestPowerOfTen)
+    {
+        *Bits = (u64)Format->InfinitePower << Format->MantissaBits;
+        return true;
+    }
+    if (q < kPowerOfFiveMin || q > kPowerOfFiveMax)
+    {
+        return false;
+    }
+    
+    u32 LeadingZeros = CountLeadingZeros64(w);
+    w <<= LeadingZeros;
+    
+    // The first product is exact enough unless the bits below the mantissa are all ones
+    u64 const *Power = PowerOfFive128 + 2*(q - kPowerOfFiveMin);
+    u64 High;
+    u64 Low = Multiply128(w, Power[0], &High);
+    u64 PrecisionMask = ~0ull >> (Format->MantissaBits + 3);
+    if ((High & PrecisionMask) == PrecisionMask)
+    {
+        u64 SecondHigh;
+        Multiply128(w, Power[1], &SecondHigh);
+        Low += SecondHigh;
+        if (SecondHigh > Low)
+        {
+            ++High;
+        }
+    }
+    
+    s32 UpperBit = (s32)(High >> 63);
+    s32 Shift = UpperBit + 64 - Format->MantissaBits - 3;
+    u64 Mantissa = High >> Shift;
+    
+    // floor(log2(10^q)) + 63
+    s32 Power2 = (((152170 + 65536)*q) >> 16) + 63 + UpperBit - (s32)LeadingZeros - Format->MinimumExponent;
+    
+    if (Power2 <= 0)
+    {
+        // Subnormal
+        if (-Power2 + 1 >= 64)
+        {
+            *Bits = 0;
+            return true;
+        }
+        
+        Mantissa >>= -Power2 + 1;
+        Mantissa += Mantissa & 1;
+        Mantissa >>= 1;
+        Power2 = Mantissa < (1ull << Format->MantissaBits) ? 0 : 1;
+        *Bits = (Mantissa & ~(1ull << Format->MantissaBits)) | ((u64)Power2 << Format->MantissaBits);
+        return true;
+    }
+    
+    // Exactly halfway between two values, round to even instead of up
+    if (Low <= 1 && q >= Format->MinRoundToEven && q <= Format->MaxRoundToEven && (Mantissa & 3) == 1)
+    {
+        if ((Mantissa << Shift) == High)
+        {
+            Mantissa &= ~1ull;
+        }
+    }
+    
+    Mantissa += Mantissa & 1;
+    Mantissa >>= 1;
+    if (Mantissa >= (2ull << Format->MantissaBits))
+    {
+        Mantissa = 1ull << Format->MantissaBits;
+        ++Power2;
+    }
+    Mantissa &= ~(1ull << Format->MantissaBits);
+    
+    if (Power2 >= Format->InfinitePower)
+    {
+        Power2 = Format->InfinitePower;
+        Mantissa = 0;
+    }
+    
+    *Bits = Mantissa | ((u64)Power2 << Format->MantissaBits);
+    return true;
+}
+
+
+// NOTE(Marcus): The fast paths need a single correctly rounded multiply or divide, which /fp:fast
+// does not promise
+#if defined(_MSC_VER)
+#pragma float_control(precise, on, push)
+#endif
+
+static f64 const ExactPowersOfTen[] = 
+{
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static b32 ToFloat64(u64 w, s32 q, b32 Negative, f64 *Result)
+{
+    f64 Value;
+    if (w <= (1ull << 53) && q >= -22 && q <= 22)
+    {
+        // Both w and 10^|q| are exact, so a single rounding gives the correct result
+        Value = q < 0 ? (f64)w / ExactPowersOfTen[-q] : (f64)w * ExactPowersOfTen[q];
+    }
+    else
+    {
+        u64 Bits;
+        if (!EiselLemire(w, q, &Float64Format, &Bits))
+        {
+            return false;
+        }
+        memcpy(&Value, &Bits, sizeof(Value));
+    }
+    
+    *Result = Negative ? -Value : Value;
+    return true;
+}
+
+static b32 ToFloat32(u64 w, s32 q, b32 Negative, f32 *Result)
+{
+    f32 Value;
+    if (w <= (1ull << 24) && q >= -10 && q <= 10)
+    {
+        Value = q < 0 ? (f32)w / (f32)ExactPowersOfTen[-q] : (f32)w * (f32)ExactPowersOfTen[q];
+    }
+    else
+    {
+        u64 Bits;
+        if (!EiselLemire(w, q, &Float32Format, &Bits))
+        {
+            return false;
+        }
+        u32 Bits32 = (u32)Bits;
+        memcpy(&Value, &Bits32, sizeof(Value));
+    }
+    
+    *Result = Negative ? -Value : Value;
+    return true;
+}
+
+
+// Correctly rounded f64 and f32 of the decimal, or strtod and strtof of the text when the mantissa
+// has too many digits or the power of ten is outside the table
+static void ConvertNumber(u8 *Start, uintptr_t Length, u64 Mantissa, s32 Exponent, b32 Negative, b32 Exact, 
+                          token *Token)
+{
+    if (!Exact ||
+        !ToFloat64(Mantissa, Exponent, Negative, &Token->f64) ||
+        !ToFloat32(Mantissa, Exponent, Negative, &Token->f32))
+    {
+        char Buffer[kNumberTextMax];
+        char *Text = Length < kNumberTextMax ? Buffer : (char *)malloc(Length + 1);
+        memcpy(Text, Start, Length);
+        Text[Length] = 0;
+        
+        Token->f64 = strtod(Text, nullptr);
+        Token->f32 = strtof(Text, nullptr);
+        
+        if (Text != Buffer)
+        {
+            free(Text);
+        }
+    }
+}
+
+
+static s64 TruncateToS64(f64 Value)
+{
+    if (Value > -9.2e18 && Value < 9.2e18)
+    {
+        return (s64)Value;
+    }
+    return Value < 0.0 ? INT64_MIN : INT64_MAX;
+}
+
+
+// Parses the number at Start and stores its value in the token, returns the number of bytes read. The
+// number is [+-]digits[.digits][(e|E)[+-]digits], the exponent is only read when it has digits.
+static uintptr_t ParseNumber(u8 *Start, u8 *End, token *Token)
+{
+    u8 *At = Start;
+    b32 Negative = false;
+    if (At < End && (*At == '-' || *At == '+'))
+    {
+        Negative = *At == '-';
+        ++At;
+    }
+    
+    u64 Mantissa = 0;
+    u32 DigitCount = 0;     // Significant digits, without the leading zeros
+    s32 Exponent = 0;
+    b32 IsInteger = true;
+    
+    for (; At < End && IsNumber((char)*At); ++At)
+    {
+        Mantissa = 10*Mantissa + (*At - '0');
+        DigitCount += Mantissa != 0;
+    }
+    
+    if (At < End && *At == '.')
+    {
+        IsInteger = false;
+        ++At;
+        for (; At < End && IsNumber((char)*At); ++At)
+        {
+            Mantissa = 10*Mantissa + (*At - '0');
+            DigitCount += Mantissa != 0;
+            --Exponent;
+        }
+    }
+    
+    if (At < End && (*At == 'e' || *At == 'E'))
+    {
+        u8 *Digits = At + 1;
+        b32 NegativeExponent = false;
+        if (Digits < End && (*Digits == '-' || *Digits == '+'))
+        {
+            NegativeExponent = *Digits == '-';
+            ++Digits;
+        }
+        
+        if (Digits < End && IsNumber((char)*Digits))
+        {
+            IsInteger = false;
+            s32 Value = 0;
+            for (At = Digits; At < End && IsNumber((char)*At); ++At)
+            {
+                // NOTE(Marcus): Saturate, anything this large is zero or infinity anyway
+                Value = Value < 100000 ? 10*Value + (*At - '0') : Value;
+            }
+            Exponent += NegativeExponent ? -Value : Value;
+        }
+    }
+    
+    uintptr_t Length = At - Start;
+    
+    b32 Exact = DigitCount <= kMantissaDigitsMax;
+    if (IsInteger && Exact && Mantissa < (1ull << 63))
+    {
+        // Conversions from integers are correctly rounded, the sign is applied afterwards so "-0" is -0.0
+        s64 Magnitude = (s64)Mantissa;
+        Token->s64 = Negative ? -Magnitude : Magnitude;
+        Token->s32 = (s32)Token->s64;
+        Token->f64 = Negative ? -(f64)Magnitude : (f64)Magnitude;
+        Token->f32 = Negative ? -(f32)Magnitude : (f32)Magnitude;
+        
+        return Length;
+    }
+    
+    if (Exact && Mantissa <= (1ull << 24) && Exponent >= -10 && Exponent <= 10)
+    {
+        // Short decimals are exact in both formats and only need one multiply or divide each
+        f64 Value64 = Exponent < 0 ? (f64)Mantissa / ExactPowersOfTen[-Exponent] : (f64)Mantissa * ExactPowersOfTen[Exponent];
+        f32 Value32 = Exponent < 0 ? (f32)Mantissa / (f32)ExactPowersOfTen[-Exponent] : (f32)Mantissa * (f32)ExactPowersOfTen[Exponent];
+        Token->f64 = Negative ? -Value64 : Value64;
+        Token->f32 = Negative ? -Value32 : Value32;
+    }
+    else
+    {
+        ConvertNumber(Start, Length, Mantissa, Exponent, Negative, Exact, Token);
+    }
+    
+    if (IsInteger && Exact)
+    {
+        // Only integers from 2^63 up get here, saturate them like TruncateToS64()
+        Token->s64 = Negative ? INT64_MIN : INT64_MAX;
+    }
+    else
+    {
+        Token->s64 = TruncateToS64(Token->f64);
+    }
+    Token->s32 = (s32)Token->s64; // TODO(Marcus): Round?
+    
+    return Length;
+}
+
+#if defined(_MSC_VER)
+#pragma float_control(pop)
+#endif
+
+
 tokenizer Tokenize(string Input)
 {
     tokenizer Result = {};
@@ -71,29 +676,414 @@ tokenizer Tokenize(string Input)
 }
 
 
+
+//
+// Windowed input
+//
+// The window is moved so it starts at the read position once less than the margin is left in it,
+// which keeps every token inside the window as long as it is shorter than the margin.
+//
+b32 OpenTokenizerFile(char const *FileName, u64 WindowSize, tokenizer *Tokenizer)
+{
+    *Tokenizer = {};
+    
+    mapped_window *Window = (mapped_window *)malloc(sizeof(mapped_window));
+    if (!Window)
+    {
+        return false;
+    }
+    
+    // A moved window must reach well past the margin, or it would have to move on every token
+    WindowSize = (WindowSize == 0 || WindowSize > 4 * kTokenWindowMargin) ? WindowSize : 4 * kTokenWindowMargin;
+    if (!OpenMappedWindow(FileName, Window, WindowSize))
+    {
+        free(Window);
+        return false;
+    }
+    
+    string Input;
+    Input.Data = Window->Data;
+    Input.Count = Window->Size;
+    
+    *Tokenizer = Tokenize(Input);
+    Tokenizer->Window = Window;
+    
+    return true;
+}
+
+
+void CloseTokenizerFile(tokenizer *Tokenizer)
+{
+    if (Tokenizer->Window)
+    {
+        CloseMappedWindow(Tokenizer->Window);
+        free(Tokenizer->Window);
+        Tokenizer->Window = nullptr;
+    }
+    
+    Tokenizer->Input = {};
+    Refill(Tokenizer);
+}
+
+
+b32 GetNextLineFileOffset(tokenizer *Tokenizer, u64 *Offset)
+{
+    if (!Tokenizer->Window || Tokenizer->Chunks)
+    {
+        return false;
+    }
+    
+    SkipToEndOfLine(Tokenizer);
+    
+    // "\r\n" is one line break here
+    u32 LineBreakSize = 0;
+    if (Tokenizer->At[0] == '\r')
+    {
+        LineBreakSize = Tokenizer->At[1] == '\n' ? 2 : 1;
+    }
+    else if (Tokenizer->At[0] == '\n')
+    {
+        LineBreakSize = 1;
+    }
+    
+    mapped_window *Window = Tokenizer->Window;
+    *Offset = Window->Offset + (Tokenizer->Input.Data - Window->Data) + LineBreakSize;
+    
+    return true;
+}
+
+
+static b32 WindowNeedsToMove(tokenizer *Tokenizer)
+{
+    mapped_window *Window = Tokenizer->Window;
+    return Window && Tokenizer->Input.Count < kTokenWindowMargin &&
+        Window->Offset + Window->Size < Window->FileSize;
+}
+
+
+static void MoveTokenizerWindow(tokenizer *Tokenizer)
+{
+    PROFILE_SCOPE("MoveTokenizerWindow");
+    
+    mapped_window *Window = Tokenizer->Window;
+    u64 Offset = Window->Offset + (Tokenizer->Input.Data - Window->Data);
+    if (!MoveMappedWindow(Window, Offset))
+    {
+        Tokenizer->Input = {};
+        Refill(Tokenizer);
+        Error(Tokenizer, "Could not map the file at offset %llu", (unsigned long long)Offset);
+        return;
+    }
+    
+    Tokenizer->Input.Data = Window->Data;
+    Tokenizer->Input.Count = Window->Size;
+    Refill(Tokenizer);
+}
+
+
+// NOTE(Marcus): Both '\r' and '\n' count as a line, so "\r\n" counts as two
 void EatAllWhiteSpaces(tokenizer *Tokenizer)
 {
-    for(;;)
+    // Single separators between tokens are the common case
+    if (!IsWhiteSpace(Tokenizer->At[0]))
+    {
+        return;
+    }
+    else if (!IsWhiteSpace(Tokenizer->At[1]))
+    {
+        Tokenizer->LineNumber += IsEndOfLine(Tokenizer->At[0]) ? 1 : 0;
+        AdvanceAndRefill(Tokenizer, 1);
+        return;
+    }
+    
+    string Input = Tokenizer->Input;
+    uintptr_t Count = 0;
+    s32 LineCount = 0;
+    
+    for (; Count < kScalarPrefix && Count < Input.Count; ++Count)
+    {
+        char C = (char)Input.Data[Count];
+        if (!IsWhiteSpace(C))
+        {
+            break;
+        }
+        LineCount += IsEndOfLine(C) ? 1 : 0;
+    }
+    
+    if (Count == kScalarPrefix)
     {
-        if (IsWhiteSpace(Tokenizer->At[0]))
+        while (Input.Count - Count >= 16)
         {
-            if (IsEndOfLine(Tokenizer->At[0]))
+            __m128i C = _mm_loadu_si128((__m128i const *)(Input.Data + Count));
+            u32 EndOfLineMask;
+            u32 Stop = ~GetWhiteSpaceMask(C, &EndOfLineMask) & 0xFFFF;
+            if (Stop)
             {
-                ++Tokenizer->LineNumber;
+                u32 Length = FindFirstBit(Stop);
+                LineCount += CountBits(EndOfLineMask & ((1u << Length) - 1));
+                Count += Length;
+                break;
             }
-            AdvanceAndRefill(Tokenizer, 1);
+            
+            LineCount += CountBits(EndOfLineMask);
+            Count += 16;
         }
-        else
+        
+        while (Count < Input.Count && IsWhiteSpace((char)Input.Data[Count]))
         {
-            return;
+            LineCount += IsEndOfLine((char)Input.Data[Count]) ? 1 : 0;
+            ++Count;
         }
     }
+    
+    if (Count)
+    {
+        Tokenizer->LineNumber += LineCount;
+        AdvanceAndRefill(Tokenizer, (u32)Count);
+    }
 }
 
 
+
+//
+// Parallel tokenisation
+//
+// Every chunk is tokenised from line number zero, the first line of each chunk is then the sum of
+// the line counts of the chunks before it.
+//
+u64 constexpr kTokenChunkSizeMin = 256 * 1024;
+u64 constexpr kTokenChunkSizeMax = 1ull << 30;     // Offsets in packed tokens are 32 bits
+u32 constexpr kTokenChunksPerThread = 4;            // Uneven chunks balance out
+u32 constexpr kPackedTokenLengthMax = (1u << 24) - 1;
+
+static b32 PackToken(token_chunk *Chunk, token *Token)
+{
+    if (Chunk->TokenCount == Chunk->TokenCapacity)
+    {
+        u32 Capacity = 2 * Chunk->TokenCapacity;
+        packed_token *Tokens = (packed_token *)realloc(Chunk->Tokens, Capacity * sizeof(packed_token));
+        if (!Tokens)
+        {
+            return false;
+        }
+        Chunk->Tokens = Tokens;
+        Chunk->TokenCapacity = Capacity;
+    }
+    
+    if (Token->Text.Count > kPackedTokenLengthMax)
+    {
+        return false;
+    }
+    
+    packed_token *Packed = &Chunk->Tokens[Chunk->TokenCount++];
+    Packed->Offset = (u32)(Token->Text.Data - Chunk->Input.Data);
+    Packed->LineNumber = Token->LineNumber;
+    Packed->Length = (u32)Token->Text.Count;
+    Packed->Type = (u32)Token->Type;
+    Packed->Float32 = Token->f32;
+    
+    // NOTE(Marcus): Also true for every token that is not a number, they are all zero. -0.0 is
+    // not an integer, it would come back as +0.0
+    Packed->IsInteger = (f64)Token->s64 == Token->f64 && (Token->s64 != 0 || !signbit(Token->f64));
+    if (Packed->IsInteger)
+    {
+        Packed->Integer = Token->s64;
+    }
+    else
+    {
+        Packed->Float64 = Token->f64;
+    }
+    
+    return true;
+}
+
+
+static void TokenizeChunk(void *Data, u32 Index)
+{
+    token_chunk *Chunk = (token_chunk *)Data + Index;
+    
+    tokenizer Tokenizer = Tokenize(Chunk->Input);
+    Tokenizer.LineNumber = 0;
+    
+    // Most numbers and identifiers in the files this is used for are a handful of bytes
+    Chunk->TokenCapacity = (u32)(Chunk->Input.Count / 8) + 16;
+    Chunk->Tokens = (packed_token *)malloc(Chunk->TokenCapacity * sizeof(packed_token));
+    Chunk->Error = Chunk->Tokens == nullptr;
+    
+    for (token Token = GetToken(&Tokenizer); 
+         Token.Type != Token_EndOfStream && !Chunk->Error; 
+         Token = GetToken(&Tokenizer))
+    {
+        Chunk->Error = !PackToken(Chunk, &Token);
+    }
+    
+    Chunk->LineCount = Tokenizer.LineNumber;
+}
+
+
+void FreeTokenChunks(tokenizer *Tokenizer)
+{
+    for (u32 Index = 0; Index < Tokenizer->ChunkCount; ++Index)
+    {
+        free(Tokenizer->Chunks[Index].Tokens);
+    }
+    free(Tokenizer->Chunks);
+    
+    Tokenizer->Chunks = nullptr;
+    Tokenizer->ChunkCount = 0;
+    Tokenizer->ChunkIndex = 0;
+    Tokenizer->TokenIndex = 0;
+}
+
+
+// Moves past the chunks that have no tokens left, after the last one the line number is the line
+// at the end of the input
+static void SkipFinishedChunks(tokenizer *Tokenizer)
+{
+    while (Tokenizer->ChunkIndex < Tokenizer->ChunkCount &&
+           Tokenizer->TokenIndex == Tokenizer->Chunks[Tokenizer->ChunkIndex].TokenCount)
+    {
+        ++Tokenizer->ChunkIndex;
+        Tokenizer->TokenIndex = 0;
+    }
+    
+    if (Tokenizer->ChunkIndex == Tokenizer->ChunkCount)
+    {
+        token_chunk *Last = &Tokenizer->Chunks[Tokenizer->ChunkCount - 1];
+        Tokenizer->LineNumber = Last->FirstLineNumber + Last->LineCount;
+    }
+}
+
+
+b32 TokenizeParallel(tokenizer *Tokenizer, u32 ThreadCount)
+{
+    PROFILE_SCOPE("TokenizeParallel");
+    
+    string Input = Tokenizer->Input;
+    if (Tokenizer->Chunks || ThreadCount < 2 || Input.Count < 2 * kTokenChunkSizeMin)
+    {
+        return false;
+    }
+    
+    mapped_window *Window = Tokenizer->Window;
+    if (Window && Window->Offset + Window->Size < Window->FileSize)
+    {
+        return false;
+    }
+    
+    u64 ChunkCount = (u64)ThreadCount * kTokenChunksPerThread;
+    ChunkCount = ChunkCount < Input.Count / kTokenChunkSizeMin ? ChunkCount : Input.Count / kTokenChunkSizeMin;
+    ChunkCount = ChunkCount > Input.Count / kTokenChunkSizeMax ? ChunkCount : Input.Count / kTokenChunkSizeMax + 1;
+    
+    token_chunk *Chunks = (token_chunk *)calloc(ChunkCount, sizeof(token_chunk));
+    if (!Chunks)
+    {
+        return false;
+    }
+    
+    //
+    // Split just after a line break, a chunk that ends up empty is fine
+    u8 *End = Input.Data + Input.Count;
+    u8 *Start = Input.Data;
+    for (u64 Index = 0; Index < ChunkCount; ++Index)
+    {
+        u8 *Split = End;
+        if (Index < ChunkCount - 1)
+        {
+            Split = Input.Data + (Index + 1) * Input.Count / ChunkCount;
+            Split = Split > Start ? Split : Start;
+            u8 *LineBreak = (u8 *)memchr(Split, '\n', End - Split);
+            Split = LineBreak ? LineBreak + 1 : End;
+        }
+        
+        Chunks[Index].Input.Data = Start;
+        Chunks[Index].Input.Count = Split - Start;
+        Start = Split;
+    }
+    
+    ParallelFor((u32)ChunkCount, ThreadCount, TokenizeChunk, Chunks);
+    
+    Tokenizer->Chunks = Chunks;
+    Tokenizer->ChunkCount = (u32)ChunkCount;
+    Tokenizer->ChunkIndex = 0;
+    Tokenizer->TokenIndex = 0;
+    
+    s32 LineNumber = Tokenizer->LineNumber;
+    for (u32 Index = 0; Index < ChunkCount; ++Index)
+    {
+        if (Chunks[Index].Error)
+        {
+            FreeTokenChunks(Tokenizer);
+            return false;
+        }
+        
+        Chunks[Index].FirstLineNumber = LineNumber;
+        LineNumber += Chunks[Index].LineCount;
+    }
+    
+    // Everything is read from the chunks from now on
+    Advance(&Tokenizer->Input, Input.Count);
+    Refill(Tokenizer);
+    SkipFinishedChunks(Tokenizer);
+    
+    return true;
+}
+
+
+static token GetPackedToken(tokenizer *Tokenizer)
+{
+    token Result = {};
+    Result.FileName = Tokenizer->FileName;
+    
+    if (Tokenizer->ChunkIndex == Tokenizer->ChunkCount)
+    {
+        Result.LineNumber = Tokenizer->LineNumber;
+        Result.Type = Token_EndOfStream;
+        Result.Text.Data = Tokenizer->Input.Data;
+        return Result;
+    }
+    
+    token_chunk *Chunk = &Tokenizer->Chunks[Tokenizer->ChunkIndex];
+    packed_token *Packed = &Chunk->Tokens[Tokenizer->TokenIndex++];
+    
+    Result.LineNumber = Chunk->FirstLineNumber + Packed->LineNumber;
+    Result.Type = (token_type)Packed->Type;
+    Result.Text.Data = Chunk->Input.Data + Packed->Offset;
+    Result.Text.Count = Packed->Length;
+    Result.f32 = Packed->Float32;
+    if (Packed->IsInteger)
+    {
+        Result.s64 = Packed->Integer;
+        Result.f64 = (f64)Packed->Integer;
+    }
+    else
+    {
+        Result.f64 = Packed->Float64;
+        Result.s64 = TruncateToS64(Packed->Float64);
+    }
+    Result.s32 = (s32)Result.s64;
+    
+    Tokenizer->LineNumber = Result.LineNumber;
+    SkipFinishedChunks(Tokenizer);
+    
+    return Result;
+}
+
+
+
 token GetToken(tokenizer *Tokenizer)
 {
+    if (Tokenizer->Chunks)
+    {
+        return GetPackedToken(Tokenizer);
+    }
+    
     EatAllWhiteSpaces(Tokenizer);
+    while (WindowNeedsToMove(Tokenizer))
+    {
+        MoveTokenizerWindow(Tokenizer);
+        EatAllWhiteSpaces(Tokenizer);
+    }
     
     token Result = {};
     Result.FileName   = Tokenizer->FileName;
@@ -128,10 +1118,8 @@ token GetToken(tokenizer *Tokenizer)
         {
             Result.Type = Token_String;
             
-            while (Tokenizer->At[0] && Tokenizer->At[0] != '"')
-            {
-                AdvanceAndRefill(Tokenizer, 1);
-            }
+            // NOTE(Marcus): Line breaks inside strings are not counted
+            AdvanceAndRefill(Tokenizer, (u32)ScanWhile<GetStringBodyMask, IsNotStringEnd>(Tokenizer->Input));
             
             Result.Text.Count = Tokenizer->Input.Data - Result.Text.Data;
             if (Tokenizer->At[0] == '"')
@@ -145,55 +1133,22 @@ token GetToken(tokenizer *Tokenizer)
             if (IsAlpha(C))
             {
                 Result.Type = Token_Identifier;
-                while (IsAlpha(Tokenizer->At[0]) ||
-                       IsNumber(Tokenizer->At[0]) ||
-                       Tokenizer->At[0] == '_')
-                {
-                    AdvanceAndRefill(Tokenizer, 1);
-                }
+                AdvanceAndRefill(Tokenizer, (u32)ScanWhile<GetIdentifierMask, IsIdentifierCharacter>(Tokenizer->Input));
                 
                 Result.Text.Count = Tokenizer->Input.Data - Result.Text.Data;
             }
             else if(IsNumber(C) || IsNumberSigned(C, Tokenizer->At[0]))
             {
-                s32 Sign = 1;
-                
-                if (C == '-')
-                {
-                    Sign = -1;
-                    C = Tokenizer->At[0];
-                    AdvanceAndRefill(Tokenizer, 1);
-                }
-                
                 Result.Type = Token_Number;
-                f32 Number = (f32)(C - '0');
-                
-                while(IsNumber(Tokenizer->At[0]))
-                {
-                    f32 Digit = (f32)(Tokenizer->At[0] - '0');
-                    Number = 10.0f*Number + Digit;
-                    AdvanceAndRefill(Tokenizer, 1);
-                }
-                
-                if (Tokenizer->At[0] == '.')
-                {
-                    AdvanceAndRefill(Tokenizer, 1);
-                    
-                    f32 Coefficient = 0.1f;
-                    while(IsNumber(Tokenizer->At[0]))
-                    {
-                        f32 Digit = (f32)(Tokenizer->At[0] - '0');
-                        Number += Coefficient*Digit;
-                        Coefficient *= 0.1f;
-                        AdvanceAndRefill(Tokenizer, 1);
-                    }
-                }
                 
-                Number *= Sign;
-                Result.f32 = Number;
-                Result.s32 = (s32)(Number); // TODO(Marcus): Round?
-                Result.Text.Count = Tokenizer->Input.Data - Result.Text.Data;
+                // NOTE(Marcus): Start from the input rather than Result.Text, which was copied with
+                // a wide store and stalls the loads on the critical path
+                u8 *Start = Tokenizer->Input.Data - 1;
+                u8 *End = Tokenizer->Input.Data + Tokenizer->Input.Count;
+                uintptr_t Length = ParseNumber(Start, End, &Result);
+                AdvanceAndRefill(Tokenizer, (u32)(Length - 1));
                 
+                Result.Text.Count = Length;
             }
             else
             {
@@ -208,9 +1163,28 @@ token GetToken(tokenizer *Tokenizer)
 
 void SkipToEndOfLine(tokenizer *Tokenizer)
 {
-    while (!IsEndOfLine(Tokenizer->At[0]))
+    if (Tokenizer->Chunks)
     {
-        AdvanceAndRefill(Tokenizer, 1);
+        // The rest of the line are the tokens on the line of the last token
+        while (Tokenizer->ChunkIndex < Tokenizer->ChunkCount)
+        {
+            token_chunk *Chunk = &Tokenizer->Chunks[Tokenizer->ChunkIndex];
+            if (Chunk->FirstLineNumber + Chunk->Tokens[Tokenizer->TokenIndex].LineNumber != Tokenizer->LineNumber)
+            {
+                break;
+            }
+            ++Tokenizer->TokenIndex;
+            SkipFinishedChunks(Tokenizer);
+        }
+        return;
+    }
+    
+    AdvanceAndRefill(Tokenizer, (u32)ScanWhile<GetLineBodyMask, IsNotEndOfLine>(Tokenizer->Input));
+    while (WindowNeedsToMove(Tokenizer) && Tokenizer->Input.Count == 0)
+    {
+        // The line goes on past the window
+        MoveTokenizerWindow(Tokenizer);
+        AdvanceAndRefill(Tokenizer, (u32)ScanWhile<GetLineBodyMask, IsNotEndOfLine>(Tokenizer->Input));
     }
     
     //token Token = GetToken(Tokenizer);
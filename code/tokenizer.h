@@ -61,11 +61,49 @@ struct token
     
     token_type Type;
     string Text;
+    
+    // Numbers, both floats are correctly rounded and the integers are truncated
     f32 f32;
     s32 s32;
+    f64 f64;
+    s64 s64;
+};
+
+
+//
+// Pre-tokenised input, see TokenizeParallel. A packed token keeps the text as an offset into its
+// chunk and the line relative to the first line of the chunk.
+//
+struct packed_token
+{
+    u32 Offset;
+    s32 LineNumber;
+    u32 Length    : 24;
+    u32 Type      : 7;
+    u32 IsInteger : 1;  // Integer holds the exact value, otherwise Float64 does
+    f32 Float32;
+    union
+    {
+        f64 Float64;
+        s64 Integer;
+    };
+};
+
+struct token_chunk
+{
+    string Input;
+    s32 FirstLineNumber;
+    s32 LineCount;
+    
+    packed_token *Tokens;
+    u32 TokenCount;
+    u32 TokenCapacity;
+    b32 Error;
 };
 
 
+struct mapped_window;
+
 struct tokenizer
 {
     char *FileName;
@@ -75,12 +113,39 @@ struct tokenizer
     char At[2];
     
     b32 Error;
+    
+    // Set by TokenizeParallel, the rest of the input is then read from the chunks
+    token_chunk *Chunks;
+    u32 ChunkCount;
+    u32 ChunkIndex;
+    u32 TokenIndex;
+    
+    // Set by OpenTokenizerFile when the input is a window into a file
+    mapped_window *Window;
 };
 
 
 b32 Parsing(tokenizer *Tokenizer);
 tokenizer Tokenize(string Input);
 
+//
+// Tokenises a file that is mapped WindowSize bytes at a time, the window is moved forward as the
+// tokens are read so the memory used does not grow with the size of the file. A WindowSize of zero
+// maps the whole file, which TokenizeParallel needs.
+//
+// NOTE(Marcus): The text of a token is only valid until the window moves, i.e. until the next
+//               token is read, and tokens longer than kTokenWindowMargin are cut short.
+//
+u64 constexpr kTokenWindowSize = 16 * 1024 * 1024;
+u64 constexpr kTokenWindowMargin = 1024 * 1024;
+
+b32 OpenTokenizerFile(char const *FileName, u64 WindowSize, tokenizer *Tokenizer);
+void CloseTokenizerFile(tokenizer *Tokenizer);
+
+// Skips the rest of the line and its line break, e.g. the end of a text header in front of binary
+// data, and gives the offset in the file of where the next line starts
+b32 GetNextLineFileOffset(tokenizer *Tokenizer, u64 *Offset);
+
 token GetToken(tokenizer *Tokenizer);
 
 void SkipToEndOfLine(tokenizer *Tokenizer);
@@ -93,6 +158,19 @@ token RequireNumber(tokenizer *Tokenizer);
 
 b32 OptionalIdentifierNamed(tokenizer *Tokenizer, const char *Name);
 
+//
+// Splits the rest of the input at line breaks into chunks and tokenises them on ThreadCount
+// threads, after which GetToken and the functions above read the tokens from the chunks, with the
+// same text, values and line numbers. The input must stay valid until the tokenizer is done.
+// Returns false, and leaves the tokenizer as it was, when the input is too small to be worth it,
+// the tokens could not be stored or the rest of the file is not mapped.
+//
+// NOTE(Marcus): A string with a line break in it can be split between two chunks, so only use
+//               this on input without them, e.g. the body of a ply file.
+//
+b32 TokenizeParallel(tokenizer *Tokenizer, u32 ThreadCount);
+void FreeTokenChunks(tokenizer *Tokenizer);
+
 void Error(tokenizer *Tokenizer, token OnToken, char *Format, ...);
 void Error(tokenizer *Tokenizer, char *Format, ...);
 
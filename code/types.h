@@ -39,10 +39,12 @@ typedef uint32_t u32;
 typedef uint64_t u64;
 
 typedef int8_t   s8;
+typedef int16_t  s16;
 typedef int32_t  s32;
 typedef int64_t  s64;
 
-typedef float f32;
+typedef float  f32;
+typedef double f64;
 
 f32 constexpr f32Max = FLT_MAX;
 f32 constexpr f32Min = FLT_MIN;
@@ -132,13 +134,14 @@ static b32 StringsAreEqual(string A, char *B)
                 return false;
             }
         }
+        
+        // NOTE(Marcus): B can be longer, e.g. "int" is not "int8"
+        return (*String == 0);
     }
     else
     {
         return (A.Count == 0);
     }
-    
-    return true;
 }
 
 
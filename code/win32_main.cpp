@@ -30,17 +30,31 @@
 
 #include <assert.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "types.h"
 #include "mathematics.h"
 #include "directX11_renderer.h"
 #include "ply_loader.h"
+#include "mesh_cache.h"
+#include "asset_loader.h"
+#include "parallel.h"
 #include "particle_system.h"
+#include "particle_recording.h"
+#include "particle_export.h"
+#include "profiler.h"
+#include "terrain.h"
+#include "benchmark.h"
 
 constexpr f32 kFrameTime = 1.0f / 60.0f;
 constexpr f32 kFrameTimeMicroSeconds = 1000000.0f * kFrameTime;
 constexpr u32 kThreadCount = 4;
 constexpr u32 kParticleCount = 1000;
+constexpr u32 kAssetCountMax = 256;
+constexpr char const *kCheckpointFileName = "..\\data\\particles.checkpoint";
+constexpr char const *kRecordingFileName = "..\\data\\particles.recording";
+constexpr char const *kTraceFileName = "..\\data\\particles.trace.json";
+constexpr char const *kExportFileName = "..\\data\\particles_export.ply";
 
 struct display_metrics
 {
@@ -72,6 +86,14 @@ struct app_state
     HWND hWnd;
     
     b32 UseSecondLight = false;
+    b32 CheckpointSaveRequested = false;
+    b32 CheckpointLoadRequested = false;
+    b32 RecordingToggleRequested = false;
+    b32 PlaybackToggleRequested = false;
+    b32 ShowProfile = false;
+    b32 TraceToggleRequested = false;
+    b32 ExportRequested = false;
+    s32 PlaybackSeek = 0;
 };
 
 #include "win32_utilities.h"
@@ -92,6 +114,49 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hInstancePrev, LPSTR lpCmdLine
     freopen_s(&FileStdOut, "CONOUT$", "w", stdout);
 #endif
     
+    InitProfiler();
+    ProfileRegisterThread("Main");
+    
+    
+    //
+    // Headless modes, the output goes to the console that started the process
+    //
+    b32 IsBenchmark = strstr(lpCmdLine, "-bench") != nullptr;
+    b32 IsVerification = strstr(lpCmdLine, "-verify") != nullptr;
+    b32 IsRegressionSuite = strstr(lpCmdLine, "-regress") != nullptr;
+    b32 IsNumberBenchmark = strstr(lpCmdLine, "-numbers") != nullptr;
+    b32 IsAssetBenchmark = strstr(lpCmdLine, "-assets") != nullptr;
+    b32 IsMatrixBenchmark = strstr(lpCmdLine, "-matrices") != nullptr;
+    if (IsBenchmark || IsVerification || IsRegressionSuite || IsNumberBenchmark || IsAssetBenchmark || 
+        IsMatrixBenchmark)
+    {
+#ifndef DEBUG
+        FILE *FileStdOut;
+        if (!AttachConsole(ATTACH_PARENT_PROCESS))
+        {
+            AllocConsole();
+        }
+        freopen_s(&FileStdOut, "CONOUT$", "w", stdout);
+#endif
+        if (IsRegressionSuite)
+        {
+            return RunRegressionSuite(lpCmdLine);
+        }
+        if (IsNumberBenchmark)
+        {
+            return RunNumberBenchmark(lpCmdLine);
+        }
+        if (IsAssetBenchmark)
+        {
+            return RunAssetBenchmark(lpCmdLine);
+        }
+        if (IsMatrixBenchmark)
+        {
+            return RunMatrixBenchmark(lpCmdLine);
+        }
+        return IsBenchmark ? RunBenchmark(lpCmdLine) : RunVerification(lpCmdLine);
+    }
+    
     
     //
     // Initial state
@@ -116,6 +181,23 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hInstancePrev, LPSTR lpCmdLine
     UpdateCamera(&AppState.Camera);
     
     
+    //
+    // Start loading the assets, they load while the window and DirectX are set up
+    //
+    asset_loader AssetLoader;
+    {
+        b32 Result = StartAssetLoader(&AssetLoader, GetProcessorCount(), kAssetCountMax);
+        assert(Result);
+    }
+    
+#if 0
+    mesh_optimize_settings MeshOptimizeSettings;
+    asset *MeshAsset = RequestMesh(&AssetLoader, "..\\data\\monkey.ply", &MeshOptimizeSettings);
+#else
+    asset *TerrainAsset = RequestTerrain(&AssetLoader, "..\\data\\volcano.txt", 61, 87);
+#endif
+    
+    
     //
     // Create window
     //
@@ -230,215 +312,56 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hInstancePrev, LPSTR lpCmdLine
     v3 *Normals;
 #if 0
     {
-        ply_state PlyState;
-        b32 Result = LoadPlyFile("..\\data\\monkey.ply", &PlyState);
+        b32 Result = WaitForAsset(&AssetLoader, MeshAsset);
         assert(Result);
         
+        ply_state PlyState = MeshAsset->Mesh;
+        mesh_optimize_report Report = MeshAsset->Report;
+        printf("Mesh: %u -> %u vertices, ACMR %.3f -> %.3f\n", Report.VertexCountBefore, Report.VertexCountAfter,
+               Report.AcmrBefore, Report.AcmrAfter);
+        
         Result = CreateRenderable(&DirectXState, &RenderableTerrain, 
                                   PlyState.Positions, sizeof(v3), PlyState.VertexCount,
-                                  PlyState.Indices , sizeof(u16), PlyState.IndexCount,
+                                  PlyState.Indices , PlyState.IndexSize, PlyState.IndexCount,
                                   D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
         assert(Result);
+        
+        // NOTE(Marcus): The asset loader generates the normals of meshes that have none
+        Result = CreateBuffer(&DirectXState, D3D11_BIND_VERTEX_BUFFER,
+                              PlyState.Normals, sizeof(v3), PlyState.VertexCount,
+                              &TerrainNormals);
+        assert(Result);
     }
 #else
+    terrain Terrain;
     {
-        // Source text file is 87 x 61 = 5307
-        u32 constexpr w = 61;
-        u32 constexpr h = 87;
-        u32 constexpr t = w * h;
-        
-        Heights = nullptr; // NOTE(Marcus): A bit of a waste, the max number is less than 255... 
-        {
-            Heights = (u32 *)malloc(t * sizeof(u32)); 
-            assert(Heights);
-            
-            FILE *File;
-            errno_t Error = fopen_s(&File, "..\\data\\volcano.txt", "r");
-            if (Error)
-            {
-                printf("Failed to open file, error: %u\n", Error);
-                assert(0);
-            }
-            
-            for (u32 Index = 0; Index < t; ++Index)
-            {
-                int ArgumentsScanned = fscanf_s(File, "%u", &Heights[Index]);
-                assert(ArgumentsScanned == 1);
-            }
-            fclose(File);
-        }
-        
-        u32 VertexCount = t;
-        v3 *Vertices = (v3 *)malloc(t * sizeof(v3));
-        assert(Vertices);
-        
-        f32 Max = 0.0f;
-        f32 Min = f32Max;
-        
-        u32 Index = 0;
-        for (u32 z = 0; z < h; ++z)
-        {
-            for (u32 x = 0; x < w; ++x)
-            {
-                f32 Height = (f32)Heights[Index];
-                
-#if 1
-                //
-                // Smoothing
-                u32 Count = 1;
-                
-                if (x > 0) // Left
-                {
-                    Height += (f32)Heights[Index - 1];
-                    ++Count;
-                }
-                
-                if (x < (w - 1)) // Right
-                {
-                    Height += (f32)Heights[Index + 1];
-                    ++Count;
-                }
-                
-                if (z > 0) // Up
-                {
-                    Height += (f32)Heights[Index - w];
-                    ++Count;
-                }
-                
-                if (z < (h - 1)) // Down
-                {
-                    Height += (f32)Heights[Index + w];
-                    ++Count;
-                }
-                
-                Height /= (f32)Count;
-                Heights[Index] = (u32)Height;
-#endif
-                
-                Max = Height > Max ? Height : Max;
-                Min = Height < Min ? Height : Min;
-                
-                Vertices[Index++] = V3((f32)x, Height, (f32)z);
-            }
-        }
-        assert(Index == VertexCount);
-        
-        printf("Min = %f, Max = %f\n", Min, Max);
-        
-        u16 *Indices = nullptr;
-        u32 IndexCount = 6 * (w - 1) * (h - 1);
-        size_t Size = IndexCount * sizeof(u16);
-        Indices = (u16 *)malloc(Size);
-        assert(Indices);
-        
-        
-        //
-        // Generate indices
-        Index = 0;
-        for (u32 z = 0; z < (h - 1); ++z)
-        {
-            for (u32 x = 0; x < (w - 1); ++x)
-            {
-                //
-                // Indices
-                Indices[Index] = (u16)((w * z) + x);
-                Indices[Index + 1] = (u16)((w * (z + 1)) + x);
-                Indices[Index + 2] = (u16)((w * (z + 1)) + x + 1);
-                
-                Indices[Index + 3] = (u16)((w * z) + x);
-                Indices[Index + 4] = (u16)((w * (z + 1)) + x + 1);
-                Indices[Index + 5] = (u16)((w * z) + x + 1);
-                
-                Index += 6;
-            }
-        }
-        assert(Index == IndexCount);
-        
-        b32 Result = CreateRenderable(&DirectXState, &RenderableTerrain, 
-                                      Vertices, sizeof(v3) , VertexCount,
-                                      Indices , sizeof(u16), IndexCount,
-                                      D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+        b32 Result = WaitForAsset(&AssetLoader, TerrainAsset);
         assert(Result);
         
-        //
-        // Normals
-        Normals = (v3 *)malloc(VertexCount * sizeof(v3));
-        assert(Normals);
-        
-        Index = 0;
-        for (u32 z = 0; z < h; ++z)
-        {
-            for (u32 x = 0; x < w; ++x)
-            {
-                v3  V[8] = {};
-                b32 B[8] = {};
-                v3 Vo = Vertices[Index];
-                
-                if (x > 0) // Left
-                {
-                    V[0] = Vertices[(w * z) + x - 1];
-                    B[0] = true;
-                }
-                if (x < w - 1) // Right
-                {
-                    V[1] = Vertices[(w * z) + x + 1];
-                    B[1] = true;
-                }
-                if (z > 0) // Up
-                {
-                    V[2] = Vertices[(w * (z - 1)) + x];
-                    B[2] = true;
-                }
-                if (z < h - 1) // Down
-                {
-                    V[3] = Vertices[(w * (z + 1)) + x];
-                    B[3] = true;
-                }
-                if (B[2] && B[0]) // Up left
-                {
-                    V[4] = Vertices[(w * (z - 1)) + x - 1];
-                    B[4] = true;
-                }
-                if (B[2] && B[1]) // Up right
-                {
-                    V[5] = Vertices[(w * (z - 1)) + x + 1];
-                    B[5] = true;
-                }
-                if (B[3] && B[1]) // Down right
-                {
-                    V[6] = Vertices[(w * (z + 1)) + x + 1];
-                    B[6] = true;
-                }
-                if (B[3] && B[0]) // Down left
-                {
-                    V[7] = Vertices[(w * (z + 1)) + x - 1];
-                    B[7] = true;
-                }
-                
-                v3 N = v3_zero;
-                for (u32 i = 0; i < 8; ++i)
-                {
-                    if (B[i])
-                    {
-                        v3 Va = V[i];
-                        v3 Vb = V[(i - 1) % 8];
-                        N += Cross(Va - Vo, Vb - Vo);
-                    }
-                }
-                Normals[Index++] = Normalize(N);
-            }
-        }
+        // NOTE(Marcus): The heights and normals are used by the particle system until the end
+        Terrain = TerrainAsset->Terrain;
+        TerrainAsset->Terrain = {};
+        printf("Min = %f, Max = %f\n", Terrain.MinHeight, Terrain.MaxHeight);
         
+        Result = CreateRenderable(&DirectXState, &RenderableTerrain, 
+                                  Terrain.Vertices, sizeof(v3) , Terrain.VertexCount,
+                                  Terrain.Indices , sizeof(u32), (u32)Terrain.IndexCount,
+                                  D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+        assert(Result);
         
+        // The vertices and indices are in the renderable now
+        free(Terrain.Vertices);
+        free(Terrain.Indices);
+        Terrain.Vertices = nullptr;
+        Terrain.Indices = nullptr;
         
         Result = CreateBuffer(&DirectXState, D3D11_BIND_VERTEX_BUFFER,
-                              Normals, sizeof(v3), VertexCount,
+                              Terrain.Normals, sizeof(v3), Terrain.VertexCount,
                               &TerrainNormals);
         assert(Result);
         
-        
-        free(Vertices);
-        free(Indices);
+        Heights = Terrain.Heights;
+        Normals = Terrain.Normals;
     }
 #endif
     
@@ -455,7 +378,7 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hInstancePrev, LPSTR lpCmdLine
         
         b32 Invertible;
         ParticleSystem.ObjectToTerrainMatrix = ParticleSystem.ObjectToWorldMatrix * M4Translation(V3(30.5f, 140.0f, 43.5f));
-        ParticleSystem.TerrainToObjectMatrix = M4Inverse(&ParticleSystem.ObjectToTerrainMatrix, &Invertible);
+        ParticleSystem.TerrainToObjectMatrix = M4AffineInverse(&ParticleSystem.ObjectToTerrainMatrix, &Invertible);
         assert(Invertible);
         
         Init(&ParticleSystem, kParticleCount, kThreadCount, kFrameTime, Heights, 61, 87, Normals);
@@ -475,6 +398,31 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hInstancePrev, LPSTR lpCmdLine
     
     
     
+    //
+    // Recording of the particle positions, toggled with F6
+    //
+    particle_recorder Recorder;
+    
+    
+    
+    //
+    // Export of the particles as PLY point clouds, requested with F4
+    //
+    particle_exporter Exporter;
+    StartExporter(&Exporter, kParticleCount, GetProcessorCount());
+    particle_export_settings ExportSettings;
+    
+    
+    
+    //
+    // Playback of a recording instead of the simulation, toggled with F7 and scrubbed with the arrow keys
+    //
+    particle_player Player;
+    b32 IsPlayingBack = false;
+    u32 PlaybackFrame = 0;
+    
+    
+    
     //
     // DirectWrite
     //
@@ -501,9 +449,6 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hInstancePrev, LPSTR lpCmdLine
     RunTime.QuadPart = 0;
     u32 FrameCount = 0;
     
-    LARGE_INTEGER ParticleTime;
-    ParticleTime.QuadPart = 0;
-    
     
     
     //
@@ -530,29 +475,124 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hInstancePrev, LPSTR lpCmdLine
         }
         
         
+        //
+        // Assets that finished loading since the last frame
+        PollAssets(&AssetLoader);
+        
         UpdateMouseState(&AppState.MouseState);
         UpdateCamera(&AppState.Camera);
+        SetLodCamera(&ParticleSystem, AppState.Camera.P, AppState.Camera.Fov, AppState.Metrics.WindowWidth);
+        
+        
+        //
+        // Checkpoints, F5 saves and F9 restores the particle system
+        if (AppState.CheckpointSaveRequested)
+        {
+            b32 Result = SaveCheckpoint(&ParticleSystem, kCheckpointFileName);
+            printf("Save checkpoint %s: %s\n", kCheckpointFileName, Result ? "done" : "failed");
+            AppState.CheckpointSaveRequested = false;
+        }
+        
+        if (AppState.CheckpointLoadRequested)
+        {
+            b32 Result = LoadCheckpoint(&ParticleSystem, kCheckpointFileName);
+            printf("Load checkpoint %s: %s\n", kCheckpointFileName, Result ? "done" : "failed");
+            AppState.CheckpointLoadRequested = false;
+        }
+        
+        if (AppState.RecordingToggleRequested)
+        {
+            if (Recorder.IsRecording)
+            {
+                b32 Result = StopRecording(&Recorder);
+                printf("Stopped recording, %u frames (%u dropped): %s\n", 
+                       Recorder.FrameCount, Recorder.DroppedFrameCount, Result ? "done" : "failed");
+            }
+            else
+            {
+                b32 Result = StartRecording(&Recorder, kRecordingFileName, kParticleCount, kThreadCount);
+                printf("Started recording to %s: %s\n", kRecordingFileName, Result ? "done" : "failed");
+            }
+            AppState.RecordingToggleRequested = false;
+        }
+        
+        if (AppState.TraceToggleRequested)
+        {
+            if (GlobalProfiler.IsTracing)
+            {
+                StopTrace();
+                printf("Stopped trace, %u events\n", GlobalProfiler.TraceEventCount);
+            }
+            else
+            {
+                b32 Result = StartTrace(kTraceFileName);
+                printf("Started trace to %s: %s\n", kTraceFileName, Result ? "done" : "failed");
+            }
+            AppState.TraceToggleRequested = false;
+        }
+        
+        if (AppState.PlaybackToggleRequested)
+        {
+            if (IsPlayingBack)
+            {
+                ClosePlayer(&Player);
+                IsPlayingBack = false;
+                printf("Stopped playback\n");
+            }
+            else if (!Recorder.IsRecording)
+            {
+                IsPlayingBack = OpenPlayer(&Player, kRecordingFileName, kThreadCount);
+                if (IsPlayingBack && Player.Header->ParticleCount != kParticleCount)
+                {
+                    ClosePlayer(&Player);
+                    IsPlayingBack = false;
+                }
+                PlaybackFrame = 0;
+                printf("Started playback of %s: %s\n", kRecordingFileName, IsPlayingBack ? "done" : "failed");
+            }
+            AppState.PlaybackToggleRequested = false;
+        }
         
         
         //
         // Particle simulation
-        LARGE_INTEGER ParticleStartingTime;
-        QueryPerformanceCounter(&ParticleStartingTime);
+        if (IsPlayingBack)
+        {
+            s32 Frame = (s32)PlaybackFrame + AppState.PlaybackSeek;
+            Frame = Frame < 0 ? 0 : (Frame >= (s32)Player.FrameCount ? (s32)Player.FrameCount - 1 : Frame);
+            AppState.PlaybackSeek = 0;
+            
+            GetFrame(&Player, (u32)Frame, ParticleSystem.P);
+            PlaybackFrame = (u32)(Frame + 1) < Player.FrameCount ? (u32)(Frame + 1) : 0;
+        }
+        else
+        {
+            Update(&ParticleSystem);
+        }
         
-        Update(&ParticleSystem);
+        Record(&Recorder, ParticleSystem.P);
         
-        LARGE_INTEGER ParticleEndingTime;
-        QueryPerformanceCounter(&ParticleEndingTime);
+        if (AppState.ExportRequested)
+        {
+            b32 Result = ExportParticles(&Exporter, &ParticleSystem, kExportFileName, &ExportSettings);
+            printf("Exporting the particles to %s: %s\n", kExportFileName, Result ? "started" : "failed");
+            AppState.ExportRequested = false;
+        }
         
-        LARGE_INTEGER ElapsedMicroseconds;
-        ElapsedMicroseconds.QuadPart = ParticleEndingTime.QuadPart - ParticleStartingTime.QuadPart;
-        ElapsedMicroseconds.QuadPart *= 1000000;
-        ElapsedMicroseconds.QuadPart /= Frequency.QuadPart;
-        ParticleTime.QuadPart += ElapsedMicroseconds.QuadPart;
+        export_result ExportResult;
+        while (PollExport(&Exporter, &ExportResult))
+        {
+            printf("Export of frame %u: %s, %u of %u files written\n", ExportResult.FrameIndex, 
+                   ExportResult.FailedCount ? "failed" : "done", 
+                   ExportResult.FileCount - ExportResult.FailedCount, ExportResult.FileCount);
+        }
         
         
         //
         // Render
+        ProfileBegin("Render");
+        u64 RenderBegin = ReadTimestamp();
+        
         SetRenderTarget(&DirectXState, &DirectXState.RenderTarget);
         SetShader(&DirectXState, &DirectXState.vBasic);
         SetShader(&DirectXState, &DirectXState.pBasic);
@@ -646,7 +686,7 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hInstancePrev, LPSTR lpCmdLine
             
             // The normal matrix
             b32 Invertible;
-            m4 Mi = M4Inverse(&ShaderConstants.ObjectToWorldMatrix, &Invertible);
+            m4 Mi = M4AffineInverse(&ShaderConstants.ObjectToWorldMatrix, &Invertible);
             assert(Invertible);
             Mi = M4Transpose(&Mi);
             ShaderConstants.NormalToWorldMatrix = Mi;
@@ -684,6 +724,7 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hInstancePrev, LPSTR lpCmdLine
         }
         
         EndRendering(&DirectXState);
+        ProfileEnd("Render", RenderBegin);
         
         
         //
@@ -691,6 +732,7 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hInstancePrev, LPSTR lpCmdLine
         LARGE_INTEGER FrameEndingTime;
         QueryPerformanceCounter(&FrameEndingTime);
         
+        LARGE_INTEGER ElapsedMicroseconds;
         ElapsedMicroseconds.QuadPart = FrameEndingTime.QuadPart - FrameStartingTime.QuadPart;
         ElapsedMicroseconds.QuadPart *= 1000000;
         ElapsedMicroseconds.QuadPart /= Frequency.QuadPart;
@@ -705,17 +747,18 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hInstancePrev, LPSTR lpCmdLine
         }
         
         ++FrameCount;
+        ProfileEndFrame();
         
         RunTime.QuadPart += ElapsedMicroseconds.QuadPart;
         if (RunTime.QuadPart > 1000000)
         {
-#if 0
-            f32 ParticleFps = 1000000.0f * ((f32)FrameCount / (f32)ParticleTime.QuadPart);
-            printf("fps: %u, particle fps = %f\n", FrameCount, ParticleFps);
-#endif
+            if (AppState.ShowProfile)
+            {
+                printf("fps: %u\n", FrameCount);
+                ProfileReport();
+            }
             RunTime.QuadPart = 0;
             FrameCount = 0;
-            ParticleTime.QuadPart = 0;
         }
     }
     
@@ -724,6 +767,16 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hInstancePrev, LPSTR lpCmdLine
     //
     // Close threads
     //
+    if (Recorder.IsRecording)
+    {
+        StopRecording(&Recorder);
+    }
+    if (IsPlayingBack)
+    {
+        ClosePlayer(&Player);
+    }
+    StopExporter(&Exporter);
+    StopTrace();
     ShutDown(&ParticleSystem);
     
     
@@ -761,6 +814,8 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hInstancePrev, LPSTR lpCmdLine
     //
     free(Heights);
     free(Normals);
+    StopAssetLoader(&AssetLoader);
+    FreeProfiler();
     
     ReleaseDirectWrite(&DirectWriteState);
     for (u32 Index = 0; Index < 3; ++Index)
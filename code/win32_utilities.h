@@ -55,6 +55,41 @@ LRESULT CALLBACK WindowProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
         
         case WM_KEYDOWN: 
         {
+            LONG_PTR Ptr = GetWindowLongPtr(hWnd, GWLP_USERDATA);
+            app_state *AppState = reinterpret_cast<app_state *>(Ptr);
+            
+            if (wParam == VK_F5)
+            {
+                AppState->CheckpointSaveRequested = true;
+            }
+            else if (wParam == VK_F9)
+            {
+                AppState->CheckpointLoadRequested = true;
+            }
+            else if (wParam == VK_F6)
+            {
+                AppState->RecordingToggleRequested = true;
+            }
+            else if (wParam == VK_F7)
+            {
+                AppState->PlaybackToggleRequested = true;
+            }
+            else if (wParam == VK_F4)
+            {
+                AppState->ExportRequested = true;
+            }
+            else if (wParam == VK_F3)
+            {
+                AppState->TraceToggleRequested = true;
+            }
+            else if (wParam == VK_F8)
+            {
+                AppState->ShowProfile = !AppState->ShowProfile;
+            }
+            else if (wParam == VK_LEFT || wParam == VK_RIGHT)
+            {
+                AppState->PlaybackSeek += wParam == VK_LEFT ? -10 : 10;
+            }
             
 #if 0
             // Toggle the second light